@@ -0,0 +1,186 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Logging.hpp"
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief A queue of tasks processed in batches by worker threads, so the
+ *        thread submitting them (e.g., the event feed) never waits for the
+ *        processing.
+ *
+ *        The pool doesn't create threads, since an enclave can't; each worker
+ *        runs on a thread that enters the enclave and calls `RunWorker`,
+ *        which only returns after `Stop` is called and the queue is drained.
+ *        A worker takes up to `maxBatchSize` tasks at once, so the per-batch
+ *        setup (e.g., seeding a random generator) is shared by the tasks.
+ *
+ * @tparam _TaskType The type of the tasks
+ */
+template<typename _TaskType>
+class BatchTaskPool
+{
+public: // static members:
+
+	using TaskType = _TaskType;
+
+	/**
+	 * @brief Process a batch of tasks on a worker thread; a throw is logged,
+	 *        and the rest of the batch is dropped
+	 *
+	 */
+	using ProcessFunc = std::function<void(std::vector<TaskType>&)>;
+
+public:
+
+	BatchTaskPool(ProcessFunc processFunc, size_t maxBatchSize = 16) :
+		m_logger(Common::LoggerFactory::GetLogger("BatchTaskPool")),
+		m_processFunc(std::move(processFunc)),
+		m_maxBatchSize(maxBatchSize),
+		m_mutex(),
+		m_cv(),
+		m_tasks(),
+		m_numProcessed(0),
+		m_isStopped(false)
+	{
+		if (m_maxBatchSize == 0)
+		{
+			throw std::invalid_argument("A batch must have at least one task");
+		}
+	}
+
+	BatchTaskPool(const BatchTaskPool&) = delete;
+
+	BatchTaskPool(BatchTaskPool&&) = delete;
+
+	~BatchTaskPool() = default;
+
+	BatchTaskPool& operator=(const BatchTaskPool&) = delete;
+
+	BatchTaskPool& operator=(BatchTaskPool&&) = delete;
+
+	void Submit(TaskType task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.push_back(std::move(task));
+		}
+		m_cv.notify_one();
+	}
+
+	/**
+	 * @brief Process batches on the calling thread, until the pool is stopped
+	 *        and all submitted tasks are done
+	 *
+	 */
+	void RunWorker()
+	{
+		std::vector<TaskType> batch;
+		batch.reserve(m_maxBatchSize);
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(
+					lock,
+					[this]()
+					{
+						return !m_tasks.empty() || m_isStopped;
+					}
+				);
+				if (m_tasks.empty())
+				{
+					// stopped, and drained
+					break;
+				}
+
+				while (!m_tasks.empty() && (batch.size() < m_maxBatchSize))
+				{
+					batch.push_back(std::move(m_tasks.front()));
+					m_tasks.pop_front();
+				}
+			}
+
+			try
+			{
+				m_processFunc(batch);
+			}
+			catch (const std::exception& e)
+			{
+				m_logger.Error(std::string("Failed to process tasks: ") + e.what());
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_numProcessed += batch.size();
+			}
+			batch.clear();
+		}
+	}
+
+	/**
+	 * @brief Let the workers return once all submitted tasks are done
+	 *
+	 */
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopped = true;
+		}
+		m_cv.notify_all();
+	}
+
+	size_t GetNumPending() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_tasks.size();
+	}
+
+	uint64_t GetNumProcessed() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numProcessed;
+	}
+
+private:
+
+	Common::Logger m_logger;
+	ProcessFunc m_processFunc;
+	size_t m_maxBatchSize;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<TaskType> m_tasks;
+	uint64_t m_numProcessed;
+	bool m_isStopped;
+
+}; // class BatchTaskPool
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -0,0 +1,423 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <WasmRuntime/SystemIO.hpp>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+struct CheckpointConfig
+{
+	/**
+	 * @brief Number of requests in a checkpoint report; the report is sent
+	 *        when it's full
+	 *
+	 */
+	size_t m_maxRequests = 256;
+
+	/**
+	 * @brief Send the report once its first request is older than this,
+	 *        checked when a request is added or `FlushIfDue` is called;
+	 *        0 disables it
+	 *
+	 */
+	uint64_t m_maxIntervalUs = 0;
+
+	/**
+	 * @brief How long `Run` waits before sending a report again, after
+	 *        sending it failed
+	 *
+	 */
+	uint64_t m_retryAfterUs = 1000 * 1000;
+}; // struct CheckpointConfig
+
+
+/**
+ * @brief Collects one entry per request, in the binary format expected by
+ *        `SLA.sol::hostCheckpointReport`, and hands the packed entries over
+ *        (e.g., to be sent in one transaction) when a checkpoint is due, so
+ *        the gas of a report is shared by many requests.
+ *
+ *        Each entry is `CHKPT_REPORT_ENTRY_SIZE` (12) bytes, big-endian: the
+ *        units used (uint64), followed by the time elapsed in microseconds
+ *        (uint32). A request with 0 units is counted by the contract as not
+ *        accepted.
+ *
+ *        A request never sends a report itself: a report that's due is
+ *        sealed and queued, and the queue is sent by `SendPending`, on the
+ *        thread that calls it, or by `Run`, until `Stop` is called. Reports
+ *        are sent one at a time, in the order of their sequence numbers; a
+ *        report is only numbered, and dropped, once it's sent, so one that
+ *        failed to be sent is sent again, with the same sequence number,
+ *        before any later one.
+ *
+ *        The buffers of sent reports are reused, so adding a request doesn't
+ *        allocate while the reports are sent as fast as they're sealed.
+ *
+ */
+class CheckpointAccumulator
+{
+public: // static members:
+
+	static constexpr size_t sk_unitFieldSize = 8;
+	static constexpr size_t sk_timeFieldSize = 4;
+	static constexpr size_t sk_entrySize = sk_unitFieldSize + sk_timeFieldSize;
+
+	/**
+	 * @brief Number of buffers of sent reports kept for reuse
+	 *
+	 */
+	static constexpr size_t sk_maxSpareBuffers = 2;
+
+	/**
+	 * @brief Send out a checkpoint report; throws if it couldn't be sent
+	 *
+	 * @param seqNum      The checkpoint sequence number
+	 * @param numRequests The number of requests in the report
+	 * @param data        The packed entries
+	 */
+	using FlushFunc = std::function<
+		void(uint64_t, uint64_t, const std::vector<uint8_t>&)
+	>;
+
+public:
+
+	/**
+	 * @param sysIO The clock `Run` waits on before retrying; only `Run`
+	 *              needs it
+	 */
+	CheckpointAccumulator(
+		const CheckpointConfig& config,
+		FlushFunc flushFunc,
+		uint64_t firstSeqNum = 0,
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO = nullptr
+	) :
+		m_config(config),
+		m_flushFunc(std::move(flushFunc)),
+		m_sysIO(std::move(sysIO)),
+		m_mutex(),
+		m_cond(),
+		m_buffer(),
+		m_firstEntryUs(0),
+		m_sealed(),
+		m_spareBuffers(),
+		m_nextSeqNum(firstSeqNum),
+		m_numFlushes(0),
+		m_numFailedSends(0),
+		m_isStopped(false),
+		m_sendMutex()
+	{
+		if (m_config.m_maxRequests == 0)
+		{
+			throw std::invalid_argument(
+				"A checkpoint must have at least one request"
+			);
+		}
+		m_buffer.reserve(m_config.m_maxRequests * sk_entrySize);
+	}
+
+	CheckpointAccumulator(const CheckpointAccumulator&) = delete;
+
+	CheckpointAccumulator(CheckpointAccumulator&&) = delete;
+
+	~CheckpointAccumulator() = default;
+
+	CheckpointAccumulator& operator=(const CheckpointAccumulator&) = delete;
+
+	CheckpointAccumulator& operator=(CheckpointAccumulator&&) = delete;
+
+	/**
+	 * @brief Add the entry of a request, and queue the report if it's due
+	 *
+	 * @param units     Units used by the request
+	 * @param elapsedUs Time elapsed, in microseconds; it's capped at the
+	 *                  largest uint32
+	 * @param nowUs     Current time, in microseconds, for the time threshold
+	 */
+	void Append(uint64_t units, uint64_t elapsedUs, uint64_t nowUs)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (m_buffer.empty())
+		{
+			m_firstEntryUs = nowUs;
+		}
+
+		uint32_t elapsed = static_cast<uint32_t>(std::min<uint64_t>(
+			elapsedUs,
+			std::numeric_limits<uint32_t>::max()
+		));
+		PutBigEndian(units, sk_unitFieldSize);
+		PutBigEndian(elapsed, sk_timeFieldSize);
+
+		if (
+			(m_buffer.size() >= m_config.m_maxRequests * sk_entrySize) ||
+			IsIntervalPassed(nowUs)
+		)
+		{
+			SealLocked(lock);
+		}
+	}
+
+	/**
+	 * @brief Queue the report if the time threshold has passed, e.g., called
+	 *        periodically when requests are rare
+	 *
+	 */
+	void FlushIfDue(uint64_t nowUs)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_buffer.empty() && IsIntervalPassed(nowUs))
+		{
+			SealLocked(lock);
+		}
+	}
+
+	/**
+	 * @brief Queue the report of the requests collected so far, if any
+	 *
+	 */
+	void Flush()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_buffer.empty())
+		{
+			SealLocked(lock);
+		}
+	}
+
+	/**
+	 * @brief Send the queued reports, in order, until the queue is empty or
+	 *        a send fails; the report that failed stays first in the queue
+	 *
+	 * @return Number of reports sent
+	 */
+	size_t SendPending()
+	{
+		// one sender at a time, so reports go out in order
+		std::lock_guard<std::mutex> sendLock(m_sendMutex);
+
+		size_t numSent = 0;
+		while (true)
+		{
+			uint64_t seqNum = 0;
+			const std::vector<uint8_t>* report = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_sealed.empty())
+				{
+					return numSent;
+				}
+				seqNum = m_nextSeqNum;
+				// only the sender removes reports, and adding more to the
+				// queue doesn't move the ones in it
+				report = &m_sealed.front();
+			}
+
+			try
+			{
+				if (m_flushFunc)
+				{
+					m_flushFunc(seqNum, report->size() / sk_entrySize, *report);
+				}
+			}
+			catch (const std::exception&)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_numFailedSends;
+				return numSent;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_nextSeqNum;
+				++m_numFlushes;
+
+				std::vector<uint8_t> sent = std::move(m_sealed.front());
+				m_sealed.pop_front();
+				if (m_spareBuffers.size() < sk_maxSpareBuffers)
+				{
+					sent.clear();
+					m_spareBuffers.push_back(std::move(sent));
+				}
+			}
+			++numSent;
+		}
+	}
+
+	/**
+	 * @brief Send the reports as they're queued, until `Stop` is called; it
+	 *        sleeps while there is nothing to send, and waits
+	 *        `m_retryAfterUs` after a send fails. Reports queued when it
+	 *        stops are left for `SendPending`.
+	 *
+	 */
+	void Run()
+	{
+		if (m_sysIO == nullptr)
+		{
+			throw std::logic_error("The checkpoint accumulator has no clock");
+		}
+
+		while (true)
+		{
+			uint64_t numFailedSends = 0;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(
+					lock,
+					[this]() { return !m_sealed.empty() || m_isStopped; }
+				);
+				if (m_isStopped)
+				{
+					return;
+				}
+				numFailedSends = m_numFailedSends;
+			}
+
+			SendPending();
+
+			if (GetNumFailedSends() != numFailedSends)
+			{
+				m_sysIO->SleepUs(m_config.m_retryAfterUs);
+			}
+		}
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopped = true;
+		}
+		m_cond.notify_all();
+	}
+
+	size_t GetNumPending() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_buffer.size() / sk_entrySize;
+	}
+
+	/**
+	 * @brief Number of reports queued, and not sent yet
+	 *
+	 */
+	size_t GetNumQueued() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_sealed.size();
+	}
+
+	/**
+	 * @brief The sequence number of the next report to be sent
+	 *
+	 */
+	uint64_t GetNextSeqNum() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_nextSeqNum;
+	}
+
+	/**
+	 * @brief Number of reports sent
+	 *
+	 */
+	uint64_t GetNumFlushes() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numFlushes;
+	}
+
+	uint64_t GetNumFailedSends() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numFailedSends;
+	}
+
+private:
+
+	template<typename _UIntType>
+	void PutBigEndian(_UIntType val, size_t size)
+	{
+		for (size_t i = size; i > 0; --i)
+		{
+			m_buffer.push_back(static_cast<uint8_t>(val >> (8 * (i - 1))));
+		}
+	}
+
+	bool IsIntervalPassed(uint64_t nowUs) const
+	{
+		return (m_config.m_maxIntervalUs != 0) &&
+			(nowUs - m_firstEntryUs >= m_config.m_maxIntervalUs);
+	}
+
+	/**
+	 * @brief Queue the collected entries as a report; `lock` must hold
+	 *        `m_mutex`
+	 *
+	 */
+	void SealLocked(std::unique_lock<std::mutex>&)
+	{
+		std::vector<uint8_t> next;
+		if (!m_spareBuffers.empty())
+		{
+			next.swap(m_spareBuffers.back());
+			m_spareBuffers.pop_back();
+		}
+		else
+		{
+			next.reserve(m_config.m_maxRequests * sk_entrySize);
+		}
+		next.swap(m_buffer);
+		m_sealed.push_back(std::move(next));
+
+		m_cond.notify_all();
+	}
+
+	CheckpointConfig m_config;
+	FlushFunc m_flushFunc;
+	std::unique_ptr<::WasmRuntime::SystemIO> m_sysIO;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::vector<uint8_t> m_buffer;
+	uint64_t m_firstEntryUs;
+	// reports not sent yet, in order; the first one is `m_nextSeqNum`
+	std::deque<std::vector<uint8_t> > m_sealed;
+	std::vector<std::vector<uint8_t> > m_spareBuffers;
+	uint64_t m_nextSeqNum;
+	uint64_t m_numFlushes;
+	uint64_t m_numFailedSends;
+	bool m_isStopped;
+
+	std::mutex m_sendMutex;
+
+}; // class CheckpointAccumulator
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -0,0 +1,319 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cmath>
+#include <cstdint>
+
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+struct CostModelConfig
+{
+	/**
+	 * @brief Weight kept by past requests each time a new one is learned, so
+	 *        the model follows changes in the workload; 0.99 remembers
+	 *        about the last 100 requests
+	 *
+	 */
+	double m_decay = 0.99;
+
+	/**
+	 * @brief Requests learned before predictions are made
+	 *
+	 */
+	uint64_t m_minSamples = 8;
+
+	/**
+	 * @brief Standard deviations of the prediction error added to the
+	 *        predicted cost to get the threshold
+	 *
+	 */
+	double m_numStdDevs = 4.0;
+
+	/**
+	 * @brief Share of the predicted cost added on top of that, since a
+	 *        request that runs out of its threshold is aborted
+	 *
+	 */
+	double m_margin = 0.25;
+
+	/**
+	 * @brief The lowest threshold given
+	 *
+	 */
+	uint64_t m_minThreshold = 1000 * 1000;
+}; // struct CostModelConfig
+
+
+struct CostPrediction
+{
+	/**
+	 * @brief False if the model hasn't learned enough requests yet; the other
+	 *        fields are 0 then
+	 *
+	 */
+	bool m_isKnown = false;
+
+	/**
+	 * @brief The expected counter
+	 *
+	 */
+	uint64_t m_counter = 0;
+
+	/**
+	 * @brief A counter that the request is very unlikely to exceed, to be
+	 *        used as its threshold
+	 *
+	 */
+	uint64_t m_counterBound = 0;
+
+	/**
+	 * @brief The expected run time
+	 *
+	 */
+	uint64_t m_timeUs = 0;
+}; // struct CostPrediction
+
+
+/**
+ * @brief Least squares fit of a line, `y = a + b * x`, with past samples
+ *        decaying; the means and co-moments are kept instead of raw sums, so
+ *        large counters don't lose precision.
+ *
+ */
+struct DecayingLinearFit
+{
+	double m_weight = 0.0;
+	double m_meanX = 0.0;
+	double m_meanY = 0.0;
+	double m_covXX = 0.0;
+	double m_covXY = 0.0;
+	double m_covYY = 0.0;
+
+	void Add(double x, double y, double decay)
+	{
+		m_weight = (m_weight * decay) + 1.0;
+		double dx = x - m_meanX;
+		double dy = y - m_meanY;
+		m_meanX += dx / m_weight;
+		m_meanY += dy / m_weight;
+		m_covXX = (m_covXX * decay) + (dx * (x - m_meanX));
+		m_covXY = (m_covXY * decay) + (dx * (y - m_meanY));
+		m_covYY = (m_covYY * decay) + (dy * (y - m_meanY));
+	}
+
+	/**
+	 * @brief The slope; 0 if all samples have (nearly) the same x, in which
+	 *        case the fit is the mean of y
+	 *
+	 */
+	double GetSlope() const
+	{
+		return (m_covXX > 1e-9 * m_weight) ? (m_covXY / m_covXX) : 0.0;
+	}
+
+	double GetIntercept() const
+	{
+		return m_meanY - (GetSlope() * m_meanX);
+	}
+
+	/**
+	 * @brief Standard deviation of the samples from the line
+	 *
+	 */
+	double GetStdDev() const
+	{
+		if (m_weight <= 0.0)
+		{
+			return 0.0;
+		}
+		double sse = m_covYY - (GetSlope() * m_covXY);
+		return (sse > 0.0) ? std::sqrt(sse / m_weight) : 0.0;
+	}
+}; // struct DecayingLinearFit
+
+
+/**
+ * @brief Predicts the cost of a request to a module from the size of its
+ *        event, learned from the requests the module has run: the counter
+ *        and the run time are each fitted by a line over the event size.
+ *
+ *        The fits are refreshed when a request is learned, so a prediction
+ *        only takes a few multiplications under an uncontended lock.
+ *
+ */
+class CostModel
+{
+public:
+
+	explicit CostModel(const CostModelConfig& config = CostModelConfig()) :
+		m_config(config),
+		m_mutex(),
+		m_counterFit(),
+		m_timeFit(),
+		m_numSamples(0),
+		m_coef()
+	{
+		if ((m_config.m_decay <= 0.0) || (m_config.m_decay > 1.0))
+		{
+			throw std::invalid_argument("The decay must be in (0, 1]");
+		}
+	}
+
+	CostModel(const CostModel&) = delete;
+
+	CostModel(CostModel&&) = delete;
+
+	~CostModel() = default;
+
+	CostModel& operator=(const CostModel&) = delete;
+
+	CostModel& operator=(CostModel&&) = delete;
+
+	/**
+	 * @brief Learn from a request that ran to the end
+	 *
+	 */
+	void Learn(uint64_t eventSize, uint64_t counter, uint64_t timeUs)
+	{
+		double x = static_cast<double>(eventSize);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_counterFit.Add(x, static_cast<double>(counter), m_config.m_decay);
+		m_timeFit.Add(x, static_cast<double>(timeUs), m_config.m_decay);
+		++m_numSamples;
+
+		m_coef.m_counterA = m_counterFit.GetIntercept();
+		m_coef.m_counterB = m_counterFit.GetSlope();
+		m_coef.m_counterStdDev = m_counterFit.GetStdDev();
+		m_coef.m_timeA = m_timeFit.GetIntercept();
+		m_coef.m_timeB = m_timeFit.GetSlope();
+	}
+
+	CostPrediction Predict(uint64_t eventSize) const
+	{
+		double x = static_cast<double>(eventSize);
+
+		Coefficients coef;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_numSamples < m_config.m_minSamples)
+			{
+				return CostPrediction();
+			}
+			coef = m_coef;
+		}
+
+		double counter = coef.m_counterA + (coef.m_counterB * x);
+		double bound =
+			(counter * (1.0 + m_config.m_margin)) +
+			(coef.m_counterStdDev * m_config.m_numStdDevs);
+		double timeUs = coef.m_timeA + (coef.m_timeB * x);
+
+		CostPrediction pred;
+		pred.m_isKnown = true;
+		pred.m_counter = ToUInt64(counter);
+		pred.m_counterBound = ToUInt64(bound);
+		if (pred.m_counterBound < m_config.m_minThreshold)
+		{
+			pred.m_counterBound = m_config.m_minThreshold;
+		}
+		pred.m_timeUs = ToUInt64(timeUs);
+		return pred;
+	}
+
+	/**
+	 * @brief The threshold to run a request with; no limit until the model
+	 *        has learned enough requests
+	 *
+	 */
+	uint64_t GetThreshold(uint64_t eventSize) const
+	{
+		CostPrediction pred = Predict(eventSize);
+		return pred.m_isKnown ?
+			pred.m_counterBound :
+			std::numeric_limits<uint64_t>::max();
+	}
+
+	/**
+	 * @brief Tell whether a client with the given budget (in counter units)
+	 *        can afford a request; it can until the model knows otherwise
+	 *
+	 */
+	bool IsAffordable(uint64_t eventSize, uint64_t budget) const
+	{
+		CostPrediction pred = Predict(eventSize);
+		return !pred.m_isKnown || (pred.m_counter <= budget);
+	}
+
+	uint64_t GetNumSamples() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numSamples;
+	}
+
+	/**
+	 * @brief Forget all requests, e.g., when the module is replaced
+	 *
+	 */
+	void Reset()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_counterFit = DecayingLinearFit();
+		m_timeFit = DecayingLinearFit();
+		m_numSamples = 0;
+		m_coef = Coefficients();
+	}
+
+private:
+
+	struct Coefficients
+	{
+		double m_counterA = 0.0;
+		double m_counterB = 0.0;
+		double m_counterStdDev = 0.0;
+		double m_timeA = 0.0;
+		double m_timeB = 0.0;
+	}; // struct Coefficients
+
+	static uint64_t ToUInt64(double val)
+	{
+		if (!(val > 0.0))
+		{
+			return 0;
+		}
+		if (val >= static_cast<double>(std::numeric_limits<uint64_t>::max()))
+		{
+			return std::numeric_limits<uint64_t>::max();
+		}
+		return static_cast<uint64_t>(val);
+	}
+
+	CostModelConfig m_config;
+
+	mutable std::mutex m_mutex;
+	DecayingLinearFit m_counterFit;
+	DecayingLinearFit m_timeFit;
+	uint64_t m_numSamples;
+	Coefficients m_coef;
+
+}; // class CostModel
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -0,0 +1,317 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief Why an execution didn't run to completion
+ *
+ */
+enum class EventAbortReason : uint8_t
+{
+	None,
+	Trap,
+	Deadline,
+}; // enum class EventAbortReason
+
+
+inline const char* GetAbortReasonStr(EventAbortReason reason)
+{
+	switch (reason)
+	{
+	case EventAbortReason::None:
+		return "none";
+	case EventAbortReason::Trap:
+		return "trap";
+	case EventAbortReason::Deadline:
+		return "deadline";
+	default:
+		return "unknown";
+	}
+}
+
+
+/**
+ * @brief The result of running one event, which is the data that goes into
+ *        the SLA report
+ *
+ */
+struct EventRunResult
+{
+	uint64_t m_counter   = 0;
+	int32_t  m_retCode   = 0;
+	uint64_t m_startTime = 0;
+	uint64_t m_endTime   = 0;
+
+	// Only in the SLA report, not in the batch encoding; in the batch
+	// encoding, the abort reason is recorded in the return code
+	EventAbortReason m_abortReason = EventAbortReason::None;
+	// The threshold at the end, which is raised every time the execution is
+	// resumed after running out of budget
+	uint64_t m_threshold      = 0;
+	uint64_t m_numSuspensions = 0;
+
+	// Memory usage, in 64KB pages
+	uint64_t m_memPeakPages = 0;
+	// Pages held over the run, weighted by the counter (i.e., a page held
+	// for N instructions counts N), which is deterministic
+	uint64_t m_memPageCount = 0;
+	// Pages held over the run, in page-milliseconds, estimated from
+	// `m_memPageCount` assuming a constant instruction rate
+	uint64_t m_memPageMs    = 0;
+	// Units to bill: the counter plus the memory charge
+	uint64_t m_billedUnits  = 0;
+	// Size of the event data (or stream), which the cost is predicted from
+	uint64_t m_eventSize    = 0;
+	uint64_t m_outputSize          = 0;
+	uint64_t m_outputTruncatedSize = 0;
+	uint64_t m_outputChargedSize   = 0;
+	// The most costly functions (name and cost), if the module counts the
+	// cost of each function
+	std::vector<std::pair<std::string, uint64_t> > m_topFuncCosts;
+	// Answered from the result cache, without being executed
+	bool m_isCacheHit = false;
+	// The ID given to the request by the receipts of checkpoints, if any
+	bool m_hasReqId = false;
+	uint64_t m_reqId = 0;
+	// The result set by the module with `enclave_wasm_set_result`, as a WASM
+	// address, so it's only meaningful while the instance is alive
+	bool m_hasResult = false;
+	uint32_t m_resultPtr = 0;
+	uint64_t m_resultSize = 0;
+	// Hash of the result (return code, output, and the result set by the
+	// module), as in the receipt; only computed for receipts and SLA records
+	bool m_hasResultHash = false;
+	std::array<uint8_t, 32> m_resultHash = {};
+}; // struct EventRunResult
+
+
+/**
+ * @brief Encoding of a batch of events and of their results, so that they can
+ *        be passed across the enclave boundary in a single call.
+ *
+ *        All integers are little-endian.
+ *        Events:  u32 numEvents, then for each event:
+ *                 u32 idLen, id bytes, u32 dataLen, data bytes
+ *        Results: for each event (in the same order):
+ *                 u64 counter, i32 retCode, u64 startTime, u64 endTime
+ *
+ */
+class EventBatch
+{
+public: // static members:
+
+	static constexpr size_t sk_resultSize = 8 + 4 + 8 + 8;
+
+	static size_t GetResultsSize(size_t numEvents)
+	{
+		return numEvents * sk_resultSize;
+	}
+
+	static std::vector<uint8_t> EncodeResults(
+		const std::vector<EventRunResult>& results
+	)
+	{
+		std::vector<uint8_t> res;
+		res.reserve(GetResultsSize(results.size()));
+		for (const auto& result : results)
+		{
+			PutUInt(res, result.m_counter, 8);
+			PutUInt(res, static_cast<uint32_t>(result.m_retCode), 4);
+			PutUInt(res, result.m_startTime, 8);
+			PutUInt(res, result.m_endTime, 8);
+		}
+		return res;
+	}
+
+	static std::vector<EventRunResult> DecodeResults(
+		const uint8_t* data,
+		size_t size
+	)
+	{
+		if (size % sk_resultSize != 0)
+		{
+			throw std::invalid_argument("Invalid size of packed event results");
+		}
+
+		std::vector<EventRunResult> results(size / sk_resultSize);
+		for (auto& result : results)
+		{
+			result.m_counter   = GetUInt(data, 8);
+			result.m_retCode   = static_cast<int32_t>(GetUInt(data + 8, 4));
+			result.m_startTime = GetUInt(data + 12, 8);
+			result.m_endTime   = GetUInt(data + 20, 8);
+			data += sk_resultSize;
+		}
+		return results;
+	}
+
+public:
+
+	EventBatch() :
+		m_numEvents(0),
+		m_bytes(4, 0)
+	{}
+
+	~EventBatch() = default;
+
+	void Add(
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& eventData
+	)
+	{
+		PutBytes(eventId);
+		PutBytes(eventData);
+
+		++m_numEvents;
+		std::vector<uint8_t> numBytes;
+		PutUInt(numBytes, m_numEvents, 4);
+		std::copy(numBytes.begin(), numBytes.end(), m_bytes.begin());
+	}
+
+	size_t GetNumEvents() const
+	{
+		return m_numEvents;
+	}
+
+	const std::vector<uint8_t>& GetBytes() const
+	{
+		return m_bytes;
+	}
+
+private:
+
+	static void PutUInt(std::vector<uint8_t>& dest, uint64_t val, size_t len)
+	{
+		for (size_t i = 0; i < len; ++i)
+		{
+			dest.push_back(static_cast<uint8_t>(val >> (8 * i)));
+		}
+	}
+
+	static uint64_t GetUInt(const uint8_t* src, size_t len)
+	{
+		uint64_t val = 0;
+		for (size_t i = 0; i < len; ++i)
+		{
+			val |= static_cast<uint64_t>(src[i]) << (8 * i);
+		}
+		return val;
+	}
+
+	void PutBytes(const std::vector<uint8_t>& bytes)
+	{
+		if (bytes.size() > UINT32_MAX)
+		{
+			throw std::invalid_argument("Event is too large to be batched");
+		}
+		PutUInt(m_bytes, bytes.size(), 4);
+		m_bytes.insert(m_bytes.end(), bytes.begin(), bytes.end());
+	}
+
+	uint32_t m_numEvents;
+	std::vector<uint8_t> m_bytes;
+
+	friend class EventBatchReader;
+}; // class EventBatch
+
+
+/**
+ * @brief Reads events, one by one, from a packed event batch. The input may
+ *        come from an untrusted source, so every length is bound-checked.
+ *
+ */
+class EventBatchReader
+{
+public:
+
+	EventBatchReader(const uint8_t* data, size_t size) :
+		m_data(data),
+		m_size(size),
+		m_pos(0),
+		m_numEvents(0),
+		m_numRead(0)
+	{
+		m_numEvents = static_cast<uint32_t>(ReadUInt32());
+	}
+
+	~EventBatchReader() = default;
+
+	size_t GetNumEvents() const
+	{
+		return m_numEvents;
+	}
+
+	bool HasNext() const
+	{
+		return m_numRead < m_numEvents;
+	}
+
+	void Next(std::vector<uint8_t>& eventId, std::vector<uint8_t>& eventData)
+	{
+		if (!HasNext())
+		{
+			throw std::out_of_range("No more events in the batch");
+		}
+		ReadBytes(eventId);
+		ReadBytes(eventData);
+		++m_numRead;
+	}
+
+private:
+
+	void Require(size_t len) const
+	{
+		if (len > m_size - m_pos)
+		{
+			throw std::out_of_range("Packed event batch is truncated");
+		}
+	}
+
+	uint32_t ReadUInt32()
+	{
+		Require(4);
+		uint32_t val = static_cast<uint32_t>(EventBatch::GetUInt(m_data + m_pos, 4));
+		m_pos += 4;
+		return val;
+	}
+
+	void ReadBytes(std::vector<uint8_t>& dest)
+	{
+		size_t len = ReadUInt32();
+		Require(len);
+		dest.assign(m_data + m_pos, m_data + m_pos + len);
+		m_pos += len;
+	}
+
+	const uint8_t* m_data;
+	size_t m_size;
+	size_t m_pos;
+	uint32_t m_numEvents;
+	uint32_t m_numRead;
+}; // class EventBatchReader
+
+
+} // namespace Common
+} // namespace SLARuntime
+
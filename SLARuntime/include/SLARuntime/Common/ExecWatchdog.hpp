@@ -0,0 +1,273 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <WasmRuntime/SystemIO.hpp>
+#include <WasmRuntime/WasmModuleInstance.hpp>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief Bounds the wall-clock time of executions, which the instruction
+ *        counter can't, e.g., when a module blocks in an expensive native
+ *        function, or when the enclave is descheduled.
+ *
+ *        An execution is watched from `Watch` to `Unwatch`; when it passes
+ *        its deadline, the watchdog calls `wasm_runtime_terminate` on its
+ *        instance, and WAMR stops it at the next point where it checks for
+ *        exceptions (it already does so for its own purposes), so nothing is
+ *        added to the code being run.
+ *
+ *        The watchdog doesn't create a thread, since an enclave can't;
+ *        a thread that enters the enclave calls `Run`, which only returns
+ *        after `Stop` is called. `CheckDeadlines` can be called instead from
+ *        any thread that's otherwise idle.
+ *
+ *        `Run` blocks while nothing is watched, and otherwise sleeps with
+ *        `SystemIO::SleepUs` until the earliest deadline, so the clock should
+ *        be one that can sleep (e.g., through an ocall), or else the thread
+ *        spins while executions are running.
+ *
+ */
+class ExecWatchdog
+{
+public: // static members:
+
+	using Token = size_t;
+
+	/**
+	 * @brief The longest `Run` sleeps between two checks while executions
+	 *        are watched, so an execution watched in the meantime, with an
+	 *        earlier deadline, is still terminated in time
+	 *
+	 */
+	static constexpr uint64_t sk_defaultPollIntervalUs = 1000;
+
+public:
+
+	ExecWatchdog(
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+		uint64_t pollIntervalUs = sk_defaultPollIntervalUs
+	) :
+		m_sysIO(std::move(sysIO)),
+		m_pollIntervalUs(pollIntervalUs),
+		m_mutex(),
+		m_cond(),
+		m_slots(),
+		m_freeSlots(),
+		m_numWatched(0),
+		m_isStopped(false),
+		m_numTerminated(0)
+	{
+		if (m_sysIO == nullptr)
+		{
+			throw std::invalid_argument("The watchdog clock is not given");
+		}
+	}
+
+	ExecWatchdog(const ExecWatchdog&) = delete;
+
+	ExecWatchdog(ExecWatchdog&&) = delete;
+
+	~ExecWatchdog() = default;
+
+	ExecWatchdog& operator=(const ExecWatchdog&) = delete;
+
+	ExecWatchdog& operator=(ExecWatchdog&&) = delete;
+
+	/**
+	 * @brief Start watching an execution on the given instance, which will be
+	 *        terminated if it runs for longer than `budgetUs`
+	 *
+	 */
+	Token Watch(::WasmRuntime::WasmModuleInstance& modInst, uint64_t budgetUs)
+	{
+		uint64_t deadline = m_sysIO->GetTimestampUs() + budgetUs;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		Token token = 0;
+		if (m_freeSlots.empty())
+		{
+			token = m_slots.size();
+			m_slots.emplace_back();
+		}
+		else
+		{
+			token = m_freeSlots.back();
+			m_freeSlots.pop_back();
+		}
+
+		Slot& slot = m_slots[token];
+		slot.m_modInst = &modInst;
+		slot.m_deadlineUs = deadline;
+		slot.m_isTerminated = false;
+
+		if (m_numWatched++ == 0)
+		{
+			m_cond.notify_all();
+		}
+
+		return token;
+	}
+
+	/**
+	 * @brief Stop watching an execution
+	 *
+	 * @return Whether the execution has been terminated by the watchdog
+	 */
+	bool Unwatch(Token token)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		Slot& slot = m_slots.at(token);
+		bool isTerminated = slot.m_isTerminated;
+		slot.m_modInst = nullptr;
+		m_freeSlots.push_back(token);
+		--m_numWatched;
+
+		return isTerminated;
+	}
+
+	/**
+	 * @brief Terminate all watched executions that passed their deadlines
+	 *
+	 * @return The number of executions terminated by this call
+	 */
+	size_t CheckDeadlines()
+	{
+		uint64_t nextDeadlineUs = 0;
+		return CheckDeadlines(nextDeadlineUs);
+	}
+
+	/**
+	 * @brief Check the deadlines until `Stop` is called; it blocks while
+	 *        nothing is watched, and sleeps until the earliest deadline (at
+	 *        most for the poll interval) otherwise
+	 *
+	 */
+	void Run()
+	{
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(
+					lock,
+					[this]() { return m_isStopped || (m_numWatched != 0); }
+				);
+				if (m_isStopped)
+				{
+					return;
+				}
+			}
+
+			uint64_t nextDeadlineUs = 0;
+			CheckDeadlines(nextDeadlineUs);
+
+			uint64_t now = m_sysIO->GetTimestampUs();
+			if (nextDeadlineUs > now)
+			{
+				m_sysIO->SleepUs(
+					std::min(nextDeadlineUs - now, m_pollIntervalUs)
+				);
+			}
+		}
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopped = true;
+		}
+		m_cond.notify_all();
+	}
+
+	uint64_t GetNumTerminated() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numTerminated;
+	}
+
+private:
+
+	/**
+	 * @param nextDeadlineUs Set to the earliest deadline that hasn't passed,
+	 *                       or to the max value if there's none
+	 */
+	size_t CheckDeadlines(uint64_t& nextDeadlineUs)
+	{
+		uint64_t now = m_sysIO->GetTimestampUs();
+		size_t numTerminated = 0;
+		nextDeadlineUs = std::numeric_limits<uint64_t>::max();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (Slot& slot : m_slots)
+		{
+			if ((slot.m_modInst == nullptr) || slot.m_isTerminated)
+			{
+				continue;
+			}
+			if (now >= slot.m_deadlineUs)
+			{
+				// still holding the lock, so the instance can't be gone
+				slot.m_modInst->Terminate();
+				slot.m_isTerminated = true;
+				++numTerminated;
+			}
+			else
+			{
+				nextDeadlineUs = std::min(nextDeadlineUs, slot.m_deadlineUs);
+			}
+		}
+		m_numTerminated += numTerminated;
+
+		return numTerminated;
+	}
+
+	struct Slot
+	{
+		::WasmRuntime::WasmModuleInstance* m_modInst = nullptr;
+		uint64_t m_deadlineUs = 0;
+		bool m_isTerminated = false;
+	}; // struct Slot
+
+	std::unique_ptr<::WasmRuntime::SystemIO> m_sysIO;
+	uint64_t m_pollIntervalUs;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::vector<Slot> m_slots;
+	std::vector<Token> m_freeSlots;
+	size_t m_numWatched;
+
+	bool m_isStopped;
+	uint64_t m_numTerminated;
+
+}; // class ExecWatchdog
+
+
+} // namespace Common
+} // namespace SLARuntime
+
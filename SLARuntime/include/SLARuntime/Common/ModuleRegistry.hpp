@@ -0,0 +1,582 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <WasmRuntime/SharedWasmRuntime.hpp>
+
+#include "Logging.hpp"
+#include "WasmRuntime.hpp"
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+struct ModuleRegistryConfig
+{
+	/**
+	 * @brief Bytes of the runtime heap that loaded modules and their warm
+	 *        instances may take, e.g., what's left of the EPC after the
+	 *        execution stacks and linear memories of running requests;
+	 *        modules are evicted once it's exceeded
+	 *
+	 */
+	uint64_t m_epcBudget = 64 * 1024 * 1024;
+
+	/**
+	 * @brief Number of idle instances kept per module, so a request doesn't
+	 *        pay for the instantiation; 0 disables it. An instance is only
+	 *        reused by the owner that used it, so the least recently
+	 *        released one makes room for a new one.
+	 *
+	 */
+	size_t m_maxWarmInstances = 2;
+}; // struct ModuleRegistryConfig
+
+
+struct ModuleRegistryStats
+{
+	uint64_t m_numHits = 0;
+	uint64_t m_numMisses = 0;
+	uint64_t m_numEvictions = 0;
+
+	/**
+	 * @brief Time spent loading (i.e., instrumenting and loading) modules
+	 *
+	 */
+	uint64_t m_totalLoadUs = 0;
+	uint64_t m_maxLoadUs = 0;
+
+	size_t m_numModules = 0;
+	size_t m_numWarmInstances = 0;
+
+	/**
+	 * @brief Bytes of the runtime heap taken by the loaded modules and their
+	 *        warm instances
+	 *
+	 */
+	uint64_t m_footprint = 0;
+
+	double GetHitRate() const
+	{
+		uint64_t numLookups = m_numHits + m_numMisses;
+		return numLookups == 0 ?
+			0.0 :
+			static_cast<double>(m_numHits) / static_cast<double>(numLookups);
+	}
+
+	double GetAvgLoadUs() const
+	{
+		return m_numMisses == 0 ?
+			0.0 :
+			static_cast<double>(m_totalLoadUs) /
+				static_cast<double>(m_numMisses);
+	}
+}; // struct ModuleRegistryStats
+
+
+/**
+ * @brief Keeps the modules of many tenants loaded on one runtime, each in its
+ *        own `WasmRuntime`, keyed by contract ID or module hash (e.g.,
+ *        `ResultCache::HashModule`).
+ *
+ *        The footprint of a module is the growth of the runtime heap when
+ *        it's loaded, and that of a warm instance when it's instantiated.
+ *        When the footprints add up to more than the EPC budget, modules are
+ *        evicted by GreedyDual-Size, a cost-aware LRU: a module's priority is
+ *        the inflation value plus its load time per byte, refreshed on every
+ *        hit, and the inflation value is raised to the priority of each
+ *        evicted module. So a small module that is slow to load outlives a
+ *        large one that is quick to reload, and a module that isn't used
+ *        ages out.
+ *
+ *        An evicted module that is still being used by a request stays alive
+ *        until the request drops it; its heap is only freed then.
+ *
+ *        A warm instance keeps the state its requests left in its linear
+ *        memory and globals, so it's only given back to the owner (e.g.,
+ *        the tenant, or the caller) that used it, as `WasmWorkerPool` does.
+ *
+ */
+class ModuleRegistry
+{
+public: // static members:
+
+	/**
+	 * @brief Give the bytecode of the module (not instrumented); called on a
+	 *        miss only
+	 *
+	 */
+	using LoadFunc = std::function<std::vector<uint8_t>()>;
+
+	/**
+	 * @brief Configure a new `WasmRuntime` before its module is loaded, e.g.,
+	 *        to enable the result cache, or set the watchdog
+	 *
+	 */
+	using SetupFunc = std::function<void(WasmRuntime&)>;
+
+	/**
+	 * @brief An instance of a registered module, with the runtime that
+	 *        loaded it, which is needed to run events on it, and the owner it
+	 *        was acquired for
+	 *
+	 */
+	struct WarmInstance
+	{
+		std::shared_ptr<WasmRuntime> m_runtime;
+		WasmRuntime::Instance m_inst;
+		uint64_t m_ownerId;
+	}; // struct WarmInstance
+
+public:
+
+	ModuleRegistry(
+		::WasmRuntime::SharedWasmRuntime wrt,
+		uint32_t modStackSize,
+		uint32_t modHeapSize,
+		uint32_t execStackSize,
+		const ModuleRegistryConfig& config = ModuleRegistryConfig(),
+		SetupFunc setupFunc = SetupFunc()
+	) :
+		m_logger(Common::LoggerFactory::GetLogger("ModuleRegistry")),
+		m_wrt(std::move(wrt)),
+		m_modStackSize(modStackSize),
+		m_modHeapSize(modHeapSize),
+		m_execStackSize(execStackSize),
+		m_config(config),
+		m_setupFunc(std::move(setupFunc)),
+		m_loadMutex(),
+		m_mutex(),
+		m_entries(),
+		m_inflation(0.0),
+		m_footprint(0),
+		m_stats()
+	{}
+
+	ModuleRegistry(const ModuleRegistry&) = delete;
+
+	ModuleRegistry(ModuleRegistry&&) = delete;
+
+	~ModuleRegistry() = default;
+
+	ModuleRegistry& operator=(const ModuleRegistry&) = delete;
+
+	ModuleRegistry& operator=(ModuleRegistry&&) = delete;
+
+	/**
+	 * @brief Get the runtime of a module, loading it on a miss
+	 *
+	 */
+	std::shared_ptr<WasmRuntime> Get(
+		const std::string& key,
+		const LoadFunc& loadFunc
+	)
+	{
+		std::shared_ptr<WasmRuntime> runtime = Lookup(key);
+		if (runtime != nullptr)
+		{
+			return runtime;
+		}
+
+		// loads are serialized, so the heap growth is (mostly) down to the
+		// module being loaded
+		std::lock_guard<std::mutex> loadLock(m_loadMutex);
+
+		// it may be loaded while waiting for the other load
+		runtime = Lookup(key, false);
+		if (runtime != nullptr)
+		{
+			return runtime;
+		}
+
+		uint64_t startUs = m_wrt->GetSystemIO().GetTimestampUs();
+		uint64_t usedBefore = m_wrt->GetHeapStats().m_usedSize;
+
+		runtime = std::make_shared<WasmRuntime>(
+			m_wrt,
+			m_modStackSize,
+			m_modHeapSize,
+			m_execStackSize
+		);
+		if (m_setupFunc)
+		{
+			m_setupFunc(*runtime);
+		}
+		std::vector<uint8_t> bytecode = loadFunc();
+		runtime->LoadPlainModule(bytecode);
+
+		uint64_t usedAfter = m_wrt->GetHeapStats().m_usedSize;
+		uint64_t loadUs = m_wrt->GetSystemIO().GetTimestampUs() - startUs;
+
+		Entry entry;
+		entry.m_runtime = runtime;
+		// requests running at the same time may free memory while loading;
+		// the bytecode size is a lower bound then
+		entry.m_modFootprint = (usedAfter > usedBefore + bytecode.size()) ?
+			(usedAfter - usedBefore) :
+			bytecode.size();
+		entry.m_loadUs = loadUs;
+		uint64_t modFootprint = entry.m_modFootprint;
+
+		// freed outside of the lock, since it takes a while
+		std::vector<Entry> evicted;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			++m_stats.m_numMisses;
+			m_stats.m_totalLoadUs += loadUs;
+			if (loadUs > m_stats.m_maxLoadUs)
+			{
+				m_stats.m_maxLoadUs = loadUs;
+			}
+
+			entry.m_priority = m_inflation + GetCostPerByte(entry);
+			m_footprint += entry.GetFootprint();
+			m_entries[key] = std::move(entry);
+
+			EvictLocked(key, evicted);
+		}
+
+		m_logger.Debug(
+			"Loaded module in " + std::to_string(loadUs) + " us, taking " +
+			std::to_string(modFootprint) + " bytes of heap"
+		);
+
+		return runtime;
+	}
+
+	/**
+	 * @brief Take an idle instance of a module that was used by the given
+	 *        owner, or a new one if there is none, loading the module on a
+	 *        miss. Its execution environment is created by the calling
+	 *        thread, which must be the only one using it.
+	 *
+	 */
+	WarmInstance AcquireInstance(
+		const std::string& key,
+		uint64_t ownerId,
+		const LoadFunc& loadFunc
+	)
+	{
+		std::shared_ptr<WasmRuntime> runtime = Get(key, loadFunc);
+
+		std::vector<WasmRuntime::Instance> taken;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_entries.find(key);
+			if ((it != m_entries.end()) && (it->second.m_runtime == runtime))
+			{
+				std::vector<IdleInstance>& warmInsts = it->second.m_warmInsts;
+				// the most recently released one first
+				for (size_t i = warmInsts.size(); i > 0; --i)
+				{
+					if (warmInsts[i - 1].m_ownerId == ownerId)
+					{
+						taken.push_back(std::move(warmInsts[i - 1].m_inst));
+						warmInsts.erase(warmInsts.begin() + (i - 1));
+						m_footprint -= it->second.m_instFootprint;
+						break;
+					}
+				}
+			}
+		}
+
+		if (!taken.empty())
+		{
+			WarmInstance warmInst { runtime, std::move(taken.back()), ownerId };
+			runtime->RenewExecEnv(warmInst.m_inst);
+			return warmInst;
+		}
+
+		uint64_t usedBefore = m_wrt->GetHeapStats().m_usedSize;
+		WarmInstance warmInst { runtime, runtime->NewInstance(), ownerId };
+		uint64_t usedAfter = m_wrt->GetHeapStats().m_usedSize;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_entries.find(key);
+		if (
+			(it != m_entries.end()) &&
+			(it->second.m_runtime == runtime) &&
+			(it->second.m_instFootprint == 0)
+		)
+		{
+			// other threads allocate and free at the same time, so this is
+			// an estimate, which falls back to the size of its linear memory
+			// and stacks
+			it->second.m_instFootprint = (usedAfter > usedBefore) ?
+				(usedAfter - usedBefore) :
+				(static_cast<uint64_t>(m_modHeapSize) +
+					m_modStackSize + m_execStackSize);
+		}
+		return warmInst;
+	}
+
+	/**
+	 * @brief Give an instance back, to be kept warm for its owner; it's
+	 *        dropped if its module has been evicted (or reloaded), and it
+	 *        replaces the least recently released instance if enough are kept
+	 *        already
+	 *
+	 */
+	void ReleaseInstance(const std::string& key, WarmInstance warmInst)
+	{
+		// a dropped instance is freed with the argument, outside of the
+		// lock, since it takes a while
+		std::vector<Entry> evicted;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			auto it = m_entries.find(key);
+			if (
+				(it == m_entries.end()) ||
+				(it->second.m_runtime != warmInst.m_runtime) ||
+				(m_config.m_maxWarmInstances == 0)
+			)
+			{
+				return;
+			}
+
+			std::vector<IdleInstance>& warmInsts = it->second.m_warmInsts;
+			if (warmInsts.size() >= m_config.m_maxWarmInstances)
+			{
+				evicted.emplace_back();
+				evicted.back().m_warmInsts.push_back(
+					std::move(warmInsts.front())
+				);
+				warmInsts.erase(warmInsts.begin());
+				m_footprint -= it->second.m_instFootprint;
+			}
+
+			// the environment belongs to this thread; a new one is created
+			// when it's acquired again
+			warmInst.m_inst.m_execEnv =
+				::WasmRuntime::SharedWasmExecEnv(nullptr);
+			warmInsts.push_back(
+				IdleInstance { std::move(warmInst.m_inst), warmInst.m_ownerId }
+			);
+			m_footprint += it->second.m_instFootprint;
+
+			EvictLocked(key, evicted);
+		}
+	}
+
+	bool Contains(const std::string& key) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_entries.find(key) != m_entries.end();
+	}
+
+	/**
+	 * @brief Unload a module, e.g., when its contract ends
+	 *
+	 * @return True if it was loaded
+	 */
+	bool Erase(const std::string& key)
+	{
+		Entry erased;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_entries.find(key);
+			if (it == m_entries.end())
+			{
+				return false;
+			}
+			erased = std::move(it->second);
+			m_footprint -= erased.GetFootprint();
+			m_entries.erase(it);
+		}
+		return true;
+	}
+
+	void Clear()
+	{
+		std::unordered_map<std::string, Entry> erased;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			erased.swap(m_entries);
+			m_footprint = 0;
+		}
+	}
+
+	/**
+	 * @brief Footprint of a module and its warm instances, in bytes; 0 if it
+	 *        isn't loaded
+	 *
+	 */
+	uint64_t GetFootprint(const std::string& key) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_entries.find(key);
+		return it == m_entries.end() ? 0 : it->second.GetFootprint();
+	}
+
+	ModuleRegistryStats GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		ModuleRegistryStats stats = m_stats;
+		stats.m_numModules = m_entries.size();
+		stats.m_footprint = m_footprint;
+		for (const auto& kv : m_entries)
+		{
+			stats.m_numWarmInstances += kv.second.m_warmInsts.size();
+		}
+		return stats;
+	}
+
+private:
+
+	struct IdleInstance
+	{
+		WasmRuntime::Instance m_inst;
+		uint64_t m_ownerId;
+	}; // struct IdleInstance
+
+	struct Entry
+	{
+		std::shared_ptr<WasmRuntime> m_runtime;
+		// in the order they're released
+		std::vector<IdleInstance> m_warmInsts;
+		uint64_t m_modFootprint = 0;
+		uint64_t m_instFootprint = 0;
+		uint64_t m_loadUs = 0;
+		// GreedyDual-Size priority; the lowest one is evicted first
+		double m_priority = 0.0;
+
+		uint64_t GetFootprint() const
+		{
+			return m_modFootprint + (m_instFootprint * m_warmInsts.size());
+		}
+	}; // struct Entry
+
+	static double GetCostPerByte(const Entry& entry)
+	{
+		// at least 1us, so free-to-load modules still age by recency
+		uint64_t cost = entry.m_loadUs == 0 ? 1 : entry.m_loadUs;
+		uint64_t size = entry.m_modFootprint == 0 ? 1 : entry.m_modFootprint;
+		return static_cast<double>(cost) / static_cast<double>(size);
+	}
+
+	/**
+	 * @param isCounted Whether the lookup counts towards the hit rate
+	 */
+	std::shared_ptr<WasmRuntime> Lookup(
+		const std::string& key,
+		bool isCounted = true
+	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_entries.find(key);
+		if (it == m_entries.end())
+		{
+			return nullptr;
+		}
+
+		if (isCounted)
+		{
+			++m_stats.m_numHits;
+		}
+		it->second.m_priority = m_inflation + GetCostPerByte(it->second);
+		return it->second.m_runtime;
+	}
+
+	/**
+	 * @brief Evict until the footprint fits in the budget; warm instances go
+	 *        first, since they are cheap to recreate, then whole modules.
+	 *        The module given is kept, since it's about to be used, even if
+	 *        it doesn't fit by itself.
+	 *
+	 *        The lowest priority is found by a scan, which is fine for the
+	 *        hundreds of modules an enclave can hold.
+	 *
+	 * @param outEvicted Receives what's evicted, to be freed by the caller
+	 *                   once the lock is released
+	 */
+	void EvictLocked(const std::string& keepKey, std::vector<Entry>& outEvicted)
+	{
+		for (auto& kv : m_entries)
+		{
+			if (m_footprint <= m_config.m_epcBudget)
+			{
+				return;
+			}
+			if (!kv.second.m_warmInsts.empty())
+			{
+				m_footprint -=
+					kv.second.m_instFootprint * kv.second.m_warmInsts.size();
+				outEvicted.emplace_back();
+				outEvicted.back().m_warmInsts.swap(kv.second.m_warmInsts);
+			}
+		}
+
+		while (m_footprint > m_config.m_epcBudget)
+		{
+			auto victim = m_entries.end();
+			for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+			{
+				if (
+					(it->first != keepKey) &&
+					(
+						(victim == m_entries.end()) ||
+						(it->second.m_priority < victim->second.m_priority)
+					)
+				)
+				{
+					victim = it;
+				}
+			}
+			if (victim == m_entries.end())
+			{
+				return;
+			}
+
+			m_inflation = victim->second.m_priority;
+			m_footprint -= victim->second.GetFootprint();
+			++m_stats.m_numEvictions;
+			outEvicted.push_back(std::move(victim->second));
+			m_entries.erase(victim);
+		}
+	}
+
+	Common::Logger m_logger;
+	::WasmRuntime::SharedWasmRuntime m_wrt;
+	uint32_t m_modStackSize;
+	uint32_t m_modHeapSize;
+	uint32_t m_execStackSize;
+	ModuleRegistryConfig m_config;
+	SetupFunc m_setupFunc;
+
+	std::mutex m_loadMutex;
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_entries;
+	// GreedyDual-Size inflation value, i.e., the priority of the last evicted
+	double m_inflation;
+	uint64_t m_footprint;
+	ModuleRegistryStats m_stats;
+
+}; // class ModuleRegistry
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -0,0 +1,668 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <EclipseMonitor/Eth/Keccak256.hpp>
+#include <WasmRuntime/SystemIO.hpp>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+using ReceiptHash = std::array<uint8_t, 32>;
+
+
+/**
+ * @brief The receipt of one request, which is a leaf of the Merkle tree of a
+ *        checkpoint
+ *
+ */
+struct RequestReceipt
+{
+	uint64_t m_reqId = 0;
+	uint64_t m_units = 0;
+	uint32_t m_timeUs = 0;
+	ReceiptHash m_resultHash = {};
+}; // struct RequestReceipt
+
+
+/**
+ * @brief Proof that a receipt is in the tree of a checkpoint
+ *
+ */
+struct ReceiptProof
+{
+	RequestReceipt m_receipt;
+	uint64_t m_chkptSeqNum = 0;
+	// position of the receipt in the checkpoint
+	uint64_t m_leafIdx = 0;
+	// siblings from the leaf level up
+	std::vector<ReceiptHash> m_siblings;
+}; // struct ReceiptProof
+
+
+/**
+ * @brief What is committed on-chain for a checkpoint
+ *
+ */
+struct CheckpointCommit
+{
+	uint64_t m_seqNum = 0;
+	uint64_t m_numRequests = 0;
+	uint64_t m_numAccepted = 0;
+	uint64_t m_totalUnits = 0;
+	ReceiptHash m_root = {};
+}; // struct CheckpointCommit
+
+
+/**
+ * @brief The Merkle tree over receipts, built the same way as
+ *        `SLA.sol::verifyReceipt` checks it, with Keccak-256:
+ *
+ *        - leaf = H(0x00 || reqId (uint256) || units (uint64) ||
+ *                   timeUs (uint32) || resultHash (bytes32)),
+ *          integers in big-endian, i.e., `abi.encodePacked`
+ *        - node = H(0x01 || left || right)
+ *        - a node without a sibling is paired with itself
+ *
+ *        The prefixes keep leaves and nodes apart.
+ *
+ */
+struct ReceiptTree
+{
+	static ReceiptHash LeafHash(const RequestReceipt& receipt)
+	{
+		std::vector<uint8_t> preimage;
+		preimage.reserve(1 + 32 + 8 + 4 + 32);
+		preimage.push_back(0x00);
+		// uint256 reqId
+		preimage.insert(preimage.end(), 32 - 8, 0);
+		PutBigEndian(preimage, receipt.m_reqId, 8);
+		PutBigEndian(preimage, receipt.m_units, 8);
+		PutBigEndian(preimage, receipt.m_timeUs, 4);
+		preimage.insert(
+			preimage.end(),
+			receipt.m_resultHash.begin(),
+			receipt.m_resultHash.end()
+		);
+
+		return Hash(preimage);
+	}
+
+	static ReceiptHash NodeHash(const ReceiptHash& left, const ReceiptHash& right)
+	{
+		std::vector<uint8_t> preimage;
+		preimage.reserve(1 + 32 + 32);
+		preimage.push_back(0x01);
+		preimage.insert(preimage.end(), left.begin(), left.end());
+		preimage.insert(preimage.end(), right.begin(), right.end());
+
+		return Hash(preimage);
+	}
+
+	/**
+	 * @brief Hash of the result of a request, i.e., the return code (int32),
+	 *        the size of the output (uint64), the output, and the result set
+	 *        by the module (if any)
+	 *
+	 */
+	template<typename _OutputCtn>
+	static ReceiptHash ResultHash(
+		int32_t retCode,
+		const _OutputCtn& output,
+		const uint8_t* result = nullptr,
+		size_t resultSize = 0
+	)
+	{
+		std::vector<uint8_t> preimage;
+		preimage.reserve(4 + 8 + output.size() + resultSize);
+		PutBigEndian(preimage, static_cast<uint32_t>(retCode), 4);
+		PutBigEndian(preimage, static_cast<uint64_t>(output.size()), 8);
+		preimage.insert(preimage.end(), output.begin(), output.end());
+		if (result != nullptr)
+		{
+			preimage.insert(preimage.end(), result, result + resultSize);
+		}
+
+		return Hash(preimage);
+	}
+
+	/**
+	 * @brief The root of the given leaves; all zeros if there is none
+	 *
+	 */
+	static ReceiptHash Root(std::vector<ReceiptHash> level)
+	{
+		if (level.empty())
+		{
+			return ReceiptHash();
+		}
+		while (level.size() > 1)
+		{
+			level = NextLevel(level);
+		}
+		return level[0];
+	}
+
+	/**
+	 * @brief The siblings of the given leaf, from the leaf level up
+	 *
+	 */
+	static std::vector<ReceiptHash> Siblings(
+		std::vector<ReceiptHash> level,
+		size_t leafIdx
+	)
+	{
+		if (leafIdx >= level.size())
+		{
+			throw std::out_of_range("The leaf is not in the tree");
+		}
+
+		std::vector<ReceiptHash> siblings;
+		size_t idx = leafIdx;
+		while (level.size() > 1)
+		{
+			size_t sibIdx = idx ^ 1;
+			siblings.push_back(
+				sibIdx < level.size() ? level[sibIdx] : level[idx]
+			);
+			level = NextLevel(level);
+			idx >>= 1;
+		}
+		return siblings;
+	}
+
+	/**
+	 * @brief Check a proof against a root, as `SLA.sol::verifyReceipt` does
+	 *
+	 */
+	static bool Verify(const ReceiptProof& proof, const ReceiptHash& root)
+	{
+		ReceiptHash node = LeafHash(proof.m_receipt);
+		uint64_t idx = proof.m_leafIdx;
+		for (const auto& sibling : proof.m_siblings)
+		{
+			node = ((idx & 1) == 1) ?
+				NodeHash(sibling, node) :
+				NodeHash(node, sibling);
+			idx >>= 1;
+		}
+		return (idx == 0) && (node == root);
+	}
+
+private:
+
+	static ReceiptHash Hash(const std::vector<uint8_t>& preimage)
+	{
+		auto hash = EclipseMonitor::Eth::Keccak256(preimage);
+		ReceiptHash res;
+		std::copy(hash.begin(), hash.end(), res.begin());
+		return res;
+	}
+
+	template<typename _UIntType>
+	static void PutBigEndian(std::vector<uint8_t>& dest, _UIntType val, size_t size)
+	{
+		for (size_t i = size; i > 0; --i)
+		{
+			dest.push_back(static_cast<uint8_t>(val >> (8 * (i - 1))));
+		}
+	}
+
+	static std::vector<ReceiptHash> NextLevel(const std::vector<ReceiptHash>& level)
+	{
+		std::vector<ReceiptHash> next;
+		next.reserve((level.size() + 1) / 2);
+		for (size_t i = 0; i < level.size(); i += 2)
+		{
+			const ReceiptHash& right =
+				(i + 1 < level.size()) ? level[i + 1] : level[i];
+			next.push_back(NodeHash(level[i], right));
+		}
+		return next;
+	}
+}; // struct ReceiptTree
+
+
+struct ReceiptConfig
+{
+	/**
+	 * @brief Number of requests in a checkpoint; the checkpoint is committed
+	 *        when it's full
+	 *
+	 */
+	size_t m_maxRequests = 256;
+
+	/**
+	 * @brief Commit the checkpoint once its first request is older than
+	 *        this, checked when a request is added or `CommitIfDue` is
+	 *        called; 0 disables it
+	 *
+	 */
+	uint64_t m_maxIntervalUs = 0;
+
+	/**
+	 * @brief Number of committed checkpoints whose receipts are kept to
+	 *        answer for disputes
+	 *
+	 */
+	size_t m_numKeptCheckpoints = 16;
+
+	/**
+	 * @brief How long `Run` waits before sending a commit again, after
+	 *        sending it failed
+	 *
+	 */
+	uint64_t m_retryAfterUs = 1000 * 1000;
+}; // struct ReceiptConfig
+
+
+/**
+ * @brief Keeps the receipt of every request, and commits each checkpoint
+ *        with the Merkle root of its receipts and the totals only, so the
+ *        calldata of a checkpoint doesn't grow with the number of requests.
+ *        The receipts of the last few checkpoints are kept, so a proof can
+ *        be given for a disputed request.
+ *
+ *        As with `CheckpointAccumulator`, a request never sends a commit
+ *        itself: a checkpoint that's due is queued, and the queue is sent by
+ *        `SendPending` or `Run`, in order. A checkpoint is only numbered,
+ *        and its commit dropped from the queue, once it's sent, so one that
+ *        failed to be sent is sent again, with the same sequence number.
+ *
+ *        Request IDs are given in order, starting from 0, as `SLA.sol`
+ *        expects.
+ *
+ */
+class ReceiptAccumulator
+{
+public: // static members:
+
+	/**
+	 * @brief Send out the commit of a checkpoint; throws if it couldn't be
+	 *        sent
+	 *
+	 */
+	using CommitFunc = std::function<void(const CheckpointCommit&)>;
+
+public:
+
+	/**
+	 * @param sysIO The clock `Run` waits on before retrying; only `Run`
+	 *              needs it
+	 */
+	ReceiptAccumulator(
+		const ReceiptConfig& config,
+		CommitFunc commitFunc,
+		uint64_t firstSeqNum = 0,
+		uint64_t firstReqId = 0,
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO = nullptr
+	) :
+		m_config(config),
+		m_commitFunc(std::move(commitFunc)),
+		m_sysIO(std::move(sysIO)),
+		m_mutex(),
+		m_cond(),
+		m_pending(),
+		m_firstEntryUs(0),
+		m_sealed(),
+		m_nextSeqNum(firstSeqNum),
+		m_nextReqId(firstReqId),
+		m_numFailedSends(0),
+		m_isStopped(false),
+		m_committed(),
+		m_sendMutex()
+	{
+		if (m_config.m_maxRequests == 0)
+		{
+			throw std::invalid_argument(
+				"A checkpoint must have at least one request"
+			);
+		}
+		m_pending.reserve(m_config.m_maxRequests);
+	}
+
+	ReceiptAccumulator(const ReceiptAccumulator&) = delete;
+
+	ReceiptAccumulator(ReceiptAccumulator&&) = delete;
+
+	~ReceiptAccumulator() = default;
+
+	ReceiptAccumulator& operator=(const ReceiptAccumulator&) = delete;
+
+	ReceiptAccumulator& operator=(ReceiptAccumulator&&) = delete;
+
+	/**
+	 * @brief Add the receipt of a request, and queue the checkpoint if it's
+	 *        due
+	 *
+	 * @param elapsedUs Time elapsed, in microseconds; it's capped at the
+	 *                  largest uint32
+	 * @param nowUs     Current time, in microseconds, for the time threshold
+	 * @return The ID given to the request
+	 */
+	uint64_t Append(
+		uint64_t units,
+		uint64_t elapsedUs,
+		const ReceiptHash& resultHash,
+		uint64_t nowUs
+	)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (m_pending.empty())
+		{
+			m_firstEntryUs = nowUs;
+		}
+
+		RequestReceipt receipt;
+		receipt.m_reqId = m_nextReqId++;
+		receipt.m_units = units;
+		receipt.m_timeUs = static_cast<uint32_t>(std::min<uint64_t>(
+			elapsedUs,
+			std::numeric_limits<uint32_t>::max()
+		));
+		receipt.m_resultHash = resultHash;
+		m_pending.push_back(receipt);
+
+		if (
+			(m_pending.size() >= m_config.m_maxRequests) ||
+			IsIntervalPassed(nowUs)
+		)
+		{
+			SealLocked(lock);
+		}
+
+		return receipt.m_reqId;
+	}
+
+	/**
+	 * @brief Queue the checkpoint if the time threshold has passed
+	 *
+	 */
+	void CommitIfDue(uint64_t nowUs)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_pending.empty() && IsIntervalPassed(nowUs))
+		{
+			SealLocked(lock);
+		}
+	}
+
+	/**
+	 * @brief Queue the checkpoint of the receipts collected so far, if any
+	 *
+	 */
+	void Commit()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_pending.empty())
+		{
+			SealLocked(lock);
+		}
+	}
+
+	/**
+	 * @brief Send the commits of the queued checkpoints, in order, until the
+	 *        queue is empty or a send fails; the checkpoint that failed stays
+	 *        first in the queue
+	 *
+	 * @return Number of commits sent
+	 */
+	size_t SendPending()
+	{
+		// one sender at a time, so commits go out in order
+		std::lock_guard<std::mutex> sendLock(m_sendMutex);
+
+		size_t numSent = 0;
+		while (true)
+		{
+			Checkpoint* chkpt = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_sealed.empty())
+				{
+					return numSent;
+				}
+				// only the sender removes checkpoints, and adding more to
+				// the queue doesn't move the ones in it
+				chkpt = &m_sealed.front();
+				chkpt->m_commit.m_seqNum = m_nextSeqNum;
+			}
+
+			// hashing is done outside of `m_mutex`, so requests keep coming
+			// in; a checkpoint sent again keeps its tree
+			if (chkpt->m_leaves.empty())
+			{
+				BuildTree(*chkpt);
+			}
+
+			try
+			{
+				if (m_commitFunc)
+				{
+					m_commitFunc(chkpt->m_commit);
+				}
+			}
+			catch (const std::exception&)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_numFailedSends;
+				return numSent;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_nextSeqNum;
+
+				m_committed.push_back(std::move(m_sealed.front()));
+				m_sealed.pop_front();
+				while (m_committed.size() > m_config.m_numKeptCheckpoints)
+				{
+					m_committed.pop_front();
+				}
+			}
+			++numSent;
+		}
+	}
+
+	/**
+	 * @brief Send the commits as checkpoints are queued, until `Stop` is
+	 *        called; it sleeps while there is nothing to send, and waits
+	 *        `m_retryAfterUs` after a send fails. Checkpoints queued when it
+	 *        stops are left for `SendPending`.
+	 *
+	 */
+	void Run()
+	{
+		if (m_sysIO == nullptr)
+		{
+			throw std::logic_error("The receipt accumulator has no clock");
+		}
+
+		while (true)
+		{
+			uint64_t numFailedSends = 0;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(
+					lock,
+					[this]() { return !m_sealed.empty() || m_isStopped; }
+				);
+				if (m_isStopped)
+				{
+					return;
+				}
+				numFailedSends = m_numFailedSends;
+			}
+
+			SendPending();
+
+			if (GetNumFailedSends() != numFailedSends)
+			{
+				m_sysIO->SleepUs(m_config.m_retryAfterUs);
+			}
+		}
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopped = true;
+		}
+		m_cond.notify_all();
+	}
+
+	/**
+	 * @brief The proof of inclusion of the given request in its (committed)
+	 *        checkpoint
+	 *
+	 */
+	ReceiptProof GetProof(uint64_t reqId) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (const auto& chkpt : m_committed)
+		{
+			uint64_t firstReqId = chkpt.m_receipts.front().m_reqId;
+			if (reqId >= firstReqId && reqId - firstReqId < chkpt.m_receipts.size())
+			{
+				size_t leafIdx = static_cast<size_t>(reqId - firstReqId);
+
+				ReceiptProof proof;
+				proof.m_receipt = chkpt.m_receipts[leafIdx];
+				proof.m_chkptSeqNum = chkpt.m_commit.m_seqNum;
+				proof.m_leafIdx = leafIdx;
+				proof.m_siblings = ReceiptTree::Siblings(chkpt.m_leaves, leafIdx);
+				return proof;
+			}
+		}
+
+		throw std::out_of_range(
+			"The request " + std::to_string(reqId) +
+			" is not in any of the kept checkpoints"
+		);
+	}
+
+	/**
+	 * @brief The sequence number of the next checkpoint to be sent
+	 *
+	 */
+	uint64_t GetNextSeqNum() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_nextSeqNum;
+	}
+
+	size_t GetNumPending() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_pending.size();
+	}
+
+	/**
+	 * @brief Number of checkpoints queued, and not sent yet
+	 *
+	 */
+	size_t GetNumQueued() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_sealed.size();
+	}
+
+	uint64_t GetNumFailedSends() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numFailedSends;
+	}
+
+private:
+
+	struct Checkpoint
+	{
+		CheckpointCommit m_commit;
+		std::vector<RequestReceipt> m_receipts;
+		std::vector<ReceiptHash> m_leaves;
+	}; // struct Checkpoint
+
+	bool IsIntervalPassed(uint64_t nowUs) const
+	{
+		return (m_config.m_maxIntervalUs != 0) &&
+			(nowUs - m_firstEntryUs >= m_config.m_maxIntervalUs);
+	}
+
+	/**
+	 * @brief Queue the pending receipts as a checkpoint; `lock` must hold
+	 *        `m_mutex`
+	 *
+	 */
+	void SealLocked(std::unique_lock<std::mutex>&)
+	{
+		Checkpoint chkpt;
+		chkpt.m_receipts.swap(m_pending);
+		m_pending.reserve(m_config.m_maxRequests);
+		chkpt.m_commit.m_numRequests = chkpt.m_receipts.size();
+
+		m_sealed.push_back(std::move(chkpt));
+
+		m_cond.notify_all();
+	}
+
+	static void BuildTree(Checkpoint& chkpt)
+	{
+		chkpt.m_leaves.reserve(chkpt.m_receipts.size());
+		for (const auto& receipt : chkpt.m_receipts)
+		{
+			chkpt.m_commit.m_totalUnits += receipt.m_units;
+			chkpt.m_commit.m_numAccepted += (receipt.m_units > 0) ? 1 : 0;
+			chkpt.m_leaves.push_back(ReceiptTree::LeafHash(receipt));
+		}
+		chkpt.m_commit.m_root = ReceiptTree::Root(chkpt.m_leaves);
+	}
+
+	ReceiptConfig m_config;
+	CommitFunc m_commitFunc;
+	std::unique_ptr<::WasmRuntime::SystemIO> m_sysIO;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::vector<RequestReceipt> m_pending;
+	uint64_t m_firstEntryUs;
+	// checkpoints not sent yet, in order; the first one is `m_nextSeqNum`
+	std::deque<Checkpoint> m_sealed;
+	uint64_t m_nextSeqNum;
+	uint64_t m_nextReqId;
+	uint64_t m_numFailedSends;
+	bool m_isStopped;
+	std::deque<Checkpoint> m_committed;
+
+	std::mutex m_sendMutex;
+
+}; // class ReceiptAccumulator
+
+
+} // namespace Common
+} // namespace SLARuntime
+
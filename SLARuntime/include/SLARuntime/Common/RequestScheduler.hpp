@@ -0,0 +1,657 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <WasmRuntime/Internal/make_unique.hpp>
+#include <WasmRuntime/SystemIO.hpp>
+
+#include "Logging.hpp"
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief The scheduling terms of an SLA contract
+ *
+ */
+struct SchedTerms
+{
+	/**
+	 * @brief Share of the workers the contract gets when it competes with
+	 *        others, e.g., its price or rate; a contract with twice the
+	 *        weight gets twice the execution time
+	 *
+	 */
+	uint64_t m_weight = 1;
+
+	/**
+	 * @brief Time from submission by which a request must be done; 0 if
+	 *        the contract isn't latency-bound
+	 *
+	 */
+	uint64_t m_latencyBoundUs = 0;
+}; // struct SchedTerms
+
+
+struct RequestSchedulerConfig
+{
+	/**
+	 * @brief Requests queued per contract; more are rejected, so one tenant
+	 *        can't take all the memory
+	 *
+	 */
+	size_t m_maxQueueLen = 1024;
+
+	/**
+	 * @brief A request of a latency-bound contract skips the fair share once
+	 *        its slack (time left to its deadline, minus its expected run
+	 *        time) is below this
+	 *
+	 */
+	uint64_t m_urgentSlackUs = 2 * 1000;
+
+	/**
+	 * @brief Expected run time of a request of a contract that hasn't run
+	 *        any yet
+	 *
+	 */
+	uint64_t m_defaultCostUs = 1000;
+}; // struct RequestSchedulerConfig
+
+
+enum class SchedAdmission
+{
+	Admitted,
+
+	/**
+	 * @brief The queue of the contract is full
+	 *
+	 */
+	QueueFull,
+
+	/**
+	 * @brief The request can't be done by its deadline, given the work with
+	 *        earlier deadlines that is queued already
+	 *
+	 */
+	DeadlineMiss,
+
+	/**
+	 * @brief The contract has no terms set (see `RequestScheduler::SetTerms`)
+	 *
+	 */
+	UnknownContract,
+
+	Stopped,
+}; // enum class SchedAdmission
+
+
+struct SchedContractStats
+{
+	uint64_t m_numAdmitted = 0;
+	uint64_t m_numRejected = 0;
+	uint64_t m_numDone = 0;
+
+	/**
+	 * @brief Requests done after their deadline
+	 *
+	 */
+	uint64_t m_numLate = 0;
+
+	/**
+	 * @brief Time requests spent in the queue, from submission to dispatch
+	 *
+	 */
+	uint64_t m_totalQueueUs = 0;
+	uint64_t m_maxQueueUs = 0;
+
+	/**
+	 * @brief Moving average of the run time of its requests
+	 *
+	 */
+	uint64_t m_avgCostUs = 0;
+
+	size_t m_queueLen = 0;
+
+	double GetAvgQueueUs() const
+	{
+		return m_numDone == 0 ?
+			0.0 :
+			static_cast<double>(m_totalQueueUs) /
+				static_cast<double>(m_numDone);
+	}
+}; // struct SchedContractStats
+
+
+/**
+ * @brief Schedules the requests of SLA contracts (e.g., calls to
+ *        `WasmRuntime::RunModule`) onto worker threads, so that a tenant
+ *        flooding the host doesn't delay the others.
+ *
+ *        Each contract has its own queue. The contracts share the workers by
+ *        weighted fair queueing (self-clocked): the request at the head of
+ *        each queue is tagged with the virtual time at which it would finish
+ *        if its contract got its weighted share, and the lowest tag runs
+ *        first. The queue of a latency-bound contract is ordered by
+ *        deadline, and a request that is about to miss its deadline runs
+ *        ahead of the fair share, earliest deadline first.
+ *
+ *        A request of a latency-bound contract is only admitted if it can be
+ *        done by its deadline, given the expected run time of the queued
+ *        requests with earlier deadlines, spread over the workers. The
+ *        queued deadlines are indexed, with the total of their costs, so a
+ *        check only walks over the requests due after the new one, which
+ *        are usually none, since deadlines grow with submission times.
+ *
+ *        Only the contracts whose terms are set are scheduled, so the
+ *        scheduler's memory is bounded by the contracts it's told about.
+ *
+ *        As with `BatchTaskPool`, the scheduler doesn't create threads; each
+ *        worker runs on a thread that calls `RunWorker`.
+ *
+ * @tparam _ReqType The type of the requests
+ */
+template<typename _ReqType>
+class RequestScheduler
+{
+public: // static members:
+
+	using ReqType = _ReqType;
+
+	/**
+	 * @brief Run a request on a worker thread; a throw is logged
+	 *
+	 */
+	using ProcessFunc = std::function<void(uint64_t, ReqType&)>;
+
+public:
+
+	RequestScheduler(
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+		ProcessFunc processFunc,
+		const RequestSchedulerConfig& config = RequestSchedulerConfig()
+	) :
+		m_logger(Common::LoggerFactory::GetLogger("RequestScheduler")),
+		m_sysIO(std::move(sysIO)),
+		m_processFunc(std::move(processFunc)),
+		m_config(config),
+		m_mutex(),
+		m_cv(),
+		m_contracts(),
+		m_deadlineCosts(),
+		m_totalDeadlineCostUs(0),
+		m_virtualTime(0.0),
+		m_seq(0),
+		m_numQueued(0),
+		m_numWorkers(0),
+		m_isStopped(false)
+	{
+		if (m_sysIO == nullptr)
+		{
+			throw std::invalid_argument("The scheduler clock is not given");
+		}
+	}
+
+	RequestScheduler(const RequestScheduler&) = delete;
+
+	RequestScheduler(RequestScheduler&&) = delete;
+
+	~RequestScheduler() = default;
+
+	RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+	RequestScheduler& operator=(RequestScheduler&&) = delete;
+
+	/**
+	 * @brief Set the terms of a contract, which must be done before its
+	 *        requests are submitted
+	 *
+	 */
+	void SetTerms(uint64_t contractId, const SchedTerms& terms)
+	{
+		if (terms.m_weight == 0)
+		{
+			throw std::invalid_argument("The contract weight must be positive");
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Contract& contract = m_contracts[contractId];
+		if ((contract.m_terms.m_latencyBoundUs == 0) !=
+			(terms.m_latencyBoundUs == 0))
+		{
+			if (!contract.m_queue.empty())
+			{
+				throw std::logic_error(
+					"The latency bound of a contract can't be turned on or "
+					"off while it has queued requests"
+				);
+			}
+		}
+		contract.m_terms = terms;
+	}
+
+	/**
+	 * @brief Drop a contract and its queued requests
+	 *
+	 * @return Number of requests dropped
+	 */
+	size_t RemoveContract(uint64_t contractId)
+	{
+		Contract removed;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_contracts.find(contractId);
+			if (it == m_contracts.end())
+			{
+				return 0;
+			}
+			removed = std::move(it->second);
+			m_contracts.erase(it);
+			m_numQueued -= removed.m_queue.size();
+			for (auto& item : removed.m_queue)
+			{
+				UnindexDeadlineLocked(item.second);
+			}
+		}
+		return removed.m_queue.size();
+	}
+
+	/**
+	 * @brief Queue a request of a contract
+	 *
+	 * @param deadlineUs Timestamp by which it must be done; 0 to use the
+	 *                   latency bound of the contract, if any
+	 * @param costUs     Expected run time, e.g., predicted by the module's
+	 *                   `CostModel`; 0 to use the average of the contract
+	 */
+	SchedAdmission Submit(
+		uint64_t contractId,
+		ReqType req,
+		uint64_t deadlineUs = 0,
+		uint64_t costUs = 0
+	)
+	{
+		uint64_t nowUs = m_sysIO->GetTimestampUs();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (m_isStopped)
+			{
+				return SchedAdmission::Stopped;
+			}
+
+			auto contractIt = m_contracts.find(contractId);
+			if (contractIt == m_contracts.end())
+			{
+				return SchedAdmission::UnknownContract;
+			}
+			Contract& contract = contractIt->second;
+			if (contract.m_queue.size() >= m_config.m_maxQueueLen)
+			{
+				++contract.m_stats.m_numRejected;
+				return SchedAdmission::QueueFull;
+			}
+
+			bool isLatencyBound = (contract.m_terms.m_latencyBoundUs != 0);
+			if ((deadlineUs == 0) && isLatencyBound)
+			{
+				deadlineUs = nowUs + contract.m_terms.m_latencyBoundUs;
+			}
+
+			if (costUs == 0)
+			{
+				costUs = GetExpectedCost(contract);
+			}
+			if (
+				(deadlineUs != 0) &&
+				(GetEarliestFinishLocked(nowUs, deadlineUs, costUs) > deadlineUs)
+			)
+			{
+				++contract.m_stats.m_numRejected;
+				return SchedAdmission::DeadlineMiss;
+			}
+
+			Pending pending {
+				std::move(req),
+				nowUs,
+				deadlineUs,
+				costUs,
+				m_deadlineCosts.end()
+			};
+			if (deadlineUs != 0)
+			{
+				pending.m_deadlineIt = m_deadlineCosts.emplace(deadlineUs, costUs);
+				m_totalDeadlineCostUs += costUs;
+			}
+			// latency-bound queues are ordered by deadline, the others by
+			// arrival
+			uint64_t key = isLatencyBound ? deadlineUs : (m_seq++);
+			contract.m_queue.emplace(key, std::move(pending));
+			++contract.m_stats.m_numAdmitted;
+			++m_numQueued;
+		}
+		m_cv.notify_one();
+
+		return SchedAdmission::Admitted;
+	}
+
+	/**
+	 * @brief Run requests on the calling thread, until the scheduler is
+	 *        stopped and all admitted requests are done
+	 *
+	 */
+	void RunWorker()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_numWorkers;
+		}
+
+		while (true)
+		{
+			uint64_t contractId = 0;
+			std::unique_ptr<Pending> pending;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(
+					lock,
+					[this]()
+					{
+						return (m_numQueued > 0) || m_isStopped;
+					}
+				);
+				if (m_numQueued == 0)
+				{
+					// stopped, and drained
+					--m_numWorkers;
+					break;
+				}
+
+				pending = DequeueLocked(m_sysIO->GetTimestampUs(), contractId);
+			}
+
+			uint64_t startUs = m_sysIO->GetTimestampUs();
+			try
+			{
+				m_processFunc(contractId, pending->m_req);
+			}
+			catch (const std::exception& e)
+			{
+				m_logger.Error(std::string("Failed to run request: ") + e.what());
+			}
+			uint64_t endUs = m_sysIO->GetTimestampUs();
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_contracts.find(contractId);
+			if (it != m_contracts.end())
+			{
+				RecordDoneLocked(it->second, *pending, startUs, endUs);
+			}
+		}
+	}
+
+	/**
+	 * @brief Stop admitting requests, and let the workers return once the
+	 *        admitted ones are done
+	 *
+	 */
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopped = true;
+		}
+		m_cv.notify_all();
+	}
+
+	SchedContractStats GetContractStats(uint64_t contractId) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_contracts.find(contractId);
+		if (it == m_contracts.end())
+		{
+			return SchedContractStats();
+		}
+		SchedContractStats stats = it->second.m_stats;
+		stats.m_queueLen = it->second.m_queue.size();
+		return stats;
+	}
+
+	size_t GetNumQueued() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numQueued;
+	}
+
+private:
+
+	// the costs of the queued requests with deadlines, by deadline
+	using DeadlineIndex = std::multimap<uint64_t, uint64_t>;
+
+	struct Pending
+	{
+		ReqType m_req;
+		uint64_t m_enqueueUs;
+		// 0 if there is none
+		uint64_t m_deadlineUs;
+		uint64_t m_costUs;
+		// its entry in `m_deadlineCosts`, if it has a deadline
+		typename DeadlineIndex::iterator m_deadlineIt;
+	}; // struct Pending
+
+	struct Contract
+	{
+		SchedTerms m_terms;
+		std::multimap<uint64_t, Pending> m_queue;
+		// virtual finish time of the last request dispatched
+		double m_lastFinish = 0.0;
+		// virtual finish time of the request at the head, which is fixed
+		// once it's computed, so a backlogged contract isn't pushed back by
+		// the others
+		bool m_hasHeadFinish = false;
+		double m_headFinish = 0.0;
+		SchedContractStats m_stats;
+	}; // struct Contract
+
+	uint64_t GetExpectedCost(const Contract& contract) const
+	{
+		return contract.m_stats.m_numDone == 0 ?
+			m_config.m_defaultCostUs :
+			contract.m_stats.m_avgCostUs;
+	}
+
+	/**
+	 * @brief When a request due at `deadlineUs` would be done, if the queued
+	 *        requests with earlier deadlines run first, spread over the
+	 *        workers; it ignores the requests that are running
+	 *
+	 */
+	uint64_t GetEarliestFinishLocked(
+		uint64_t nowUs,
+		uint64_t deadlineUs,
+		uint64_t costUs
+	) const
+	{
+		// all of them, but the ones due after it
+		uint64_t aheadUs = m_totalDeadlineCostUs;
+		for (
+			auto it = m_deadlineCosts.rbegin();
+			(it != m_deadlineCosts.rend()) && (it->first > deadlineUs);
+			++it
+		)
+		{
+			aheadUs -= it->second;
+		}
+
+		uint64_t numWorkers = (m_numWorkers == 0) ? 1 : m_numWorkers;
+		return nowUs + (aheadUs / numWorkers) + costUs;
+	}
+
+	void UnindexDeadlineLocked(const Pending& pending)
+	{
+		if (pending.m_deadlineUs != 0)
+		{
+			m_totalDeadlineCostUs -= pending.m_deadlineIt->second;
+			m_deadlineCosts.erase(pending.m_deadlineIt);
+		}
+	}
+
+	/**
+	 * @brief Take the next request: the urgent one with the earliest
+	 *        deadline if any, otherwise the one with the lowest virtual
+	 *        finish time
+	 *
+	 */
+	std::unique_ptr<Pending> DequeueLocked(uint64_t nowUs, uint64_t& outContractId)
+	{
+		auto urgent = m_contracts.end();
+		auto fair = m_contracts.end();
+		double fairFinish = 0.0;
+
+		for (auto it = m_contracts.begin(); it != m_contracts.end(); ++it)
+		{
+			Contract& contract = it->second;
+			if (contract.m_queue.empty())
+			{
+				continue;
+			}
+			const Pending& head = contract.m_queue.begin()->second;
+
+			if (
+				(head.m_deadlineUs != 0) &&
+				(head.m_deadlineUs <
+					nowUs + head.m_costUs + m_config.m_urgentSlackUs) &&
+				(
+					(urgent == m_contracts.end()) ||
+					(head.m_deadlineUs <
+						urgent->second.m_queue.begin()->second.m_deadlineUs)
+				)
+			)
+			{
+				urgent = it;
+			}
+
+			if (!contract.m_hasHeadFinish)
+			{
+				contract.m_headFinish = GetVirtualFinish(contract, head);
+				contract.m_hasHeadFinish = true;
+			}
+			double finish = contract.m_headFinish;
+			if ((fair == m_contracts.end()) || (finish < fairFinish))
+			{
+				fair = it;
+				fairFinish = finish;
+			}
+		}
+
+		auto chosen = (urgent != m_contracts.end()) ? urgent : fair;
+		Contract& contract = chosen->second;
+		auto head = contract.m_queue.begin();
+
+		// an urgent request is still charged to its contract's share
+		contract.m_lastFinish = contract.m_headFinish;
+		contract.m_hasHeadFinish = false;
+		if (chosen == fair)
+		{
+			m_virtualTime = fairFinish;
+		}
+
+		outContractId = chosen->first;
+		std::unique_ptr<Pending> pending =
+			::WasmRuntime::Internal::make_unique<Pending>(
+				std::move(head->second)
+			);
+		contract.m_queue.erase(head);
+		--m_numQueued;
+		UnindexDeadlineLocked(*pending);
+
+		uint64_t queueUs = nowUs - pending->m_enqueueUs;
+		contract.m_stats.m_totalQueueUs += queueUs;
+		if (queueUs > contract.m_stats.m_maxQueueUs)
+		{
+			contract.m_stats.m_maxQueueUs = queueUs;
+		}
+
+		return pending;
+	}
+
+	double GetVirtualFinish(const Contract& contract, const Pending& head) const
+	{
+		double start = (contract.m_lastFinish > m_virtualTime) ?
+			contract.m_lastFinish :
+			m_virtualTime;
+		return start +
+			(static_cast<double>(head.m_costUs) /
+				static_cast<double>(contract.m_terms.m_weight));
+	}
+
+	void RecordDoneLocked(
+		Contract& contract,
+		const Pending& pending,
+		uint64_t startUs,
+		uint64_t endUs
+	)
+	{
+		SchedContractStats& stats = contract.m_stats;
+
+		uint64_t costUs = endUs - startUs;
+		// moving average over about the last 8 requests
+		stats.m_avgCostUs = (stats.m_numDone == 0) ?
+			costUs :
+			(stats.m_avgCostUs - (stats.m_avgCostUs / 8) + (costUs / 8));
+
+		++stats.m_numDone;
+		if ((pending.m_deadlineUs != 0) && (endUs > pending.m_deadlineUs))
+		{
+			++stats.m_numLate;
+		}
+	}
+
+	Common::Logger m_logger;
+	std::unique_ptr<::WasmRuntime::SystemIO> m_sysIO;
+	ProcessFunc m_processFunc;
+	RequestSchedulerConfig m_config;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::unordered_map<uint64_t, Contract> m_contracts;
+	DeadlineIndex m_deadlineCosts;
+	uint64_t m_totalDeadlineCostUs;
+	// virtual time of the fair share, i.e., the finish time of the last
+	// request dispatched by it
+	double m_virtualTime;
+	uint64_t m_seq;
+	size_t m_numQueued;
+	size_t m_numWorkers;
+	bool m_isStopped;
+
+}; // class RequestScheduler
+
+
+} // namespace Common
+} // namespace SLARuntime
+
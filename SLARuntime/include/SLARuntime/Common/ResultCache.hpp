@@ -0,0 +1,291 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mbedTLScpp/Hash.hpp>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief How a request answered from the result cache is billed
+ *
+ */
+enum class ResultCacheBilling
+{
+	/**
+	 * @brief Bill the units of the original execution, so the price of a
+	 *        request doesn't depend on whether it was cached
+	 *
+	 */
+	Original,
+
+	/**
+	 * @brief Bill a flat number of units (`m_hitUnits`), e.g., 0
+	 *
+	 */
+	Flat,
+}; // enum class ResultCacheBilling
+
+
+struct ResultCacheConfig
+{
+	/**
+	 * @brief Number of results kept; the least recently used one is evicted
+	 *        first
+	 *
+	 */
+	size_t m_maxEntries = 256;
+
+	/**
+	 * @brief Results with more output (plus the result set by the module)
+	 *        than this are not kept
+	 *
+	 */
+	size_t m_maxOutputSize = 64 * 1024;
+
+	ResultCacheBilling m_billing = ResultCacheBilling::Original;
+
+	uint64_t m_hitUnits = 0;
+}; // struct ResultCacheConfig
+
+
+/**
+ * @brief What is needed to answer a request again without running it
+ *
+ */
+struct CachedResult
+{
+	int32_t m_retCode = 0;
+	// the output printed by the module
+	std::string m_output;
+	// the result set by the module, if any
+	bool m_hasResult = false;
+	std::vector<uint8_t> m_result;
+	// the counter of the original execution
+	uint64_t m_counter = 0;
+	// the units billed for the original execution
+	uint64_t m_billedUnits = 0;
+}; // struct CachedResult
+
+
+/**
+ * @brief Results of deterministic requests of one contract, keyed by the hash
+ *        of the module plus the hash of the request (event ID and data), so a
+ *        repeated request is answered without being executed.
+ *
+ *        It's up to the owner to only put results of modules that can't tell
+ *        two executions apart (e.g., by reading the time), and of executions
+ *        that ran to completion.
+ *
+ */
+class ResultCache
+{
+public: // static members:
+
+	using Hasher = mbedTLScpp::Hasher<mbedTLScpp::HashType::SHA256>;
+
+	/**
+	 * @brief SHA-256 of the bytes, as a binary string
+	 *
+	 */
+	static std::string HashModule(const std::vector<uint8_t>& bytecode)
+	{
+		auto hash = Hasher().Calc(mbedTLScpp::CtnFullR(bytecode));
+		return std::string(hash.m_data.begin(), hash.m_data.end());
+	}
+
+	/**
+	 * @brief SHA-256 of the module hash, and the event ID and data, each
+	 *        prefixed with its length, so that no two requests share a
+	 *        preimage
+	 *
+	 */
+	static std::string MakeKey(
+		const std::string& modHash,
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& eventData
+	)
+	{
+		std::vector<uint8_t> preimage;
+		preimage.reserve(modHash.size() + 16 + eventId.size() + eventData.size());
+		preimage.insert(preimage.end(), modHash.begin(), modHash.end());
+		AppendSized(preimage, eventId);
+		AppendSized(preimage, eventData);
+
+		auto hash = Hasher().Calc(mbedTLScpp::CtnFullR(preimage));
+		return std::string(hash.m_data.begin(), hash.m_data.end());
+	}
+
+public:
+
+	ResultCache(const ResultCacheConfig& config) :
+		m_config(config),
+		m_mutex(),
+		m_lru(),
+		m_entries(),
+		m_numHits(0),
+		m_numMisses(0)
+	{
+		if (m_config.m_maxEntries == 0)
+		{
+			throw std::invalid_argument(
+				"The result cache must keep at least one entry"
+			);
+		}
+	}
+
+	ResultCache(const ResultCache&) = delete;
+
+	ResultCache(ResultCache&&) = delete;
+
+	~ResultCache() = default;
+
+	ResultCache& operator=(const ResultCache&) = delete;
+
+	ResultCache& operator=(ResultCache&&) = delete;
+
+	/**
+	 * @brief Look up the result of a request
+	 *
+	 * @return True if it's found, and copied to `outResult`
+	 */
+	bool Find(const std::string& key, CachedResult& outResult)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_entries.find(key);
+		if (it == m_entries.end())
+		{
+			++m_numMisses;
+			return false;
+		}
+
+		// most recently used at the front
+		m_lru.splice(m_lru.begin(), m_lru, it->second);
+		outResult = it->second->second;
+		++m_numHits;
+		return true;
+	}
+
+	void Put(const std::string& key, CachedResult result)
+	{
+		if (
+			result.m_output.size() + result.m_result.size() >
+				m_config.m_maxOutputSize
+		)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_entries.find(key);
+		if (it != m_entries.end())
+		{
+			it->second->second = std::move(result);
+			m_lru.splice(m_lru.begin(), m_lru, it->second);
+			return;
+		}
+
+		while (m_entries.size() >= m_config.m_maxEntries)
+		{
+			m_entries.erase(m_lru.back().first);
+			m_lru.pop_back();
+		}
+
+		m_lru.emplace_front(key, std::move(result));
+		m_entries.emplace(key, m_lru.begin());
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.clear();
+		m_lru.clear();
+	}
+
+	/**
+	 * @brief The units to bill for a request answered with the given result
+	 *
+	 */
+	uint64_t GetHitBilledUnits(const CachedResult& result) const
+	{
+		switch (m_config.m_billing)
+		{
+		case ResultCacheBilling::Flat:
+			return m_config.m_hitUnits;
+		case ResultCacheBilling::Original:
+		default:
+			return result.m_billedUnits;
+		}
+	}
+
+	size_t GetNumEntries() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_entries.size();
+	}
+
+	uint64_t GetNumHits() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numHits;
+	}
+
+	uint64_t GetNumMisses() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numMisses;
+	}
+
+private:
+
+	using LruList = std::list<std::pair<std::string, CachedResult> >;
+
+	static void AppendSized(
+		std::vector<uint8_t>& dest,
+		const std::vector<uint8_t>& bytes
+	)
+	{
+		uint64_t size = bytes.size();
+		for (size_t i = 0; i < sizeof(size); ++i)
+		{
+			dest.push_back(static_cast<uint8_t>(size >> (8 * i)));
+		}
+		dest.insert(dest.end(), bytes.begin(), bytes.end());
+	}
+
+	ResultCacheConfig m_config;
+
+	mutable std::mutex m_mutex;
+	LruList m_lru;
+	std::unordered_map<std::string, LruList::iterator> m_entries;
+	uint64_t m_numHits;
+	uint64_t m_numMisses;
+
+}; // class ResultCache
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -6,7 +6,20 @@
 #pragma once
 
 
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <mbedtls/gcm.h>
+#include <mbedtls/platform_util.h>
 
 #include <DecentEnclave/Common/Logging.hpp>
 
@@ -14,6 +27,7 @@
 
 #include <mbedTLScpp/DefaultRbg.hpp>
 #include <mbedTLScpp/Gcm.hpp>
+#include <mbedTLScpp/Hash.hpp>
 #include <mbedTLScpp/SecretVector.hpp>
 
 #include <SimpleObjects/Internal/make_unique.hpp>
@@ -38,6 +52,52 @@ public: // static members:
 
 	using EthPublicKeyType = mbedTLScpp::EcPublicKey<mbedTLScpp::EcType::SECP256K1>;
 
+	using GcmType = mbedTLScpp::Gcm<mbedTLScpp::CipherType::AES, 256>;
+
+	static constexpr size_t sk_ivSize = 12;
+	static constexpr size_t sk_tagSize = 16;
+
+	/**
+	 * @brief Bytes added to a response by `EncryptResponse`
+	 *
+	 */
+	static constexpr size_t sk_sealOverhead = sk_ivSize + sk_tagSize;
+
+	static size_t GetSealedSize(size_t dataSize)
+	{
+		return dataSize + sk_sealOverhead;
+	}
+
+	/**
+	 * @brief The key responses are encrypted with, derived from the shared
+	 *        root key, so that the counter IVs used with it never collide
+	 *        with the random IVs used with the root key:
+	 *        `SHA-256("SLA response key" || root key)`; it's returned in a
+	 *        buffer that is wiped when it's freed
+	 *
+	 */
+	template<typename _SharedKey>
+	static mbedTLScpp::SecretVector<uint8_t> DeriveResponseKey(
+		const _SharedKey& rootKey
+	)
+	{
+		static const std::string sk_label = "SLA response key";
+
+		mbedTLScpp::SecretVector<uint8_t> preimage;
+		preimage.reserve(sk_label.size() + rootKey.size());
+		preimage.insert(preimage.end(), sk_label.begin(), sk_label.end());
+		preimage.insert(preimage.end(), rootKey.begin(), rootKey.end());
+
+		auto hash = mbedTLScpp::Hasher<mbedTLScpp::HashType::SHA256>().Calc(
+			mbedTLScpp::CtnFullR(preimage)
+		);
+		mbedTLScpp::SecretVector<uint8_t> key;
+		key.reserve(hash.m_data.size());
+		key.insert(key.end(), hash.m_data.begin(), hash.m_data.end());
+		mbedtls_platform_zeroize(hash.m_data.data(), hash.m_data.size());
+		return key;
+	}
+
 	template<typename _ContractAddr, typename _EthPublicKey, typename _SharedKey>
 	static std::unique_ptr<SLAContract> MakeUnique(
 		uint64_t contractId,
@@ -71,8 +131,16 @@ public:
 				"SLARuntime::Common::SLAContract_ID_" +
 				std::to_string(m_contractId)
 			)
-		)
-	{}
+		),
+		m_gcmMutex(),
+		m_rootGcm(mbedTLScpp::CtnFullR(m_sharedRootKey)),
+		m_respGcm(mbedTLScpp::CtnFullR(DeriveResponseKey(m_sharedRootKey))),
+		m_respIvPrefix(),
+		m_respCounter(0)
+	{
+		// in case the same root key is ever used by another instance
+		m_rand.Rand(m_respIvPrefix.data(), m_respIvPrefix.size());
+	}
 
 	~SLAContract() = default;
 
@@ -88,24 +156,23 @@ public:
 
 	std::vector<uint8_t> EncryptData(const std::vector<uint8_t>& data) const
 	{
-		std::vector<uint8_t> iv;
-		iv.resize(12);
-		m_rand.Rand(iv.data(), iv.size());
-
 		std::vector<uint8_t> empty;
 
-		mbedTLScpp::Gcm<mbedTLScpp::CipherType::AES, 256> gcm(
-			mbedTLScpp::CtnFullR(m_sharedRootKey)
-		);
-
+		std::vector<uint8_t> iv;
 		std::vector<uint8_t> cipher;
 		std::array<uint8_t, 16> tag;
+		{
+			std::lock_guard<std::mutex> lock(m_gcmMutex);
 
-		std::tie(cipher, tag) = gcm.Encrypt(
-			mbedTLScpp::CtnFullR(data),
-			mbedTLScpp::CtnFullR(iv),
-			mbedTLScpp::CtnFullR(empty)
-		);
+			iv.resize(sk_ivSize);
+			m_rand.Rand(iv.data(), iv.size());
+
+			std::tie(cipher, tag) = m_rootGcm.Encrypt(
+				mbedTLScpp::CtnFullR(data),
+				mbedTLScpp::CtnFullR(iv),
+				mbedTLScpp::CtnFullR(empty)
+			);
+		}
 
 		SimpleObjects::List package = {
 			SimpleObjects::Bytes(iv),
@@ -116,7 +183,130 @@ public:
 		return SimpleRlp::WriteRlp(package);
 	}
 
+	/**
+	 * @brief Encrypt a response to the client into the given buffer, as
+	 *        `IV || cipher || tag`, with the response key (see
+	 *        `DeriveResponseKey`); the IV is a random prefix fixed for this
+	 *        contract, followed by the big-endian response counter, so no IV
+	 *        is reused with the key, and the prepared context is reused,
+	 *        instead of running the key schedule each time
+	 *
+	 * @param out     The buffer to write to
+	 * @param outSize The size of the buffer, at least `GetSealedSize(size)`
+	 * @return The number of bytes written
+	 */
+	size_t EncryptResponse(
+		const uint8_t* data,
+		size_t size,
+		uint8_t* out,
+		size_t outSize
+	) const
+	{
+		std::lock_guard<std::mutex> lock(m_gcmMutex);
+		return EncryptResponseLocked(data, size, out, outSize);
+	}
+
+	/**
+	 * @brief Encrypt many responses in one call, appended to `out` one after
+	 *        the other, in the format of `EncryptResponse`; they're sealed
+	 *        into a buffer sized once, which replaces `out` only if all of
+	 *        them are sealed, so `out` is left as it was on a throw
+	 *
+	 * @return The number of bytes appended
+	 */
+	size_t EncryptResponses(
+		const std::vector<std::vector<uint8_t> >& responses,
+		std::vector<uint8_t>& out
+	) const
+	{
+		size_t totalSize = 0;
+		for (const auto& resp : responses)
+		{
+			totalSize += GetSealedSize(resp.size());
+		}
+
+		size_t offset = out.size();
+		std::vector<uint8_t> sealed;
+		sealed.reserve(offset + totalSize);
+		sealed.insert(sealed.end(), out.begin(), out.end());
+		sealed.resize(offset + totalSize);
+
+		{
+			std::lock_guard<std::mutex> lock(m_gcmMutex);
+			for (const auto& resp : responses)
+			{
+				offset += EncryptResponseLocked(
+					resp.data(),
+					resp.size(),
+					sealed.data() + offset,
+					sealed.size() - offset
+				);
+			}
+		}
+
+		out.swap(sealed);
+		return totalSize;
+	}
+
+	uint64_t GetNumResponses() const
+	{
+		std::lock_guard<std::mutex> lock(m_gcmMutex);
+		return m_respCounter;
+	}
+
 private:
+
+	size_t EncryptResponseLocked(
+		const uint8_t* data,
+		size_t size,
+		uint8_t* out,
+		size_t outSize
+	) const
+	{
+		if (outSize < GetSealedSize(size))
+		{
+			throw std::invalid_argument(
+				"The buffer is too small for the encrypted response"
+			);
+		}
+		if (m_respCounter == std::numeric_limits<uint64_t>::max())
+		{
+			throw std::logic_error("The response counter is exhausted");
+		}
+
+		uint64_t counter = m_respCounter++;
+
+		uint8_t* iv = out;
+		uint8_t* cipher = out + sk_ivSize;
+		uint8_t* tag = cipher + size;
+
+		std::copy(m_respIvPrefix.begin(), m_respIvPrefix.end(), iv);
+		for (size_t i = 0; i < sizeof(counter); ++i)
+		{
+			iv[sk_ivSize - 1 - i] = static_cast<uint8_t>(counter >> (8 * i));
+		}
+
+		int ret = mbedtls_gcm_crypt_and_tag(
+			m_respGcm.Get(),
+			MBEDTLS_GCM_ENCRYPT,
+			size,
+			iv, sk_ivSize,
+			nullptr, 0,
+			data,
+			cipher,
+			sk_tagSize,
+			tag
+		);
+		if (ret != 0)
+		{
+			throw std::runtime_error(
+				"Failed to encrypt the response (" + std::to_string(ret) + ")"
+			);
+		}
+
+		return GetSealedSize(size);
+	}
+
 	mutable mbedTLScpp::DefaultRbg m_rand;
 
 	uint64_t m_contractId;
@@ -125,6 +315,13 @@ private:
 	mbedTLScpp::SecretVector<uint8_t> m_sharedRootKey;
 
 	LoggerType m_logger;
+
+	// the contexts are not thread-safe
+	mutable std::mutex m_gcmMutex;
+	mutable GcmType m_rootGcm;
+	mutable GcmType m_respGcm;
+	std::array<uint8_t, sk_ivSize - sizeof(uint64_t)> m_respIvPrefix;
+	mutable uint64_t m_respCounter;
 }; // class SLAContract
 
 
@@ -9,8 +9,11 @@
 #include <cstdint>
 
 #include <atomic>
+#include <functional>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <AdvancedRlp/AdvancedRlp.hpp>
 
@@ -35,7 +38,13 @@
 #include <SimpleObjects/SimpleObjects.hpp>
 #include <SimpleRlp/SimpleRlp.hpp>
 
+#include "BatchTaskPool.hpp"
+#include "CheckpointAccumulator.hpp"
+#include "ReceiptTree.hpp"
+#include "SessionPool.hpp"
+#include "ShardedMap.hpp"
 #include "SLAContract.hpp"
+#include "TxnQueue.hpp"
 
 
 namespace SLARuntime
@@ -44,6 +53,30 @@ namespace Common
 {
 
 
+/**
+ * @brief Pool of TLS sessions to the DecentEthereum component; see
+ *        `MakeDecentEthSessionPool`
+ *
+ */
+using DecentEthSessionPool = SessionPool<
+	DecentEnclave::Common::TlsSocket,
+	DecentEnclave::Common::DetMsg
+>;
+
+
+/**
+ * @brief The fields of a `SlaProposal` event needed to accept it
+ *
+ */
+struct SlaProposal
+{
+	uint64_t m_contractId = 0;
+	EclipseMonitor::Eth::ContractAddr m_clientAddr;
+	std::vector<uint8_t> m_clientKeyX;
+	std::vector<uint8_t> m_clientKeyY;
+}; // struct SlaProposal
+
+
 class SLARuntime
 {
 public: // static members:
@@ -97,6 +130,68 @@ public: // static members:
 			>
 		>;
 
+	using FuncAbiCheckpointReport =
+		EclipseMonitor::Eth::AbiWriterStaticTuple<
+			// param 1 - uint64 chkptSeqNum
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Integer,
+				EclipseMonitor::Eth::AbiUInt64
+			>,
+			// param 2 - uint64 numRequests
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Integer,
+				EclipseMonitor::Eth::AbiUInt64
+			>,
+			// param 3 - bytes memory checkpointData
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Bytes,
+				std::true_type
+			>
+		>;
+
+	using FuncAbiCheckpointCommit =
+		EclipseMonitor::Eth::AbiWriterStaticTuple<
+			// param 1 - uint64 chkptSeqNum
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Integer,
+				EclipseMonitor::Eth::AbiUInt64
+			>,
+			// param 2 - uint64 numRequests
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Integer,
+				EclipseMonitor::Eth::AbiUInt64
+			>,
+			// param 3 - uint64 numAccepted
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Integer,
+				EclipseMonitor::Eth::AbiUInt64
+			>,
+			// param 4 - uint64 totalUnits
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Integer,
+				EclipseMonitor::Eth::AbiUInt64
+			>,
+			// param 5 - bytes32 receiptRoot
+			EclipseMonitor::Eth::AbiWriter<
+				SimpleObjects::ObjCategory::Bytes,
+				EclipseMonitor::Eth::AbiSize<32>
+			>
+		>;
+
+	/**
+	 * @brief Called when an SLA contract is deployed for a proposal this
+	 *        provider accepted
+	 *
+	 * @param clientAddr The wallet address of the client
+	 * @param slaAddr    The address of the deployed SLA contract
+	 */
+	using SlaDeployedFunc = std::function<
+		void(
+			const EclipseMonitor::Eth::ContractAddr&,
+			const EclipseMonitor::Eth::ContractAddr&
+		)
+	>;
+
 	static std::unique_ptr<SLARuntime> MakeUnique(
 		std::shared_ptr<EthKeyPairType> ethKey,
 		std::shared_ptr<EthKeyPairType> dhKey,
@@ -129,7 +224,12 @@ public:
 		m_chainId(chainId),
 		m_nonce(0),
 		m_funcReg(slaMgrAddr, "registerProvider"),
-		m_funcAccept(slaMgrAddr, "acceptProposal")
+		m_funcAccept(slaMgrAddr, "acceptProposal"),
+		m_onSlaDeployed(),
+		m_txnQueue(),
+		m_decentEthPool(),
+		m_contracts(),
+		m_proposalPool()
 	{}
 
 	~SLARuntime() = default;
@@ -143,17 +243,69 @@ public:
 		// 	SimpleObjects::Codec::Hex::Encode<std::string>(txn.get_Data())
 		// );
 
-		txn.SetChainID(m_chainId);
-		txn.SetNonce(m_nonce++);
-		txn.SetMaxPriorFeePerGas(300000000);
-		txn.SetMaxFeePerGas(300000000);
+		if (m_txnQueue != nullptr)
+		{
+			// signed by the queue, once it knows the nonce and the fees
+			auto queuedTxn =
+				std::make_shared<EclipseMonitor::Eth::Transaction::DynFee>(txn);
+			auto chainId = m_chainId;
+			auto ethKey = m_ethKey;
+			uint64_t nonce = m_txnQueue->Submit(
+				[queuedTxn, chainId, ethKey](
+					uint64_t nonce,
+					uint64_t maxFeePerGas,
+					uint64_t maxPriorFeePerGas
+				)
+				{
+					queuedTxn->SetChainID(chainId);
+					queuedTxn->SetNonce(nonce);
+					queuedTxn->SetMaxPriorFeePerGas(maxPriorFeePerGas);
+					queuedTxn->SetMaxFeePerGas(maxFeePerGas);
+
+					EclipseMonitor::Eth::Transaction::SignTransaction(
+						*queuedTxn,
+						*ethKey
+					);
+
+					return queuedTxn->RlpSerializeSigned();
+				}
+			);
+
+			m_logger.Info(
+				"Queued transaction with nonce " + std::to_string(nonce)
+			);
+			return;
+		}
+
+		uint64_t nonce = m_nonce++;
 
-		EclipseMonitor::Eth::Transaction::SignTransaction(txn, *m_ethKey);
+		std::vector<uint8_t> rlp;
+		try
+		{
+			txn.SetChainID(m_chainId);
+			txn.SetNonce(nonce);
+			txn.SetMaxPriorFeePerGas(300000000);
+			txn.SetMaxFeePerGas(300000000);
 
-		auto rlp = txn.RlpSerializeSigned();
+			EclipseMonitor::Eth::Transaction::SignTransaction(txn, *m_ethKey);
+
+			rlp = txn.RlpSerializeSigned();
+		}
+		catch (const std::exception&)
+		{
+			// nothing has left the enclave, so give the nonce back, unless a
+			// later one was taken meanwhile, or all the following
+			// transactions would be stuck behind the gap
+			uint64_t expected = nonce + 1;
+			m_nonce.compare_exchange_strong(expected, nonce);
+			throw;
+		}
 
 		m_logger.Info("Sending transaction...");
 
+		// once the send is started, the node may have the transaction even if
+		// it fails, so the nonce is kept; reusing it could replace the
+		// transaction with another one
 		EthSendRawTransaction(rlp);
 	}
 
@@ -223,7 +375,7 @@ public:
 	}
 
 	void AcceptSLAProposal(
-		std::unique_ptr<SLAContract> contract
+		std::shared_ptr<SLAContract> contract
 	)
 	{
 		static constexpr uint64_t sk_1ether = 1ULL * 1000000000ULL * 1000000000ULL;
@@ -245,16 +397,326 @@ public:
 		m_logger.Info("Generated transaction to accept proposal");
 
 		FinishAndSendTransaction(txn);
+
+		// fills in the reservation made by `HandleProposal`, if any; if the
+		// transaction isn't sent, the reservation is given back there
+		m_contracts.InsertOrAssign(contract->GetContractId(), std::move(contract));
+	}
+
+	/**
+	 * @brief The contract of an accepted proposal, or null if there is none
+	 *        with the given ID (or it's still being accepted)
+	 *
+	 */
+	std::shared_ptr<SLAContract> GetContract(uint64_t contractId) const
+	{
+		std::shared_ptr<SLAContract> contract;
+		m_contracts.Find(contractId, contract);
+		return contract;
+	}
+
+	/**
+	 * @brief Number of contracts, including the ones being accepted
+	 *
+	 */
+	size_t GetNumContracts() const
+	{
+		return m_contracts.Size();
+	}
+
+	/**
+	 * @brief Send a checkpoint report, in the format built by
+	 *        `CheckpointAccumulator`, to the given SLA contract
+	 *
+	 */
+	void SendCheckpointReport(
+		const EclipseMonitor::Eth::ContractAddr& slaAddr,
+		uint64_t seqNum,
+		uint64_t numRequests,
+		const std::vector<uint8_t>& data
+	)
+	{
+		// a rough estimate; the calldata and the parsing grow with the
+		// number of requests
+		static constexpr uint64_t sk_baseGas = 300000;
+		static constexpr uint64_t sk_gasPerRequest = 2000;
+
+		EclipseMonitor::Eth::Transaction::ContractFuncStaticDef<
+			FuncAbiCheckpointReport
+		> funcChkpt(slaAddr, "hostCheckpointReport");
+
+		auto txn = funcChkpt.CallByTxn(
+			SimpleObjects::UInt64(seqNum),
+			SimpleObjects::UInt64(numRequests),
+			SimpleObjects::Bytes(data)
+		);
+		txn.SetGasLimit(sk_baseGas + (numRequests * sk_gasPerRequest));
+
+		m_logger.Info(
+			"Generated transaction for checkpoint report #" +
+			std::to_string(seqNum) + " with " +
+			std::to_string(numRequests) + " requests"
+		);
+
+		FinishAndSendTransaction(txn);
+	}
+
+	/**
+	 * @brief Commit a checkpoint, built by `ReceiptAccumulator`, to the
+	 *        given SLA contract; unlike `SendCheckpointReport`, the calldata
+	 *        doesn't grow with the number of requests
+	 *
+	 */
+	void SendCheckpointCommit(
+		const EclipseMonitor::Eth::ContractAddr& slaAddr,
+		const CheckpointCommit& commit
+	)
+	{
+		// a rough estimate of the settlement and the storage of the root
+		static constexpr uint64_t sk_gas = 300000;
+
+		EclipseMonitor::Eth::Transaction::ContractFuncStaticDef<
+			FuncAbiCheckpointCommit
+		> funcCommit(slaAddr, "hostCheckpointCommit");
+
+		auto txn = funcCommit.CallByTxn(
+			SimpleObjects::UInt64(commit.m_seqNum),
+			SimpleObjects::UInt64(commit.m_numRequests),
+			SimpleObjects::UInt64(commit.m_numAccepted),
+			SimpleObjects::UInt64(commit.m_totalUnits),
+			SimpleObjects::Bytes(commit.m_root.begin(), commit.m_root.end())
+		);
+		txn.SetGasLimit(sk_gas);
+
+		m_logger.Info(
+			"Generated transaction for checkpoint commit #" +
+			std::to_string(commit.m_seqNum) + " with " +
+			std::to_string(commit.m_numRequests) + " requests"
+		);
+
+		FinishAndSendTransaction(txn);
+	}
+
+	/**
+	 * @brief The address of the Ethereum key, i.e., the sender of the
+	 *        transactions
+	 *
+	 */
+	EclipseMonitor::Eth::ContractAddr GetEthAddr() const
+	{
+		auto pubXVec = m_ethKey->BorrowPubPointX().Bytes</*_LitEndian=*/false>();
+		auto pubYVec = m_ethKey->BorrowPubPointY().Bytes</*_LitEndian=*/false>();
+
+		// the last 20 bytes of the hash of the 64-byte public key
+		std::vector<uint8_t> pubKey(64, 0);
+		std::copy(
+			pubXVec.begin(),
+			pubXVec.end(),
+			pubKey.begin() + (32 - pubXVec.size())
+		);
+		std::copy(
+			pubYVec.begin(),
+			pubYVec.end(),
+			pubKey.end() - pubYVec.size()
+		);
+		auto hash = EclipseMonitor::Eth::Keccak256(pubKey);
+
+		EclipseMonitor::Eth::ContractAddr addr;
+		std::copy(hash.end() - addr.size(), hash.end(), addr.begin());
+		return addr;
+	}
+
+	/**
+	 * @brief The number of the confirmed transactions of the Ethereum key,
+	 *        i.e., the next nonce to use, asked from DecentEthereum, which
+	 *        answers it with `eth_getTransactionCount` (at the latest block)
+	 *
+	 */
+	uint64_t EthGetTransactionCount()
+	{
+		auto msg = BuildGetTransactionCountMsg(GetEthAddr());
+
+		std::vector<uint8_t> reply;
+		if (m_decentEthPool != nullptr)
+		{
+			reply = m_decentEthPool->Call(msg);
+		}
+		else
+		{
+			auto sock = DecentEnclave::Trusted::MakeLambdaCall(
+				"DecentEthereum",
+				DecentEnclave::Common::DecentTlsConfig::MakeTlsConfig(
+					false,
+					"Secp256r1",
+					"Secp256r1"
+				),
+				msg // lvalue reference needed
+			);
+			reply = sock->SizedRecvBytes<std::vector<uint8_t> >();
+		}
+
+		return ParseTransactionCountReply(reply);
+	}
+
+	void SetSlaDeployedCallback(SlaDeployedFunc func)
+	{
+		m_onSlaDeployed = std::move(func);
+	}
+
+	/**
+	 * @brief Send transactions through a queue from now on, so that the
+	 *        callers (e.g., the request handlers) never wait for the chain;
+	 *        the queue is processed by `RunTxnQueue`
+	 *
+	 * @param sysIO     The clock of the queue
+	 * @param config    The queue configuration
+	 * @param nonceFunc Source of the nonce on chain, to learn about
+	 *                  confirmations; if it's empty, the nonce is asked from
+	 *                  DecentEthereum (see `EthGetTransactionCount`)
+	 */
+	void EnableTxnQueue(
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+		const TxnQueueConfig& config = TxnQueueConfig(),
+		TxnQueue::NonceFunc nonceFunc = TxnQueue::NonceFunc()
+	)
+	{
+		if (m_txnQueue != nullptr)
+		{
+			throw std::logic_error("The transaction queue is already enabled");
+		}
+		if (!nonceFunc)
+		{
+			nonceFunc = [this]()
+			{
+				return EthGetTransactionCount();
+			};
+		}
+		m_txnQueue = std::make_shared<TxnQueue>(
+			std::move(sysIO),
+			[this](const std::vector<uint8_t>& txn)
+			{
+				EthSendRawTransaction(txn);
+			},
+			std::move(nonceFunc),
+			m_nonce.load(),
+			config
+		);
+	}
+
+	/**
+	 * @brief Process the transaction queue until `StopTxnQueue` is called;
+	 *        to be called by a thread dedicated to it
+	 *
+	 */
+	void RunTxnQueue()
+	{
+		GetTxnQueue().Run();
+	}
+
+	void StopTxnQueue()
+	{
+		GetTxnQueue().Stop();
+	}
+
+	TxnQueue& GetTxnQueue()
+	{
+		if (m_txnQueue == nullptr)
+		{
+			throw std::logic_error("The transaction queue is not enabled");
+		}
+		return *m_txnQueue;
+	}
+
+	/**
+	 * @brief Send transactions, and make subscriptions, through the given
+	 *        pool of sessions to DecentEthereum, instead of a new connection
+	 *        each time; it must be set before any of them is made
+	 *
+	 */
+	void SetDecentEthSessionPool(std::shared_ptr<DecentEthSessionPool> pool)
+	{
+		m_decentEthPool = std::move(pool);
+	}
+
+	/**
+	 * @brief The pool of sessions to DecentEthereum, or null if there is none
+	 *
+	 */
+	const std::shared_ptr<DecentEthSessionPool>& GetDecentEthSessionPool() const
+	{
+		return m_decentEthPool;
 	}
 
 	void ProcessSLAProposal(
-		std::unique_ptr<SLAContract> contract
+		std::shared_ptr<SLAContract> contract
 	)
 	{
 		// for now, we just accept the proposal
 		AcceptSLAProposal(std::move(contract));
 	}
 
+	/**
+	 * @brief Process proposals on worker threads from now on, so that the
+	 *        event feed isn't held up by the key derivation and the accept
+	 *        transactions; the workers are run by `RunProposalWorker`
+	 *
+	 * @param maxBatchSize Number of proposals a worker takes at once
+	 */
+	void EnableProposalWorkers(size_t maxBatchSize = 16)
+	{
+		if (m_proposalPool != nullptr)
+		{
+			throw std::logic_error("The proposal workers are already enabled");
+		}
+		m_proposalPool = std::make_shared<BatchTaskPool<SlaProposal> >(
+			[this](std::vector<SlaProposal>& proposals)
+			{
+				// one generator per batch, since it's not thread-safe
+				mbedTLScpp::DefaultRbg rand;
+				for (const auto& proposal : proposals)
+				{
+					try
+					{
+						HandleProposal(proposal, rand);
+					}
+					catch (const std::exception& e)
+					{
+						m_logger.Error(
+							"Failed to accept SLA proposal " +
+							std::to_string(proposal.m_contractId) + ": " +
+							e.what()
+						);
+					}
+				}
+			},
+			maxBatchSize
+		);
+	}
+
+	/**
+	 * @brief Run a proposal worker on the calling thread, until
+	 *        `StopProposalWorkers` is called and the queued proposals are done
+	 *
+	 */
+	void RunProposalWorker()
+	{
+		GetProposalPool().RunWorker();
+	}
+
+	void StopProposalWorkers()
+	{
+		GetProposalPool().Stop();
+	}
+
+	BatchTaskPool<SlaProposal>& GetProposalPool()
+	{
+		if (m_proposalPool == nullptr)
+		{
+			throw std::logic_error("The proposal workers are not enabled");
+		}
+		return *m_proposalPool;
+	}
+
 	void OnProposeEvent(const SimpleObjects::BytesBaseObj& logData)
 	{
 		// m_logger.Debug(
@@ -282,47 +744,100 @@ public:
 		}
 		m_logger.Info("Received SLA proposal event");
 
-		uint64_t contractID;
-		std::tie(contractID, abiBegin) =
+		SlaProposal proposal;
+		std::tie(proposal.m_contractId, abiBegin) =
 			_UIntParser().ToPrimitive(abiBegin, logData.end(), logData.begin());
-		std::vector<uint8_t> clientKeyXBytes;
-		std::tie(clientKeyXBytes, abiBegin) =
+		std::tie(proposal.m_clientKeyX, abiBegin) =
 			_Byte32Parser().ToPrimitive(abiBegin, logData.end(), logData.begin());
-		std::vector<uint8_t> clientKeyYBytes;
-		std::tie(clientKeyYBytes, abiBegin) =
+		std::tie(proposal.m_clientKeyY, abiBegin) =
 			_Byte32Parser().ToPrimitive(abiBegin, logData.end(), logData.begin());
 
-		auto contractAddr = EclipseMonitor::Eth::ContractAddr();
 		std::copy(
 			clientAddrBytes.begin() + 12,
 			clientAddrBytes.end(),
-			contractAddr.begin()
+			proposal.m_clientAddr.begin()
 		);
 
+		if (m_proposalPool != nullptr)
+		{
+			m_proposalPool->Submit(std::move(proposal));
+		}
+		else
+		{
+			HandleProposal(proposal, m_rand);
+		}
+	}
+
+	/**
+	 * @brief Derive the key shared with the client, and accept the proposal;
+	 *        the contract ID is reserved first, so a proposal delivered twice
+	 *        (e.g., to two workers) is only accepted once
+	 *
+	 * @param rand The random generator to use; it's only used by the calling
+	 *             thread
+	 */
+	void HandleProposal(
+		const SlaProposal& proposal,
+		mbedTLScpp::RbgInterface& rand
+	)
+	{
+		// the reservation is filled in by `AcceptSLAProposal`
+		if (!m_contracts.Insert(proposal.m_contractId, nullptr))
+		{
+			m_logger.Debug(
+				"SLA proposal " + std::to_string(proposal.m_contractId) +
+				" is already accepted"
+			);
+			return;
+		}
+
+		try
+		{
+			AcceptReservedProposal(proposal, rand);
+		}
+		catch (...)
+		{
+			// give the ID back, so the proposal can be accepted later
+			m_contracts.Erase(proposal.m_contractId);
+			throw;
+		}
+	}
+
+	/**
+	 * @brief The rest of `HandleProposal`, once the contract ID is reserved
+	 *
+	 */
+	void AcceptReservedProposal(
+		const SlaProposal& proposal,
+		mbedTLScpp::RbgInterface& rand
+	)
+	{
 		m_logger.Debug(
 			"Contract address: " +
-			SimpleObjects::Codec::Hex::Encode<std::string>(contractAddr)
+			SimpleObjects::Codec::Hex::Encode<std::string>(proposal.m_clientAddr)
 		);
-		m_logger.Debug("Contract ID: " + std::to_string(contractID));
+		m_logger.Debug("Contract ID: " + std::to_string(proposal.m_contractId));
 		m_logger.Debug(
 			std::string("Client public key:") +
-			"\nX:" + SimpleObjects::Codec::Hex::Encode<std::string>(clientKeyXBytes) +
-			"\nY:" + SimpleObjects::Codec::Hex::Encode<std::string>(clientKeyYBytes)
+			"\nX:" +
+			SimpleObjects::Codec::Hex::Encode<std::string>(proposal.m_clientKeyX) +
+			"\nY:" +
+			SimpleObjects::Codec::Hex::Encode<std::string>(proposal.m_clientKeyY)
 		);
 
 		auto pubX = mbedTLScpp::BigNum(
-			mbedTLScpp::CtnFullR(clientKeyXBytes),
+			mbedTLScpp::CtnFullR(proposal.m_clientKeyX),
 			/*isPositive=*/true,
 			/*isLittleEndian=*/false
 		);
 		auto pubY = mbedTLScpp::BigNum(
-			mbedTLScpp::CtnFullR(clientKeyYBytes),
+			mbedTLScpp::CtnFullR(proposal.m_clientKeyY),
 			/*isPositive=*/true,
 			/*isLittleEndian=*/false
 		);
 
 		auto peerDhKey = EthPublicKeyType::FromPublicNum(pubX, pubY);
-		auto sharedKey = m_dhKey->DeriveSharedKeyInBigNum(peerDhKey, m_rand).
+		auto sharedKey = m_dhKey->DeriveSharedKeyInBigNum(peerDhKey, rand).
 			SecretBytes</*_LitEndian=*/false>();
 		m_logger.Debug(
 			"Shared root key: " +
@@ -330,14 +845,59 @@ public:
 		);
 		ProcessSLAProposal(
 			SLAContract::MakeUnique(
-				contractID,
-				contractAddr,
+				proposal.m_contractId,
+				proposal.m_clientAddr,
 				std::move(peerDhKey),
 				std::move(sharedKey)
 			)
 		);
 	}
 
+	void OnProposalAcceptedEvent(const SimpleObjects::BytesBaseObj& logData)
+	{
+		auto abiBegin = logData.begin();
+
+		std::vector<uint8_t> clientAddrBytes;
+		std::tie(clientAddrBytes, abiBegin) =
+			_Byte32Parser().ToPrimitive(abiBegin, logData.end(), logData.begin());
+		std::vector<uint8_t> hardwareIDBytes;
+		std::tie(hardwareIDBytes, abiBegin) =
+			_Byte32Parser().ToPrimitive(abiBegin, logData.end(), logData.begin());
+
+		if (hardwareIDBytes != DecentEnclave::Trusted::PlatformId::GetId())
+		{
+			m_logger.Debug("Received a SLA accepted event for a different platform");
+			return;
+		}
+
+		std::vector<uint8_t> slaAddrBytes;
+		std::tie(slaAddrBytes, abiBegin) =
+			_Byte32Parser().ToPrimitive(abiBegin, logData.end(), logData.begin());
+
+		auto clientAddr = EclipseMonitor::Eth::ContractAddr();
+		std::copy(
+			clientAddrBytes.begin() + 12,
+			clientAddrBytes.end(),
+			clientAddr.begin()
+		);
+		auto slaAddr = EclipseMonitor::Eth::ContractAddr();
+		std::copy(
+			slaAddrBytes.begin() + 12,
+			slaAddrBytes.end(),
+			slaAddr.begin()
+		);
+
+		m_logger.Info(
+			"SLA contract deployed at " +
+			SimpleObjects::Codec::Hex::Encode<std::string>(slaAddr)
+		);
+
+		if (m_onSlaDeployed)
+		{
+			m_onSlaDeployed(clientAddr, slaAddr);
+		}
+	}
+
 private:
 
 	using _Byte32Parser =
@@ -363,9 +923,61 @@ private:
 		return msg;
 	}
 
-	static void EthSendRawTransaction(const std::vector<uint8_t>& txn)
+	static DecentEnclave::Common::DetMsg BuildGetTransactionCountMsg(
+		const EclipseMonitor::Eth::ContractAddr& addr
+	)
+	{
+		static const SimpleObjects::String sk_labelAddress("address");
+		static const SimpleObjects::String sk_labelBlock("block");
+
+		SimpleObjects::Dict msgContent;
+		msgContent[sk_labelAddress] = SimpleObjects::Bytes(
+			addr.begin(),
+			addr.end()
+		);
+		msgContent[sk_labelBlock] = SimpleObjects::String("latest");
+
+		DecentEnclave::Common::DetMsg msg;
+
+		msg.get_MsgId().get_MsgType() = SimpleObjects::String("Transaction.GetCount");
+		msg.get_MsgContent() = SimpleObjects::Bytes(
+			AdvancedRlp::GenericWriter::Write(msgContent)
+		);
+
+		return msg;
+	}
+
+	/**
+	 * @brief The reply holds the count as RLP bytes, in big-endian
+	 *
+	 */
+	static uint64_t ParseTransactionCountReply(const std::vector<uint8_t>& reply)
+	{
+		auto replyObj = AdvancedRlp::Parse(reply);
+		const auto& countBytes = replyObj.AsBytes();
+		if (countBytes.size() > sizeof(uint64_t))
+		{
+			throw std::runtime_error(
+				"The transaction count from DecentEthereum is too large"
+			);
+		}
+
+		uint64_t count = 0;
+		for (const auto& byte : countBytes)
+		{
+			count = (count << 8) | static_cast<uint8_t>(byte);
+		}
+		return count;
+	}
+
+	void EthSendRawTransaction(const std::vector<uint8_t>& txn)
 	{
 		auto msg = BuildSendRawTransactionMsg(txn);
+		if (m_decentEthPool != nullptr)
+		{
+			m_decentEthPool->Call(msg);
+			return;
+		}
 		DecentEnclave::Trusted::MakeLambdaCall(
 			"DecentEthereum",
 			DecentEnclave::Common::DecentTlsConfig::MakeTlsConfig(
@@ -396,6 +1008,15 @@ private:
 		FuncAbiAccept
 	> m_funcAccept;
 
+	SlaDeployedFunc m_onSlaDeployed;
+
+	std::shared_ptr<TxnQueue> m_txnQueue;
+	std::shared_ptr<DecentEthSessionPool> m_decentEthPool;
+
+	// accepted contracts, by contract ID
+	ShardedMap<uint64_t, std::shared_ptr<SLAContract> > m_contracts;
+	std::shared_ptr<BatchTaskPool<SlaProposal> > m_proposalPool;
+
 }; // class SLARuntime
 
 
@@ -442,6 +1063,21 @@ inline DecentEnclave::Common::DetMsg BuildSubMsgSlaProposeEvent(
 }
 
 
+inline DecentEnclave::Common::DetMsg BuildSubMsgSlaProposalAcceptedEvent(
+	const EclipseMonitor::Eth::ContractAddr& publisherAddr
+)
+{
+	static const auto sk_signTopic = EclipseMonitor::Eth::Keccak256(
+		std::string("SlaProposalAccepted(uint256,address,bytes32,address,bytes)")
+	);
+	static const SimpleObjects::Bytes  sk_signTopicBytes(
+		std::vector<uint8_t>(sk_signTopic.begin(), sk_signTopic.end())
+	);
+
+	return BuildSubscribeMsg(publisherAddr, sk_signTopicBytes);
+}
+
+
 template<typename _NotifyFunc>
 inline
 typename DecentEnclave::Trusted::HeartbeatRecvMgr::RecvFunc
@@ -467,12 +1103,96 @@ BuildFuncNotifyOnEventLog(_NotifyFunc func)
 }
 
 
-inline void SubscribeToSlaProposeEvent(std::shared_ptr<SLARuntime> slaRt)
+/**
+ * @brief Make a pool of long-lived TLS sessions to DecentEthereum; the TLS
+ *        config is made once, and further messages are sent over the open
+ *        sessions, rather than with a new lambda call (and handshake) each.
+ *        This relies on DecentEthereum serving several messages per
+ *        connection, each answered with a sized reply, which is read before
+ *        the session is used again; a session that is closed, or doesn't
+ *        answer, is replaced, and the message is sent again. A session
+ *        idle for a while is pinged (with a `Session.Ping` message) before
+ *        it's used again.
+ *
+ *        The TLS socket can't be closed from another thread, so a session
+ *        that doesn't reply in time only loses its slot in the pool (see
+ *        `SessionPoolConfig::m_replyTimeoutUs`); the call waiting on it
+ *        fails once the host's read returns
+ *
+ * @param sysIO  The clock of the pool
+ * @param config The pool configuration
+ */
+inline std::shared_ptr<DecentEthSessionPool> MakeDecentEthSessionPool(
+	std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+	const SessionPoolConfig& config = SessionPoolConfig()
+)
 {
-	auto subMsg = BuildSubMsgSlaProposeEvent(slaRt->GetSlaManagerAddr());
+	auto tlsConfig = DecentEnclave::Common::DecentTlsConfig::MakeTlsConfig(
+		false,
+		"Secp256r1",
+		"Secp256r1"
+	);
 
-	std::shared_ptr<DecentEnclave::Common::TlsSocket> pubsubTlsSocket =
-		DecentEnclave::Trusted::MakeLambdaCall(
+	return std::make_shared<DecentEthSessionPool>(
+		std::move(sysIO),
+		[tlsConfig](DecentEnclave::Common::DetMsg& msg)
+		{
+			return DecentEnclave::Trusted::MakeLambdaCall(
+				"DecentEthereum",
+				tlsConfig,
+				msg // lvalue reference needed
+			);
+		},
+		[](
+			DecentEnclave::Common::TlsSocket& sock,
+			DecentEnclave::Common::DetMsg& msg
+		)
+		{
+			// same framing as the first message of a lambda call
+			sock.SizedSendBytes(AdvancedRlp::GenericWriter::Write(msg));
+		},
+		config,
+		[](DecentEnclave::Common::TlsSocket& sock)
+		{
+			DecentEnclave::Common::DetMsg pingMsg;
+			pingMsg.get_MsgId().get_MsgType() =
+				SimpleObjects::String("Session.Ping");
+
+			sock.SizedSendBytes(AdvancedRlp::GenericWriter::Write(pingMsg));
+			auto reply = sock.SizedRecvBytes<std::vector<uint8_t> >();
+			return !reply.empty();
+		},
+		[](DecentEnclave::Common::TlsSocket& sock)
+		{
+			auto reply = sock.SizedRecvBytes<std::vector<uint8_t> >();
+			if (reply.empty())
+			{
+				throw std::runtime_error(
+					"DecentEthereum didn't acknowledge the message"
+				);
+			}
+			return reply;
+		}
+	);
+}
+
+
+template<typename _NotifyFunc>
+inline void SubscribeToEvent(
+	DecentEnclave::Common::DetMsg& subMsg,
+	_NotifyFunc func,
+	std::shared_ptr<DecentEthSessionPool> pool = nullptr
+)
+{
+	// the subscription keeps its session, which is handed to the receiver
+	std::shared_ptr<DecentEnclave::Common::TlsSocket> pubsubTlsSocket;
+	if (pool != nullptr)
+	{
+		pubsubTlsSocket = pool->Open(subMsg);
+	}
+	else
+	{
+		pubsubTlsSocket = DecentEnclave::Trusted::MakeLambdaCall(
 			"DecentEthereum",
 			DecentEnclave::Common::DecentTlsConfig::MakeTlsConfig(
 				false,
@@ -481,6 +1201,7 @@ inline void SubscribeToSlaProposeEvent(std::shared_ptr<SLARuntime> slaRt)
 			),
 			subMsg // lvalue reference needed
 		);
+	}
 
 	auto pubsubHbConstraint =
 		std::make_shared<DecentEnclave::Trusted::HeartbeatTimeConstraint<uint64_t> >(
@@ -490,17 +1211,105 @@ inline void SubscribeToSlaProposeEvent(std::shared_ptr<SLARuntime> slaRt)
 	DecentEnclave::Trusted::HeartbeatRecvMgr::GetInstance().AddRecv(
 		pubsubHbConstraint,
 		pubsubTlsSocket,
-		BuildFuncNotifyOnEventLog(
-			[slaRt](const SimpleObjects::BytesBaseObj& logData)
-			{
-				slaRt->OnProposeEvent(logData);
-			}
-		),
+		BuildFuncNotifyOnEventLog(std::move(func)),
 		true
 	);
 }
 
 
+inline void SubscribeToSlaProposeEvent(std::shared_ptr<SLARuntime> slaRt)
+{
+	auto subMsg = BuildSubMsgSlaProposeEvent(slaRt->GetSlaManagerAddr());
+
+	SubscribeToEvent(
+		subMsg,
+		[slaRt](const SimpleObjects::BytesBaseObj& logData)
+		{
+			slaRt->OnProposeEvent(logData);
+		},
+		slaRt->GetDecentEthSessionPool()
+	);
+}
+
+
+/**
+ * @brief Learn the addresses of the SLA contracts deployed for accepted
+ *        proposals, which is where checkpoint reports are sent; see
+ *        `SLARuntime::SetSlaDeployedCallback`
+ *
+ */
+inline void SubscribeToSlaProposalAcceptedEvent(std::shared_ptr<SLARuntime> slaRt)
+{
+	auto subMsg = BuildSubMsgSlaProposalAcceptedEvent(slaRt->GetSlaManagerAddr());
+
+	SubscribeToEvent(
+		subMsg,
+		[slaRt](const SimpleObjects::BytesBaseObj& logData)
+		{
+			slaRt->OnProposalAcceptedEvent(logData);
+		},
+		slaRt->GetDecentEthSessionPool()
+	);
+}
+
+
+/**
+ * @brief Make an accumulator whose reports are sent to the given SLA
+ *        contract by the given runtime, when the accumulator is run (see
+ *        `CheckpointAccumulator::Run`)
+ *
+ * @param sysIO The clock the accumulator waits on before retrying a report
+ */
+inline std::shared_ptr<CheckpointAccumulator> MakeCheckpointAccumulator(
+	std::shared_ptr<SLARuntime> slaRt,
+	const EclipseMonitor::Eth::ContractAddr& slaAddr,
+	std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+	const CheckpointConfig& config = CheckpointConfig()
+)
+{
+	return std::make_shared<CheckpointAccumulator>(
+		config,
+		[slaRt, slaAddr](
+			uint64_t seqNum,
+			uint64_t numRequests,
+			const std::vector<uint8_t>& data
+		)
+		{
+			slaRt->SendCheckpointReport(slaAddr, seqNum, numRequests, data);
+		},
+		0,
+		std::move(sysIO)
+	);
+}
+
+
+/**
+ * @brief Make an accumulator whose checkpoints are committed to the given SLA
+ *        contract by the given runtime, when the accumulator is run (see
+ *        `ReceiptAccumulator::Run`)
+ *
+ * @param sysIO The clock the accumulator waits on before retrying a commit
+ */
+inline std::shared_ptr<ReceiptAccumulator> MakeReceiptAccumulator(
+	std::shared_ptr<SLARuntime> slaRt,
+	const EclipseMonitor::Eth::ContractAddr& slaAddr,
+	std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+	const ReceiptConfig& config = ReceiptConfig()
+)
+{
+	return std::make_shared<ReceiptAccumulator>(
+		config,
+		[slaRt, slaAddr](const CheckpointCommit& commit)
+		{
+			slaRt->SendCheckpointCommit(slaAddr, commit);
+		},
+		0,
+		0,
+		std::move(sysIO)
+	);
+}
+
+
 } // namespace Common
 } // namespace SLARuntime
 
@@ -0,0 +1,660 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <WasmRuntime/SystemIO.hpp>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+struct SessionPoolConfig
+{
+	/**
+	 * @brief Number of sessions open at a time; a call waits for a session
+	 *        to be free once they are all in use
+	 *
+	 */
+	size_t m_maxSessions = 4;
+
+	/**
+	 * @brief Close a session that hasn't been used for this long, since the
+	 *        peer may have dropped it already
+	 *
+	 */
+	uint64_t m_maxIdleUs = 60 * 1000 * 1000;
+
+	/**
+	 * @brief Close a session this long after it's opened, so it's
+	 *        re-authenticated every now and then; 0 disables it
+	 *
+	 */
+	uint64_t m_maxLifetimeUs = 0;
+
+	/**
+	 * @brief A session idle for longer than this is checked (see `CheckFunc`)
+	 *        before it's used again; 0 checks it every time
+	 *
+	 */
+	uint64_t m_checkAfterIdleUs = 5 * 1000 * 1000;
+
+	/**
+	 * @brief How long a reply (or a health check) may take; an overdue
+	 *        session is aborted, and its slot is given back, so the other
+	 *        calls aren't held up by it; a reply that comes later is taken as
+	 *        a failure. 0 disables it
+	 *
+	 */
+	uint64_t m_replyTimeoutUs = 10 * 1000 * 1000;
+}; // struct SessionPoolConfig
+
+
+struct SessionPoolStats
+{
+	uint64_t m_numCalls = 0;
+	uint64_t m_numConnects = 0;
+	uint64_t m_numReuses = 0;
+	uint64_t m_numReconnects = 0;
+	uint64_t m_numClosed = 0;
+	uint64_t m_numFailedChecks = 0;
+	uint64_t m_numTimedOut = 0;
+	size_t m_numOpen = 0;
+}; // struct SessionPoolStats
+
+
+/**
+ * @brief Keeps a few long-lived sessions (e.g., authenticated TLS sockets)
+ *        open to a peer, so that a message doesn't cost a new connection and
+ *        handshake; each message is sent over a free session, one message per
+ *        session at a time.
+ *
+ *        Opening a session also sends the first message over it (as
+ *        `DecentEnclave::Trusted::MakeLambdaCall` does). A session that fails
+ *        to send, or fails the health check, is closed; the message is then
+ *        sent over a new session.
+ *
+ *        Thus, the peer must serve several messages per connection. With an
+ *        `AckFunc`, the peer's reply to each message is read before the
+ *        session is used again, so a session the peer has dropped is found
+ *        out by the message sent over it, rather than by the next one; a
+ *        message whose reply is missing is sent again over a new session,
+ *        so messages must be safe to deliver twice (as raw transactions
+ *        are).
+ *
+ *        Replies and health checks have a deadline. Since the pool can't
+ *        interrupt a blocked read by itself, a session past its deadline is
+ *        handed to the `AbortFunc` by the next call (or by `CheckHealth`),
+ *        and its slot is given back right away; the call waiting on it
+ *        fails once the read returns.
+ *
+ * @tparam _SessionType The type of the session, e.g., a TLS socket
+ * @tparam _MsgType     The type of the messages
+ */
+template<typename _SessionType, typename _MsgType>
+class SessionPool
+{
+public: // static members:
+
+	using SessionType = _SessionType;
+	using MsgType = _MsgType;
+
+	/**
+	 * @brief Open a new session, and send the given message over it
+	 *
+	 */
+	using ConnectFunc = std::function<
+		std::shared_ptr<SessionType>(MsgType&)
+	>;
+
+	/**
+	 * @brief Send a message over an open session; throws if it can't
+	 *
+	 */
+	using SendFunc = std::function<void(SessionType&, MsgType&)>;
+
+	/**
+	 * @brief Tell whether an idle session can still be used, e.g., by a
+	 *        round trip to the peer
+	 *
+	 */
+	using CheckFunc = std::function<bool(SessionType&)>;
+
+	/**
+	 * @brief Read the peer's reply to the message just sent over the
+	 *        session; throws if there is none, or it's a failure
+	 *
+	 * @return The reply
+	 */
+	using AckFunc = std::function<std::vector<uint8_t>(SessionType&)>;
+
+	/**
+	 * @brief Make a read blocked on the session return (e.g., by closing the
+	 *        session); called from another thread than the reader's
+	 *
+	 */
+	using AbortFunc = std::function<void(SessionType&)>;
+
+public:
+
+	SessionPool(
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+		ConnectFunc connectFunc,
+		SendFunc sendFunc,
+		const SessionPoolConfig& config = SessionPoolConfig(),
+		CheckFunc checkFunc = CheckFunc(),
+		AckFunc ackFunc = AckFunc(),
+		AbortFunc abortFunc = AbortFunc()
+	) :
+		m_sysIO(std::move(sysIO)),
+		m_connectFunc(std::move(connectFunc)),
+		m_sendFunc(std::move(sendFunc)),
+		m_checkFunc(std::move(checkFunc)),
+		m_ackFunc(std::move(ackFunc)),
+		m_abortFunc(std::move(abortFunc)),
+		m_config(config),
+		m_mutex(),
+		m_cond(),
+		m_idle(),
+		m_waits(),
+		m_nextWaitId(0),
+		m_numOpen(0),
+		m_stats()
+	{
+		if (m_sysIO == nullptr)
+		{
+			throw std::invalid_argument("The session pool clock is not given");
+		}
+		if (m_config.m_maxSessions == 0)
+		{
+			throw std::invalid_argument(
+				"The session pool must allow at least one session"
+			);
+		}
+	}
+
+	SessionPool(const SessionPool&) = delete;
+
+	SessionPool(SessionPool&&) = delete;
+
+	~SessionPool() = default;
+
+	SessionPool& operator=(const SessionPool&) = delete;
+
+	SessionPool& operator=(SessionPool&&) = delete;
+
+	/**
+	 * @brief Send a message over a pooled session, opening one if none is
+	 *        free; throws if a new session can't be opened (or doesn't
+	 *        acknowledge the message) either
+	 *
+	 * @return The peer's reply, read by the `AckFunc`; empty if there is none
+	 */
+	std::vector<uint8_t> Call(MsgType& msg)
+	{
+		AbortOverdue();
+
+		Session session;
+		bool hasSession = AcquireHealthy(session);
+
+		std::vector<uint8_t> reply;
+		if (hasSession)
+		{
+			WaitResult result = WaitResult::Failed;
+			try
+			{
+				m_sendFunc(*session.m_sock, msg);
+				result = Ack(session.m_sock, reply);
+			}
+			catch (const std::exception&)
+			{}
+
+			if (result == WaitResult::Done)
+			{
+				Release(std::move(session));
+				return reply;
+			}
+			if (result == WaitResult::Overdue)
+			{
+				// its slot is already given back
+				throw std::runtime_error("The peer didn't reply in time");
+			}
+			// the peer may have closed it; try a new one
+			Discard(true);
+		}
+
+		try
+		{
+			session.m_sock = m_connectFunc(msg);
+		}
+		catch (...)
+		{
+			Discard(false);
+			throw;
+		}
+		WaitResult result = Ack(session.m_sock, reply);
+		if (result != WaitResult::Done)
+		{
+			if (result == WaitResult::Failed)
+			{
+				Discard(false);
+			}
+			throw std::runtime_error("The peer didn't acknowledge the message");
+		}
+		session.m_openUs = m_sysIO->GetTimestampUs();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_stats.m_numConnects;
+		}
+		Release(std::move(session));
+		return reply;
+	}
+
+	/**
+	 * @brief Open a session that isn't pooled, through the same connection
+	 *        path, e.g., for a subscription whose session is then owned by
+	 *        its receiver
+	 *
+	 */
+	std::shared_ptr<SessionType> Open(MsgType& msg)
+	{
+		auto sock = m_connectFunc(msg);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_stats.m_numConnects;
+		return sock;
+	}
+
+	/**
+	 * @brief Abort the sessions past their reply deadlines, and close the
+	 *        idle sessions that are too old, or fail the health check; calls
+	 *        do the same with the sessions they take, but this can be called
+	 *        periodically so that idle sessions aren't kept open for nothing
+	 *
+	 * @return Number of sessions closed (including the aborted ones)
+	 */
+	size_t CheckHealth()
+	{
+		size_t numAborted = AbortOverdue();
+
+		std::vector<Session> toCheck;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			toCheck.swap(m_idle);
+			// they are in use while being checked
+		}
+
+		std::vector<Session> kept;
+		for (auto& session : toCheck)
+		{
+			if (IsHealthy(session, /*isForced=*/true))
+			{
+				kept.push_back(std::move(session));
+			}
+		}
+
+		size_t numClosed = toCheck.size() - kept.size();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& session : kept)
+			{
+				m_idle.push_back(std::move(session));
+			}
+			m_numOpen -= numClosed;
+			m_stats.m_numClosed += numClosed;
+		}
+		m_cond.notify_all();
+
+		return numAborted + numClosed;
+	}
+
+	/**
+	 * @brief Abort the sessions past their reply (or health check) deadlines,
+	 *        and give their slots back
+	 *
+	 * @return Number of sessions aborted
+	 */
+	size_t AbortOverdue()
+	{
+		std::vector<std::shared_ptr<SessionType> > overdue;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			uint64_t nowUs = m_sysIO->GetTimestampUs();
+			for (auto& item : m_waits)
+			{
+				Wait& wait = item.second;
+				if (!wait.m_isOverdue && (nowUs >= wait.m_deadlineUs))
+				{
+					wait.m_isOverdue = true;
+					overdue.push_back(wait.m_sock);
+				}
+			}
+			m_numOpen -= overdue.size();
+			m_stats.m_numClosed += overdue.size();
+			m_stats.m_numTimedOut += overdue.size();
+		}
+		if (overdue.empty())
+		{
+			return 0;
+		}
+		m_cond.notify_all();
+
+		if (m_abortFunc)
+		{
+			for (auto& sock : overdue)
+			{
+				try
+				{
+					m_abortFunc(*sock);
+				}
+				catch (const std::exception&)
+				{
+					// its reader finds out anyway, once the read returns
+				}
+			}
+		}
+		return overdue.size();
+	}
+
+	/**
+	 * @brief Close all the idle sessions
+	 *
+	 */
+	void Clear()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_numOpen -= m_idle.size();
+			m_stats.m_numClosed += m_idle.size();
+			m_idle.clear();
+		}
+		m_cond.notify_all();
+	}
+
+	SessionPoolStats GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		SessionPoolStats stats = m_stats;
+		stats.m_numOpen = m_numOpen;
+		return stats;
+	}
+
+private:
+
+	struct Session
+	{
+		std::shared_ptr<SessionType> m_sock;
+		uint64_t m_openUs = 0;
+		uint64_t m_lastUsedUs = 0;
+	}; // struct Session
+
+	/**
+	 * @brief A read (of a reply, or of a health check) in progress
+	 *
+	 */
+	struct Wait
+	{
+		std::shared_ptr<SessionType> m_sock;
+		uint64_t m_deadlineUs = 0;
+		// aborted by `AbortOverdue`, which gave its slot back
+		bool m_isOverdue = false;
+	}; // struct Wait
+
+	enum class WaitResult
+	{
+		Done,
+		Failed,
+		// the slot of the session is already given back
+		Overdue,
+	}; // enum class WaitResult
+
+	/**
+	 * @brief Run the given read on the session, with the reply deadline
+	 *
+	 */
+	template<typename _ReadFunc>
+	WaitResult WaitFor(
+		const std::shared_ptr<SessionType>& sock,
+		_ReadFunc readFunc
+	)
+	{
+		uint64_t waitId = 0;
+		uint64_t deadlineUs = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			deadlineUs = (m_config.m_replyTimeoutUs == 0) ?
+				std::numeric_limits<uint64_t>::max() :
+				(m_sysIO->GetTimestampUs() + m_config.m_replyTimeoutUs);
+			waitId = m_nextWaitId++;
+
+			Wait& wait = m_waits[waitId];
+			wait.m_sock = sock;
+			wait.m_deadlineUs = deadlineUs;
+		}
+
+		bool isDone = false;
+		try
+		{
+			isDone = readFunc();
+		}
+		catch (const std::exception&)
+		{}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_waits.find(waitId);
+		bool isOverdue = it->second.m_isOverdue;
+		m_waits.erase(it);
+
+		if (isOverdue)
+		{
+			return WaitResult::Overdue;
+		}
+		if (m_sysIO->GetTimestampUs() >= deadlineUs)
+		{
+			// a late reply isn't trusted, since the peer is too slow anyway
+			++m_stats.m_numTimedOut;
+			return WaitResult::Failed;
+		}
+		return isDone ? WaitResult::Done : WaitResult::Failed;
+	}
+
+	WaitResult Ack(
+		const std::shared_ptr<SessionType>& sock,
+		std::vector<uint8_t>& reply
+	)
+	{
+		if (!m_ackFunc)
+		{
+			return WaitResult::Done;
+		}
+		return WaitFor(
+			sock,
+			[this, &sock, &reply]()
+			{
+				reply = m_ackFunc(*sock);
+				return true;
+			}
+		);
+	}
+
+	/**
+	 * @brief Whether the session is still usable; it's only checked by the
+	 *        `CheckFunc` if it's been idle for a while, unless `isForced`
+	 *
+	 */
+	bool IsHealthy(const Session& session, bool isForced)
+	{
+		uint64_t nowUs = m_sysIO->GetTimestampUs();
+
+		uint64_t idleUs = nowUs - session.m_lastUsedUs;
+		bool isExpired =
+			(idleUs >= m_config.m_maxIdleUs) ||
+			((m_config.m_maxLifetimeUs != 0) &&
+				(nowUs - session.m_openUs >= m_config.m_maxLifetimeUs));
+		if (isExpired)
+		{
+			return false;
+		}
+		if (!m_checkFunc || (!isForced && (idleUs < m_config.m_checkAfterIdleUs)))
+		{
+			return true;
+		}
+
+		WaitResult result = WaitFor(
+			session.m_sock,
+			[this, &session]()
+			{
+				return m_checkFunc(*session.m_sock);
+			}
+		);
+		if (result != WaitResult::Done)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_stats.m_numFailedChecks;
+			if (result == WaitResult::Overdue)
+			{
+				// its slot is already given back, so it's not closed twice
+				++m_numOpen;
+				--m_stats.m_numClosed;
+			}
+		}
+		return result == WaitResult::Done;
+	}
+
+	/**
+	 * @brief Take a free session that passes the health check, or a slot for
+	 *        a new one; the ones that fail the check are closed
+	 *
+	 * @return True if a session is taken, false if a new one should be opened
+	 */
+	bool AcquireHealthy(Session& outSession)
+	{
+		while (Acquire(outSession))
+		{
+			if (IsHealthy(outSession, /*isForced=*/false))
+			{
+				return true;
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				--m_numOpen;
+				++m_stats.m_numClosed;
+				// it's counted again by the next `Acquire`
+				--m_stats.m_numCalls;
+				--m_stats.m_numReuses;
+			}
+			m_cond.notify_one();
+			outSession = Session();
+		}
+		return false;
+	}
+
+	/**
+	 * @brief Take a free session, or a slot for a new one, waiting if all
+	 *        the sessions are in use
+	 *
+	 * @return True if a session is taken, false if a new one should be opened
+	 */
+	bool Acquire(Session& outSession)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_cond.wait(
+			lock,
+			[this]()
+			{
+				return !m_idle.empty() || (m_numOpen < m_config.m_maxSessions);
+			}
+		);
+		++m_stats.m_numCalls;
+
+		if (!m_idle.empty())
+		{
+			// the most recently used one is the least likely to be dropped
+			outSession = std::move(m_idle.back());
+			m_idle.pop_back();
+			++m_stats.m_numReuses;
+			return true;
+		}
+
+		++m_numOpen;
+		return false;
+	}
+
+	void Release(Session session)
+	{
+		session.m_lastUsedUs = m_sysIO->GetTimestampUs();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_idle.push_back(std::move(session));
+		}
+		m_cond.notify_one();
+	}
+
+	/**
+	 * @brief Give up a session; if `isReconnecting`, its slot is kept for the
+	 *        new session that replaces it
+	 *
+	 */
+	void Discard(bool isReconnecting)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (isReconnecting)
+			{
+				++m_stats.m_numReconnects;
+				++m_stats.m_numClosed;
+				return;
+			}
+			--m_numOpen;
+		}
+		m_cond.notify_one();
+	}
+
+	std::unique_ptr<::WasmRuntime::SystemIO> m_sysIO;
+	ConnectFunc m_connectFunc;
+	SendFunc m_sendFunc;
+	CheckFunc m_checkFunc;
+	AckFunc m_ackFunc;
+	AbortFunc m_abortFunc;
+	SessionPoolConfig m_config;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::vector<Session> m_idle;
+	// by wait ID
+	std::map<uint64_t, Wait> m_waits;
+	uint64_t m_nextWaitId;
+	// idle sessions, sessions in use, and the ones being opened
+	size_t m_numOpen;
+	SessionPoolStats m_stats;
+
+}; // class SessionPool
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -0,0 +1,166 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <WasmRuntime/Internal/make_unique.hpp>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief A hash map split into shards, each with its own lock, so that
+ *        threads working on different keys rarely wait for each other.
+ *
+ *        Values are copied in and out, so they're meant to be small, e.g.,
+ *        shared pointers.
+ *
+ */
+template<
+	typename _KeyType,
+	typename _ValType,
+	typename _HasherType = std::hash<_KeyType>
+>
+class ShardedMap
+{
+public:
+
+	explicit ShardedMap(size_t numShards = 16) :
+		m_hasher(),
+		m_shards()
+	{
+		if (numShards == 0)
+		{
+			throw std::invalid_argument("The map needs at least one shard");
+		}
+		for (size_t i = 0; i < numShards; ++i)
+		{
+			m_shards.push_back(::WasmRuntime::Internal::make_unique<Shard>());
+		}
+	}
+
+	ShardedMap(const ShardedMap&) = delete;
+
+	ShardedMap(ShardedMap&&) = delete;
+
+	~ShardedMap() = default;
+
+	ShardedMap& operator=(const ShardedMap&) = delete;
+
+	ShardedMap& operator=(ShardedMap&&) = delete;
+
+	/**
+	 * @brief Add the value, unless the key is already there
+	 *
+	 * @return True if it's added
+	 */
+	bool Insert(const _KeyType& key, _ValType val)
+	{
+		Shard& shard = GetShard(key);
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		return shard.m_map.emplace(key, std::move(val)).second;
+	}
+
+	void InsertOrAssign(const _KeyType& key, _ValType val)
+	{
+		Shard& shard = GetShard(key);
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		shard.m_map[key] = std::move(val);
+	}
+
+	/**
+	 * @brief Look up a key
+	 *
+	 * @return True if it's found, and its value copied to `outVal`
+	 */
+	bool Find(const _KeyType& key, _ValType& outVal) const
+	{
+		const Shard& shard = GetShard(key);
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		auto it = shard.m_map.find(key);
+		if (it == shard.m_map.end())
+		{
+			return false;
+		}
+		outVal = it->second;
+		return true;
+	}
+
+	bool Contains(const _KeyType& key) const
+	{
+		const Shard& shard = GetShard(key);
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		return shard.m_map.find(key) != shard.m_map.end();
+	}
+
+	bool Erase(const _KeyType& key)
+	{
+		Shard& shard = GetShard(key);
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		return shard.m_map.erase(key) > 0;
+	}
+
+	/**
+	 * @brief Number of entries; only a snapshot, since the shards are
+	 *        counted one at a time
+	 *
+	 */
+	size_t Size() const
+	{
+		size_t size = 0;
+		for (const auto& shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard->m_mutex);
+			size += shard->m_map.size();
+		}
+		return size;
+	}
+
+	size_t GetNumShards() const
+	{
+		return m_shards.size();
+	}
+
+private:
+
+	struct Shard
+	{
+		mutable std::mutex m_mutex;
+		std::unordered_map<_KeyType, _ValType, _HasherType> m_map;
+	}; // struct Shard
+
+	Shard& GetShard(const _KeyType& key)
+	{
+		return *m_shards[m_hasher(key) % m_shards.size()];
+	}
+
+	const Shard& GetShard(const _KeyType& key) const
+	{
+		return *m_shards[m_hasher(key) % m_shards.size()];
+	}
+
+	_HasherType m_hasher;
+	std::vector<std::unique_ptr<Shard> > m_shards;
+
+}; // class ShardedMap
+
+
+} // namespace Common
+} // namespace SLARuntime
+
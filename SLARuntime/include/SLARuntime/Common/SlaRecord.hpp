@@ -0,0 +1,107 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+#include <cstring>
+
+#include <type_traits>
+
+#include "EventBatch.hpp"
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief The SLA report of one request, in a fixed binary layout, so it can
+ *        be passed around (and across the enclave boundary) by copying,
+ *        without building or parsing anything.
+ *
+ *        Integers are in the byte order of the host; times are in
+ *        microseconds, and memory is in 64KB pages.
+ *
+ */
+struct SlaRecord
+{
+	static constexpr uint32_t sk_flagHasReqId = 1u << 0;
+	static constexpr uint32_t sk_flagHasResultHash = 1u << 1;
+	static constexpr uint32_t sk_flagCacheHit = 1u << 2;
+	// the abort reason is kept in bits 8 to 15
+	static constexpr uint32_t sk_abortReasonShift = 8;
+	static constexpr uint32_t sk_abortReasonMask = 0xFFu << sk_abortReasonShift;
+
+	uint64_t m_contractId;
+	uint64_t m_reqId;
+	uint64_t m_counter;
+	uint64_t m_billedUnits;
+	uint64_t m_startTime;
+	uint64_t m_endTime;
+	uint64_t m_memPeakPages;
+	int32_t  m_retCode;
+	uint32_t m_flags;
+	// hash of the result, as in the receipt (`ReceiptTree::ResultHash`)
+	uint8_t  m_resultHash[32];
+
+	static SlaRecord FromResult(uint64_t contractId, const EventRunResult& result)
+	{
+		SlaRecord rec;
+		std::memset(&rec, 0, sizeof(SlaRecord));
+
+		rec.m_contractId = contractId;
+		rec.m_reqId = result.m_reqId;
+		rec.m_counter = result.m_counter;
+		rec.m_billedUnits = result.m_billedUnits;
+		rec.m_startTime = result.m_startTime;
+		rec.m_endTime = result.m_endTime;
+		rec.m_memPeakPages = result.m_memPeakPages;
+		rec.m_retCode = result.m_retCode;
+
+		rec.m_flags =
+			(static_cast<uint32_t>(result.m_abortReason) << sk_abortReasonShift) &
+			sk_abortReasonMask;
+		if (result.m_hasReqId)
+		{
+			rec.m_flags |= sk_flagHasReqId;
+		}
+		if (result.m_isCacheHit)
+		{
+			rec.m_flags |= sk_flagCacheHit;
+		}
+		if (result.m_hasResultHash)
+		{
+			rec.m_flags |= sk_flagHasResultHash;
+			std::memcpy(
+				rec.m_resultHash,
+				result.m_resultHash.data(),
+				sizeof(rec.m_resultHash)
+			);
+		}
+		return rec;
+	}
+
+	EventAbortReason GetAbortReason() const
+	{
+		return static_cast<EventAbortReason>(
+			(m_flags & sk_abortReasonMask) >> sk_abortReasonShift
+		);
+	}
+}; // struct SlaRecord
+
+static_assert(sizeof(SlaRecord) == 96, "SlaRecord must have a fixed layout");
+static_assert(
+	std::is_trivially_copyable<SlaRecord>::value,
+	"SlaRecord must be copyable as bytes"
+);
+
+
+} // namespace Common
+} // namespace SLARuntime
+
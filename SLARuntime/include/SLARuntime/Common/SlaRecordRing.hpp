@@ -0,0 +1,473 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <WasmRuntime/Internal/make_unique.hpp>
+#include <WasmRuntime/SystemIO.hpp>
+
+#include <SimpleObjects/SimpleObjects.hpp>
+#include <SimpleJson/SimpleJson.hpp>
+
+#include "CheckpointAccumulator.hpp"
+#include "EventBatch.hpp"
+#include "Logging.hpp"
+#include "SlaRecord.hpp"
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief A bounded lock-free multi-producer/multi-consumer ring of SLA
+ *        records in enclave memory, so reporting a request only costs a
+ *        copy of its record, and the records are consumed in bulk, off the
+ *        request path (see `SlaRecordDrain`).
+ *
+ *        Each cell carries a sequence number, which tells whether it's free
+ *        for the producer at a position, or filled for the consumer at that
+ *        position (D. Vyukov's bounded MPMC queue); producers and consumers
+ *        claim positions with a CAS, and never wait for each other.
+ *
+ *        A record pushed into a full ring is dropped and counted; the ring
+ *        should be sized for the requests done between two drains.
+ *
+ */
+class SlaRecordRing
+{
+public: // static members:
+
+	static constexpr size_t sk_cacheLineSize = 64;
+
+public:
+
+	/**
+	 * @param capacity Number of records; must be a power of 2
+	 */
+	explicit SlaRecordRing(size_t capacity = 4096) :
+		m_cells(),
+		m_mask(capacity - 1),
+		m_enqueuePos(0),
+		m_dequeuePos(0),
+		m_numDropped(0)
+	{
+		if ((capacity == 0) || ((capacity & (capacity - 1)) != 0))
+		{
+			throw std::invalid_argument(
+				"The capacity of the ring must be a power of 2"
+			);
+		}
+		m_cells = ::WasmRuntime::Internal::make_unique<Cell[]>(capacity);
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	SlaRecordRing(const SlaRecordRing&) = delete;
+
+	SlaRecordRing(SlaRecordRing&&) = delete;
+
+	~SlaRecordRing() = default;
+
+	SlaRecordRing& operator=(const SlaRecordRing&) = delete;
+
+	SlaRecordRing& operator=(SlaRecordRing&&) = delete;
+
+	/**
+	 * @return false if the ring is full, and the record is dropped
+	 */
+	bool TryPush(const SlaRecord& rec)
+	{
+		uint64_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell = nullptr;
+		while (true)
+		{
+			cell = &m_cells[pos & m_mask];
+			uint64_t seq = cell->m_seq.load(std::memory_order_acquire);
+			int64_t diff = static_cast<int64_t>(seq - pos);
+			if (diff == 0)
+			{
+				if (m_enqueuePos.compare_exchange_weak(
+					pos,
+					pos + 1,
+					std::memory_order_relaxed
+				))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				m_numDropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->m_rec = rec;
+		cell->m_seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @return false if the ring is empty
+	 */
+	bool TryPop(SlaRecord& rec)
+	{
+		uint64_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		Cell* cell = nullptr;
+		while (true)
+		{
+			cell = &m_cells[pos & m_mask];
+			uint64_t seq = cell->m_seq.load(std::memory_order_acquire);
+			int64_t diff = static_cast<int64_t>(seq - (pos + 1));
+			if (diff == 0)
+			{
+				if (m_dequeuePos.compare_exchange_weak(
+					pos,
+					pos + 1,
+					std::memory_order_relaxed
+				))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		rec = cell->m_rec;
+		cell->m_seq.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief Pop up to `maxNum` records into `out`
+	 *
+	 * @return Number of records popped
+	 */
+	size_t PopBulk(SlaRecord* out, size_t maxNum)
+	{
+		size_t num = 0;
+		while ((num < maxNum) && TryPop(out[num]))
+		{
+			++num;
+		}
+		return num;
+	}
+
+	size_t GetCapacity() const
+	{
+		return m_mask + 1;
+	}
+
+	uint64_t GetNumDropped() const
+	{
+		return m_numDropped.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	struct Cell
+	{
+		std::atomic<uint64_t> m_seq;
+		SlaRecord m_rec;
+	}; // struct Cell
+
+	std::unique_ptr<Cell[]> m_cells;
+	size_t m_mask;
+
+	// the positions are kept on separate cache lines, so that producers and
+	// consumers don't keep invalidating each other's cache line
+	uint8_t m_pad0[sk_cacheLineSize];
+	std::atomic<uint64_t> m_enqueuePos;
+	uint8_t m_pad1[sk_cacheLineSize - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> m_dequeuePos;
+	uint8_t m_pad2[sk_cacheLineSize - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> m_numDropped;
+
+}; // class SlaRecordRing
+
+
+/**
+ * @brief Drains an `SlaRecordRing` in bulk, and hands each batch of records
+ *        to every sink, e.g., the checkpoint logic, an untrusted exporter,
+ *        or the JSON log for debugging.
+ *
+ *        It doesn't create a thread, since an enclave can't; the drain runs
+ *        on the thread that calls `DrainOnce` (e.g., an ecall made by the
+ *        exporter), or `Run`, which keeps draining until `Stop` is called,
+ *        and sleeps through the clock while the ring is empty (producers
+ *        never wake it up, so they never take a lock). Drains are
+ *        serialized, so sinks are never called concurrently.
+ *
+ */
+class SlaRecordDrain
+{
+public: // static members:
+
+	using SinkFunc = std::function<void(const SlaRecord*, size_t)>;
+
+	/**
+	 * @brief Feed a checkpoint accumulator with the records, as
+	 *        `WasmRuntime` does per request when it has no record ring
+	 *
+	 */
+	static SinkFunc MakeCheckpointSink(
+		std::shared_ptr<CheckpointAccumulator> chkptAcc
+	)
+	{
+		return [chkptAcc](const SlaRecord* recs, size_t num)
+		{
+			for (size_t i = 0; i < num; ++i)
+			{
+				chkptAcc->Append(
+					recs[i].m_billedUnits,
+					recs[i].m_endTime - recs[i].m_startTime,
+					recs[i].m_endTime
+				);
+			}
+		};
+	}
+
+	/**
+	 * @brief Log each record as JSON; for debugging only, since it allocates
+	 *        for every record
+	 *
+	 */
+	static SinkFunc MakeJsonLogSink()
+	{
+		auto logger = std::make_shared<Common::Logger>(
+			Common::LoggerFactory::GetLogger("SlaRecord")
+		);
+		return [logger](const SlaRecord* recs, size_t num)
+		{
+			for (size_t i = 0; i < num; ++i)
+			{
+				const SlaRecord& rec = recs[i];
+
+				SimpleObjects::Dict slaRecord;
+				slaRecord[SimpleObjects::String("contractId")] = SimpleObjects::UInt64(rec.m_contractId);
+				slaRecord[SimpleObjects::String("counter")] = SimpleObjects::UInt64(rec.m_counter);
+				slaRecord[SimpleObjects::String("retCode")] = SimpleObjects::Int32(rec.m_retCode);
+				slaRecord[SimpleObjects::String("billedUnits")] = SimpleObjects::UInt64(rec.m_billedUnits);
+				slaRecord[SimpleObjects::String("abortReason")] = SimpleObjects::String(GetAbortReasonStr(rec.GetAbortReason()));
+				slaRecord[SimpleObjects::String("startTime")] = SimpleObjects::UInt64(rec.m_startTime);
+				slaRecord[SimpleObjects::String("endTime")] = SimpleObjects::UInt64(rec.m_endTime);
+				slaRecord[SimpleObjects::String("memPeakPages")] = SimpleObjects::UInt64(rec.m_memPeakPages);
+				slaRecord[SimpleObjects::String("cacheHit")] = SimpleObjects::Bool((rec.m_flags & SlaRecord::sk_flagCacheHit) != 0);
+				if ((rec.m_flags & SlaRecord::sk_flagHasReqId) != 0)
+				{
+					slaRecord[SimpleObjects::String("reqId")] = SimpleObjects::UInt64(rec.m_reqId);
+				}
+
+				logger->Info("SLA record: " + SimpleJson::DumpStr(slaRecord));
+			}
+		};
+	}
+
+public:
+
+	SlaRecordDrain(
+		std::shared_ptr<SlaRecordRing> ring,
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+		size_t maxBatchSize = 256,
+		uint64_t pollIntervalUs = 10 * 1000
+	) :
+		m_logger(Common::LoggerFactory::GetLogger("SlaRecordDrain")),
+		m_ring(std::move(ring)),
+		m_sysIO(std::move(sysIO)),
+		m_pollIntervalUs(pollIntervalUs),
+		m_mutex(),
+		m_cond(),
+		m_sinks(),
+		m_batch(maxBatchSize),
+		m_numDrained(0),
+		m_isStopped(false)
+	{
+		if (m_ring == nullptr)
+		{
+			throw std::invalid_argument("The record ring is not given");
+		}
+		if (m_sysIO == nullptr)
+		{
+			throw std::invalid_argument("The record drain clock is not given");
+		}
+		if (maxBatchSize == 0)
+		{
+			throw std::invalid_argument("A batch must have at least one record");
+		}
+	}
+
+	SlaRecordDrain(const SlaRecordDrain&) = delete;
+
+	SlaRecordDrain(SlaRecordDrain&&) = delete;
+
+	~SlaRecordDrain() = default;
+
+	SlaRecordDrain& operator=(const SlaRecordDrain&) = delete;
+
+	SlaRecordDrain& operator=(SlaRecordDrain&&) = delete;
+
+	void AddSink(SinkFunc sink)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_sinks.push_back(std::move(sink));
+		}
+		m_cond.notify_all();
+	}
+
+	/**
+	 * @brief Drain up to `maxNum` records, in batches, handing each batch to
+	 *        the sinks, and to `extraSink` if given (e.g., to copy them into
+	 *        the buffer of an ecall); a throw by a sink is logged
+	 *
+	 * @return Number of records drained
+	 */
+	size_t DrainOnce(
+		size_t maxNum = SIZE_MAX,
+		const SinkFunc& extraSink = SinkFunc()
+	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		size_t total = 0;
+		while (total < maxNum)
+		{
+			size_t batchSize = maxNum - total;
+			if (batchSize > m_batch.size())
+			{
+				batchSize = m_batch.size();
+			}
+			size_t num = m_ring->PopBulk(m_batch.data(), batchSize);
+			if (num == 0)
+			{
+				break;
+			}
+
+			for (const auto& sink : m_sinks)
+			{
+				CallSink(sink, num);
+			}
+			if (extraSink)
+			{
+				CallSink(extraSink, num);
+			}
+			total += num;
+		}
+		m_numDrained += total;
+		return total;
+	}
+
+	/**
+	 * @brief Keep draining on the calling thread, until `Stop` is called; it
+	 *        blocks while there is no sink, and sleeps for the poll interval
+	 *        once the ring is drained
+	 *
+	 */
+	void Run()
+	{
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(
+					lock,
+					[this]()
+					{
+						return !m_sinks.empty() ||
+							m_isStopped.load(std::memory_order_acquire);
+					}
+				);
+				if (m_isStopped.load(std::memory_order_acquire))
+				{
+					break;
+				}
+			}
+
+			// a full batch may mean there are more records right behind it
+			if (DrainOnce() < m_batch.size())
+			{
+				m_sysIO->SleepUs(m_pollIntervalUs);
+			}
+		}
+		// what's left when it's stopped
+		DrainOnce();
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopped.store(true, std::memory_order_release);
+		}
+		m_cond.notify_all();
+	}
+
+	uint64_t GetNumDrained() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numDrained;
+	}
+
+private:
+
+	void CallSink(const SinkFunc& sink, size_t num)
+	{
+		try
+		{
+			sink(m_batch.data(), num);
+		}
+		catch (const std::exception& e)
+		{
+			m_logger.Error(std::string("Failed to sink SLA records: ") + e.what());
+		}
+	}
+
+	Common::Logger m_logger;
+	std::shared_ptr<SlaRecordRing> m_ring;
+	std::unique_ptr<::WasmRuntime::SystemIO> m_sysIO;
+	uint64_t m_pollIntervalUs;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::vector<SinkFunc> m_sinks;
+	std::vector<SlaRecord> m_batch;
+	uint64_t m_numDrained;
+	std::atomic<bool> m_isStopped;
+
+}; // class SlaRecordDrain
+
+
+} // namespace Common
+} // namespace SLARuntime
+
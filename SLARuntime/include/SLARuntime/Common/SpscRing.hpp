@@ -0,0 +1,260 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief A slot of the ring, carrying one message of at most `_DataSize`
+ *        bytes, tagged with an ID chosen by the producer.
+ *
+ */
+template<size_t _DataSize>
+struct SpscRingSlot
+{
+	uint64_t m_id;
+	uint32_t m_size;
+	uint8_t  m_data[_DataSize];
+}; // struct SpscRingSlot
+
+
+/**
+ * @brief A lock-free single-producer/single-consumer ring buffer, which is
+ *        placed in memory shared by the host and the enclave, so messages
+ *        can be passed without any ecall or ocall.
+ *
+ *        The ring is a plain struct so it has the same layout on both sides;
+ *        it is allocated by the host, and the enclave only gets a pointer to
+ *        it, which must be checked to be outside of the enclave before use.
+ *
+ *        Ownership of a slot is handed over by the head and tail indices:
+ *        the producer only writes slots in [tail, head + N), and the consumer
+ *        only reads slots in [head, tail). A message is always copied out of
+ *        the slot before the head is advanced, so the consumer never works on
+ *        memory the other side may still write to. Since one side may be
+ *        untrusted, the size of a message is read once and bound-checked,
+ *        and the tail is checked against the head on every pop. A consumer
+ *        that doesn't trust the producer (e.g., the enclave) uses
+ *        `SpscRingConsumer`, which keeps the head in its own memory, instead
+ *        of `TryPop`.
+ *
+ */
+template<size_t _NumSlots, size_t _DataSize>
+struct SpscRing
+{
+	static constexpr size_t sk_numSlots = _NumSlots;
+	static constexpr size_t sk_dataSize = _DataSize;
+	static constexpr size_t sk_cacheLineSize = 64;
+
+	using SlotType = SpscRingSlot<_DataSize>;
+
+	static_assert(
+		(_NumSlots != 0) && ((_NumSlots & (_NumSlots - 1)) == 0),
+		"The number of slots must be a power of 2"
+	);
+
+	/**
+	 * @brief Initialize an empty ring; must be called once by the side that
+	 *        allocates it, before it is shared
+	 *
+	 */
+	void Init()
+	{
+		m_head.store(0, std::memory_order_relaxed);
+		m_tail.store(0, std::memory_order_relaxed);
+		m_closed.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	/**
+	 * @brief (Producer only) Push a message into the ring
+	 *
+	 * @return false if the ring is full
+	 */
+	bool TryPush(uint64_t id, const uint8_t* data, size_t size)
+	{
+		if (size > _DataSize)
+		{
+			throw std::invalid_argument("Message is too large for the ring slot");
+		}
+
+		uint64_t tail = m_tail.load(std::memory_order_relaxed);
+		uint64_t head = m_head.load(std::memory_order_acquire);
+		if (tail - head >= _NumSlots)
+		{
+			return false;
+		}
+
+		SlotType& slot = m_slots[tail & (_NumSlots - 1)];
+		slot.m_id = id;
+		slot.m_size = static_cast<uint32_t>(size);
+		std::memcpy(slot.m_data, data, size);
+
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief (Consumer only) Pop a message from the ring, copying it into
+	 *        `dest`; the head is read from the ring
+	 *
+	 * @return false if the ring is empty
+	 */
+	bool TryPop(uint64_t& id, std::vector<uint8_t>& dest)
+	{
+		uint64_t head = m_head.load(std::memory_order_relaxed);
+		return TryPopAt(head, id, dest);
+	}
+
+	/**
+	 * @brief (Consumer only) Pop a message from the ring at the given head,
+	 *        which is kept by the caller, and advanced on success; the new
+	 *        head is published to the ring for the producer, but never read
+	 *        back from it
+	 *
+	 * @return false if the ring is empty
+	 */
+	bool TryPopAt(uint64_t& head, uint64_t& id, std::vector<uint8_t>& dest)
+	{
+		uint64_t tail = m_tail.load(std::memory_order_acquire);
+		if (head == tail)
+		{
+			return false;
+		}
+		if (tail - head > _NumSlots)
+		{
+			throw std::runtime_error("The ring is corrupted");
+		}
+
+		const SlotType& slot = m_slots[head & (_NumSlots - 1)];
+		id = slot.m_id;
+		// read the size only once, so it can't be changed after the check
+		uint32_t size = *static_cast<const volatile uint32_t*>(&slot.m_size);
+		if (size > _DataSize)
+		{
+			throw std::runtime_error("Invalid message size in the ring");
+		}
+		dest.resize(size);
+		std::memcpy(dest.data(), slot.m_data, size);
+
+		++head;
+		m_head.store(head, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief (Producer only) Indicate that no more messages will be pushed
+	 *
+	 */
+	void Close()
+	{
+		m_closed.store(1, std::memory_order_release);
+	}
+
+	/**
+	 * @brief (Consumer only) Check if the producer has closed the ring and all
+	 *        messages have been consumed
+	 *
+	 */
+	bool IsClosedAndEmpty() const
+	{
+		return IsClosedAndEmptyAt(m_head.load(std::memory_order_relaxed));
+	}
+
+	/**
+	 * @brief (Consumer only) `IsClosedAndEmpty`, with the head kept by the
+	 *        caller
+	 *
+	 */
+	bool IsClosedAndEmptyAt(uint64_t head) const
+	{
+		// the closed flag must be read before the tail; otherwise, messages
+		// pushed right before closing could be missed
+		bool closed = m_closed.load(std::memory_order_acquire) != 0;
+		return closed && (head == m_tail.load(std::memory_order_acquire));
+	}
+
+	// head and tail are kept on separate cache lines, so that the producer and
+	// the consumer don't keep invalidating each other's cache line
+
+	std::atomic<uint64_t> m_head;
+	uint8_t m_pad1[sk_cacheLineSize - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> m_tail;
+	uint8_t m_pad2[sk_cacheLineSize - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint32_t> m_closed;
+	uint8_t m_pad3[sk_cacheLineSize - sizeof(std::atomic<uint32_t>)];
+
+	SlotType m_slots[_NumSlots];
+}; // struct SpscRing
+
+
+/**
+ * @brief The consumer end of a ring whose producer isn't trusted: the head is
+ *        kept here (e.g., in enclave memory) and only published to the ring,
+ *        so the producer can't make the consumer read a slot twice, or skip
+ *        one, by changing it. The ring must not have been consumed from
+ *        before, i.e., its head must still be where `Init` left it.
+ *
+ */
+template<typename _RingType>
+class SpscRingConsumer
+{
+public:
+
+	explicit SpscRingConsumer(_RingType& ring) :
+		m_ring(ring),
+		m_head(0)
+	{}
+
+	SpscRingConsumer(const SpscRingConsumer&) = delete;
+
+	SpscRingConsumer(SpscRingConsumer&&) = delete;
+
+	~SpscRingConsumer() = default;
+
+	SpscRingConsumer& operator=(const SpscRingConsumer&) = delete;
+
+	SpscRingConsumer& operator=(SpscRingConsumer&&) = delete;
+
+	/**
+	 * @brief Pop a message from the ring, copying it into `dest`
+	 *
+	 * @return false if the ring is empty
+	 */
+	bool TryPop(uint64_t& id, std::vector<uint8_t>& dest)
+	{
+		return m_ring.TryPopAt(m_head, id, dest);
+	}
+
+	bool IsClosedAndEmpty() const
+	{
+		return m_ring.IsClosedAndEmptyAt(m_head);
+	}
+
+private:
+
+	_RingType& m_ring;
+	uint64_t m_head;
+}; // class SpscRingConsumer
+
+
+} // namespace Common
+} // namespace SLARuntime
+
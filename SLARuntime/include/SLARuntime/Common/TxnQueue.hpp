@@ -0,0 +1,573 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <WasmRuntime/SystemIO.hpp>
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+struct TxnQueueConfig
+{
+	/**
+	 * @brief Number of transactions sent but not confirmed yet; no more are
+	 *        sent until some of them are confirmed
+	 *
+	 */
+	size_t m_maxInFlight = 16;
+
+	uint64_t m_maxFeePerGas = 300000000;
+	uint64_t m_maxPriorFeePerGas = 300000000;
+
+	/**
+	 * @brief How much the fees are raised, in percent, when a transaction is
+	 *        resubmitted; nodes only replace a pending transaction if the fees
+	 *        are raised by at least 10%
+	 *
+	 */
+	uint64_t m_feeBumpPercent = 15;
+
+	/**
+	 * @brief The fees are never raised beyond this
+	 *
+	 */
+	uint64_t m_maxFeePerGasCap = 3000000000;
+
+	/**
+	 * @brief Resubmit a transaction, with raised fees, if it's not confirmed
+	 *        this long after it was sent
+	 *
+	 */
+	uint64_t m_resubmitAfterUs = 30 * 1000 * 1000;
+
+	/**
+	 * @brief Retry to send a transaction this long after sending failed
+	 *
+	 */
+	uint64_t m_retryAfterUs = 1000 * 1000;
+
+	/**
+	 * @brief How long `Run` sleeps (through `SystemIO::SleepUs`) between two
+	 *        rounds while there are transactions in the queue; a transaction
+	 *        submitted during the sleep is sent in the next round
+	 *
+	 */
+	uint64_t m_pollIntervalUs = 10 * 1000;
+
+	/**
+	 * @brief How often the nonce on chain is polled, while there are
+	 *        transactions in the queue; each poll is a round trip to the node
+	 *
+	 */
+	uint64_t m_noncePollIntervalUs = 1000 * 1000;
+}; // struct TxnQueueConfig
+
+
+struct TxnQueueStats
+{
+	uint64_t m_numSubmitted = 0;
+	uint64_t m_numSent = 0;
+	uint64_t m_numResubmitted = 0;
+	uint64_t m_numFailedSends = 0;
+	uint64_t m_numConfirmed = 0;
+	uint64_t m_numRenumbered = 0;
+	uint64_t m_numNoncePolls = 0;
+	uint64_t m_numFailedNoncePolls = 0;
+
+	size_t m_numQueued = 0;
+	size_t m_numInFlight = 0;
+
+	// from the submission to the confirmation
+	uint64_t m_sumLatencyUs = 0;
+	uint64_t m_maxLatencyUs = 0;
+
+	uint64_t GetAvgLatencyUs() const
+	{
+		return (m_numConfirmed == 0) ? 0 : (m_sumLatencyUs / m_numConfirmed);
+	}
+}; // struct TxnQueueStats
+
+
+/**
+ * @brief Signs and sends transactions in the background, so the callers of
+ *        `Submit` never wait for the chain, with several transactions in
+ *        flight at a time.
+ *
+ *        Nonces are given out in the order transactions are submitted, and
+ *        transactions are sent in nonce order; a transaction is kept until
+ *        its nonce is known to be used on chain (see `ReconcileNonce`), so
+ *        one that failed to be sent, or was dropped, is sent again, with
+ *        raised fees if it was sent before, instead of leaving a gap that
+ *        blocks all the later ones. Transactions whose nonces were taken by
+ *        someone else (e.g., the same key used elsewhere) are given new ones.
+ *        Thus, the queue needs a nonce source; a send that failed may still
+ *        have reached the node, and only the chain can tell.
+ *
+ *        The queue doesn't create a thread, since an enclave can't; a thread
+ *        that enters the enclave calls `Run`, which only returns after `Stop`
+ *        is called, and sleeps through the clock between rounds.
+ *        `ProcessOnce` can be called instead from any thread that's otherwise
+ *        idle.
+ *
+ */
+class TxnQueue
+{
+public: // static members:
+
+	/**
+	 * @brief Build and sign the transaction with the given nonce, max fee per
+	 *        gas, and max priority fee per gas
+	 *
+	 * @return The signed transaction, serialized
+	 */
+	using BuildFunc = std::function<
+		std::vector<uint8_t>(uint64_t, uint64_t, uint64_t)
+	>;
+
+	/**
+	 * @brief Send a signed transaction; throws if it couldn't be sent
+	 *
+	 */
+	using SendFunc = std::function<void(const std::vector<uint8_t>&)>;
+
+	/**
+	 * @brief Get the nonce of the account on chain, i.e., the number of its
+	 *        confirmed transactions; throws if it can't be learned
+	 *
+	 */
+	using NonceFunc = std::function<uint64_t()>;
+
+public:
+
+	TxnQueue(
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
+		SendFunc sendFunc,
+		NonceFunc nonceFunc,
+		uint64_t firstNonce,
+		const TxnQueueConfig& config = TxnQueueConfig()
+	) :
+		m_sysIO(std::move(sysIO)),
+		m_sendFunc(std::move(sendFunc)),
+		m_nonceFunc(std::move(nonceFunc)),
+		m_config(config),
+		m_mutex(),
+		m_cond(),
+		m_txns(),
+		m_nextNonce(firstNonce),
+		m_nextNoncePollUs(0),
+		m_stats(),
+		m_hasNewTxn(false),
+		m_isStopped(false)
+	{
+		if (m_sysIO == nullptr)
+		{
+			throw std::invalid_argument("The transaction queue clock is not given");
+		}
+		if (!m_nonceFunc)
+		{
+			throw std::invalid_argument(
+				"The transaction queue nonce source is not given"
+			);
+		}
+		if (m_config.m_maxInFlight == 0)
+		{
+			throw std::invalid_argument(
+				"At least one transaction must be allowed in flight"
+			);
+		}
+	}
+
+	TxnQueue(const TxnQueue&) = delete;
+
+	TxnQueue(TxnQueue&&) = delete;
+
+	~TxnQueue() = default;
+
+	TxnQueue& operator=(const TxnQueue&) = delete;
+
+	TxnQueue& operator=(TxnQueue&&) = delete;
+
+	/**
+	 * @brief Queue a transaction; it returns right away
+	 *
+	 * @return The nonce given to the transaction, which may change if it's
+	 *         taken by someone else before the transaction is sent
+	 */
+	uint64_t Submit(BuildFunc buildFunc)
+	{
+		uint64_t nonce = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			nonce = m_nextNonce++;
+
+			Txn& txn = m_txns[nonce];
+			txn.m_build = std::move(buildFunc);
+			txn.m_maxFeePerGas = m_config.m_maxFeePerGas;
+			txn.m_maxPriorFeePerGas = m_config.m_maxPriorFeePerGas;
+			txn.m_submitUs = m_sysIO->GetTimestampUs();
+
+			++m_stats.m_numSubmitted;
+			m_hasNewTxn = true;
+		}
+		m_cond.notify_all();
+		return nonce;
+	}
+
+	/**
+	 * @brief Learn the nonce of the account on chain: transactions below it
+	 *        are confirmed, and the ones never tried yet get new nonces; a
+	 *        transaction whose send failed may still have reached the node,
+	 *        so it's taken as confirmed rather than sent twice
+	 *
+	 */
+	void ReconcileNonce(uint64_t chainNonce)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		uint64_t nowUs = m_sysIO->GetTimestampUs();
+
+		std::vector<Txn> renumbered;
+		auto it = m_txns.begin();
+		while (it != m_txns.end() && it->first < chainNonce)
+		{
+			const Txn& txn = it->second;
+			if ((txn.m_numSends > 0) || txn.m_hasFailed || txn.m_isSending)
+			{
+				++m_stats.m_numConfirmed;
+				RecordLatency(nowUs - txn.m_submitUs);
+			}
+			else
+			{
+				// never tried, so the nonce was used by someone else
+				renumbered.push_back(std::move(it->second));
+			}
+			it = m_txns.erase(it);
+		}
+
+		m_nextNonce = std::max(m_nextNonce, chainNonce);
+		for (auto& txn : renumbered)
+		{
+			m_txns[m_nextNonce++] = std::move(txn);
+			++m_stats.m_numRenumbered;
+		}
+	}
+
+	/**
+	 * @brief Poll the nonce on chain (if it's due), and send the
+	 *        transactions that are due
+	 *
+	 * @return Number of transactions sent
+	 */
+	size_t ProcessOnce()
+	{
+		if (IsNoncePollDue())
+		{
+			try
+			{
+				ReconcileNonce(m_nonceFunc());
+			}
+			catch (const std::exception&)
+			{
+				// try again in the next poll
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_stats.m_numFailedNoncePolls;
+			}
+		}
+
+		std::vector<Job> jobs = CollectJobs();
+
+		size_t numSent = 0;
+		for (auto& job : jobs)
+		{
+			bool isSent = false;
+			try
+			{
+				m_sendFunc(
+					job.m_build(job.m_nonce, job.m_maxFeePerGas, job.m_maxPriorFeePerGas)
+				);
+				isSent = true;
+				++numSent;
+			}
+			catch (const std::exception&)
+			{}
+
+			FinishJob(job, isSent);
+			if (!isSent)
+			{
+				// later nonces would only be stuck behind this one
+				break;
+			}
+		}
+		return numSent;
+	}
+
+	/**
+	 * @brief Process the queue until `Stop` is called; it blocks while
+	 *        nothing is queued, and sleeps for the poll interval between
+	 *        rounds otherwise, unless a transaction was submitted during the
+	 *        last round
+	 *
+	 */
+	void Run()
+	{
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(
+					lock,
+					[this]()
+					{
+						return !m_txns.empty() ||
+							m_isStopped.load(std::memory_order_acquire);
+					}
+				);
+				if (m_isStopped.load(std::memory_order_acquire))
+				{
+					return;
+				}
+				// the ones submitted from now on are sent in the next round
+				m_hasNewTxn = false;
+			}
+
+			ProcessOnce();
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_hasNewTxn || m_isStopped.load(std::memory_order_acquire))
+				{
+					continue;
+				}
+			}
+			m_sysIO->SleepUs(m_config.m_pollIntervalUs);
+		}
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopped.store(true, std::memory_order_release);
+		}
+		m_cond.notify_all();
+	}
+
+	TxnQueueStats GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		TxnQueueStats stats = m_stats;
+		for (const auto& item : m_txns)
+		{
+			if (item.second.m_numSends > 0)
+			{
+				++stats.m_numInFlight;
+			}
+			else
+			{
+				++stats.m_numQueued;
+			}
+		}
+		return stats;
+	}
+
+private:
+
+	struct Txn
+	{
+		BuildFunc m_build;
+		uint64_t m_maxFeePerGas = 0;
+		uint64_t m_maxPriorFeePerGas = 0;
+		uint64_t m_submitUs = 0;
+		uint64_t m_lastTryUs = 0;
+		size_t m_numSends = 0;
+		bool m_isSending = false;
+		bool m_hasFailed = false;
+	}; // struct Txn
+
+	struct Job
+	{
+		uint64_t m_nonce;
+		BuildFunc m_build;
+		uint64_t m_maxFeePerGas;
+		uint64_t m_maxPriorFeePerGas;
+	}; // struct Job
+
+	/**
+	 * @brief Whether the nonce on chain should be polled now; there is no
+	 *        need while the queue is empty
+	 *
+	 */
+	bool IsNoncePollDue()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		uint64_t nowUs = m_sysIO->GetTimestampUs();
+		if (m_txns.empty() || (nowUs < m_nextNoncePollUs))
+		{
+			return false;
+		}
+		m_nextNoncePollUs = nowUs + m_config.m_noncePollIntervalUs;
+		++m_stats.m_numNoncePolls;
+		return true;
+	}
+
+	static uint64_t BumpFee(uint64_t fee, uint64_t percent, uint64_t cap)
+	{
+		uint64_t bumped = fee + ((fee * percent) + 99) / 100;
+		return std::min(std::max(bumped, fee), std::max(cap, fee));
+	}
+
+	/**
+	 * @brief The transactions to send in this round, in nonce order: the
+	 *        ones not sent yet (up to the in-flight limit), and the ones in
+	 *        flight for too long, with raised fees
+	 *
+	 */
+	std::vector<Job> CollectJobs()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		uint64_t nowUs = m_sysIO->GetTimestampUs();
+
+		size_t numInFlight = 0;
+		for (const auto& item : m_txns)
+		{
+			numInFlight += (item.second.m_numSends > 0) ? 1 : 0;
+		}
+
+		std::vector<Job> jobs;
+		for (auto& item : m_txns)
+		{
+			Txn& txn = item.second;
+			if (txn.m_isSending)
+			{
+				continue;
+			}
+
+			if (txn.m_numSends == 0)
+			{
+				if (
+					(numInFlight >= m_config.m_maxInFlight) ||
+					(txn.m_hasFailed &&
+						(nowUs - txn.m_lastTryUs < m_config.m_retryAfterUs))
+				)
+				{
+					// keep the nonce order
+					break;
+				}
+				++numInFlight;
+			}
+			else if (nowUs - txn.m_lastTryUs < m_config.m_resubmitAfterUs)
+			{
+				continue;
+			}
+			else
+			{
+				txn.m_maxFeePerGas = BumpFee(
+					txn.m_maxFeePerGas,
+					m_config.m_feeBumpPercent,
+					m_config.m_maxFeePerGasCap
+				);
+				txn.m_maxPriorFeePerGas = std::min(
+					BumpFee(
+						txn.m_maxPriorFeePerGas,
+						m_config.m_feeBumpPercent,
+						m_config.m_maxFeePerGasCap
+					),
+					txn.m_maxFeePerGas
+				);
+				++m_stats.m_numResubmitted;
+			}
+
+			txn.m_isSending = true;
+			jobs.push_back(Job{
+				item.first,
+				txn.m_build,
+				txn.m_maxFeePerGas,
+				txn.m_maxPriorFeePerGas
+			});
+		}
+
+		return jobs;
+	}
+
+	void FinishJob(const Job& job, bool isSent)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		uint64_t nowUs = m_sysIO->GetTimestampUs();
+
+		auto it = m_txns.find(job.m_nonce);
+		if (it == m_txns.end())
+		{
+			// confirmed meanwhile
+			return;
+		}
+		Txn& txn = it->second;
+		txn.m_isSending = false;
+		txn.m_lastTryUs = nowUs;
+
+		if (!isSent)
+		{
+			txn.m_hasFailed = true;
+			++m_stats.m_numFailedSends;
+			return;
+		}
+
+		txn.m_hasFailed = false;
+		++txn.m_numSends;
+		++m_stats.m_numSent;
+	}
+
+	void RecordLatency(uint64_t latencyUs)
+	{
+		m_stats.m_sumLatencyUs += latencyUs;
+		m_stats.m_maxLatencyUs = std::max(m_stats.m_maxLatencyUs, latencyUs);
+	}
+
+	std::unique_ptr<::WasmRuntime::SystemIO> m_sysIO;
+	SendFunc m_sendFunc;
+	NonceFunc m_nonceFunc;
+	TxnQueueConfig m_config;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	// by nonce
+	std::map<uint64_t, Txn> m_txns;
+	uint64_t m_nextNonce;
+	uint64_t m_nextNoncePollUs;
+	TxnQueueStats m_stats;
+	// a transaction was submitted since the last round of `Run`
+	bool m_hasNewTxn;
+
+	std::atomic<bool> m_isStopped;
+
+}; // class TxnQueue
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -8,6 +8,8 @@
 
 #include <cstdint>
 
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <WasmWat/WasmWat.h>
@@ -22,8 +24,20 @@ namespace WasmCounter
 {
 
 
+/**
+ * @brief Instrument the given module
+ *
+ * @param outFuncNames If given, it receives the names of the functions of the
+ *                     instrumented module, indexed by function index
+ * @param outImportFuncs If given, it receives the functions imported by the
+ *                       module, as (module name, field name)
+ */
 inline std::vector<uint8_t> InstrumentWasm(
-	const std::vector<uint8_t>& wasmCode
+	const std::vector<uint8_t>& wasmCode,
+	std::vector<std::string>* outFuncNames = nullptr,
+	const ::WasmCounter::InstrumentConfig& config =
+		::WasmCounter::InstrumentConfig(),
+	std::vector<std::pair<std::string, std::string> >* outImportFuncs = nullptr
 )
 {
 	auto mod = WasmWat::Wasm2Mod(
@@ -32,7 +46,16 @@ inline std::vector<uint8_t> InstrumentWasm(
 		WasmWat::ReadWasmConfig()
 	);
 
-	WasmCounter::Instrument(*(mod.m_ptr));
+	::WasmCounter::Instrument(*(mod.m_ptr), nullptr, config);
+
+	if (outFuncNames != nullptr)
+	{
+		*outFuncNames = ::WasmCounter::GetFuncNames(*(mod.m_ptr));
+	}
+	if (outImportFuncs != nullptr)
+	{
+		*outImportFuncs = ::WasmCounter::GetImportFuncs(*(mod.m_ptr));
+	}
 
 	auto instWasmCode = WasmWat::Mod2Wasm(
 		*(mod.m_ptr),
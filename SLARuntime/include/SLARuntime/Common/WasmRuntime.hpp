@@ -7,18 +7,41 @@
 
 
 #include <cstddef>
+#include <cstdint>
 
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+#include <WasmRuntime/BudgetGate.hpp>
+#include <WasmRuntime/EventDataStream.hpp>
+#include <WasmRuntime/FuncCost.hpp>
+#include <WasmRuntime/GuestOutputBuffer.hpp>
+#include <WasmRuntime/HeapStats.hpp>
 #include <WasmRuntime/Internal/make_unique.hpp>
 #include <WasmRuntime/MainRunner.hpp>
+#include <WasmRuntime/SamplingProfiler.hpp>
 #include <WasmRuntime/SharedWasmRuntime.hpp>
 #include <WasmRuntime/SystemIO.hpp>
+#include <WasmRuntime/WasmRuntimeArenaHeap.hpp>
 #include <WasmRuntime/WasmRuntimeStaticHeap.hpp>
 
 #include <SimpleObjects/SimpleObjects.hpp>
 #include <SimpleJson/SimpleJson.hpp>
 
+#include "CheckpointAccumulator.hpp"
+#include "CostModel.hpp"
+#include "EventBatch.hpp"
+#include "ExecWatchdog.hpp"
+#include "ReceiptTree.hpp"
+#include "ResultCache.hpp"
+#include "SlaRecordRing.hpp"
 #include "WasmCounter.hpp"
 #include "Logging.hpp"
 
@@ -29,6 +52,22 @@ namespace Common
 {
 
 
+/**
+ * @brief Runs the requests to one loaded WASM module.
+ *
+ *        `RunModule`, `RunModuleStream`, `RunModuleBatch`, `NewInstance`,
+ *        and `RunOnInstance` can be called by several threads at once, each
+ *        holding a `::WasmRuntime::WasmThreadEnv` (except for the thread
+ *        that initialized WAMR), and each on its own instances. The loaded
+ *        module is guarded by a lock, and is only read by instantiation;
+ *        a running instance keeps the module it was created from alive, so
+ *        a module can be loaded while requests are running. Everything else
+ *        requests share (accumulators, cost model, watchdog, result cache)
+ *        does its own locking, and the SLA record ring is lock-free. The
+ *        `Set*` and `Enable*` configuration methods must be called before
+ *        requests start.
+ *
+ */
 class WasmRuntime
 {
 public: // static members:
@@ -39,26 +78,162 @@ public: // static members:
 		return sk_globalCounterName;
 	}
 
+	static const std::string& sk_globalThresholdName()
+	{
+		static const std::string sk_globalThresholdName = "enclave_wasm_threshold";
+		return sk_globalThresholdName;
+	}
+
+	static const std::string& sk_globalMemPagesName()
+	{
+		static const std::string sk_globalMemPagesName = "enclave_wasm_mem_pages";
+		return sk_globalMemPagesName;
+	}
+
+	static const std::string& sk_globalMemPeakPagesName()
+	{
+		static const std::string sk_globalMemPeakPagesName = "enclave_wasm_mem_peak_pages";
+		return sk_globalMemPeakPagesName;
+	}
+
+	static const std::string& sk_globalMemPageCounterName()
+	{
+		static const std::string sk_globalMemPageCounterName = "enclave_wasm_mem_page_counter";
+		return sk_globalMemPageCounterName;
+	}
+
+	static const std::string& sk_globalMemLastCounterName()
+	{
+		static const std::string sk_globalMemLastCounterName = "enclave_wasm_mem_last_counter";
+		return sk_globalMemLastCounterName;
+	}
+
+	/**
+	 * @brief Natives that let a module tell two executions of the same
+	 *        request apart, so its results can't be cached
+	 *
+	 */
+	static const std::vector<std::string>& sk_nonDetNatives()
+	{
+		static const std::vector<std::string> sk_nonDetNatives = {
+			"enclave_wasm_start_benchmark",
+			"enclave_wasm_stop_benchmark",
+		};
+		return sk_nonDetNatives;
+	}
+
+	/**
+	 * @brief The return code recorded for an event that trapped, when the
+	 *        result is reported instead of the error being thrown
+	 *
+	 */
+	static constexpr int32_t sk_batchTrapRetCode = INT32_MIN;
+
+	/**
+	 * @brief The return code recorded for an event that was terminated by
+	 *        the watchdog for passing its deadline
+	 *
+	 */
+	static constexpr int32_t sk_batchDeadlineRetCode = INT32_MIN + 1;
+
+	/**
+	 * @brief Receives the result set by the module (with
+	 *        `enclave_wasm_set_result`), right after the execution, as a view
+	 *        into its linear memory, which is only valid during the call;
+	 *        e.g., to copy or encrypt it straight into an output buffer
+	 *
+	 */
+	using ResultSink = std::function<void(const uint8_t*, size_t)>;
+
+	/**
+	 * @brief The budget gate of one run of `RunModule` or `RunModuleStream`,
+	 *        made by `NewSuspendHandle` and given to the run; another thread
+	 *        uses it to wait for that run to pause (`WaitForSuspendOrDone`),
+	 *        and to `Resume` or `Abort` it
+	 *
+	 */
+	using SuspendHandle = std::shared_ptr<::WasmRuntime::BudgetGate>;
+
 public:
 
 	WasmRuntime(
-		std::unique_ptr<WasmRuntime::SystemIO> sysIO,
+		std::unique_ptr<::WasmRuntime::SystemIO> sysIO,
 		size_t heapSize,
 		uint32_t modStackSize,
 		uint32_t modHeapSize,
 		uint32_t execStackSize
 	) :
-		m_logger(Common::LoggerFactory::GetLogger("WasmRuntime")),
-		m_wrt(
-			WasmRuntime::WasmRuntimeStaticHeap::MakeUnique(
+		WasmRuntime(
+			::WasmRuntime::WasmRuntimeStaticHeap::MakeUnique(
 				std::move(sysIO),
-				heapSize
-			)
-		),
+				static_cast<uint32_t>(heapSize)
+			),
+			modStackSize,
+			modHeapSize,
+			execStackSize
+		)
+	{}
+
+	/**
+	 * @brief Construct with a runtime of any heap type, e.g.,
+	 *        `WasmRuntimeArenaHeap` when modules are run by multiple threads
+	 *
+	 */
+	WasmRuntime(
+		std::unique_ptr<::WasmRuntime::WasmRuntime> wrt,
+		uint32_t modStackSize,
+		uint32_t modHeapSize,
+		uint32_t execStackSize
+	) :
+		WasmRuntime(
+			::WasmRuntime::SharedWasmRuntime(std::move(wrt)),
+			modStackSize,
+			modHeapSize,
+			execStackSize
+		)
+	{}
+
+	/**
+	 * @brief Construct with a runtime that is shared with other instances of
+	 *        this class, each loading its own module (e.g., by
+	 *        `ModuleRegistry`), since WAMR can only be initialized once per
+	 *        process
+	 *
+	 */
+	WasmRuntime(
+		::WasmRuntime::SharedWasmRuntime wrt,
+		uint32_t modStackSize,
+		uint32_t modHeapSize,
+		uint32_t execStackSize
+	) :
+		m_logger(Common::LoggerFactory::GetLogger("WasmRuntime")),
+		m_wrt(std::move(wrt)),
 		m_modStackSize(modStackSize),
 		m_modHeapSize(modHeapSize),
 		m_execStackSize(execStackSize),
+		m_outputConfig(),
+		m_watchdogMutex(),
+		m_watchdog(),
+		m_deadlineUs(0),
+		m_hasExecuted(false),
+		m_isSuspendEnabled(false),
+		m_suspendPolicy(),
+		m_isMemAccountingEnabled(false),
+		m_memPageCountPerUnit(0),
+		m_profiler(),
+		m_funcCostTopN(0),
+		m_resultCache(),
+		m_chkptAcc(),
+		m_receiptAcc(),
+		m_costModel(),
+		m_slaRecordRing(),
+		m_contractId(0),
+		m_isSlaReportLogged(false),
 
+		m_modMutex(),
+		m_funcNames(),
+		m_modHash(),
+		m_isModDeterministic(false),
 		m_mod(nullptr)
 	{}
 
@@ -68,79 +243,1191 @@ public:
 	void LoadPlainModule(const std::vector<uint8_t>& bytecode)
 	{
 		m_logger.Debug("Instrumenting wasm...");
+		::WasmCounter::InstrumentConfig instConfig;
+		instConfig.m_enableFuncCost = (m_funcCostTopN != 0);
+		instConfig.m_enableMemAccounting = m_isMemAccountingEnabled;
+
+		std::vector<std::string> funcNames;
+		std::vector<std::pair<std::string, std::string> > importFuncs;
 		std::vector<uint8_t> instrumentedWasm =
-			SLARuntime::Common::WasmCounter::InstrumentWasm(bytecode);
+			SLARuntime::Common::WasmCounter::InstrumentWasm(
+				bytecode,
+				&funcNames,
+				instConfig,
+				&importFuncs
+			);
 		m_logger.Debug("Instrumentation done.");
 
 		LoadInstModule(instrumentedWasm);
+		SetFuncNames(std::move(funcNames));
+
+		std::lock_guard<std::mutex> lock(m_modMutex);
+		m_isModDeterministic = IsDeterministic(importFuncs);
 	}
 
+	/**
+	 * @brief Load a module that is already instrumented; its imports are not
+	 *        known, so its results are never cached
+	 *
+	 */
 	void LoadInstModule(const std::vector<uint8_t>& bytecode)
 	{
-		m_mod = m_wrt.LoadModule(bytecode);
+		auto mod = m_wrt.LoadModule(bytecode);
+		std::string modHash;
+		if (m_resultCache != nullptr)
+		{
+			modHash = ResultCache::HashModule(bytecode);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_modMutex);
+			// instances of the old module keep it alive until they're gone
+			m_mod = std::move(mod);
+			m_modHash = std::move(modHash);
+			m_isModDeterministic = false;
+		}
+		SetFuncNames(std::vector<std::string>());
+
+		if (m_costModel != nullptr)
+		{
+			m_costModel->Reset();
+		}
+		if (m_resultCache != nullptr)
+		{
+			m_resultCache->Clear();
+		}
+	}
+
+	/**
+	 * @brief Get the heap usage of the runtime (high-water mark and
+	 *        fragmentation), to size the heap from data
+	 *
+	 */
+	::WasmRuntime::HeapStats GetHeapStats() const
+	{
+		return m_wrt->GetHeapStats();
+	}
+
+	/**
+	 * @brief Set how the output printed by modules is buffered and budgeted;
+	 *        applies to instances created afterwards
+	 *
+	 */
+	void SetGuestOutputConfig(const ::WasmRuntime::GuestOutputConfig& config)
+	{
+		m_outputConfig = config;
+	}
+
+	/**
+	 * @brief Have every execution of this contract watched by the given
+	 *        watchdog, which terminates it after `deadlineUs`; it's refused
+	 *        once an execution has started, since executions in flight would
+	 *        be watched by some other deadline (or not at all)
+	 *
+	 */
+	void SetWatchdog(std::shared_ptr<ExecWatchdog> watchdog, uint64_t deadlineUs)
+	{
+		std::lock_guard<std::mutex> lock(m_watchdogMutex);
+		if (m_hasExecuted)
+		{
+			throw std::logic_error(
+				"The watchdog must be set before any execution starts"
+			);
+		}
+		m_watchdog = std::move(watchdog);
+		m_deadlineUs = deadlineUs;
+	}
+
+	/**
+	 * @brief Make `RunModule` and `RunModuleStream` pause when they run out of
+	 *        budget, instead of aborting. Each run has a gate of its own: a
+	 *        run given a handle from `NewSuspendHandle` continues after
+	 *        `Resume` is called on that handle from another thread; any run
+	 *        continues when the given policy (if any) gives it more budget,
+	 *        and a run with neither is aborted as before. Executions on
+	 *        `Instance`s are not affected.
+	 *
+	 *        Note that a watchdog deadline includes the time spent paused.
+	 *
+	 */
+	void EnableSuspend(
+		::WasmRuntime::BudgetGate::Policy policy = ::WasmRuntime::BudgetGate::Policy()
+	)
+	{
+		m_suspendPolicy = std::move(policy);
+		m_isSuspendEnabled = true;
+	}
+
+	/**
+	 * @brief Make a handle for one run of `RunModule` or `RunModuleStream`;
+	 *        a handle can be reused once its run is done
+	 *
+	 */
+	SuspendHandle NewSuspendHandle() const
+	{
+		if (!m_isSuspendEnabled)
+		{
+			throw std::logic_error("Suspending on budget exhaustion is not enabled");
+		}
+		SuspendHandle handle = std::make_shared<::WasmRuntime::BudgetGate>();
+		handle->SetPolicy(m_suspendPolicy);
+		return handle;
+	}
+
+	/**
+	 * @brief Track the memory pages used by each run, for the SLA report and
+	 *        for billing memory; it applies to modules loaded with
+	 *        `LoadPlainModule` afterwards, and adds code after each
+	 *        `memory.grow`
+	 *
+	 */
+	void EnableMemAccounting()
+	{
+		m_isMemAccountingEnabled = true;
+	}
+
+	/**
+	 * @brief Bill memory along with instructions: every `pageCountPerUnit`
+	 *        pages held for one instruction add one unit, e.g., with 1024, a
+	 *        module holding 64MB pays twice as much as for its instructions
+	 *        alone; 0 (the default) doesn't bill memory. A price turns on
+	 *        `EnableMemAccounting`, so it must be set before the module is
+	 *        loaded.
+	 *
+	 */
+	void SetMemoryPrice(uint64_t pageCountPerUnit)
+	{
+		m_memPageCountPerUnit = pageCountPerUnit;
+		if (pageCountPerUnit != 0)
+		{
+			EnableMemAccounting();
+		}
+	}
+
+	/**
+	 * @brief Sample the call stack of `RunModule` and `RunModuleStream` every
+	 *        `samplePeriod` units, to show what the units are spent on; a
+	 *        smaller period gives a finer profile at a higher overhead
+	 *
+	 */
+	void EnableProfiling(uint64_t samplePeriod)
+	{
+		m_profiler = std::make_shared<::WasmRuntime::SamplingProfiler>(samplePeriod);
+
+		std::lock_guard<std::mutex> lock(m_modMutex);
+		m_profiler->SetFuncNames(m_funcNames);
+	}
+
+	/**
+	 * @brief Count the cost of each function, and put the `topN` most costly
+	 *        ones in the SLA report; 0 (the default) turns it off. It applies
+	 *        to modules loaded with `LoadPlainModule` afterwards, and costs one
+	 *        more add per counted block.
+	 *
+	 */
+	void SetFuncCostTopN(size_t topN)
+	{
+		m_funcCostTopN = topN;
+	}
+
+	/**
+	 * @brief Answer repeated requests to `RunModule` (same module, event ID,
+	 *        and data) from a cache of results, without executing them; only
+	 *        modules loaded with `LoadPlainModule` afterwards, that don't
+	 *        import non-deterministic natives (see `sk_nonDetNatives`), are
+	 *        cached, and only executions that ran to completion. It must be
+	 *        enabled before the module is loaded.
+	 *        A cached result is only used if its counter is within the
+	 *        threshold of the request.
+	 *
+	 */
+	void EnableResultCache(const ResultCacheConfig& config = ResultCacheConfig())
+	{
+		m_resultCache = std::make_shared<ResultCache>(config);
+	}
+
+	/**
+	 * @brief The result cache, or null if it's not enabled
+	 *
+	 */
+	const std::shared_ptr<ResultCache>& GetResultCache() const
+	{
+		return m_resultCache;
+	}
+
+	/**
+	 * @brief Learn the cost of the module from every request that runs to
+	 *        the end, as a function of the size of its event, so the cost of
+	 *        a request can be predicted before it's run (see `PredictCost`)
+	 *
+	 */
+	void EnableCostModel(const CostModelConfig& config = CostModelConfig())
+	{
+		m_costModel = std::make_shared<CostModel>(config);
+	}
+
+	const std::shared_ptr<CostModel>& GetCostModel() const
+	{
+		return m_costModel;
+	}
+
+	/**
+	 * @brief Predict the cost of a request with an event of the given size
+	 *        (data, or stream); unknown if the cost model is not enabled, or
+	 *        hasn't learned enough requests yet
+	 *
+	 */
+	CostPrediction PredictCost(uint64_t eventSize) const
+	{
+		return (m_costModel == nullptr) ?
+			CostPrediction() :
+			m_costModel->Predict(eventSize);
+	}
+
+	/**
+	 * @brief A threshold that a request with an event of the given size is
+	 *        very unlikely to exceed, from the cost model; no limit if the
+	 *        cost isn't known
+	 *
+	 */
+	uint64_t GetAutoThreshold(uint64_t eventSize) const
+	{
+		return (m_costModel == nullptr) ?
+			std::numeric_limits<uint64_t>::max() :
+			m_costModel->GetThreshold(eventSize);
+	}
+
+	/**
+	 * @brief Add an entry for every request run by `RunModule`,
+	 *        `RunModuleStream`, and `RunModuleBatch` (per event) to the given
+	 *        accumulator, with the units billed and the time elapsed; e.g.,
+	 *        one made by `MakeCheckpointAccumulator` for the SLA contract of
+	 *        this runtime. With an SLA record ring, the accumulator is fed by
+	 *        the drain of the ring instead (see
+	 *        `SlaRecordDrain::MakeCheckpointSink`). Requests only queue the
+	 *        reports; they're sent by the accumulator's `Run` or
+	 *        `SendPending`.
+	 *
+	 *        It can't be used along with `SetReceiptAccumulator`, since
+	 *        reports and commits share the checkpoint sequence of the SLA
+	 *        contract.
+	 *
+	 */
+	void SetCheckpointAccumulator(std::shared_ptr<CheckpointAccumulator> chkptAcc)
+	{
+		if ((chkptAcc != nullptr) && (m_receiptAcc != nullptr))
+		{
+			throw std::logic_error(
+				"Checkpoint reports can't be sent along with receipt commits"
+			);
+		}
+		m_chkptAcc = std::move(chkptAcc);
+	}
+
+	/**
+	 * @brief Keep a receipt for every request, as `SetCheckpointAccumulator`
+	 *        does with entries, with the hash of its result (return code and
+	 *        output); each request is given a request ID, which is put in its
+	 *        SLA report. It can't be used along with
+	 *        `SetCheckpointAccumulator`.
+	 *
+	 */
+	void SetReceiptAccumulator(std::shared_ptr<ReceiptAccumulator> receiptAcc)
+	{
+		if ((receiptAcc != nullptr) && (m_chkptAcc != nullptr))
+		{
+			throw std::logic_error(
+				"Receipt commits can't be sent along with checkpoint reports"
+			);
+		}
+		m_receiptAcc = std::move(receiptAcc);
+	}
+
+	/**
+	 * @brief Push a fixed-layout record of every request (see `SlaRecord`)
+	 *        into the given ring, to be drained in bulk by a `SlaRecordDrain`
+	 *
+	 * @param contractId The SLA contract the records are for
+	 */
+	void SetSlaRecordRing(std::shared_ptr<SlaRecordRing> ring, uint64_t contractId)
+	{
+		m_slaRecordRing = std::move(ring);
+		m_contractId = contractId;
+	}
+
+	/**
+	 * @brief Log the SLA report of every request as JSON, which is off by
+	 *        default; it's meant for debugging, since it allocates and makes
+	 *        an ocall per request. With an SLA record ring, a log sink on its
+	 *        drain (see `SlaRecordDrain::MakeJsonLogSink`) keeps it off the
+	 *        request path
+	 *
+	 */
+	void SetSlaReportLogging(bool isLogged)
+	{
+		m_isSlaReportLogged = isLogged;
+	}
+
+	/**
+	 * @brief The proof that the given request is in its committed checkpoint,
+	 *        to settle a dispute on the units it actually used
+	 *
+	 */
+	ReceiptProof GetReceiptProof(uint64_t reqId) const
+	{
+		if (m_receiptAcc == nullptr)
+		{
+			throw std::logic_error("Receipts are not enabled");
+		}
+		return m_receiptAcc->GetProof(reqId);
+	}
+
+	::WasmRuntime::SamplingProfiler& GetProfiler()
+	{
+		if (m_profiler == nullptr)
+		{
+			throw std::logic_error("Profiling is not enabled");
+		}
+		return *m_profiler;
+	}
+
+	/**
+	 * @brief Log the profile collected so far, as collapsed stacks, which
+	 *        can be turned into a flame graph
+	 *
+	 */
+	void LogProfile() const
+	{
+		if (m_profiler == nullptr)
+		{
+			return;
+		}
+		m_logger.Info(
+			"Profile (" + std::to_string(m_profiler->GetNumSamples()) +
+			" samples):\n" + m_profiler->ToCollapsed()
+		);
+	}
+
+	/**
+	 * @brief Log the heap usage of the runtime
+	 *
+	 */
+	void LogHeapStats() const
+	{
+		::WasmRuntime::HeapStats stats = GetHeapStats();
+
+		SimpleObjects::Dict heapReport;
+		heapReport[SimpleObjects::String("heapSize")] = SimpleObjects::UInt64(stats.m_heapSize);
+		heapReport[SimpleObjects::String("usedSize")] = SimpleObjects::UInt64(stats.m_usedSize);
+		heapReport[SimpleObjects::String("peakUsedSize")] = SimpleObjects::UInt64(stats.m_peakUsedSize);
+		heapReport[SimpleObjects::String("internalFragSize")] = SimpleObjects::UInt64(stats.m_internalFragSize);
+		heapReport[SimpleObjects::String("externalFragSize")] = SimpleObjects::UInt64(stats.m_externalFragSize);
+		heapReport[SimpleObjects::String("numFailedAllocs")] = SimpleObjects::UInt64(stats.m_numFailedAllocs);
+
+		std::string heapReportStr = SimpleJson::DumpStr(heapReport);
+		m_logger.Info("Heap report: " + heapReportStr);
 	}
 
+	/**
+	 * @param resultSink    If given, it receives the result set by the
+	 *                      module, if any
+	 * @param suspendHandle If given, the run pauses on it when it runs out of
+	 *                      budget (see `EnableSuspend`)
+	 */
 	void RunModule(
 		const std::vector<uint8_t>& eventId,
 		const std::vector<uint8_t>& msgContent,
+		uint64_t threshold,
+		const ResultSink& resultSink = ResultSink(),
+		const SuspendHandle& suspendHandle = SuspendHandle()
+	)
+	{
+		std::string cacheKey;
+		std::string modHash = GetCacheableModHash();
+		if (!modHash.empty())
+		{
+			cacheKey = ResultCache::MakeKey(modHash, eventId, msgContent);
+			if (RunFromCache(cacheKey, threshold, resultSink))
+			{
+				// the run never started, but whoever waits on it is done
+				if (suspendHandle != nullptr)
+				{
+					suspendHandle->Finish();
+				}
+				return;
+			}
+		}
+
+		std::unique_ptr<::WasmRuntime::ExecEnvUserData> execEnvUserData =
+			::WasmRuntime::Internal::make_unique<::WasmRuntime::ExecEnvUserData>();
+		execEnvUserData->SetEventId(eventId);
+		execEnvUserData->SetEventData(msgContent);
+
+		RunWithUserData(
+			std::move(execEnvUserData),
+			threshold,
+			cacheKey,
+			resultSink,
+			suspendHandle
+		);
+	}
+
+	/**
+	 * @brief Run the module with an event whose data is read through a
+	 *        stream, via `enclave_wasm_read_event_chunk`, instead of being
+	 *        copied into the module as a whole.
+	 *
+	 * @param suspendHandle If given, the run pauses on it when it runs out of
+	 *                      budget (see `EnableSuspend`)
+	 */
+	void RunModuleStream(
+		const std::vector<uint8_t>& eventId,
+		std::unique_ptr<::WasmRuntime::EventDataStream> eventStream,
+		uint64_t threshold,
+		const SuspendHandle& suspendHandle = SuspendHandle()
+	)
+	{
+		std::unique_ptr<::WasmRuntime::ExecEnvUserData> execEnvUserData =
+			::WasmRuntime::Internal::make_unique<::WasmRuntime::ExecEnvUserData>();
+		execEnvUserData->SetEventId(eventId);
+		execEnvUserData->SetEventDataStream(std::move(eventStream));
+
+		RunWithUserData(
+			std::move(execEnvUserData),
+			threshold,
+			std::string(),
+			ResultSink(),
+			suspendHandle
+		);
+	}
+
+
+	/**
+	 * @brief Run a batch of events, packed as described in `EventBatch`,
+	 *        back to back on a single module instance, which saves the cost
+	 *        of instantiating the module and logging a report for each event.
+	 *        The instance is only used for this batch, so all events in it
+	 *        must come from the same caller (see `RunOnInstance`).
+	 *
+	 * @return The per-event results, packed as described in `EventBatch`
+	 */
+	std::vector<uint8_t> RunModuleBatch(
+		const uint8_t* packedEvents,
+		size_t packedEventsSize,
 		uint64_t threshold
 	)
 	{
+		EventBatchReader reader(packedEvents, packedEventsSize);
 
-		auto modInst = m_mod.Instantiate(m_modStackSize, m_modHeapSize);
-		auto execEnv = modInst.CreateExecEnv(m_execStackSize);
+		std::vector<EventRunResult> results;
+		results.reserve(reader.GetNumEvents());
+
+		Instance inst = NewInstance();
+
+		std::vector<uint8_t> eventId;
+		std::vector<uint8_t> eventData;
+		std::string output;
+		while (reader.HasNext())
+		{
+			reader.Next(eventId, eventData);
+			results.push_back(
+				RunOnInstance(
+					inst,
+					eventId,
+					eventData,
+					threshold,
+					IsResultHashed() ? &output : nullptr
+				)
+			);
+			RecordCheckpoint(
+				results.back(),
+				output,
+				GetResultData(inst.m_modInst, results.back())
+			);
+		}
+
+		m_logger.Debug(
+			"Batch of " + std::to_string(results.size()) + " events executed"
+		);
+
+		return EventBatch::EncodeResults(results);
+	}
+
+	/**
+	 * @brief An instance of the loaded module, together with its execution
+	 *        environment, which can be reused for many events.
+	 *
+	 *        Following WAMR's thread-safety rules, an instance must only be
+	 *        used by one thread at a time, and the execution environment must
+	 *        be used by the thread that created it; the module itself is
+	 *        shared read-only by all instances.
+	 *
+	 *        An instance keeps its linear memory and its globals from one
+	 *        event to the next, so it must only be reused for events of the
+	 *        same caller; events of different callers get different
+	 *        instances.
+	 *
+	 */
+	struct Instance
+	{
+		::WasmRuntime::SharedWasmModuleInstance m_modInst;
+		::WasmRuntime::SharedWasmExecEnv m_execEnv;
+	}; // struct Instance
+
+	/**
+	 * @brief Instantiate the loaded module. The module must not be reloaded
+	 *        while instances are being created on other threads.
+	 *
+	 */
+	Instance NewInstance()
+	{
+		Instance inst {
+			GetModule().Instantiate(m_modStackSize, m_modHeapSize),
+			::WasmRuntime::SharedWasmExecEnv(nullptr)
+		};
+		RenewExecEnv(inst);
+		return inst;
+	}
+
+	/**
+	 * @brief Give an instance a new execution environment, created by the
+	 *        calling thread, so that an idle instance can be reused by
+	 *        another thread
+	 *
+	 */
+	void RenewExecEnv(Instance& inst)
+	{
+		inst.m_execEnv = ::WasmRuntime::SharedWasmExecEnv(nullptr);
+		inst.m_execEnv = inst.m_modInst.CreateExecEnv(m_execStackSize);
+		inst.m_execEnv->SetOutputConfig(m_outputConfig);
+	}
 
-		std::unique_ptr<WasmRuntime::ExecEnvUserData> execEnvUserData =
-			WasmRuntime::Internal::make_unique<WasmRuntime::ExecEnvUserData>();
+	/**
+	 * @brief The underlying runtime, which may be shared with other
+	 *        instances of this class
+	 *
+	 */
+	const ::WasmRuntime::SharedWasmRuntime& GetSharedRuntime() const
+	{
+		return m_wrt;
+	}
+
+	/**
+	 * @brief Run one event on an instance created by `NewInstance`, without
+	 *        logging the SLA report.
+	 *
+	 *        If the event traps, or is terminated by the watchdog, the return
+	 *        code is set to `sk_batchTrapRetCode` or `sk_batchDeadlineRetCode`,
+	 *        and the instance is replaced by a fresh one, since an aborted
+	 *        instance is not reusable.
+	 *
+	 *        Only the counter, the threshold, and the memory accounting
+	 *        globals are reset before the event; whatever the previous event
+	 *        left in linear memory and in the other globals is visible to
+	 *        this one. So the instance must only be reused for events of the
+	 *        same caller (e.g., one batch, or one client).
+	 *
+	 * @param outOutput If given, it receives the output printed by the module
+	 */
+	EventRunResult RunOnInstance(
+		Instance& inst,
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& eventData,
+		uint64_t threshold,
+		std::string* outOutput = nullptr
+	)
+	{
+		std::unique_ptr<::WasmRuntime::ExecEnvUserData> execEnvUserData =
+			::WasmRuntime::Internal::make_unique<::WasmRuntime::ExecEnvUserData>();
 		execEnvUserData->SetEventId(eventId);
-		execEnvUserData->SetEventData(msgContent);
+		execEnvUserData->SetEventData(eventData);
+		inst.m_execEnv->SetUserData(std::move(execEnvUserData));
+
+		// the injected main refuses to run if the threshold is still set
+		inst.m_modInst->SetGlobal<uint64_t>(sk_globalCounterName(), 0);
+		inst.m_modInst->SetGlobal<uint64_t>(sk_globalThresholdName(), 0);
+
+		EventRunResult result =
+			Execute(inst.m_modInst, inst.m_execEnv, threshold, outOutput);
+		if (result.m_abortReason != EventAbortReason::None)
+		{
+			inst.m_execEnv = ::WasmRuntime::SharedWasmExecEnv(nullptr);
+			inst = NewInstance();
+		}
+
+		return result;
+	}
 
+
+private:
+
+	/**
+	 * @param cacheKey   If not empty, the result is put into the result cache
+	 *                   under this key
+	 * @param resultSink If given, it receives the result set by the module
+	 * @param suspendHandle If given, the gate of this run; otherwise, if
+	 *                      suspending is enabled with a policy, the run gets
+	 *                      a gate of its own
+	 */
+	void RunWithUserData(
+		std::unique_ptr<::WasmRuntime::ExecEnvUserData> execEnvUserData,
+		uint64_t threshold,
+		const std::string& cacheKey = std::string(),
+		const ResultSink& resultSink = ResultSink(),
+		const SuspendHandle& suspendHandle = SuspendHandle()
+	)
+	{
+		SuspendHandle budgetGate = suspendHandle;
+		if ((budgetGate == nullptr) && m_isSuspendEnabled && m_suspendPolicy)
+		{
+			budgetGate = NewSuspendHandle();
+		}
+
+		auto modInst = GetModule().Instantiate(m_modStackSize, m_modHeapSize);
+		auto execEnv = modInst.CreateExecEnv(m_execStackSize);
+		execEnv->SetOutputConfig(m_outputConfig);
+
+		execEnvUserData->SetBudgetGate(budgetGate);
+		execEnvUserData->SetProfiler(m_profiler);
 		execEnv->SetUserData(std::move(execEnvUserData));
 
+		// throws if the handle is used by another run
+		if (budgetGate != nullptr)
+		{
+			budgetGate->Start();
+		}
+		EventRunResult result;
+		std::string output;
+		try
+		{
+			result = Execute(
+				modInst,
+				execEnv,
+				threshold,
+				(cacheKey.empty() && !IsResultHashed()) ?
+					nullptr :
+					&output
+			);
+		}
+		catch (...)
+		{
+			if (budgetGate != nullptr)
+			{
+				budgetGate->Finish();
+			}
+			throw;
+		}
+		if (budgetGate != nullptr)
+		{
+			result.m_numSuspensions = budgetGate->GetNumSuspensions();
+			budgetGate->Finish();
+		}
+
+		// read in place, while the instance is alive
+		const uint8_t* resultData = GetResultData(modInst, result);
+
+		if (!cacheKey.empty() && (result.m_abortReason == EventAbortReason::None))
+		{
+			CachedResult cached;
+			cached.m_retCode = result.m_retCode;
+			cached.m_output = output;
+			cached.m_counter = result.m_counter;
+			cached.m_billedUnits = result.m_billedUnits;
+			if (resultData != nullptr)
+			{
+				cached.m_hasResult = true;
+				cached.m_result.assign(resultData, resultData + result.m_resultSize);
+			}
+			m_resultCache->Put(cacheKey, std::move(cached));
+		}
+
+		RecordCheckpoint(result, output, resultData);
+		if ((resultData != nullptr) && resultSink)
+		{
+			resultSink(resultData, result.m_resultSize);
+		}
+		LogSlaReport(result);
 
+		if (result.m_abortReason == EventAbortReason::Trap)
+		{
+			throw ::WasmRuntime::WasmRuntimeException(modInst->GetExceptionMsg());
+		}
+	}
+
+	::WasmRuntime::SharedWasmModule GetModule() const
+	{
+		std::lock_guard<std::mutex> lock(m_modMutex);
+		return m_mod;
+	}
+
+	/**
+	 * @brief The hash of the loaded module, if its results can be cached;
+	 *        empty otherwise
+	 *
+	 */
+	std::string GetCacheableModHash() const
+	{
+		if (m_resultCache == nullptr)
+		{
+			return std::string();
+		}
+		std::lock_guard<std::mutex> lock(m_modMutex);
+		return m_isModDeterministic ? m_modHash : std::string();
+	}
+
+	/**
+	 * @brief Answer the request with the cached result, if there is one that
+	 *        fits in the threshold; the output is replayed, and the SLA report
+	 *        is logged as if it was executed, billed as the cache is
+	 *        configured
+	 *
+	 * @return True if the request is answered
+	 */
+	bool RunFromCache(
+		const std::string& cacheKey,
+		uint64_t threshold,
+		const ResultSink& resultSink
+	)
+	{
+		CachedResult cached;
+		if (
+			!m_resultCache->Find(cacheKey, cached) ||
+			(cached.m_counter > threshold)
+		)
+		{
+			return false;
+		}
+
+		if (!cached.m_output.empty())
+		{
+			m_logger.Info(cached.m_output);
+		}
+
+		EventRunResult result;
+		result.m_isCacheHit = true;
+		result.m_retCode = cached.m_retCode;
+		result.m_counter = cached.m_counter;
+		result.m_threshold = threshold;
+		result.m_billedUnits = m_resultCache->GetHitBilledUnits(cached);
+		result.m_startTime = m_wrt->GetSystemIO().GetTimestampUs();
+		result.m_endTime = result.m_startTime;
+		result.m_hasResult = cached.m_hasResult;
+		result.m_resultSize = cached.m_result.size();
+
+		const uint8_t* resultData = cached.m_hasResult ?
+			cached.m_result.data() :
+			nullptr;
+		RecordCheckpoint(result, cached.m_output, resultData);
+		if ((resultData != nullptr) && resultSink)
+		{
+			resultSink(resultData, result.m_resultSize);
+		}
+		LogSlaReport(result);
+		return true;
+	}
+
+	/**
+	 * @param outOutput If given, it receives the output printed by the
+	 *                  module, e.g., to be cached
+	 */
+	EventRunResult Execute(
+		::WasmRuntime::SharedWasmModuleInstance& modInst,
+		::WasmRuntime::SharedWasmExecEnv& execEnv,
+		uint64_t threshold,
+		std::string* outOutput = nullptr
+	)
+	{
 		using MainRetType = std::tuple<int32_t>;
 
+		EventRunResult result;
+
+		// with the profiler, the module stops at every sample point instead
+		::WasmRuntime::SamplingProfiler* profiler =
+			execEnv->GetUserData().GetProfiler();
+		::WasmRuntime::SamplingState& samplingState =
+			execEnv->GetUserData().GetSamplingState();
+		uint64_t modThreshold = (profiler != nullptr) ?
+			profiler->Start(samplingState, threshold) :
+			threshold;
+
+		bool hasFuncCost = (m_funcCostTopN != 0) &&
+			::WasmRuntime::FuncCost::HasFuncCost(*(modInst.get()));
+		if (hasFuncCost)
+		{
+			// the instance may have been used by another event
+			::WasmRuntime::FuncCost::Reset(*(modInst.get()));
+		}
+
+		std::shared_ptr<ExecWatchdog> watchdog;
+		uint64_t deadlineUs = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_watchdogMutex);
+			m_hasExecuted = true;
+			watchdog = m_watchdog;
+			deadlineUs = m_deadlineUs;
+		}
+
+		// Watching only adds a lock at the start and the end of execution
+		ExecWatchdog::Token watchToken = 0;
+		if (watchdog != nullptr)
+		{
+			watchToken = watchdog->Watch(*(modInst.get()), deadlineUs);
+		}
+
 		const auto& execEnvRef = *(execEnv.get());
 		execEnv->GetUserData().StartStopwatch(execEnvRef);
-		auto mainRetVals = execEnv->ExecFunc<MainRetType>(
-			"enclave_wasm_injected_main",
-			static_cast<uint32_t>(execEnv->GetUserData().GetEventId().size()),
-			static_cast<uint32_t>(execEnv->GetUserData().GetEventData().size()),
-			static_cast<uint64_t>(threshold)
-		);
+		if (outOutput != nullptr)
+		{
+			// only the output of the module, not the stopwatch's
+			execEnv->FlushOutput();
+			execEnv->SetOutputCapture(true);
+		}
+		try
+		{
+			auto mainRetVals = execEnv->ExecFunc<MainRetType>(
+				"enclave_wasm_injected_main",
+				static_cast<uint32_t>(execEnv->GetUserData().GetEventId().size()),
+				static_cast<uint32_t>(execEnv->GetUserData().GetEventData().size()),
+				static_cast<uint64_t>(modThreshold)
+			);
+			result.m_retCode = std::get<0>(mainRetVals);
+		}
+		catch (const ::WasmRuntime::WasmRuntimeException& e)
+		{
+			result.m_abortReason = EventAbortReason::Trap;
+			result.m_retCode = sk_batchTrapRetCode;
+			m_logger.Error(std::string("Event aborted: ") + e.what());
+		}
+		catch (...)
+		{
+			if (watchdog != nullptr)
+			{
+				watchdog->Unwatch(watchToken);
+			}
+			throw;
+		}
+		if (outOutput != nullptr)
+		{
+			execEnv->SetOutputCapture(false);
+			*outOutput = execEnv->TakeCapturedOutput();
+		}
 		execEnv->GetUserData().StopStopwatch(execEnvRef);
 
+		if ((watchdog != nullptr) && watchdog->Unwatch(watchToken))
+		{
+			if (result.m_abortReason == EventAbortReason::None)
+			{
+				// terminated right after it finished; the result stands, but
+				// the termination must not hit the next execution
+				modInst->ClearException();
+			}
+			else
+			{
+				result.m_abortReason = EventAbortReason::Deadline;
+				result.m_retCode = sk_batchDeadlineRetCode;
+			}
+		}
+
 		// Collecting data for SLA report
-		uint64_t counter = modInst->GetGlobal<uint64_t>(sk_globalCounterName());
+		result.m_counter = modInst->GetGlobal<uint64_t>(sk_globalCounterName());
+		result.m_threshold = (profiler != nullptr) ?
+			samplingState.m_limit :
+			modInst->GetGlobal<uint64_t>(sk_globalThresholdName());
+		result.m_startTime = execEnv->GetUserData().GetStopwatchStartTime();
+		result.m_endTime = execEnv->GetUserData().GetStopwatchEndTime();
+		// the stream size falls back to the data size when there's no
+		// stream, so only one of them is counted
+		result.m_eventSize = execEnv->GetUserData().HasEventDataStream() ?
+			execEnv->GetUserData().GetEventStreamSize() :
+			execEnv->GetUserData().GetEventData().size();
+		CollectMemUsage(modInst, result);
+		if (hasFuncCost)
+		{
+			std::lock_guard<std::mutex> lock(m_modMutex);
+			auto topFuncCosts = ::WasmRuntime::FuncCost::GetTop(
+				*(modInst.get()),
+				m_funcNames,
+				m_funcCostTopN
+			);
+			for (auto& funcCost : topFuncCosts)
+			{
+				result.m_topFuncCosts.emplace_back(
+					std::move(funcCost.m_name),
+					funcCost.m_cost
+				);
+			}
+		}
+
+		const auto& output = execEnv->GetOutput();
+		result.m_outputSize = output.GetNumBytes();
+		result.m_outputTruncatedSize = output.GetNumTruncatedBytes();
+		result.m_outputChargedSize = output.GetNumChargedBytes();
 
-		int32_t retCode = std::get<0>(mainRetVals);
+		if (
+			(m_costModel != nullptr) &&
+			(result.m_abortReason == EventAbortReason::None)
+		)
+		{
+			m_costModel->Learn(
+				result.m_eventSize,
+				result.m_counter,
+				result.m_endTime - result.m_startTime
+			);
+		}
 
-		uint64_t startTime = execEnv->GetUserData().GetStopwatchStartTime();
-		uint64_t endTime = execEnv->GetUserData().GetStopwatchEndTime();
-		uint64_t deltaTime = endTime - startTime;
+		const auto& userData = execEnv->GetUserData();
+		if (
+			userData.HasResult() &&
+			(result.m_abortReason == EventAbortReason::None)
+		)
+		{
+			result.m_hasResult = true;
+			result.m_resultPtr = userData.GetResultPtr();
+			result.m_resultSize = userData.GetResultSize();
+		}
+
+		return result;
+	}
+
+	/**
+	 * @brief A view of the result set by the module, in its linear memory;
+	 *        null if there is none
+	 *
+	 */
+	static const uint8_t* GetResultData(
+		const ::WasmRuntime::SharedWasmModuleInstance& modInst,
+		const EventRunResult& result
+	)
+	{
+		if (!result.m_hasResult)
+		{
+			return nullptr;
+		}
+		return modInst->GetMemView(
+			result.m_resultPtr,
+			static_cast<uint32_t>(result.m_resultSize)
+		);
+	}
+
+	/**
+	 * @brief Read the memory accounting globals injected by the
+	 *        instrumentation; modules instrumented without them (see
+	 *        `EnableMemAccounting`) are only billed for instructions
+	 *
+	 */
+	void CollectMemUsage(
+		::WasmRuntime::SharedWasmModuleInstance& modInst,
+		EventRunResult& result
+	)
+	{
+		result.m_billedUnits = result.m_counter;
+
+		uint64_t pages = 0;
+		uint64_t lastCounter = 0;
+		try
+		{
+			pages = modInst->GetGlobal<uint64_t>(sk_globalMemPagesName());
+			lastCounter = modInst->GetGlobal<uint64_t>(sk_globalMemLastCounterName());
+			result.m_memPeakPages = modInst->GetGlobal<uint64_t>(sk_globalMemPeakPagesName());
+			result.m_memPageCount = modInst->GetGlobal<uint64_t>(sk_globalMemPageCounterName());
+		}
+		catch (const ::WasmRuntime::Exception&)
+		{
+			return;
+		}
+
+		// the pages held since the last change
+		if (result.m_counter > lastCounter)
+		{
+			result.m_memPageCount += (result.m_counter - lastCounter) * pages;
+		}
+
+		uint64_t deltaTime = result.m_endTime - result.m_startTime;
+		double pageUs = (result.m_counter != 0) ?
+			static_cast<double>(result.m_memPageCount) *
+				static_cast<double>(deltaTime) /
+				static_cast<double>(result.m_counter) :
+			static_cast<double>(pages) * static_cast<double>(deltaTime);
+		result.m_memPageMs = static_cast<uint64_t>(pageUs / 1000.0);
+
+		if (m_memPageCountPerUnit != 0)
+		{
+			result.m_billedUnits +=
+				result.m_memPageCount / m_memPageCountPerUnit;
+		}
+	}
+
+	static bool IsDeterministic(
+		const std::vector<std::pair<std::string, std::string> >& importFuncs
+	)
+	{
+		for (const auto& importFunc : importFuncs)
+		{
+			for (const auto& nonDetNative : sk_nonDetNatives())
+			{
+				if (importFunc.second == nonDetNative)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Whether the result of a request is hashed, for its receipt or
+	 *        its SLA record, so its output must be captured
+	 *
+	 */
+	bool IsResultHashed() const
+	{
+		return (m_receiptAcc != nullptr) || (m_slaRecordRing != nullptr);
+	}
+
+	/**
+	 * @param output     The output printed by the module; only used for
+	 *                   receipts and SLA records
+	 * @param resultData The result set by the module, if any; only used for
+	 *                   receipts and SLA records
+	 */
+	void RecordCheckpoint(
+		EventRunResult& result,
+		const std::string& output,
+		const uint8_t* resultData = nullptr
+	)
+	{
+		if (IsResultHashed())
+		{
+			result.m_resultHash = ReceiptTree::ResultHash(
+				result.m_retCode,
+				output,
+				resultData,
+				(resultData != nullptr) ? result.m_resultSize : 0
+			);
+			result.m_hasResultHash = true;
+		}
+
+		if ((m_chkptAcc != nullptr) && (m_slaRecordRing == nullptr))
+		{
+			m_chkptAcc->Append(
+				result.m_billedUnits,
+				result.m_endTime - result.m_startTime,
+				result.m_endTime
+			);
+		}
+		if (m_receiptAcc != nullptr)
+		{
+			result.m_reqId = m_receiptAcc->Append(
+				result.m_billedUnits,
+				result.m_endTime - result.m_startTime,
+				result.m_resultHash,
+				result.m_endTime
+			);
+			result.m_hasReqId = true;
+		}
+		if (m_slaRecordRing != nullptr)
+		{
+			// a record that doesn't fit is counted by the ring; logging it
+			// here would cost what the ring saves
+			m_slaRecordRing->TryPush(SlaRecord::FromResult(m_contractId, result));
+		}
+	}
+
+	void SetFuncNames(std::vector<std::string> funcNames)
+	{
+		std::lock_guard<std::mutex> lock(m_modMutex);
+		m_funcNames = std::move(funcNames);
+		if (m_profiler != nullptr)
+		{
+			m_profiler->SetFuncNames(m_funcNames);
+		}
+	}
+
+	void LogSlaReport(const EventRunResult& result)
+	{
+		if (!m_isSlaReportLogged)
+		{
+			return;
+		}
+
+		uint64_t deltaTime = result.m_endTime - result.m_startTime;
 
 		// Construct SLA report
 		SimpleObjects::Dict slaReport;
-		slaReport[SimpleObjects::String("counter")] = SimpleObjects::UInt64(counter);
-		slaReport[SimpleObjects::String("retCode")] = SimpleObjects::Int32(retCode);
-		slaReport[SimpleObjects::String("startTime")] = SimpleObjects::UInt64(startTime);
-		slaReport[SimpleObjects::String("endTime")] = SimpleObjects::UInt64(endTime);
+		slaReport[SimpleObjects::String("counter")] = SimpleObjects::UInt64(result.m_counter);
+		slaReport[SimpleObjects::String("retCode")] = SimpleObjects::Int32(result.m_retCode);
+		slaReport[SimpleObjects::String("threshold")] = SimpleObjects::UInt64(result.m_threshold);
+		slaReport[SimpleObjects::String("numSuspensions")] = SimpleObjects::UInt64(result.m_numSuspensions);
+		slaReport[SimpleObjects::String("memPeakPages")] = SimpleObjects::UInt64(result.m_memPeakPages);
+		slaReport[SimpleObjects::String("memPageCount")] = SimpleObjects::UInt64(result.m_memPageCount);
+		slaReport[SimpleObjects::String("memPageMs")] = SimpleObjects::UInt64(result.m_memPageMs);
+		slaReport[SimpleObjects::String("billedUnits")] = SimpleObjects::UInt64(result.m_billedUnits);
+		slaReport[SimpleObjects::String("abortReason")] = SimpleObjects::String(GetAbortReasonStr(result.m_abortReason));
+		slaReport[SimpleObjects::String("startTime")] = SimpleObjects::UInt64(result.m_startTime);
+		slaReport[SimpleObjects::String("endTime")] = SimpleObjects::UInt64(result.m_endTime);
 		slaReport[SimpleObjects::String("deltaTime")] = SimpleObjects::UInt64(deltaTime);
+		slaReport[SimpleObjects::String("eventSize")] = SimpleObjects::UInt64(result.m_eventSize);
+		slaReport[SimpleObjects::String("outputSize")] = SimpleObjects::UInt64(result.m_outputSize);
+		slaReport[SimpleObjects::String("outputTruncatedSize")] = SimpleObjects::UInt64(result.m_outputTruncatedSize);
+		slaReport[SimpleObjects::String("outputChargedSize")] = SimpleObjects::UInt64(result.m_outputChargedSize);
+		slaReport[SimpleObjects::String("resultSize")] = SimpleObjects::UInt64(result.m_resultSize);
+		slaReport[SimpleObjects::String("cacheHit")] = SimpleObjects::Bool(result.m_isCacheHit);
+		if (result.m_hasReqId)
+		{
+			slaReport[SimpleObjects::String("reqId")] = SimpleObjects::UInt64(result.m_reqId);
+		}
+		if (!result.m_topFuncCosts.empty())
+		{
+			SimpleObjects::List topFuncs;
+			for (const auto& funcCost : result.m_topFuncCosts)
+			{
+				SimpleObjects::Dict topFunc;
+				topFunc[SimpleObjects::String("name")] = SimpleObjects::String(funcCost.first);
+				topFunc[SimpleObjects::String("cost")] = SimpleObjects::UInt64(funcCost.second);
+				topFuncs.push_back(std::move(topFunc));
+			}
+			slaReport[SimpleObjects::String("topFuncs")] = std::move(topFuncs);
+		}
 
 		// Print SLA report
 		std::string slaReportStr = SimpleJson::DumpStr(slaReport);
 		m_logger.Info("SLA report: " + slaReportStr);
 	}
 
-
 private:
 	Common::Logger m_logger;
-	WasmRuntime::SharedWasmRuntime m_wrt;
+	::WasmRuntime::SharedWasmRuntime m_wrt;
 	uint32_t m_modStackSize;
 	uint32_t m_modHeapSize;
 	uint32_t m_execStackSize;
+	::WasmRuntime::GuestOutputConfig m_outputConfig;
+	// guards the watchdog, which is read by every execution
+	std::mutex m_watchdogMutex;
+	std::shared_ptr<ExecWatchdog> m_watchdog;
+	uint64_t m_deadlineUs;
+	bool m_hasExecuted;
+	bool m_isSuspendEnabled;
+	::WasmRuntime::BudgetGate::Policy m_suspendPolicy;
+	bool m_isMemAccountingEnabled;
+	uint64_t m_memPageCountPerUnit;
+	std::shared_ptr<::WasmRuntime::SamplingProfiler> m_profiler;
+	size_t m_funcCostTopN;
+	std::shared_ptr<ResultCache> m_resultCache;
+	std::shared_ptr<CheckpointAccumulator> m_chkptAcc;
+	std::shared_ptr<ReceiptAccumulator> m_receiptAcc;
+	std::shared_ptr<CostModel> m_costModel;
+	std::shared_ptr<SlaRecordRing> m_slaRecordRing;
+	uint64_t m_contractId;
+	bool m_isSlaReportLogged;
+
+	// guards the loaded module, and what's known about it
+	mutable std::mutex m_modMutex;
+	std::vector<std::string> m_funcNames;
+	// hash of the loaded (instrumented) module, if the result cache is on
+	std::string m_modHash;
+	bool m_isModDeterministic;
 
-	WasmRuntime::SharedWasmModule m_mod;
+	::WasmRuntime::SharedWasmModule m_mod;
 }; // class WasmRuntime
 
 
@@ -0,0 +1,388 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <WasmRuntime/Internal/make_unique.hpp>
+#include <WasmRuntime/WasmThreadEnv.hpp>
+
+#include "EventBatch.hpp"
+#include "Logging.hpp"
+#include "WasmRuntime.hpp"
+
+
+namespace SLARuntime
+{
+namespace Common
+{
+
+
+/**
+ * @brief Runs events on several threads inside the enclave.
+ *
+ *        The pool doesn't create threads, since an enclave can't; instead,
+ *        each worker runs on a thread that enters the enclave (i.e., a TCS)
+ *        and calls `RunWorker`, which only returns after `Stop` is called.
+ *
+ *        Every worker owns its instance of the shared module, so no WAMR
+ *        object other than the module is ever shared between threads.
+ *        An instance keeps the memory of the events run on it, so a worker
+ *        only reuses its instance for events of the same owner, and
+ *        instantiates the module again when the owner changes.
+ *        Submitted events are spread over per-worker deques; a worker takes
+ *        events from the front of its own deque, and, when that is empty,
+ *        steals from the back of the others' deques.
+ *
+ */
+class WasmWorkerPool
+{
+public: // static members:
+
+	/**
+	 * @brief Called on the worker thread when an event is done.
+	 *        If the execution failed, the return code in the result is
+	 *        `WasmRuntime::sk_batchTrapRetCode` (or `sk_batchDeadlineRetCode`
+	 *        if it was terminated by the watchdog).
+	 *
+	 */
+	using Callback = std::function<void(const EventRunResult&)>;
+
+	struct Task
+	{
+		std::vector<uint8_t> m_eventId;
+		std::vector<uint8_t> m_eventData;
+		uint64_t m_threshold;
+		Callback m_callback;
+
+		/**
+		 * @brief Events of different owners (e.g., clients, or batches) never
+		 *        run on the same instance, so one can't see what the other
+		 *        left in memory
+		 *
+		 */
+		uint64_t m_ownerId = 0;
+	}; // struct Task
+
+	struct WorkerStats
+	{
+		uint64_t m_numExecuted = 0;
+		uint64_t m_numStolen = 0;
+		uint64_t m_numInstantiated = 0;
+	}; // struct WorkerStats
+
+public:
+
+	WasmWorkerPool(WasmRuntime& rt, size_t numWorkers) :
+		m_logger(Common::LoggerFactory::GetLogger("WasmWorkerPool")),
+		m_rt(rt),
+		m_workers(),
+		m_nextWorker(0),
+		m_numPending(0),
+		m_idleMutex(),
+		m_idleCv(),
+		m_doneCv(),
+		m_numRunning(0),
+		m_isStopped(false)
+	{
+		if (numWorkers == 0)
+		{
+			throw std::invalid_argument("The pool needs at least one worker");
+		}
+		for (size_t i = 0; i < numWorkers; ++i)
+		{
+			m_workers.push_back(::WasmRuntime::Internal::make_unique<Worker>());
+		}
+	}
+
+	WasmWorkerPool(const WasmWorkerPool&) = delete;
+
+	WasmWorkerPool(WasmWorkerPool&&) = delete;
+
+	~WasmWorkerPool() = default;
+
+	WasmWorkerPool& operator=(const WasmWorkerPool&) = delete;
+
+	WasmWorkerPool& operator=(WasmWorkerPool&&) = delete;
+
+	size_t GetNumWorkers() const
+	{
+		return m_workers.size();
+	}
+
+	/**
+	 * @brief Submit an event; it throws if the pool is stopped, since the
+	 *        workers may be gone already
+	 *
+	 */
+	void Submit(Task task)
+	{
+		size_t idx = m_nextWorker++ % m_workers.size();
+		{
+			std::lock_guard<std::mutex> idleLock(m_idleMutex);
+			if (m_isStopped)
+			{
+				throw std::logic_error("The worker pool is stopped");
+			}
+			// counted before it's visible, so it is never taken while
+			// uncounted, and no worker returns before it's done
+			m_numPending++;
+		}
+		{
+			Worker& worker = *m_workers[idx];
+			std::lock_guard<std::mutex> lock(worker.m_mutex);
+			worker.m_tasks.push_back(std::move(task));
+		}
+
+		std::lock_guard<std::mutex> idleLock(m_idleMutex);
+		m_idleCv.notify_one();
+	}
+
+	/**
+	 * @brief Run the worker with the given index on the calling thread,
+	 *        until the pool is stopped and all submitted events are done.
+	 *
+	 */
+	void RunWorker(size_t workerIdx)
+	{
+		if (workerIdx >= m_workers.size())
+		{
+			throw std::out_of_range("Invalid worker index");
+		}
+		Worker& worker = *m_workers[workerIdx];
+
+		{
+			std::lock_guard<std::mutex> idleLock(m_idleMutex);
+			++m_numRunning;
+		}
+		try
+		{
+			RunWorkerLoop(worker, workerIdx);
+		}
+		catch (...)
+		{
+			LeaveWorker();
+			throw;
+		}
+		LeaveWorker();
+	}
+
+	/**
+	 * @brief Block until `isDone` returns true, which is checked every time
+	 *        an event is done; `isDone` must not call into the pool.
+	 *
+	 * @return False if the pool is stopped, and all its workers have
+	 *         returned, before that; nothing submitted runs after that
+	 */
+	bool WaitUntil(const std::function<bool()>& isDone)
+	{
+		std::unique_lock<std::mutex> idleLock(m_idleMutex);
+		m_doneCv.wait(
+			idleLock,
+			[this, &isDone]()
+			{
+				return isDone() || (m_isStopped && (m_numRunning == 0));
+			}
+		);
+		return isDone();
+	}
+
+	/**
+	 * @brief Let the workers return once all submitted events are done
+	 *
+	 */
+	void Stop()
+	{
+		std::lock_guard<std::mutex> idleLock(m_idleMutex);
+		m_isStopped = true;
+		m_idleCv.notify_all();
+		m_doneCv.notify_all();
+	}
+
+	WorkerStats GetWorkerStats(size_t workerIdx) const
+	{
+		const Worker& worker = *m_workers.at(workerIdx);
+		std::lock_guard<std::mutex> lock(worker.m_mutex);
+		return worker.m_stats;
+	}
+
+private:
+
+	struct Worker
+	{
+		mutable std::mutex m_mutex;
+		std::deque<Task> m_tasks;
+		WorkerStats m_stats;
+	}; // struct Worker
+
+	static bool PopLocal(Worker& worker, Task& task)
+	{
+		std::lock_guard<std::mutex> lock(worker.m_mutex);
+		if (worker.m_tasks.empty())
+		{
+			return false;
+		}
+		task = std::move(worker.m_tasks.front());
+		worker.m_tasks.pop_front();
+		return true;
+	}
+
+	bool Steal(size_t thiefIdx, Task& task)
+	{
+		for (size_t i = 1; i < m_workers.size(); ++i)
+		{
+			Worker& victim = *m_workers[(thiefIdx + i) % m_workers.size()];
+			std::lock_guard<std::mutex> lock(victim.m_mutex);
+			if (!victim.m_tasks.empty())
+			{
+				task = std::move(victim.m_tasks.back());
+				victim.m_tasks.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	struct WorkerInst
+	{
+		WasmRuntime::Instance m_inst;
+		bool m_isUsed;
+		uint64_t m_ownerId;
+		// false if renewing it failed, so it must be renewed before use
+		bool m_isValid;
+	}; // struct WorkerInst
+
+	/**
+	 * @brief Give the instance to the owner of the task, instantiating the
+	 *        module again if another owner has used it
+	 *
+	 */
+	void AssignInst(WorkerInst& inst, uint64_t ownerId, bool& isRenewed)
+	{
+		if (!inst.m_isValid || (inst.m_isUsed && (inst.m_ownerId != ownerId)))
+		{
+			inst.m_isValid = false;
+			inst.m_inst.m_execEnv = ::WasmRuntime::SharedWasmExecEnv(nullptr);
+			inst.m_inst = m_rt.NewInstance();
+			inst.m_isValid = true;
+			isRenewed = true;
+		}
+		inst.m_isUsed = true;
+		inst.m_ownerId = ownerId;
+	}
+
+	void Execute(WorkerInst& inst, Task& task, bool& isRenewed)
+	{
+		EventRunResult result;
+		try
+		{
+			AssignInst(inst, task.m_ownerId, isRenewed);
+			result = m_rt.RunOnInstance(
+				inst.m_inst,
+				task.m_eventId,
+				task.m_eventData,
+				task.m_threshold
+			);
+		}
+		catch (const std::exception& e)
+		{
+			m_logger.Error(std::string("Failed to run event: ") + e.what());
+			result.m_retCode = WasmRuntime::sk_batchTrapRetCode;
+			// the instance may be left half-renewed
+			inst.m_isValid = false;
+		}
+
+		if (task.m_callback)
+		{
+			task.m_callback(result);
+		}
+	}
+
+	void RunWorkerLoop(Worker& worker, size_t workerIdx)
+	{
+		::WasmRuntime::WasmThreadEnv threadEnv;
+		// the instance is created on this thread, and only used by it
+		WorkerInst inst { m_rt.NewInstance(), false, 0, true };
+
+		Task task;
+		while (true)
+		{
+			bool isStolen = false;
+			if (!PopLocal(worker, task))
+			{
+				isStolen = Steal(workerIdx, task);
+				if (!isStolen)
+				{
+					std::unique_lock<std::mutex> idleLock(m_idleMutex);
+					if (m_isStopped && (m_numPending == 0))
+					{
+						break;
+					}
+					m_idleCv.wait(
+						idleLock,
+						[this]()
+						{
+							return (m_numPending > 0) || m_isStopped;
+						}
+					);
+					continue;
+				}
+			}
+			m_numPending--;
+
+			bool isRenewed = false;
+			Execute(inst, task, isRenewed);
+
+			{
+				std::lock_guard<std::mutex> lock(worker.m_mutex);
+				worker.m_stats.m_numExecuted++;
+				worker.m_stats.m_numStolen += isStolen ? 1 : 0;
+				worker.m_stats.m_numInstantiated += isRenewed ? 1 : 0;
+			}
+
+			// taken, so a waiter can't miss it between checking and waiting
+			std::lock_guard<std::mutex> idleLock(m_idleMutex);
+			m_doneCv.notify_all();
+		}
+	}
+
+	void LeaveWorker()
+	{
+		std::lock_guard<std::mutex> idleLock(m_idleMutex);
+		--m_numRunning;
+		m_doneCv.notify_all();
+	}
+
+	Common::Logger m_logger;
+	WasmRuntime& m_rt;
+	std::vector<std::unique_ptr<Worker> > m_workers;
+	std::atomic<size_t> m_nextWorker;
+	std::atomic<size_t> m_numPending;
+
+	std::mutex m_idleMutex;
+	std::condition_variable m_idleCv;
+	// notified when an event is done, or a worker returns
+	std::condition_variable m_doneCv;
+	size_t m_numRunning;
+	bool m_isStopped;
+
+}; // class WasmWorkerPool
+
+
+} // namespace Common
+} // namespace SLARuntime
+
@@ -0,0 +1,48 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <SLARuntime/Common/EventBatch.hpp>
+#include <SLARuntime/Common/SpscRing.hpp>
+
+
+namespace End2End
+{
+
+
+static constexpr size_t gsk_ringNumSlots = 32;
+
+
+/**
+ * @brief Each request is a packed `EventBatch`
+ *
+ */
+static constexpr size_t gsk_requestDataSize = 4 * 1024;
+
+/**
+ * @brief Each completion is the packed results of the batch in the request
+ *        with the same ID, or empty if the request failed.
+ *        An event takes at least 8 bytes in a request (two 32-bit lengths),
+ *        so this is enough for the largest batch that fits in a request.
+ *
+ */
+static constexpr size_t gsk_completionDataSize =
+	((gsk_requestDataSize - 4) / 8) *
+	SLARuntime::Common::EventBatch::sk_resultSize;
+
+
+using RequestRing =
+	SLARuntime::Common::SpscRing<gsk_ringNumSlots, gsk_requestDataSize>;
+
+using CompletionRing =
+	SLARuntime::Common::SpscRing<gsk_ringNumSlots, gsk_completionDataSize>;
+
+
+} // namespace End2End
+
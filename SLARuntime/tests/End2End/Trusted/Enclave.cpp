@@ -5,11 +5,21 @@
 
 
 #include <cstdint>
+#include <cstring>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+#include <sgx_cpuid.h>
 #include <sgx_edger8r.h>
+#include <sgx_trts.h>
 
 #include <DecentEnclave/Common/Platform/Print.hpp>
 #include <DecentEnclave/Common/Sgx/MbedTlsInit.hpp>
@@ -17,12 +27,28 @@
 #include <DecentEnclave/Trusted/AppCertRequester.hpp>
 #include <DecentEnclave/Trusted/PlatformId.hpp>
 
+#include <SLARuntime/Common/CheckpointAccumulator.hpp>
+#include <SLARuntime/Common/ExecWatchdog.hpp>
+#include <SLARuntime/Common/ModuleRegistry.hpp>
+#include <SLARuntime/Common/ReceiptTree.hpp>
+#include <SLARuntime/Common/RequestScheduler.hpp>
+#include <SLARuntime/Common/SessionPool.hpp>
+#include <SLARuntime/Common/SLAContract.hpp>
 #include <SLARuntime/Common/SLARuntime.hpp>
+#include <SLARuntime/Common/SlaRecordRing.hpp>
+#include <SLARuntime/Common/TxnQueue.hpp>
 #include <SLARuntime/Common/WasmRuntime.hpp>
+#include <SLARuntime/Common/WasmWorkerPool.hpp>
+
+#include <WasmRuntime/ArenaHeap.hpp>
+#include <WasmRuntime/SystemIOTsc.hpp>
+#include <WasmRuntime/WasmThreadEnv.hpp>
 
 #include <EclipseMonitor/Eth/DataTypes.hpp>
 
+#include "../RequestRings.hpp"
 #include "Certs.hpp"
+#include "EventStream.hpp"
 #include "Keys.hpp"
 #include "SystemIO.hpp"
 
@@ -34,15 +60,289 @@ namespace End2End
 static std::shared_ptr<SLARuntime::Common::SLARuntime> gs_slaRt;
 
 
+/**
+ * @brief Whether RDTSC can be used in this enclave; CPUID is read with an
+ *        ocall, so this can't be called during the enclave initialization
+ *
+ */
+static bool IsTscUsable()
+{
+	return ::WasmRuntime::SystemIOTsc::IsSupported(
+		[](uint32_t leaf, uint32_t subleaf)
+		{
+			int info[4] = { 0, 0, 0, 0 };
+			sgx_status_t ret = sgx_cpuidex(
+				info,
+				static_cast<int>(leaf),
+				static_cast<int>(subleaf)
+			);
+			if (ret != SGX_SUCCESS)
+			{
+				throw std::runtime_error("Failed to read CPUID");
+			}
+			return std::array<uint32_t, 4>{{
+				static_cast<uint32_t>(info[0]),
+				static_cast<uint32_t>(info[1]),
+				static_cast<uint32_t>(info[2]),
+				static_cast<uint32_t>(info[3]),
+			}};
+		}
+	);
+}
+
+
+static std::unique_ptr<::WasmRuntime::SystemIOTsc> MakeTscClock()
+{
+	::WasmRuntime::TscClockConfig config;
+	config.m_isTscUsable = IsTscUsable;
+	return ::WasmRuntime::SystemIOTsc::MakeUnique(
+		End2End::SystemIO::MakeUnique(),
+		config
+	);
+}
+
+
+#ifdef END2END_TSC_CLOCK
+// TSC clocks handed out by `MakeClock`, which are calibrated in `Init`
+static std::vector<const ::WasmRuntime::SystemIOTsc*> gs_tscClocks;
+#endif // END2END_TSC_CLOCK
+
+
+/**
+ * @brief Make the clock of the runtime, the watchdog and the SLA record
+ *        drain; it's the untrusted clock (one ocall per timestamp), unless
+ *        the TSC clock is opted in with END2END_TSC_CLOCK
+ *
+ */
+static std::unique_ptr<::WasmRuntime::SystemIO> MakeClock()
+{
+#ifdef END2END_TSC_CLOCK
+	std::unique_ptr<::WasmRuntime::SystemIOTsc> clock = MakeTscClock();
+	gs_tscClocks.push_back(clock.get());
+	return std::unique_ptr<::WasmRuntime::SystemIO>(std::move(clock));
+#else
+	return End2End::SystemIO::MakeUnique();
+#endif // END2END_TSC_CLOCK
+}
+
+
 static SLARuntime::Common::WasmRuntime gs_rt(
-	End2End::SystemIO::MakeUnique(),
-	10 * 1024 * 1024, // 10MB - Total heap size
+	::WasmRuntime::WasmRuntimeArenaHeap::MakeUnique(
+		MakeClock(),
+		64 * 1024 * 1024, // 64MB - Total heap size (for up to 6 pool workers)
+		8,                // 8 arenas - one per enclave thread running WASM
+		512 * 1024        // 512KB - Arena size
+	),
 	 2 * 1024 * 1024, // 2MB - Module stack size
 	 7 * 1024 * 1024, // 7MB - Module heap size
 	 1 * 1024 * 1024  // 1MB - Execution stack size
 );
 
 
+static std::shared_ptr<SLARuntime::Common::ExecWatchdog> gs_watchdog =
+	std::make_shared<SLARuntime::Common::ExecWatchdog>(MakeClock());
+
+
+// SLA records of the requests run by `gs_rt`, exported by the host
+static std::shared_ptr<SLARuntime::Common::SlaRecordRing> gs_slaRecordRing =
+	std::make_shared<SLARuntime::Common::SlaRecordRing>(16384);
+
+
+static SLARuntime::Common::SlaRecordDrain gs_slaRecordDrain(
+	gs_slaRecordRing,
+	MakeClock()
+);
+
+
+static std::mutex gs_poolMutex;
+static std::shared_ptr<SLARuntime::Common::WasmWorkerPool> gs_pool;
+// each batch run on the pool is a different owner, so batches never share
+// an instance
+static std::atomic<uint64_t> gs_poolNextOwnerId(0);
+
+
+// budget grants of the policy of `GetSuspendTestRuntime`
+static std::atomic<uint64_t> gs_numSuspendGrants(0);
+
+
+static std::mutex gs_wasmMutex;
+// the module loaded by `ecall_end2end_load_wasm`, which the self-tests load
+// into runtimes of their own, set up for what they check
+static std::vector<uint8_t> gs_wasm;
+
+
+std::vector<uint8_t> GetLoadedWasm()
+{
+	std::lock_guard<std::mutex> lock(gs_wasmMutex);
+	if (gs_wasm.empty())
+	{
+		throw std::runtime_error("The WASM module is not loaded");
+	}
+	return gs_wasm;
+}
+
+
+/**
+ * @brief Make a runtime for a self-test, on the WAMR runtime of `gs_rt`; the
+ *        test sets it up, then loads `GetLoadedWasm()` into it
+ *
+ */
+std::shared_ptr<SLARuntime::Common::WasmRuntime> MakeTestRuntime()
+{
+	return std::make_shared<SLARuntime::Common::WasmRuntime>(
+		gs_rt.GetSharedRuntime(),
+		2 * 1024 * 1024, // 2MB - Module stack size
+		7 * 1024 * 1024, // 7MB - Module heap size
+		1 * 1024 * 1024  // 1MB - Execution stack size
+	);
+}
+
+
+/**
+ * @brief A module whose `enclave_wasm_main` only returns 0, but which imports
+ *        `enclave_wasm_start_benchmark`, so its results must not be cached
+ *
+ */
+std::vector<uint8_t> MakeNonDetWasm()
+{
+	auto appendName = [](std::vector<uint8_t>& dest, const std::string& name)
+	{
+		dest.push_back(static_cast<uint8_t>(name.size()));
+		dest.insert(dest.end(), name.begin(), name.end());
+	};
+	auto appendSection = [](
+		std::vector<uint8_t>& dest,
+		uint8_t id,
+		const std::vector<uint8_t>& body
+	)
+	{
+		// all the sections here are shorter than 128 bytes, so their sizes
+		// fit in one LEB128 byte
+		dest.push_back(id);
+		dest.push_back(static_cast<uint8_t>(body.size()));
+		dest.insert(dest.end(), body.begin(), body.end());
+	};
+
+	std::vector<uint8_t> wasm = { 0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00 };
+
+	// types: () -> (), and (i32, i32) -> i32
+	appendSection(wasm, 1, { 2, 0x60, 0, 0, 0x60, 2, 0x7f, 0x7f, 1, 0x7f });
+
+	std::vector<uint8_t> imports = { 2 };
+	for (const char* name :
+		{ "enclave_wasm_counter_exceed", "enclave_wasm_start_benchmark" })
+	{
+		appendName(imports, "env");
+		appendName(imports, name);
+		imports.insert(imports.end(), { 0x00, 0 });
+	}
+	appendSection(wasm, 2, imports);
+
+	// one function of type 1, and a memory of one page
+	appendSection(wasm, 3, { 1, 1 });
+	appendSection(wasm, 5, { 1, 0x00, 1 });
+
+	std::vector<uint8_t> exports = { 2 };
+	appendName(exports, "memory");
+	exports.insert(exports.end(), { 0x02, 0 });
+	appendName(exports, "enclave_wasm_main");
+	// after the two imported functions
+	exports.insert(exports.end(), { 0x00, 2 });
+	appendSection(wasm, 7, exports);
+
+	// i32.const 0
+	appendSection(wasm, 10, { 1, 4, 0, 0x41, 0x00, 0x0b });
+
+	return wasm;
+}
+
+
+/**
+ * @brief The runtime shared by the concurrent runs of
+ *        `ecall_end2end_test_suspend`; it suspends runs that are out of
+ *        budget, and the policy doubles their budget, counting the times it
+ *        is asked
+ *
+ */
+std::shared_ptr<SLARuntime::Common::WasmRuntime> GetSuspendTestRuntime()
+{
+	static std::mutex s_mutex;
+	static std::shared_ptr<SLARuntime::Common::WasmRuntime> s_rt;
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (s_rt == nullptr)
+	{
+		auto rt = MakeTestRuntime();
+		rt->EnableSuspend(
+			[](uint64_t, uint64_t threshold)
+			{
+				++gs_numSuspendGrants;
+				return threshold;
+			}
+		);
+		rt->LoadPlainModule(GetLoadedWasm());
+		s_rt = rt;
+	}
+	return s_rt;
+}
+
+
+/**
+ * @brief The runtime shared by the concurrent runs of
+ *        `ecall_end2end_test_sampling`, which samples the call stack often
+ *
+ */
+std::shared_ptr<SLARuntime::Common::WasmRuntime> GetSamplingTestRuntime()
+{
+	static std::mutex s_mutex;
+	static std::shared_ptr<SLARuntime::Common::WasmRuntime> s_rt;
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (s_rt == nullptr)
+	{
+		auto rt = MakeTestRuntime();
+		rt->EnableProfiling(64);
+		rt->LoadPlainModule(GetLoadedWasm());
+		s_rt = rt;
+	}
+	return s_rt;
+}
+
+
+std::shared_ptr<SLARuntime::Common::WasmWorkerPool> GetPool()
+{
+	std::lock_guard<std::mutex> lock(gs_poolMutex);
+	if (gs_pool == nullptr)
+	{
+		throw std::runtime_error("The worker pool is not started");
+	}
+	return gs_pool;
+}
+
+
+/**
+ * @brief Check a ring handed over by the host: all of it, including its
+ *        slots, must be in untrusted memory, and its atomics must be aligned
+ *
+ */
+template<typename _RingType>
+inline bool IsValidUntrustedRing(const void* ring)
+{
+	// the slots are stored in the ring itself, not behind a pointer
+	static_assert(
+		sizeof(_RingType) >=
+			(sizeof(typename _RingType::SlotType) * _RingType::sk_numSlots),
+		"The ring must hold its slots"
+	);
+
+	uintptr_t addr = reinterpret_cast<uintptr_t>(ring);
+	return (ring != nullptr) &&
+		(addr % alignof(_RingType) == 0) &&
+		(addr <= (std::numeric_limits<uintptr_t>::max() - sizeof(_RingType))) &&
+		sgx_is_outside_enclave(ring, sizeof(_RingType));
+}
+
+
 void GlobalInitialization()
 {
 	using namespace DecentEnclave::Common;
@@ -175,6 +475,14 @@ void Init(
 	);
 
 	SLARuntime::Common::SubscribeToSlaProposeEvent(gs_slaRt);
+
+#ifdef END2END_TSC_CLOCK
+	// ocalls are allowed now; calibrate here rather than in the first request
+	for (const auto* clock : gs_tscClocks)
+	{
+		clock->Calibrate();
+	}
+#endif // END2END_TSC_CLOCK
 }
 
 
@@ -210,16 +518,52 @@ extern "C" sgx_status_t ecall_end2end_init(
 
 extern "C" sgx_status_t ecall_end2end_load_wasm(
 	const uint8_t* in_wasm,
-	size_t in_wasm_size
+	size_t in_wasm_size,
+	int enable_sla_ring,
+	int enable_cost_model,
+	int enable_mem_accounting,
+	int enable_sla_log
 )
 {
 	try
 	{
 		std::vector<uint8_t> wasm(in_wasm, in_wasm + in_wasm_size);
 
+		// each of them costs something on every request, so they're only
+		// enabled when asked for
+		if (enable_cost_model)
+		{
+			End2End::gs_rt.EnableCostModel();
+		}
+		if (enable_mem_accounting)
+		{
+			End2End::gs_rt.EnableMemAccounting();
+		}
+		if (enable_sla_ring)
+		{
+			End2End::gs_rt.SetSlaRecordRing(End2End::gs_slaRecordRing, 0);
+		}
+		if (enable_sla_log)
+		{
+			if (enable_sla_ring)
+			{
+				// logged when drained, off the request path
+				End2End::gs_slaRecordDrain.AddSink(
+					SLARuntime::Common::SlaRecordDrain::MakeJsonLogSink()
+				);
+			}
+			else
+			{
+				End2End::gs_rt.SetSlaReportLogging(true);
+			}
+		}
+
 		// Load wasm module
 		End2End::gs_rt.LoadPlainModule(wasm);
 
+		std::lock_guard<std::mutex> lock(End2End::gs_wasmMutex);
+		End2End::gs_wasm = std::move(wasm);
+
 		return SGX_SUCCESS;
 	}
 	catch(const std::exception& e)
@@ -231,6 +575,58 @@ extern "C" sgx_status_t ecall_end2end_load_wasm(
 }
 
 extern "C" sgx_status_t ecall_end2end_run_func(
+	const uint8_t* in_event_id,
+	size_t in_event_id_size,
+	const uint8_t* in_msg,
+	size_t in_msg_size,
+	uint64_t threshold,
+	uint8_t* out_result,
+	size_t out_result_size,
+	size_t* out_result_len
+)
+{
+	try
+	{
+		std::vector<uint8_t> eventId(in_event_id, in_event_id + in_event_id_size);
+		std::vector<uint8_t> msg(in_msg, in_msg + in_msg_size);
+
+		// the caller's threshold stands; the cost model only fills in when
+		// none is given, with its margin and floor (see `CostModelConfig`),
+		// and there's no limit until the cost of the module is learned
+		if (threshold == 0)
+		{
+			threshold = End2End::gs_rt.GetAutoThreshold(msg.size());
+		}
+
+		// the result is copied straight from the module's linear memory into
+		// the output buffer; the full length is given back, even if the
+		// buffer is too small for it
+		*out_result_len = 0;
+		End2End::gs_rt.RunModule(
+			eventId,
+			msg,
+			threshold,
+			[out_result, out_result_size, out_result_len](
+				const uint8_t* data,
+				size_t size
+			)
+			{
+				std::memcpy(out_result, data, std::min(size, out_result_size));
+				*out_result_len = size;
+			}
+		);
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_event_size(
 	const uint8_t* in_event_id,
 	size_t in_event_id_size,
 	const uint8_t* in_msg,
@@ -242,9 +638,288 @@ extern "C" sgx_status_t ecall_end2end_run_func(
 		std::vector<uint8_t> eventId(in_event_id, in_event_id + in_event_id_size);
 		std::vector<uint8_t> msg(in_msg, in_msg + in_msg_size);
 
+		// the cost model learns from the event size in the result, and is
+		// asked with the size of the message, so the two must agree
+		auto inst = End2End::gs_rt.NewInstance();
+		auto result = End2End::gs_rt.RunOnInstance(
+			inst,
+			eventId,
+			msg,
+			std::numeric_limits<uint64_t>::max()
+		);
+		if (result.m_eventSize != msg.size())
+		{
+			throw std::runtime_error(
+				"The event size learned (" +
+				std::to_string(result.m_eventSize) +
+				") isn't the size predicted from (" +
+				std::to_string(msg.size()) + ")"
+			);
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_run_func_stream(
+	const uint8_t* in_event_id,
+	size_t in_event_id_size,
+	uint64_t stream_id,
+	uint64_t stream_size
+)
+{
+	try
+	{
+		std::vector<uint8_t> eventId(in_event_id, in_event_id + in_event_id_size);
+
+		uint64_t threshold = std::numeric_limits<uint64_t>::max();
+
+		End2End::gs_rt.RunModuleStream(
+			eventId,
+			End2End::MakeUntrustedEventStream(stream_id, stream_size),
+			threshold
+		);
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_run_batch(
+	const uint8_t* in_events,
+	size_t in_events_size,
+	uint8_t* out_results,
+	size_t out_results_size
+)
+{
+	try
+	{
+		uint64_t threshold = std::numeric_limits<uint64_t>::max();
+
+		std::vector<uint8_t> results = End2End::gs_rt.RunModuleBatch(
+			in_events,
+			in_events_size,
+			threshold
+		);
+		if (results.size() != out_results_size)
+		{
+			throw std::invalid_argument(
+				"The size of the result buffer doesn't match the batch size"
+			);
+		}
+		std::memcpy(out_results, results.data(), results.size());
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_ring_worker(
+	void* req_ring,
+	void* cpl_ring
+)
+{
+	try
+	{
+		// The rings are in untrusted memory; make sure that neither of them
+		// overlaps with the enclave, over their whole size, and that they
+		// don't overlap with each other
+		uintptr_t reqAddr = reinterpret_cast<uintptr_t>(req_ring);
+		uintptr_t cplAddr = reinterpret_cast<uintptr_t>(cpl_ring);
+		if (
+			!End2End::IsValidUntrustedRing<End2End::RequestRing>(req_ring) ||
+			!End2End::IsValidUntrustedRing<End2End::CompletionRing>(cpl_ring) ||
+			!(
+				(reqAddr + sizeof(End2End::RequestRing) <= cplAddr) ||
+				(cplAddr + sizeof(End2End::CompletionRing) <= reqAddr)
+			)
+		)
+		{
+			throw std::invalid_argument("Invalid request/completion ring");
+		}
+		auto cplRing = static_cast<End2End::CompletionRing*>(cpl_ring);
+		// the head of the request ring is kept in the enclave, so the host
+		// can't make the worker read a request twice, or skip one
+		SLARuntime::Common::SpscRingConsumer<End2End::RequestRing> reqRing(
+			*static_cast<End2End::RequestRing*>(req_ring)
+		);
+
+		::WasmRuntime::WasmThreadEnv threadEnv;
+
 		uint64_t threshold = std::numeric_limits<uint64_t>::max();
 
-		End2End::gs_rt.RunModule(eventId, msg, threshold);
+		uint64_t reqId = 0;
+		std::vector<uint8_t> req;
+		std::vector<uint8_t> results;
+		while (!reqRing.IsClosedAndEmpty())
+		{
+			// The request is copied into the enclave by TryPop before it is
+			// processed, so the host can't change it afterwards
+			if (!reqRing.TryPop(reqId, req))
+			{
+				__builtin_ia32_pause();
+				continue;
+			}
+
+			try
+			{
+				results = End2End::gs_rt.RunModuleBatch(
+					req.data(),
+					req.size(),
+					threshold
+				);
+			}
+			catch(const std::exception& e)
+			{
+				using namespace DecentEnclave::Common;
+				Platform::Print::StrErr(e.what());
+				results.clear();
+			}
+
+			while (!cplRing->TryPush(reqId, results.data(), results.size()))
+			{
+				__builtin_ia32_pause();
+			}
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_pool_start(size_t num_workers)
+{
+	try
+	{
+		auto pool = std::make_shared<SLARuntime::Common::WasmWorkerPool>(
+			End2End::gs_rt,
+			num_workers
+		);
+
+		std::lock_guard<std::mutex> lock(End2End::gs_poolMutex);
+		End2End::gs_pool = pool;
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_pool_worker(size_t worker_idx)
+{
+	try
+	{
+		End2End::GetPool()->RunWorker(worker_idx);
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_pool_run_batch(
+	const uint8_t* in_events,
+	size_t in_events_size,
+	uint8_t* out_results,
+	size_t out_results_size
+)
+{
+	try
+	{
+		using namespace SLARuntime::Common;
+
+		auto pool = End2End::GetPool();
+
+		EventBatchReader reader(in_events, in_events_size);
+		if (
+			EventBatch::GetResultsSize(reader.GetNumEvents()) !=
+			out_results_size
+		)
+		{
+			throw std::invalid_argument(
+				"The size of the result buffer doesn't match the batch size"
+			);
+		}
+
+		uint64_t ownerId = End2End::gs_poolNextOwnerId++;
+
+		std::vector<EventRunResult> results(reader.GetNumEvents());
+		size_t numSubmitted = 0;
+		size_t numDone = 0;
+		std::mutex doneMutex;
+		auto isSubmittedDone = [&numDone, &numSubmitted, &doneMutex]()
+		{
+			std::lock_guard<std::mutex> lock(doneMutex);
+			return numDone == numSubmitted;
+		};
+
+		try
+		{
+			for (size_t i = 0; reader.HasNext(); ++i)
+			{
+				WasmWorkerPool::Task task;
+				reader.Next(task.m_eventId, task.m_eventData);
+				task.m_threshold = std::numeric_limits<uint64_t>::max();
+				task.m_ownerId = ownerId;
+				task.m_callback =
+					[i, &results, &numDone, &doneMutex]
+					(const EventRunResult& result)
+					{
+						std::lock_guard<std::mutex> lock(doneMutex);
+						results[i] = result;
+						++numDone;
+					};
+				pool->Submit(std::move(task));
+				++numSubmitted;
+			}
+		}
+		catch (...)
+		{
+			// the submitted events still refer to the state on this stack
+			pool->WaitUntil(isSubmittedDone);
+			throw;
+		}
+
+		// returns early if the pool is stopped with no worker left to run
+		// the events
+		if (!pool->WaitUntil(isSubmittedDone))
+		{
+			throw std::runtime_error(
+				"The worker pool was stopped before the batch was done"
+			);
+		}
+
+		std::vector<uint8_t> packed = EventBatch::EncodeResults(results);
+		std::memcpy(out_results, packed.data(), packed.size());
 
 		return SGX_SUCCESS;
 	}
@@ -256,3 +931,1203 @@ extern "C" sgx_status_t ecall_end2end_run_func(
 	}
 }
 
+extern "C" sgx_status_t ecall_end2end_pool_stop()
+{
+	try
+	{
+		End2End::GetPool()->Stop();
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_log_heap_stats()
+{
+	try
+	{
+		End2End::gs_rt.LogHeapStats();
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_arena_heap(uint64_t num_rounds)
+{
+	try
+	{
+		// A small heap of its own, so the runtime heap is left alone
+		std::vector<uint8_t> buf(2 * 1024 * 1024);
+		::WasmRuntime::ArenaHeap heap(buf.data(), buf.size(), 2, 256 * 1024);
+
+		auto getFootprint = [&heap]()
+		{
+			size_t footprint = 0;
+			for (size_t i = 0; i <= heap.GetNumArenas(); ++i)
+			{
+				footprint += heap.GetRegionFootprint(i);
+			}
+			return footprint;
+		};
+
+		// Churn a fixed number of live blocks of mixed sizes; one in eight
+		// is large enough to go to the slab region
+		std::vector<void*> slots(128, nullptr);
+		uint64_t rng = 0x9E3779B97F4A7C15ULL;
+		for (uint64_t round = 0; round < num_rounds; ++round)
+		{
+			for (size_t i = 0; i < 4096; ++i)
+			{
+				rng ^= rng << 13;
+				rng ^= rng >> 7;
+				rng ^= rng << 17;
+				size_t slot = rng % slots.size();
+				size_t size = ((rng >> 32) % 8 == 0) ?
+					1 + ((rng >> 16) % (32 * 1024)) :
+					1 + ((rng >> 16) % 2048);
+
+				heap.Free(slots[slot]);
+				slots[slot] = heap.Malloc(size);
+				if (slots[slot] == nullptr)
+				{
+					throw std::runtime_error(
+						"Arena heap exhausted after " +
+						std::to_string(round) + " rounds of churn"
+					);
+				}
+			}
+
+			// Free space is merged and reused, so the part of the heap in
+			// use stays within a constant factor of the live blocks
+			::WasmRuntime::HeapStats stats = heap.GetStats();
+			uint64_t liveSize = stats.m_usedSize + stats.m_internalFragSize;
+			if (getFootprint() > (3 * liveSize))
+			{
+				throw std::runtime_error(
+					"Arena heap footprint keeps growing under churn"
+				);
+			}
+		}
+
+		for (void* ptr : slots)
+		{
+			heap.Free(ptr);
+		}
+		::WasmRuntime::HeapStats stats = heap.GetStats();
+		if (
+			(getFootprint() != 0) ||
+			(stats.m_usedSize != 0) ||
+			(stats.m_internalFragSize != 0) ||
+			(stats.m_externalFragSize != 0)
+		)
+		{
+			throw std::runtime_error(
+				"Arena heap isn't empty after freeing all blocks"
+			);
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_suspend(
+	const uint8_t* in_event_id,
+	size_t in_event_id_size,
+	const uint8_t* in_msg,
+	size_t in_msg_size
+)
+{
+	try
+	{
+		std::vector<uint8_t> eventId(in_event_id, in_event_id + in_event_id_size);
+		std::vector<uint8_t> msg(in_msg, in_msg + in_msg_size);
+
+		::WasmRuntime::WasmThreadEnv threadEnv;
+
+		auto rt = End2End::GetSuspendTestRuntime();
+
+		// Runs on other threads suspend at the same time as these, each on a
+		// gate of its own
+		uint64_t grantsBefore = End2End::gs_numSuspendGrants.load();
+		rt->RunModule(eventId, msg, 1);
+		if (End2End::gs_numSuspendGrants.load() == grantsBefore)
+		{
+			throw std::runtime_error(
+				"The run out of budget was not suspended"
+			);
+		}
+
+		// a handle tells about its own run only
+		auto handle = rt->NewSuspendHandle();
+		rt->RunModule(
+			eventId,
+			msg,
+			1,
+			SLARuntime::Common::WasmRuntime::ResultSink(),
+			handle
+		);
+		if (
+			(handle->GetState() != ::WasmRuntime::BudgetGate::State::Done) ||
+			(handle->GetNumSuspensions() == 0)
+		)
+		{
+			throw std::runtime_error(
+				"The suspend handle doesn't tell about its run"
+			);
+		}
+
+		// ... and can be reused once its run is done
+		uint64_t numSuspensions = handle->GetNumSuspensions();
+		rt->RunModule(
+			eventId,
+			msg,
+			1,
+			SLARuntime::Common::WasmRuntime::ResultSink(),
+			handle
+		);
+		if (handle->GetNumSuspensions() != numSuspensions)
+		{
+			throw std::runtime_error(
+				"The reused suspend handle kept the count of its last run"
+			);
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_sampling(
+	const uint8_t* in_event_id,
+	size_t in_event_id_size,
+	const uint8_t* in_msg,
+	size_t in_msg_size,
+	uint64_t threshold,
+	uint64_t num_runs,
+	uint8_t expect_trap
+)
+{
+	try
+	{
+		std::vector<uint8_t> eventId(in_event_id, in_event_id + in_event_id_size);
+		std::vector<uint8_t> msg(in_msg, in_msg + in_msg_size);
+
+		::WasmRuntime::WasmThreadEnv threadEnv;
+
+		auto rt = End2End::GetSamplingTestRuntime();
+
+		// Runs on other threads, with other thresholds, sample at the same
+		// time as these; each run stops at its own threshold only
+		for (uint64_t i = 0; i < num_runs; ++i)
+		{
+			bool isTrapped = false;
+			try
+			{
+				rt->RunModule(eventId, msg, threshold);
+			}
+			catch (const ::WasmRuntime::WasmRuntimeException&)
+			{
+				isTrapped = true;
+			}
+			if (isTrapped != (expect_trap != 0))
+			{
+				throw std::runtime_error(
+					"A sampled run with threshold " + std::to_string(threshold) +
+					(isTrapped ? " was aborted" : " was not aborted")
+				);
+			}
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_checkpoint(
+	const uint8_t* in_event_id,
+	size_t in_event_id_size,
+	const uint8_t* in_msg,
+	size_t in_msg_size
+)
+{
+	try
+	{
+		std::vector<uint8_t> eventId(in_event_id, in_event_id + in_event_id_size);
+		std::vector<uint8_t> msg(in_msg, in_msg + in_msg_size);
+
+		// the first send fails, as if the chain couldn't be reached
+		size_t numSendCalls = 0;
+		std::vector<uint64_t> sentSeqNums;
+		SLARuntime::Common::CheckpointConfig config;
+		config.m_maxRequests = 2;
+		auto chkptAcc = std::make_shared<SLARuntime::Common::CheckpointAccumulator>(
+			config,
+			[&numSendCalls, &sentSeqNums](
+				uint64_t seqNum,
+				uint64_t numRequests,
+				const std::vector<uint8_t>&
+			)
+			{
+				if (numSendCalls++ == 0)
+				{
+					throw std::runtime_error("The chain can't be reached");
+				}
+				if (numRequests != 2)
+				{
+					throw std::runtime_error("The report lost requests");
+				}
+				sentSeqNums.push_back(seqNum);
+			}
+		);
+
+		auto rt = End2End::MakeTestRuntime();
+		rt->SetCheckpointAccumulator(chkptAcc);
+		rt->LoadPlainModule(End2End::GetLoadedWasm());
+
+		// requests only queue the report
+		uint64_t threshold = std::numeric_limits<uint64_t>::max();
+		rt->RunModule(eventId, msg, threshold);
+		rt->RunModule(eventId, msg, threshold);
+		if ((numSendCalls != 0) || (chkptAcc->GetNumQueued() != 1))
+		{
+			throw std::runtime_error("A request sent its checkpoint report");
+		}
+
+		// a failed report keeps its sequence number, and is sent again
+		if (
+			(chkptAcc->SendPending() != 0) ||
+			(chkptAcc->GetNextSeqNum() != 0) ||
+			(chkptAcc->GetNumQueued() != 1)
+		)
+		{
+			throw std::runtime_error("A checkpoint report that failed was dropped");
+		}
+		rt->RunModule(eventId, msg, threshold);
+		rt->RunModule(eventId, msg, threshold);
+		if (
+			(chkptAcc->SendPending() != 2) ||
+			(sentSeqNums != std::vector<uint64_t>{ 0, 1 }) ||
+			(chkptAcc->GetNumQueued() != 0)
+		)
+		{
+			throw std::runtime_error("The checkpoint reports were sent out of order");
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_receipts(
+	const uint8_t* in_event_id,
+	size_t in_event_id_size,
+	const uint8_t* in_msg,
+	size_t in_msg_size
+)
+{
+	try
+	{
+		std::vector<uint8_t> eventId(in_event_id, in_event_id + in_event_id_size);
+		std::vector<uint8_t> msg(in_msg, in_msg + in_msg_size);
+
+		// the first send fails, as if the chain couldn't be reached
+		size_t numSendCalls = 0;
+		std::vector<SLARuntime::Common::CheckpointCommit> commits;
+		SLARuntime::Common::ReceiptConfig config;
+		config.m_maxRequests = 2;
+		auto receiptAcc = std::make_shared<SLARuntime::Common::ReceiptAccumulator>(
+			config,
+			[&numSendCalls, &commits](
+				const SLARuntime::Common::CheckpointCommit& commit
+			)
+			{
+				if (numSendCalls++ == 0)
+				{
+					throw std::runtime_error("The chain can't be reached");
+				}
+				commits.push_back(commit);
+			}
+		);
+
+		auto rt = End2End::MakeTestRuntime();
+		rt->SetReceiptAccumulator(receiptAcc);
+		rt->LoadPlainModule(End2End::GetLoadedWasm());
+
+		// reports and commits share the checkpoint sequence on chain
+		bool isRefused = false;
+		try
+		{
+			rt->SetCheckpointAccumulator(
+				std::make_shared<SLARuntime::Common::CheckpointAccumulator>(
+					SLARuntime::Common::CheckpointConfig(),
+					SLARuntime::Common::CheckpointAccumulator::FlushFunc()
+				)
+			);
+		}
+		catch (const std::logic_error&)
+		{
+			isRefused = true;
+		}
+		if (!isRefused)
+		{
+			throw std::runtime_error(
+				"Checkpoint reports were allowed along with receipt commits"
+			);
+		}
+
+		// requests only queue the checkpoint
+		uint64_t threshold = std::numeric_limits<uint64_t>::max();
+		rt->RunModule(eventId, msg, threshold);
+		rt->RunModule(eventId, msg, threshold);
+		if ((numSendCalls != 0) || (receiptAcc->GetNumQueued() != 1))
+		{
+			throw std::runtime_error("A request sent its checkpoint commit");
+		}
+
+		// a failed commit keeps its sequence number, and is sent again
+		if (
+			(receiptAcc->SendPending() != 0) ||
+			(receiptAcc->GetNextSeqNum() != 0) ||
+			(receiptAcc->SendPending() != 1) ||
+			(commits.size() != 1) ||
+			(commits[0].m_seqNum != 0) ||
+			(commits[0].m_numRequests != 2)
+		)
+		{
+			throw std::runtime_error("A checkpoint commit that failed was lost");
+		}
+
+		// ... and its receipts are proven against the root sent
+		SLARuntime::Common::ReceiptProof proof = receiptAcc->GetProof(1);
+		if (!SLARuntime::Common::ReceiptTree::Verify(proof, commits[0].m_root))
+		{
+			throw std::runtime_error("The receipt isn't in the committed root");
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_module_registry()
+{
+	try
+	{
+		SLARuntime::Common::ModuleRegistry registry(
+			End2End::gs_rt.GetSharedRuntime(),
+			2 * 1024 * 1024, // 2MB - Module stack size
+			7 * 1024 * 1024, // 7MB - Module heap size
+			1 * 1024 * 1024  // 1MB - Execution stack size
+		);
+		auto loadFunc = []() { return End2End::GetLoadedWasm(); };
+		static const std::string sk_key = "end2end";
+
+		auto instOwner1 = registry.AcquireInstance(sk_key, 1, loadFunc);
+		const void* inst1 = instOwner1.m_inst.m_modInst.get();
+		registry.ReleaseInstance(sk_key, std::move(instOwner1));
+
+		// another owner never gets the instance left by the first one
+		auto instOwner2 = registry.AcquireInstance(sk_key, 2, loadFunc);
+		if (instOwner2.m_inst.m_modInst.get() == inst1)
+		{
+			throw std::runtime_error(
+				"A warm instance was given to another owner"
+			);
+		}
+		registry.ReleaseInstance(sk_key, std::move(instOwner2));
+
+		// ... while its own owner does
+		instOwner1 = registry.AcquireInstance(sk_key, 1, loadFunc);
+		if (instOwner1.m_inst.m_modInst.get() != inst1)
+		{
+			throw std::runtime_error(
+				"The warm instance wasn't given back to its owner"
+			);
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_txn_queue()
+{
+	try
+	{
+		using namespace SLARuntime::Common;
+
+		// there is no queue without a nonce source
+		bool isRefused = false;
+		try
+		{
+			TxnQueue queue(
+				::WasmRuntime::SystemIONull::MakeUnique(),
+				[](const std::vector<uint8_t>&) {},
+				TxnQueue::NonceFunc(),
+				0
+			);
+		}
+		catch (const std::invalid_argument&)
+		{
+			isRefused = true;
+		}
+		if (!isRefused)
+		{
+			throw std::runtime_error(
+				"A transaction queue was made without a nonce source"
+			);
+		}
+
+		// the built transaction is just its nonce
+		auto buildFunc = [](uint64_t nonce, uint64_t, uint64_t)
+		{
+			return std::vector<uint8_t>{ static_cast<uint8_t>(nonce) };
+		};
+		std::vector<uint64_t> sentNonces;
+		bool isSendFailing = false;
+		uint64_t chainNonce = 0;
+
+		TxnQueueConfig config;
+		config.m_retryAfterUs = 0;
+		config.m_noncePollIntervalUs = 0;
+		TxnQueue queue(
+			::WasmRuntime::SystemIONull::MakeUnique(),
+			[&sentNonces, &isSendFailing](const std::vector<uint8_t>& txn)
+			{
+				if (isSendFailing)
+				{
+					throw std::runtime_error("The connection is lost");
+				}
+				sentNonces.push_back(txn[0]);
+			},
+			[&chainNonce]() { return chainNonce; },
+			0,
+			config
+		);
+
+		queue.Submit(buildFunc);
+		queue.Submit(buildFunc);
+		queue.Submit(buildFunc);
+		if (
+			(queue.ProcessOnce() != 3) ||
+			(sentNonces != std::vector<uint64_t>{ 0, 1, 2 })
+		)
+		{
+			throw std::runtime_error("The transactions weren't sent in order");
+		}
+
+		// two are confirmed, and the send of the next one fails
+		chainNonce = 2;
+		isSendFailing = true;
+		queue.Submit(buildFunc);
+		queue.ProcessOnce();
+		TxnQueueStats stats = queue.GetStats();
+		if ((stats.m_numConfirmed != 2) || (stats.m_numFailedSends != 1))
+		{
+			throw std::runtime_error("The confirmations weren't learned");
+		}
+
+		// ... but it reached the node, and is confirmed, so it's not sent again
+		chainNonce = 4;
+		isSendFailing = false;
+		queue.ProcessOnce();
+		stats = queue.GetStats();
+		if (
+			(stats.m_numConfirmed != 4) ||
+			(stats.m_numRenumbered != 0) ||
+			(sentNonces.size() != 3) ||
+			(stats.m_numQueued + stats.m_numInFlight != 0)
+		)
+		{
+			throw std::runtime_error(
+				"A transaction that may have been sent was sent again"
+			);
+		}
+
+		// a transaction never tried, whose nonce is taken by someone else,
+		// is given a new one
+		queue.Submit(buildFunc);
+		chainNonce = 6;
+		queue.ReconcileNonce(chainNonce);
+		queue.ProcessOnce();
+		stats = queue.GetStats();
+		if ((stats.m_numRenumbered != 1) || (sentNonces.back() != 6))
+		{
+			throw std::runtime_error(
+				"A transaction whose nonce was taken wasn't renumbered"
+			);
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_session_pool()
+{
+	try
+	{
+		using namespace SLARuntime::Common;
+
+		struct FakeSession
+		{
+			bool m_isAlive = true;
+		}; // struct FakeSession
+		using FakePool = SessionPool<FakeSession, std::vector<uint8_t> >;
+
+		// a clock that only moves when it's told to
+		struct FakeClock : public ::WasmRuntime::SystemIO
+		{
+			uint64_t m_nowUs = 1;
+
+			virtual uint64_t GetTimestampUs() const override
+			{
+				return m_nowUs;
+			}
+		}; // struct FakeClock
+		std::unique_ptr<FakeClock> clockOwner(new FakeClock());
+		FakeClock& clock = *clockOwner;
+
+		SessionPoolConfig config;
+		config.m_checkAfterIdleUs = 1000;
+		config.m_replyTimeoutUs = 10000;
+
+		std::shared_ptr<FakeSession> lastSession;
+		FakePool* poolPtr = nullptr;
+		bool isReplyHung = false;
+		size_t numAborts = 0;
+		FakePool pool(
+			std::move(clockOwner),
+			[&lastSession](std::vector<uint8_t>&)
+			{
+				lastSession = std::make_shared<FakeSession>();
+				return lastSession;
+			},
+			[](FakeSession& session, std::vector<uint8_t>&)
+			{
+				if (!session.m_isAlive)
+				{
+					throw std::runtime_error("The session is closed");
+				}
+			},
+			config,
+			[](FakeSession& session) { return session.m_isAlive; },
+			[&clock, &poolPtr, &isReplyHung, &config](FakeSession&)
+			{
+				if (isReplyHung)
+				{
+					// as if another thread found the reply overdue meanwhile
+					clock.m_nowUs += config.m_replyTimeoutUs;
+					poolPtr->AbortOverdue();
+				}
+				return std::vector<uint8_t>{ 1 };
+			},
+			[&numAborts](FakeSession&) { ++numAborts; }
+		);
+		poolPtr = &pool;
+
+		std::vector<uint8_t> msg{ 0 };
+		pool.Call(msg);
+		pool.Call(msg);
+		SessionPoolStats stats = pool.GetStats();
+		if ((stats.m_numConnects != 1) || (stats.m_numReuses != 1))
+		{
+			throw std::runtime_error("The session wasn't reused");
+		}
+
+		// a session dropped while idle is found out by the check, not by
+		// the message
+		lastSession->m_isAlive = false;
+		clock.m_nowUs += config.m_checkAfterIdleUs;
+		pool.Call(msg);
+		stats = pool.GetStats();
+		if (
+			(stats.m_numFailedChecks != 1) ||
+			(stats.m_numConnects != 2) ||
+			(stats.m_numReconnects != 0) ||
+			(stats.m_numOpen != 1)
+		)
+		{
+			throw std::runtime_error("An idle session wasn't checked");
+		}
+
+		// a session that doesn't reply in time is aborted, and its slot is
+		// given back
+		isReplyHung = true;
+		bool isTimedOut = false;
+		try
+		{
+			pool.Call(msg);
+		}
+		catch (const std::runtime_error&)
+		{
+			isTimedOut = true;
+		}
+		isReplyHung = false;
+		stats = pool.GetStats();
+		if (
+			!isTimedOut ||
+			(numAborts != 1) ||
+			(stats.m_numTimedOut != 1) ||
+			(stats.m_numOpen != 0)
+		)
+		{
+			throw std::runtime_error("A session that hung wasn't given up");
+		}
+
+		pool.Call(msg);
+		if (pool.GetStats().m_numConnects != 3)
+		{
+			throw std::runtime_error("No new session replaced the hung one");
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_request_scheduler()
+{
+	try
+	{
+		using namespace SLARuntime::Common;
+		using Scheduler = RequestScheduler<uint64_t>;
+
+		std::vector<uint64_t> doneContracts;
+		Scheduler scheduler(
+			::WasmRuntime::SystemIONull::MakeUnique(),
+			[&doneContracts](uint64_t contractId, uint64_t&)
+			{
+				doneContracts.push_back(contractId);
+			}
+		);
+
+		if (scheduler.Submit(1, 0, 0, 100) != SchedAdmission::UnknownContract)
+		{
+			throw std::runtime_error("A request of an unknown contract is admitted");
+		}
+
+		// the clock stays at 0, so each request is due at 1000
+		SchedTerms boundTerms;
+		boundTerms.m_latencyBoundUs = 1000;
+		scheduler.SetTerms(3, boundTerms);
+		for (size_t round = 0; round < 2; ++round)
+		{
+			if ((scheduler.Submit(3, 0, 0, 400) != SchedAdmission::Admitted) ||
+				(scheduler.Submit(3, 0, 0, 400) != SchedAdmission::Admitted))
+			{
+				throw std::runtime_error("A request that fits its deadline is rejected");
+			}
+			if (scheduler.Submit(3, 0, 0, 400) != SchedAdmission::DeadlineMiss)
+			{
+				throw std::runtime_error("A request that misses its deadline is admitted");
+			}
+			// the dropped requests no longer count against new ones
+			if (scheduler.RemoveContract(3) != 2)
+			{
+				throw std::runtime_error("The queued requests are not dropped");
+			}
+			scheduler.SetTerms(3, boundTerms);
+		}
+		scheduler.RemoveContract(3);
+
+		SchedTerms heavyTerms;
+		heavyTerms.m_weight = 3;
+		scheduler.SetTerms(1, SchedTerms());
+		scheduler.SetTerms(2, heavyTerms);
+		for (uint64_t i = 0; i < 4; ++i)
+		{
+			scheduler.Submit(1, i, 0, 100);
+			scheduler.Submit(2, i, 0, 100);
+		}
+
+		// a stopped worker runs what's queued, and then returns
+		scheduler.Stop();
+		scheduler.RunWorker();
+		if (doneContracts.size() != 8)
+		{
+			throw std::runtime_error("The queued requests are not all run");
+		}
+		size_t numHeavyFirst = static_cast<size_t>(
+			std::count(doneContracts.begin(), doneContracts.begin() + 4, 2)
+		);
+		if (numHeavyFirst != 3)
+		{
+			throw std::runtime_error("The workers are not shared by weight");
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_result_cache()
+{
+	try
+	{
+		using namespace SLARuntime::Common;
+
+		const std::vector<uint8_t> eventId = { 'c', 'a', 'c', 'h', 'e' };
+		const std::vector<uint8_t> msg = { 'c', 'a', 'c', 'h', 'e', 'd' };
+		const uint64_t maxThreshold = std::numeric_limits<uint64_t>::max();
+
+		std::vector<uint8_t> results[2];
+		auto rt = End2End::MakeTestRuntime();
+		rt->EnableResultCache();
+		rt->LoadPlainModule(End2End::GetLoadedWasm());
+		const auto& cache = rt->GetResultCache();
+		for (auto& result : results)
+		{
+			rt->RunModule(
+				eventId,
+				msg,
+				maxThreshold,
+				[&result](const uint8_t* data, size_t size)
+				{
+					result.assign(data, data + size);
+				}
+			);
+		}
+		if ((cache->GetNumMisses() != 1) || (cache->GetNumHits() != 1))
+		{
+			throw std::runtime_error("A repeated request is not a cache hit");
+		}
+		if (results[0].empty() || (results[0] != results[1]))
+		{
+			throw std::runtime_error("A cache hit doesn't replay the result");
+		}
+
+		// no execution fits in a threshold of 1, so the cached one is skipped,
+		// and the request runs out of budget
+		try
+		{
+			rt->RunModule(eventId, msg, 1);
+		}
+		catch (const std::exception&)
+		{}
+		if ((cache->GetNumMisses() != 2) || (cache->GetNumHits() != 1))
+		{
+			throw std::runtime_error(
+				"A cached result over the threshold is used"
+			);
+		}
+
+		auto nonDetRt = End2End::MakeTestRuntime();
+		nonDetRt->EnableResultCache();
+		nonDetRt->LoadPlainModule(End2End::MakeNonDetWasm());
+		const auto& nonDetCache = nonDetRt->GetResultCache();
+		nonDetRt->RunModule(eventId, msg, maxThreshold);
+		nonDetRt->RunModule(eventId, msg, maxThreshold);
+		if (
+			(nonDetCache->GetNumEntries() != 0) ||
+			(nonDetCache->GetNumHits() != 0) ||
+			(nonDetCache->GetNumMisses() != 0)
+		)
+		{
+			throw std::runtime_error(
+				"The results of a non-deterministic module are cached"
+			);
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_test_proposals()
+{
+	try
+	{
+		using namespace SLARuntime::Common;
+
+		// accept transactions are only queued, since the queue isn't run
+		auto slaRt = ::SLARuntime::Common::SLARuntime::MakeUnique(
+			End2End::DecentKey_Secp256k1::GetKeySharedPtr(),
+			End2End::DecentKey_Secp256k1DH::GetKeySharedPtr(),
+			/*chainId=*/1,
+			EclipseMonitor::Eth::ContractAddr()
+		);
+		slaRt->EnableTxnQueue(
+			::WasmRuntime::SystemIONull::MakeUnique(),
+			TxnQueueConfig(),
+			[]() { return 0; }
+		);
+		slaRt->EnableProposalWorkers();
+
+		// any point on the curve will do as the client's key
+		auto clientKey = End2End::DecentKey_Secp256k1::GetKeySharedPtr();
+		auto pubX = clientKey->BorrowPubPointX().Bytes</*_LitEndian=*/false>();
+		auto pubY = clientKey->BorrowPubPointY().Bytes</*_LitEndian=*/false>();
+		SlaProposal proposal;
+		proposal.m_contractId = 1;
+		proposal.m_clientKeyX.assign(pubX.begin(), pubX.end());
+		proposal.m_clientKeyY.assign(pubY.begin(), pubY.end());
+
+		// a stopped worker handles what's queued, and then returns
+		slaRt->GetProposalPool().Submit(proposal);
+		slaRt->GetProposalPool().Submit(proposal);
+		slaRt->StopProposalWorkers();
+		slaRt->RunProposalWorker();
+		if (
+			(slaRt->GetNumContracts() != 1) ||
+			(slaRt->GetContract(1) == nullptr) ||
+			(slaRt->GetTxnQueue().GetStats().m_numSubmitted != 1)
+		)
+		{
+			throw std::runtime_error("A proposal delivered twice is not accepted once");
+		}
+
+		// (0, 0) isn't on the curve, so no key can be derived from it
+		SlaProposal badProposal = proposal;
+		badProposal.m_contractId = 2;
+		badProposal.m_clientKeyX.assign(32, 0);
+		badProposal.m_clientKeyY.assign(32, 0);
+		mbedTLScpp::DefaultRbg rand;
+		bool isRejected = false;
+		try
+		{
+			slaRt->HandleProposal(badProposal, rand);
+		}
+		catch (const std::exception&)
+		{
+			isRejected = true;
+		}
+		if (!isRejected || (slaRt->GetNumContracts() != 1))
+		{
+			throw std::runtime_error("A failed proposal keeps its contract ID");
+		}
+
+		proposal.m_contractId = 2;
+		slaRt->HandleProposal(proposal, rand);
+		if (
+			(slaRt->GetContract(2) == nullptr) ||
+			(slaRt->GetTxnQueue().GetStats().m_numSubmitted != 2)
+		)
+		{
+			throw std::runtime_error("A given back contract ID can't be accepted");
+		}
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_bench_clock(uint64_t num_iters)
+{
+	try
+	{
+		using namespace DecentEnclave::Common;
+
+		auto refSysIO = End2End::SystemIO::MakeUnique();
+		// falls back to the reference clock where RDTSC isn't usable
+		auto tscSysIO = End2End::MakeTscClock();
+		// calibrate before timing
+		tscSysIO->GetTimestampUs();
+
+		// Both are timed with the TSC clock, since the reference clock has
+		// only microsecond precision
+		uint64_t sum = 0;
+		uint64_t start = tscSysIO->GetTimestampUs();
+		for (uint64_t i = 0; i < num_iters; ++i)
+		{
+			sum += refSysIO->GetTimestampUs();
+		}
+		uint64_t refDuration = tscSysIO->GetTimestampUs() - start;
+
+		start = tscSysIO->GetTimestampUs();
+		for (uint64_t i = 0; i < num_iters; ++i)
+		{
+			sum += tscSysIO->GetTimestampUs();
+		}
+		uint64_t tscDuration = tscSysIO->GetTimestampUs() - start;
+
+		uint64_t diff = tscSysIO->GetTimestampUs() - refSysIO->GetTimestampUs();
+
+		Platform::Print::StrInfo(
+			"Clock benchmark: {"
+				"\"num_iters\":"          + std::to_string(num_iters)                          + ", "
+				"\"ref_ns_per_ts\":"      + std::to_string(refDuration * 1000 / num_iters)     + ", "
+				"\"tsc_ns_per_ts\":"      + std::to_string(tscDuration * 1000 / num_iters)     + ", "
+				"\"tsc_in_use\":"         + std::to_string(!tscSysIO->IsUsingRefClock())       + ", "
+				"\"ticks_per_us\":"       + std::to_string(tscSysIO->GetTicksPerUs())          + ", "
+				"\"recalibrations\":"     + std::to_string(tscSysIO->GetNumRecalibrations())   + ", "
+				"\"drifts\":"             + std::to_string(tscSysIO->GetNumDrifts())           + ", "
+				"\"inconsistencies\":"    + std::to_string(tscSysIO->GetNumInconsistencies())  + ", "
+				"\"max_drift_us\":"       + std::to_string(tscSysIO->GetMaxDriftUs())          + ", "
+				"\"diff_to_ref_us\":"     + std::to_string(static_cast<int64_t>(diff))         + ", "
+				"\"checksum\":"           + std::to_string(sum & 1)                            + ""
+			"}"
+		);
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_bench_encrypt(
+	uint64_t msg_size,
+	uint64_t num_msgs,
+	uint64_t batch_size
+)
+{
+	try
+	{
+		using namespace DecentEnclave::Common;
+		using SLARuntime::Common::SLAContract;
+
+		if ((num_msgs == 0) || (batch_size == 0))
+		{
+			throw std::invalid_argument("Nothing to benchmark");
+		}
+
+		auto sysIO = End2End::MakeTscClock();
+		sysIO->GetTimestampUs();
+
+		// The generator of secp256k1, as the client key
+		static const std::vector<uint8_t> sk_gx = {
+			0x79, 0xBE, 0x66, 0x7E, 0xF9, 0xDC, 0xBB, 0xAC,
+			0x55, 0xA0, 0x62, 0x95, 0xCE, 0x87, 0x0B, 0x07,
+			0x02, 0x9B, 0xFC, 0xDB, 0x2D, 0xCE, 0x28, 0xD9,
+			0x59, 0xF2, 0x81, 0x5B, 0x16, 0xF8, 0x17, 0x98,
+		};
+		static const std::vector<uint8_t> sk_gy = {
+			0x48, 0x3A, 0xDA, 0x77, 0x26, 0xA3, 0xC4, 0x65,
+			0x5D, 0xA4, 0xFB, 0xFC, 0x0E, 0x11, 0x08, 0xA8,
+			0xFD, 0x17, 0xB4, 0x48, 0xA6, 0x85, 0x54, 0x19,
+			0x9C, 0x47, 0xD0, 0x8F, 0xFB, 0x10, 0xD4, 0xB8,
+		};
+		auto cltKey = SLAContract::EthPublicKeyType::FromPublicNum(
+			mbedTLScpp::BigNum(mbedTLScpp::CtnFullR(sk_gx), true, false),
+			mbedTLScpp::BigNum(mbedTLScpp::CtnFullR(sk_gy), true, false)
+		);
+
+		mbedTLScpp::DefaultRbg rand;
+		mbedTLScpp::SecretVector<uint8_t> rootKey;
+		rootKey.resize(32);
+		rand.Rand(rootKey.data(), rootKey.size());
+
+		auto contract = SLAContract::MakeUnique(
+			0,
+			EclipseMonitor::Eth::ContractAddr(),
+			std::move(cltKey),
+			std::move(rootKey)
+		);
+
+		std::vector<std::vector<uint8_t> > responses(
+			batch_size,
+			std::vector<uint8_t>(msg_size, 0x5A)
+		);
+		uint64_t numBatches = (num_msgs + batch_size - 1) / batch_size;
+		uint64_t numBytes = numBatches * batch_size * msg_size;
+
+		// RLP-packaged, with a random IV, as the connect message
+		size_t sum = 0;
+		uint64_t start = sysIO->GetTimestampUs();
+		for (uint64_t i = 0; i < numBatches * batch_size; ++i)
+		{
+			sum += contract->EncryptData(responses[0]).size();
+		}
+		uint64_t rlpDuration = sysIO->GetTimestampUs() - start;
+
+		// One at a time, into the same buffer
+		std::vector<uint8_t> out(SLAContract::GetSealedSize(msg_size));
+		start = sysIO->GetTimestampUs();
+		for (uint64_t i = 0; i < numBatches * batch_size; ++i)
+		{
+			sum += contract->EncryptResponse(
+				responses[0].data(),
+				responses[0].size(),
+				out.data(),
+				out.size()
+			);
+		}
+		uint64_t singleDuration = sysIO->GetTimestampUs() - start;
+
+		// In batches, each sealed into a buffer of its own
+		out.clear();
+		start = sysIO->GetTimestampUs();
+		for (uint64_t i = 0; i < numBatches; ++i)
+		{
+			out.clear();
+			sum += contract->EncryptResponses(responses, out);
+		}
+		uint64_t batchDuration = sysIO->GetTimestampUs() - start;
+
+		// bytes per microsecond is MB/s
+		auto toMBps = [numBytes](uint64_t durationUs)
+		{
+			return std::to_string(
+				static_cast<double>(numBytes) /
+				static_cast<double>(durationUs == 0 ? 1 : durationUs)
+			);
+		};
+
+		Platform::Print::StrInfo(
+			"Encryption benchmark: {"
+				"\"msg_size\":"       + std::to_string(msg_size)              + ", "
+				"\"num_msgs\":"       + std::to_string(numBatches * batch_size) + ", "
+				"\"batch_size\":"     + std::to_string(batch_size)            + ", "
+				"\"rlp_mbps\":"       + toMBps(rlpDuration)                   + ", "
+				"\"single_mbps\":"    + toMBps(singleDuration)                + ", "
+				"\"batch_mbps\":"     + toMBps(batchDuration)                 + ", "
+				"\"checksum\":"       + std::to_string(sum & 1)               + ""
+			"}"
+		);
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_export_sla_records(
+	uint8_t* out_records,
+	size_t out_records_size,
+	size_t* out_num_records
+)
+{
+	try
+	{
+		using namespace SLARuntime::Common;
+
+		size_t maxNum = out_records_size / sizeof(SlaRecord);
+		size_t numCopied = 0;
+		End2End::gs_slaRecordDrain.DrainOnce(
+			maxNum,
+			[out_records, &numCopied](const SlaRecord* recs, size_t num)
+			{
+				std::memcpy(
+					out_records + (numCopied * sizeof(SlaRecord)),
+					recs,
+					num * sizeof(SlaRecord)
+				);
+				numCopied += num;
+			}
+		);
+		*out_num_records = numCopied;
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_set_deadline(uint64_t deadline_us)
+{
+	try
+	{
+		End2End::gs_rt.SetWatchdog(End2End::gs_watchdog, deadline_us);
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_watchdog_run()
+{
+	try
+	{
+		End2End::gs_watchdog->Run();
+
+		return SGX_SUCCESS;
+	}
+	catch(const std::exception& e)
+	{
+		using namespace DecentEnclave::Common;
+		Platform::Print::StrErr(e.what());
+		return SGX_ERROR_UNEXPECTED;
+	}
+}
+
+extern "C" sgx_status_t ecall_end2end_watchdog_stop()
+{
+	End2End::gs_watchdog->Stop();
+
+	return SGX_SUCCESS;
+}
+
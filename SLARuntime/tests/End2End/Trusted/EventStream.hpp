@@ -0,0 +1,75 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+#include <memory>
+#include <stdexcept>
+
+#include <sgx_error.h>
+
+#include <WasmRuntime/EventDataStream.hpp>
+
+
+extern "C" sgx_status_t ocall_end2end_read_event_stream(
+	size_t*  retval,
+	uint64_t stream_id,
+	uint64_t offset,
+	uint8_t* buf,
+	size_t   buf_size
+);
+
+
+namespace End2End
+{
+
+
+/**
+ * @brief Build an event data stream that reads from the stream with the given
+ *        ID registered at the untrusted side; each window is fetched with a
+ *        single ocall.
+ *
+ * NOTE: the data is provided by the untrusted host, so it is NOT integrity
+ *       protected; the WASM program should authenticate it if needed.
+ */
+inline std::unique_ptr<WasmRuntime::EventDataStream> MakeUntrustedEventStream(
+	uint64_t streamId,
+	uint64_t streamSize
+)
+{
+	auto fetchFunc = [streamId](uint64_t offset, uint8_t* dest, size_t len)
+	{
+		size_t retSize = 0;
+		sgx_status_t sgxRet = ocall_end2end_read_event_stream(
+			&retSize,
+			streamId,
+			offset,
+			dest,
+			len
+		);
+		if (sgxRet != SGX_SUCCESS)
+		{
+			throw std::runtime_error("Failed to read event stream from ocall");
+		}
+		// the size is returned by the untrusted side, so it must be checked
+		if (retSize > len)
+		{
+			throw std::runtime_error("Invalid size returned by event stream");
+		}
+		return retSize;
+	};
+
+	return WasmRuntime::BufferedEventDataStream::MakeUnique(
+		streamSize,
+		fetchFunc
+	);
+}
+
+
+} // namespace End2End
+
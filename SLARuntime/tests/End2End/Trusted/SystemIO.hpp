@@ -6,14 +6,20 @@
 #pragma once
 
 
+#include <cstdint>
+
 #include <memory>
 
+#include <sgx_error.h>
 
 #include <DecentEnclave/Common/Time.hpp>
 #include <WasmRuntime/Internal/make_unique.hpp>
 #include <WasmRuntime/SystemIO.hpp>
 
 
+extern "C" sgx_status_t ocall_end2end_sleep_us(uint64_t us);
+
+
 namespace End2End
 {
 
@@ -39,6 +45,19 @@ public:
 		return DecentEnclave::Common::UntrustedTime::TimestampMicrSec();
 	}
 
+	/**
+	 * @brief Sleep on the untrusted side, so the thread doesn't spin (and
+	 *        make an ocall for every timestamp) in the meantime
+	 *
+	 */
+	virtual void SleepUs(uint64_t us) const override
+	{
+		if (ocall_end2end_sleep_us(us) != SGX_SUCCESS)
+		{
+			WasmRuntime::SystemIO::SleepUs(us);
+		}
+	}
+
 }; // class SystemIO
 
 
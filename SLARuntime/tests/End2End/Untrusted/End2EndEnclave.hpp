@@ -6,12 +6,18 @@
 #pragma once
 
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include <DecentEnclave/Common/Sgx/Exceptions.hpp>
 #include <DecentEnclave/Untrusted/Sgx/DecentSgxEnclave.hpp>
 
+#include <SLARuntime/Common/EventBatch.hpp>
+#include <SLARuntime/Common/SlaRecord.hpp>
+
+#include "../RequestRings.hpp"
+
 #include <SimpleSysIO/SysCall/Files.hpp>
 
 extern "C" sgx_status_t ecall_end2end_init(
@@ -26,10 +32,128 @@ extern "C" sgx_status_t ecall_end2end_load_wasm(
 	sgx_enclave_id_t eid,
 	sgx_status_t*    retval,
 	const uint8_t*   in_wasm,
-	size_t           in_wasm_size
+	size_t           in_wasm_size,
+	int              enable_sla_ring,
+	int              enable_cost_model,
+	int              enable_mem_accounting,
+	int              enable_sla_log
 );
 
 extern "C" sgx_status_t ecall_end2end_run_func(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_event_id,
+	size_t           in_event_id_size,
+	const uint8_t*   in_msg,
+	size_t           in_msg_size,
+	uint64_t         threshold,
+	uint8_t*         out_result,
+	size_t           out_result_size,
+	size_t*          out_result_len
+);
+
+extern "C" sgx_status_t ecall_end2end_test_event_size(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_event_id,
+	size_t           in_event_id_size,
+	const uint8_t*   in_msg,
+	size_t           in_msg_size
+);
+
+extern "C" sgx_status_t ecall_end2end_run_func_stream(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_event_id,
+	size_t           in_event_id_size,
+	uint64_t         stream_id,
+	uint64_t         stream_size
+);
+
+extern "C" sgx_status_t ecall_end2end_run_batch(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_events,
+	size_t           in_events_size,
+	uint8_t*         out_results,
+	size_t           out_results_size
+);
+
+extern "C" sgx_status_t ecall_end2end_ring_worker(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	void*            req_ring,
+	void*            cpl_ring
+);
+
+extern "C" sgx_status_t ecall_end2end_pool_start(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	size_t           num_workers
+);
+
+extern "C" sgx_status_t ecall_end2end_pool_worker(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	size_t           worker_idx
+);
+
+extern "C" sgx_status_t ecall_end2end_pool_run_batch(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_events,
+	size_t           in_events_size,
+	uint8_t*         out_results,
+	size_t           out_results_size
+);
+
+extern "C" sgx_status_t ecall_end2end_pool_stop(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_log_heap_stats(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_test_arena_heap(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	uint64_t         num_rounds
+);
+
+extern "C" sgx_status_t ecall_end2end_test_suspend(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_event_id,
+	size_t           in_event_id_size,
+	const uint8_t*   in_msg,
+	size_t           in_msg_size
+);
+
+extern "C" sgx_status_t ecall_end2end_test_sampling(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_event_id,
+	size_t           in_event_id_size,
+	const uint8_t*   in_msg,
+	size_t           in_msg_size,
+	uint64_t         threshold,
+	uint64_t         num_runs,
+	uint8_t          expect_trap
+);
+
+extern "C" sgx_status_t ecall_end2end_test_checkpoint(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	const uint8_t*   in_event_id,
+	size_t           in_event_id_size,
+	const uint8_t*   in_msg,
+	size_t           in_msg_size
+);
+
+extern "C" sgx_status_t ecall_end2end_test_receipts(
 	sgx_enclave_id_t eid,
 	sgx_status_t*    retval,
 	const uint8_t*   in_event_id,
@@ -38,11 +162,99 @@ extern "C" sgx_status_t ecall_end2end_run_func(
 	size_t           in_msg_size
 );
 
+extern "C" sgx_status_t ecall_end2end_test_module_registry(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_test_txn_queue(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_test_session_pool(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_test_request_scheduler(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_test_result_cache(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_test_proposals(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_bench_clock(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	uint64_t         num_iters
+);
+
+extern "C" sgx_status_t ecall_end2end_bench_encrypt(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	uint64_t         msg_size,
+	uint64_t         num_msgs,
+	uint64_t         batch_size
+);
+
+extern "C" sgx_status_t ecall_end2end_export_sla_records(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	uint8_t*         out_records,
+	size_t           out_records_size,
+	size_t*          out_num_records
+);
+
+extern "C" sgx_status_t ecall_end2end_set_deadline(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval,
+	uint64_t         deadline_us
+);
+
+extern "C" sgx_status_t ecall_end2end_watchdog_run(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
+extern "C" sgx_status_t ecall_end2end_watchdog_stop(
+	sgx_enclave_id_t eid,
+	sgx_status_t*    retval
+);
+
 
 namespace End2End
 {
 
 
+/**
+ * @brief What the runtime does for every request besides running it, on top
+ *        of metering; all off by default, since each has a cost per request
+ *
+ */
+struct LoadOptions
+{
+	// push an SLA record of every request into the ring exported by
+	// `ExportSlaRecords`
+	bool m_hasSlaRecordRing = false;
+	// learn the cost of the module, to predict the threshold of a request
+	bool m_hasCostModel = false;
+	// track the memory pages used by every request
+	bool m_hasMemAccounting = false;
+	// log the SLA report of every request as JSON; when the records are
+	// drained, if there is a ring
+	bool m_isSlaLogged = false;
+}; // struct LoadOptions
+
+
 class End2EndEnclave :
 	public DecentEnclave::Untrusted::Sgx::DecentSgxEnclave
 {
@@ -72,39 +284,504 @@ public:
 
 	virtual ~End2EndEnclave() = default;
 
-	void LoadWasm(const std::vector<uint8_t>& wasmCode)
+	void LoadWasm(
+		const std::vector<uint8_t>& wasmCode,
+		const LoadOptions& options = LoadOptions()
+	)
 	{
 		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
 			ecall_end2end_load_wasm,
 			m_encId,
 			wasmCode.data(),
-			wasmCode.size()
+			wasmCode.size(),
+			options.m_hasSlaRecordRing ? 1 : 0,
+			options.m_hasCostModel ? 1 : 0,
+			options.m_hasMemAccounting ? 1 : 0,
+			options.m_isSlaLogged ? 1 : 0
 		);
 	}
 
-	void LoadWasm(const std::string& wasmPath)
+	void LoadWasm(
+		const std::string& wasmPath,
+		const LoadOptions& options = LoadOptions()
+	)
 	{
 		std::vector<uint8_t> wasmCode =
 			SimpleSysIO::SysCall::RBinaryFile::Open(wasmPath)->
 				ReadBytes<std::vector<uint8_t> >();
-		LoadWasm(wasmCode);
+		LoadWasm(wasmCode, options);
 	}
 
-	void RunFunc(
+	/**
+	 * @brief Run the WASM module
+	 *
+	 * @param threshold The counter limit; if it's 0, the limit predicted by
+	 *                  the cost model is used
+	 * @return The result set by the module, which is empty if it sets none;
+	 *         it's truncated to `maxResultSize` bytes
+	 */
+	std::vector<uint8_t> RunFunc(
 		const std::vector<uint8_t>& eventId,
-		const std::vector<uint8_t>& msg
+		const std::vector<uint8_t>& msg,
+		size_t maxResultSize = 64 * 1024,
+		uint64_t threshold = 0
 	)
 	{
+		std::vector<uint8_t> result(maxResultSize);
+		size_t resultLen = 0;
+
 		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
 			ecall_end2end_run_func,
 			m_encId,
 			eventId.data(),
 			eventId.size(),
 			msg.data(),
+			msg.size(),
+			threshold,
+			result.data(),
+			result.size(),
+			&resultLen
+		);
+
+		result.resize(std::min(resultLen, maxResultSize));
+		return result;
+	}
+
+	/**
+	 * @brief Run the WASM module once, and check that the event size it
+	 *        learns the cost from is the size of the message
+	 *
+	 */
+	void TestEventSize(
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& msg
+	)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_event_size,
+			m_encId,
+			eventId.data(),
+			eventId.size(),
+			msg.data(),
 			msg.size()
 		);
 	}
 
+	/**
+	 * @brief Run the WASM module with event data that is streamed from the
+	 *        given event stream, which must be registered to the
+	 *        EventStreamRegistry
+	 *
+	 */
+	void RunFuncStream(
+		const std::vector<uint8_t>& eventId,
+		uint64_t streamId,
+		uint64_t streamSize
+	)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_run_func_stream,
+			m_encId,
+			eventId.data(),
+			eventId.size(),
+			streamId,
+			streamSize
+		);
+	}
+
+	/**
+	 * @brief Run all events in the batch with a single ecall
+	 *
+	 * @return The result of each event, in the same order as the batch
+	 */
+	std::vector<SLARuntime::Common::EventRunResult> RunBatch(
+		const SLARuntime::Common::EventBatch& batch
+	)
+	{
+		using namespace SLARuntime::Common;
+
+		std::vector<uint8_t> results(
+			EventBatch::GetResultsSize(batch.GetNumEvents())
+		);
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_run_batch,
+			m_encId,
+			batch.GetBytes().data(),
+			batch.GetBytes().size(),
+			results.data(),
+			results.size()
+		);
+
+		return EventBatch::DecodeResults(results.data(), results.size());
+	}
+
+	/**
+	 * @brief Run an enclave worker that polls the request ring and posts the
+	 *        results to the completion ring; it blocks the calling thread
+	 *        until the request ring is closed and drained.
+	 *
+	 */
+	void RunRingWorker(RequestRing& reqRing, CompletionRing& cplRing)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_ring_worker,
+			m_encId,
+			&reqRing,
+			&cplRing
+		);
+	}
+
+	/**
+	 * @brief Create the in-enclave worker pool; each worker must then be run
+	 *        by calling `RunPoolWorker` on its own thread
+	 *
+	 */
+	void StartPool(size_t numWorkers)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_pool_start,
+			m_encId,
+			numWorkers
+		);
+	}
+
+	/**
+	 * @brief Run a worker of the pool; it blocks the calling thread until
+	 *        `StopPool` is called and all submitted events are done
+	 *
+	 */
+	void RunPoolWorker(size_t workerIdx)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_pool_worker,
+			m_encId,
+			workerIdx
+		);
+	}
+
+	/**
+	 * @brief Run all events in the batch on the worker pool
+	 *
+	 * @return The result of each event, in the same order as the batch
+	 */
+	std::vector<SLARuntime::Common::EventRunResult> RunBatchOnPool(
+		const SLARuntime::Common::EventBatch& batch
+	)
+	{
+		using namespace SLARuntime::Common;
+
+		std::vector<uint8_t> results(
+			EventBatch::GetResultsSize(batch.GetNumEvents())
+		);
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_pool_run_batch,
+			m_encId,
+			batch.GetBytes().data(),
+			batch.GetBytes().size(),
+			results.data(),
+			results.size()
+		);
+
+		return EventBatch::DecodeResults(results.data(), results.size());
+	}
+
+	void StopPool()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_pool_stop,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Log the usage statistics of the WASM runtime heap in the enclave
+	 *
+	 */
+	void LogHeapStats()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_log_heap_stats,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Churn an arena heap of the enclave's own with blocks of mixed
+	 *        sizes, and check that its footprint stays bounded, and that
+	 *        it's empty again once all blocks are freed
+	 *
+	 */
+	void TestArenaHeap(uint64_t numRounds)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_arena_heap,
+			m_encId,
+			numRounds
+		);
+	}
+
+	/**
+	 * @brief Run the WASM module out of budget, on a runtime that suspends
+	 *        such runs; it can be called by several threads at once
+	 *
+	 */
+	void TestSuspend(
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& msg
+	)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_suspend,
+			m_encId,
+			eventId.data(),
+			eventId.size(),
+			msg.data(),
+			msg.size()
+		);
+	}
+
+	/**
+	 * @brief Run the WASM module `numRuns` times with the given threshold, on
+	 *        a runtime that samples the call stack, checking that each run is
+	 *        aborted or not as expected; it can be called by several threads
+	 *        at once
+	 *
+	 */
+	void TestSampling(
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& msg,
+		uint64_t threshold,
+		uint64_t numRuns,
+		bool expectTrap
+	)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_sampling,
+			m_encId,
+			eventId.data(),
+			eventId.size(),
+			msg.data(),
+			msg.size(),
+			threshold,
+			numRuns,
+			expectTrap ? 1 : 0
+		);
+	}
+
+	/**
+	 * @brief Check that requests only queue checkpoint reports, and that a
+	 *        report that failed to be sent is sent again, in order
+	 *
+	 */
+	void TestCheckpoint(
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& msg
+	)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_checkpoint,
+			m_encId,
+			eventId.data(),
+			eventId.size(),
+			msg.data(),
+			msg.size()
+		);
+	}
+
+	/**
+	 * @brief Check that requests only queue checkpoint commits, that a commit
+	 *        that failed to be sent is sent again, and that receipts are
+	 *        proven against the root sent
+	 *
+	 */
+	void TestReceipts(
+		const std::vector<uint8_t>& eventId,
+		const std::vector<uint8_t>& msg
+	)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_receipts,
+			m_encId,
+			eventId.data(),
+			eventId.size(),
+			msg.data(),
+			msg.size()
+		);
+	}
+
+	/**
+	 * @brief Check that a warm instance of the module registry is only given
+	 *        back to the owner that used it
+	 *
+	 */
+	void TestModuleRegistry()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_module_registry,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Check that the transaction queue learns confirmations from the
+	 *        nonce on chain, and never sends again a transaction whose send
+	 *        failed but reached the node
+	 *
+	 */
+	void TestTxnQueue()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_txn_queue,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Check that the session pool checks idle sessions before reusing
+	 *        them, and gives back the slot of a session that doesn't reply in
+	 *        time
+	 *
+	 */
+	void TestSessionPool()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_session_pool,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Check that the request scheduler only admits requests of known
+	 *        contracts, rejects the ones that'd miss their deadlines, and
+	 *        shares the workers by weight
+	 *
+	 */
+	void TestRequestScheduler()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_request_scheduler,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Check that a repeated request is answered from the result cache,
+	 *        unless its threshold is below the cached counter, and that the
+	 *        results of a module that imports a non-deterministic native are
+	 *        never cached
+	 *
+	 */
+	void TestResultCache()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_result_cache,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Check that an SLA proposal delivered twice to the proposal
+	 *        workers is accepted once, and that a proposal that fails to be
+	 *        accepted gives its contract ID back
+	 *
+	 */
+	void TestProposals()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_test_proposals,
+			m_encId
+		);
+	}
+
+	/**
+	 * @brief Log the cost per timestamp of the untrusted clock (an ocall)
+	 *        and of the TSC clock in the enclave
+	 *
+	 */
+	void BenchClock(uint64_t numIters)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_bench_clock,
+			m_encId,
+			numIters
+		);
+	}
+
+	/**
+	 * @brief Log the throughput, in MB/s, of encrypting responses to the
+	 *        client, one at a time and in batches
+	 *
+	 */
+	void BenchEncrypt(uint64_t msgSize, uint64_t numMsgs, uint64_t batchSize)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_bench_encrypt,
+			m_encId,
+			msgSize,
+			numMsgs,
+			batchSize
+		);
+	}
+
+	/**
+	 * @brief Take up to `maxNum` SLA records of the requests run so far out
+	 *        of the enclave, in one call
+	 *
+	 */
+	std::vector<SLARuntime::Common::SlaRecord> ExportSlaRecords(
+		size_t maxNum = 4096
+	)
+	{
+		std::vector<SLARuntime::Common::SlaRecord> records(maxNum);
+		size_t numRecords = 0;
+
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_export_sla_records,
+			m_encId,
+			reinterpret_cast<uint8_t*>(records.data()),
+			records.size() * sizeof(SLARuntime::Common::SlaRecord),
+			&numRecords
+		);
+
+		records.resize(numRecords);
+		return records;
+	}
+
+	/**
+	 * @brief Set the wall-clock deadline of each execution, after which it
+	 *        is terminated by the watchdog
+	 *
+	 */
+	void SetDeadline(uint64_t deadlineUs)
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_set_deadline,
+			m_encId,
+			deadlineUs
+		);
+	}
+
+	/**
+	 * @brief Run the watchdog on the calling thread, until `StopWatchdog` is
+	 *        called
+	 *
+	 */
+	void RunWatchdog()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_watchdog_run,
+			m_encId
+		);
+	}
+
+	void StopWatchdog()
+	{
+		DECENTENCLAVE_SGX_ECALL_CHECK_ERROR_E_R(
+			ecall_end2end_watchdog_stop,
+			m_encId
+		);
+	}
+
 }; // class End2EndEnclave
 
 
@@ -0,0 +1,254 @@
+// Copyright (c) 2024 SLARuntime Authors
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace End2End
+{
+
+
+/**
+ * @brief A source of event data living at the untrusted side, which is read
+ *        by the enclave chunk by chunk via `ocall_end2end_read_event_stream`
+ *
+ */
+class EventStreamSource
+{
+public:
+	EventStreamSource() = default;
+
+	virtual ~EventStreamSource() = default;
+
+	virtual uint64_t GetSize() const = 0;
+
+	virtual size_t Read(uint64_t offset, uint8_t* dest, size_t len) = 0;
+
+}; // class EventStreamSource
+
+
+class MemEventStreamSource :
+	public EventStreamSource
+{
+public:
+
+	MemEventStreamSource(std::vector<uint8_t> data) :
+		m_data(std::move(data)),
+		m_maxReadSize(0)
+	{}
+
+	virtual ~MemEventStreamSource() = default;
+
+	virtual uint64_t GetSize() const override
+	{
+		return m_data.size();
+	}
+
+	virtual size_t Read(uint64_t offset, uint8_t* dest, size_t len) override
+	{
+		m_maxReadSize = std::max(m_maxReadSize, len);
+		if (offset >= m_data.size())
+		{
+			return 0;
+		}
+		size_t cpSize = std::min(len, m_data.size() - static_cast<size_t>(offset));
+		std::memcpy(dest, m_data.data() + offset, cpSize);
+		return cpSize;
+	}
+
+	/**
+	 * @brief The largest read asked by the enclave, i.e., the largest buffer
+	 *        of an ocall
+	 *
+	 */
+	size_t GetMaxReadSize() const
+	{
+		return m_maxReadSize;
+	}
+
+private:
+
+	std::vector<uint8_t> m_data;
+	size_t m_maxReadSize;
+
+}; // class MemEventStreamSource
+
+
+/**
+ * @brief Event data backed by a file; the file is read with `pread`, and the
+ *        kernel is advised to read ahead the range following each read, since
+ *        the enclave reads the stream (mostly) sequentially
+ *
+ */
+class FileEventStreamSource :
+	public EventStreamSource
+{
+public:
+
+	FileEventStreamSource(const std::string& path) :
+		m_fd(-1),
+		m_size(0)
+	{
+		m_fd = open(path.c_str(), O_RDONLY);
+		if (m_fd < 0)
+		{
+			throw std::runtime_error("Failed to open event stream file " + path);
+		}
+		off_t size = lseek(m_fd, 0, SEEK_END);
+		if (size < 0)
+		{
+			close(m_fd);
+			throw std::runtime_error("Failed to get size of file " + path);
+		}
+		m_size = static_cast<uint64_t>(size);
+		posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	FileEventStreamSource(const FileEventStreamSource&) = delete;
+
+	virtual ~FileEventStreamSource()
+	{
+		close(m_fd);
+	}
+
+	FileEventStreamSource& operator=(const FileEventStreamSource&) = delete;
+
+	virtual uint64_t GetSize() const override
+	{
+		return m_size;
+	}
+
+	virtual size_t Read(uint64_t offset, uint8_t* dest, size_t len) override
+	{
+		size_t totalRead = 0;
+		while (totalRead < len && offset + totalRead < m_size)
+		{
+			ssize_t ret = pread(
+				m_fd,
+				dest + totalRead,
+				len - totalRead,
+				static_cast<off_t>(offset + totalRead)
+			);
+			if (ret <= 0)
+			{
+				break;
+			}
+			totalRead += static_cast<size_t>(ret);
+		}
+
+		// read ahead the next chunk while the enclave is processing this one
+		posix_fadvise(
+			m_fd,
+			static_cast<off_t>(offset + totalRead),
+			static_cast<off_t>(len),
+			POSIX_FADV_WILLNEED
+		);
+
+		return totalRead;
+	}
+
+private:
+
+	int m_fd;
+	uint64_t m_size;
+
+}; // class FileEventStreamSource
+
+
+class EventStreamRegistry
+{
+public: // static members:
+
+	static EventStreamRegistry& GetInstance()
+	{
+		static EventStreamRegistry s_inst;
+		return s_inst;
+	}
+
+public:
+
+	EventStreamRegistry() :
+		m_mutex(),
+		m_nextId(1),
+		m_sources()
+	{}
+
+	~EventStreamRegistry() = default;
+
+	/**
+	 * @brief Register a source, and return the stream ID to be passed to
+	 *        the enclave
+	 *
+	 */
+	uint64_t Add(std::shared_ptr<EventStreamSource> source)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		uint64_t id = m_nextId++;
+		m_sources.emplace(id, std::move(source));
+		return id;
+	}
+
+	void Remove(uint64_t id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_sources.erase(id);
+	}
+
+	std::shared_ptr<EventStreamSource> Get(uint64_t id) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_sources.find(id);
+		return (it == m_sources.end()) ? nullptr : it->second;
+	}
+
+private:
+
+	mutable std::mutex m_mutex;
+	uint64_t m_nextId;
+	std::unordered_map<uint64_t, std::shared_ptr<EventStreamSource> > m_sources;
+
+}; // class EventStreamRegistry
+
+
+} // namespace End2End
+
+
+extern "C" size_t ocall_end2end_read_event_stream(
+	uint64_t stream_id,
+	uint64_t offset,
+	uint8_t* buf,
+	size_t buf_size
+)
+{
+	try
+	{
+		auto source = End2End::EventStreamRegistry::GetInstance().Get(stream_id);
+		if (source == nullptr)
+		{
+			return 0;
+		}
+		return source->Read(offset, buf, buf_size);
+	}
+	catch(const std::exception&)
+	{
+		return 0;
+	}
+}
+
@@ -4,8 +4,13 @@
 // https://opensource.org/licenses/MIT.
 
 
+#include <atomic>
+#include <chrono>
+#include <limits>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <DecentEnclave/Common/Platform/Print.hpp>
@@ -26,6 +31,7 @@
 #include <SimpleSysIO/SysCall/Files.hpp>
 
 #include "End2EndEnclave.hpp"
+#include "EventStreamRegistry.hpp"
 #include "RunUntilSignal.hpp"
 
 
@@ -37,6 +43,22 @@ using namespace SimpleObjects;
 using namespace SimpleSysIO::SysCall;
 
 
+extern "C" void ocall_end2end_sleep_us(uint64_t us)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+
+/**
+ * @brief The most workers the in-enclave pool is run with; along with the
+ *        main thread, the watchdog, the thread pool and the submitters of
+ *        `TestConcurrentBatches`, they must fit in the TCSNum of
+ *        Enclave.config.xml
+ *
+ */
+static constexpr size_t sk_maxPoolWorkers = 6;
+
+
 std::shared_ptr<ThreadPool> GetThreadPool()
 {
 	static  std::shared_ptr<ThreadPool> threadPool =
@@ -46,24 +68,680 @@ std::shared_ptr<ThreadPool> GetThreadPool()
 }
 
 
-int main(int argc, char* argv[])
+/**
+ * @brief Run `numEvents` events in batches of `batchSize`, and print the
+ *        throughput in requests per second
+ *
+ */
+void BenchmarkBatch(
+	End2End::End2EndEnclave& enclave,
+	size_t batchSize,
+	size_t numEvents,
+	const std::vector<uint8_t>& eventId,
+	const std::vector<uint8_t>& msg
+)
+{
+	SLARuntime::Common::EventBatch batch;
+	for (size_t i = 0; i < batchSize; ++i)
+	{
+		batch.Add(eventId, msg);
+	}
+
+	size_t numBatches = (numEvents + batchSize - 1) / batchSize;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < numBatches; ++i)
+	{
+		enclave.RunBatch(batch);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double sec = std::chrono::duration<double>(end - start).count();
+	double reqPerSec = (numBatches * batchSize) / sec;
+	Common::Platform::Print::StrInfo(
+		"Batch size " + std::to_string(batchSize) + ": " +
+		std::to_string(reqPerSec) + " requests/sec"
+	);
+}
+
+
+/**
+ * @brief Submit `numEvents` events to enclave workers through the shared
+ *        memory rings (one request/completion ring pair per worker), in
+ *        batches of `batchSize`, and print the throughput in requests per
+ *        second
+ *
+ */
+void BenchmarkRings(
+	End2End::End2EndEnclave& enclave,
+	size_t numWorkers,
+	size_t batchSize,
+	size_t numEvents,
+	const std::vector<uint8_t>& eventId,
+	const std::vector<uint8_t>& msg
+)
+{
+	SLARuntime::Common::EventBatch batch;
+	for (size_t i = 0; i < batchSize; ++i)
+	{
+		batch.Add(eventId, msg);
+	}
+	const std::vector<uint8_t>& req = batch.GetBytes();
+
+	std::vector<std::unique_ptr<End2End::RequestRing> > reqRings;
+	std::vector<std::unique_ptr<End2End::CompletionRing> > cplRings;
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		reqRings.emplace_back(new End2End::RequestRing());
+		reqRings.back()->Init();
+		cplRings.emplace_back(new End2End::CompletionRing());
+		cplRings.back()->Init();
+	}
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		End2End::RequestRing& reqRing = *reqRings[i];
+		End2End::CompletionRing& cplRing = *cplRings[i];
+		workers.emplace_back(
+			[&enclave, &reqRing, &cplRing]()
+			{
+				enclave.RunRingWorker(reqRing, cplRing);
+			}
+		);
+	}
+
+	size_t numReqs = (numEvents + batchSize - 1) / batchSize;
+	size_t numSubmitted = 0;
+	size_t numCompleted = 0;
+	size_t numFailed = 0;
+	uint64_t cplId = 0;
+	std::vector<uint8_t> cpl;
+
+	auto start = std::chrono::steady_clock::now();
+	while (numCompleted < numReqs)
+	{
+		for (size_t i = 0; i < numWorkers; ++i)
+		{
+			if (
+				(numSubmitted < numReqs) &&
+				reqRings[i]->TryPush(numSubmitted, req.data(), req.size())
+			)
+			{
+				++numSubmitted;
+			}
+			while (cplRings[i]->TryPop(cplId, cpl))
+			{
+				++numCompleted;
+				numFailed += cpl.empty() ? 1 : 0;
+			}
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		reqRings[i]->Close();
+		workers[i].join();
+	}
+
+	double sec = std::chrono::duration<double>(end - start).count();
+	double reqPerSec = (numReqs * batchSize) / sec;
+	Common::Platform::Print::StrInfo(
+		"Rings (" + std::to_string(numWorkers) + " workers), batch size " +
+		std::to_string(batchSize) + ": " +
+		std::to_string(reqPerSec) + " requests/sec, " +
+		std::to_string(numFailed) + " failed batches"
+	);
+}
+
+
+/**
+ * @brief Run `numEvents` events on the in-enclave worker pool with
+ *        `numWorkers` workers, and print the throughput in requests per second
+ *
+ */
+void BenchmarkPool(
+	End2End::End2EndEnclave& enclave,
+	size_t numWorkers,
+	size_t numEvents,
+	const std::vector<uint8_t>& eventId,
+	const std::vector<uint8_t>& msg
+)
+{
+	static constexpr size_t sk_batchSize = 256;
+
+	SLARuntime::Common::EventBatch batch;
+	for (size_t i = 0; i < sk_batchSize; ++i)
+	{
+		batch.Add(eventId, msg);
+	}
+
+	enclave.StartPool(numWorkers);
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		workers.emplace_back(
+			[&enclave, i]()
+			{
+				enclave.RunPoolWorker(i);
+			}
+		);
+	}
+
+	size_t numBatches = (numEvents + sk_batchSize - 1) / sk_batchSize;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < numBatches; ++i)
+	{
+		enclave.RunBatchOnPool(batch);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	enclave.StopPool();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	double sec = std::chrono::duration<double>(end - start).count();
+	double reqPerSec = (numBatches * sk_batchSize) / sec;
+	Common::Platform::Print::StrInfo(
+		"Pool with " + std::to_string(numWorkers) + " workers: " +
+		std::to_string(reqPerSec) + " requests/sec"
+	);
+}
+
+
+/**
+ * @brief Run the same batches on one thread, then on `numWorkers` ring
+ *        workers and on a pool of `numWorkers` workers, and check that every
+ *        event gets the same result, i.e., that workers running on the shared
+ *        runtime at once don't interfere with each other; it throws if they
+ *        do
+ *
+ */
+void TestConcurrentBatches(
+	End2End::End2EndEnclave& enclave,
+	size_t numWorkers,
+	const std::vector<uint8_t>& eventId
+)
 {
-	std::string configPath;
-	if (argc == 1)
+	using SLARuntime::Common::EventBatch;
+	using SLARuntime::Common::EventRunResult;
+
+	static constexpr size_t sk_numBatches = 64;
+	static constexpr size_t sk_batchSize = 16;
+
+	// events of different sizes, so they have different counters
+	std::vector<EventBatch> batches(sk_numBatches);
+	for (size_t i = 0; i < sk_numBatches; ++i)
+	{
+		for (size_t j = 0; j < sk_batchSize; ++j)
+		{
+			batches[i].Add(
+				eventId,
+				std::vector<uint8_t>(1 + ((i + j) % 64), 0x5A)
+			);
+		}
+	}
+
+	std::vector<std::vector<EventRunResult> > expected;
+	for (const auto& batch : batches)
+	{
+		expected.push_back(enclave.RunBatch(batch));
+	}
+
+	auto checkBatch = [&expected](
+		const std::string& name,
+		size_t batchIdx,
+		const std::vector<EventRunResult>& results
+	)
+	{
+		const auto& exp = expected.at(batchIdx);
+		if (results.size() != exp.size())
+		{
+			throw std::runtime_error(
+				name + ": batch " + std::to_string(batchIdx) +
+				" has " + std::to_string(results.size()) + " results"
+			);
+		}
+		for (size_t j = 0; j < exp.size(); ++j)
+		{
+			if (
+				(results[j].m_retCode != exp[j].m_retCode) ||
+				(results[j].m_counter != exp[j].m_counter)
+			)
+			{
+				throw std::runtime_error(
+					name + ": event " + std::to_string(j) + " of batch " +
+					std::to_string(batchIdx) +
+					" differs from the single-threaded run"
+				);
+			}
+		}
+	};
+
+	// Ring workers, one request/completion ring pair each
+	std::vector<std::unique_ptr<End2End::RequestRing> > reqRings;
+	std::vector<std::unique_ptr<End2End::CompletionRing> > cplRings;
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		reqRings.emplace_back(new End2End::RequestRing());
+		reqRings.back()->Init();
+		cplRings.emplace_back(new End2End::CompletionRing());
+		cplRings.back()->Init();
+	}
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		End2End::RequestRing& reqRing = *reqRings[i];
+		End2End::CompletionRing& cplRing = *cplRings[i];
+		workers.emplace_back(
+			[&enclave, &reqRing, &cplRing]()
+			{
+				enclave.RunRingWorker(reqRing, cplRing);
+			}
+		);
+	}
+
+	size_t numSubmitted = 0;
+	size_t numCompleted = 0;
+	uint64_t cplId = 0;
+	std::vector<uint8_t> cpl;
+	std::vector<std::vector<uint8_t> > ringResults(sk_numBatches);
+	while (numCompleted < sk_numBatches)
 	{
-		configPath = END2END_SRC_DIR "/components_config.json";
+		for (size_t i = 0; i < numWorkers; ++i)
+		{
+			const auto& req = batches[numSubmitted % sk_numBatches].GetBytes();
+			if (
+				(numSubmitted < sk_numBatches) &&
+				reqRings[i]->TryPush(numSubmitted, req.data(), req.size())
+			)
+			{
+				++numSubmitted;
+			}
+			while (cplRings[i]->TryPop(cplId, cpl))
+			{
+				ringResults.at(cplId) = cpl;
+				++numCompleted;
+			}
+		}
+	}
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		reqRings[i]->Close();
+		workers[i].join();
+	}
+	workers.clear();
+
+	for (size_t i = 0; i < sk_numBatches; ++i)
+	{
+		checkBatch(
+			"Rings",
+			i,
+			EventBatch::DecodeResults(ringResults[i].data(), ringResults[i].size())
+		);
 	}
-	else if (argc == 2)
+
+	// Pool workers, with batches submitted by two threads at once
+	enclave.StartPool(numWorkers);
+	for (size_t i = 0; i < numWorkers; ++i)
 	{
-		configPath = argv[1];
+		workers.emplace_back(
+			[&enclave, i]()
+			{
+				enclave.RunPoolWorker(i);
+			}
+		);
 	}
-	else
+
+	static constexpr size_t sk_numSubmitters = 2;
+	std::vector<std::vector<EventRunResult> > poolResults(sk_numBatches);
+	std::vector<std::thread> submitters;
+	for (size_t i = 0; i < sk_numSubmitters; ++i)
 	{
-		Common::Platform::Print::StrErr("Unexpected number of arguments.");
-		Common::Platform::Print::StrErr(
-			"Only the path to the components configuration file is needed."
+		submitters.emplace_back(
+			[&enclave, &batches, &poolResults, i]()
+			{
+				for (size_t j = i; j < sk_numBatches; j += sk_numSubmitters)
+				{
+					poolResults[j] = enclave.RunBatchOnPool(batches[j]);
+				}
+			}
 		);
-		return -1;
+	}
+	for (auto& submitter : submitters)
+	{
+		submitter.join();
+	}
+
+	enclave.StopPool();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (size_t i = 0; i < sk_numBatches; ++i)
+	{
+		checkBatch("Pool", i, poolResults[i]);
+	}
+
+	Common::Platform::Print::StrInfo(
+		"Concurrent batches (" + std::to_string(numWorkers) + " workers): " +
+		"all " + std::to_string(sk_numBatches * sk_batchSize) +
+		" events match the single-threaded run"
+	);
+}
+
+
+/**
+ * @brief Run `TestSuspend` on `numThreads` threads at once, so that runs are
+ *        suspended at the same time
+ *
+ */
+void TestConcurrentSuspend(
+	End2End::End2EndEnclave& enclave,
+	size_t numThreads,
+	const std::vector<uint8_t>& eventId,
+	const std::vector<uint8_t>& msg
+)
+{
+	std::atomic<size_t> numFailed(0);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		threads.emplace_back(
+			[&enclave, &eventId, &msg, &numFailed]()
+			{
+				try
+				{
+					enclave.TestSuspend(eventId, msg);
+				}
+				catch (const std::exception& e)
+				{
+					Common::Platform::Print::StrErr(e.what());
+					++numFailed;
+				}
+			}
+		);
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	if (numFailed.load() != 0)
+	{
+		throw std::runtime_error(
+			std::to_string(numFailed.load()) + " of " +
+			std::to_string(numThreads) + " concurrent suspended runs failed"
+		);
+	}
+}
+
+
+/**
+ * @brief Sample runs that have no limit while runs with a tiny threshold are
+ *        sampled on other threads, so that a run stopping at another run's
+ *        limit shows up
+ *
+ */
+void TestConcurrentSampling(
+	End2End::End2EndEnclave& enclave,
+	size_t numThreads,
+	const std::vector<uint8_t>& eventId,
+	const std::vector<uint8_t>& msg
+)
+{
+	static constexpr uint64_t sk_numRuns = 16;
+
+	std::atomic<size_t> numFailed(0);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		bool isLimited = (i % 2) == 1;
+		threads.emplace_back(
+			[&enclave, &eventId, &msg, &numFailed, isLimited]()
+			{
+				try
+				{
+					enclave.TestSampling(
+						eventId,
+						msg,
+						isLimited ? 1 : std::numeric_limits<uint64_t>::max(),
+						sk_numRuns,
+						isLimited
+					);
+				}
+				catch (const std::exception& e)
+				{
+					Common::Platform::Print::StrErr(e.what());
+					++numFailed;
+				}
+			}
+		);
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	if (numFailed.load() != 0)
+	{
+		throw std::runtime_error(
+			std::to_string(numFailed.load()) + " of " +
+			std::to_string(numThreads) + " concurrent sampled runners failed"
+		);
+	}
+}
+
+
+/**
+ * @brief Check the features of the runtime on the loaded module; it throws
+ *        at the first check that fails
+ *
+ */
+void RunSelfTests(
+	End2End::End2EndEnclave& enclave,
+	const std::vector<uint8_t>& eventId,
+	const std::vector<uint8_t>& msg
+)
+{
+	// Heap reuse under allocation churn
+	enclave.TestArenaHeap(64);
+
+	enclave.TestEventSize(eventId, msg);
+
+	// Streamed event data, which is larger than the WASM instance heap; the
+	// module checks the pattern, and traps if any chunk is misplaced
+	std::vector<uint8_t> largeMsg(16 * 1024 * 1024);
+	for (size_t i = 0; i < largeMsg.size(); ++i)
+	{
+		largeMsg[i] = static_cast<uint8_t>(i % 251);
+	}
+	uint64_t streamSize = largeMsg.size();
+	std::shared_ptr<End2End::MemEventStreamSource> streamSrc =
+		std::make_shared<End2End::MemEventStreamSource>(std::move(largeMsg));
+	uint64_t streamId =
+		End2End::EventStreamRegistry::GetInstance().Add(streamSrc);
+	enclave.RunFuncStream(eventId, streamId, streamSize);
+	End2End::EventStreamRegistry::GetInstance().Remove(streamId);
+	// the module reads chunks larger than the window, but no single fetch
+	// (i.e., ocall buffer) may be larger than it
+	static constexpr size_t sk_streamWindow = 256 * 1024;
+	if (streamSrc->GetMaxReadSize() > sk_streamWindow)
+	{
+		throw std::runtime_error(
+			"A stream fetch of " + std::to_string(streamSrc->GetMaxReadSize()) +
+			" bytes is larger than the window"
+		);
+	}
+	Common::Platform::Print::StrInfo(
+		"Largest stream fetch: " +
+		std::to_string(streamSrc->GetMaxReadSize()) + " bytes"
+	);
+
+	// SLA records of the requests above, exported in bulk
+	std::vector<SLARuntime::Common::SlaRecord> slaRecords =
+		enclave.ExportSlaRecords();
+	for (const auto& rec : slaRecords)
+	{
+		Common::Platform::Print::StrInfo(
+			"SLA record: counter " + std::to_string(rec.m_counter) +
+			", retCode " + std::to_string(rec.m_retCode) +
+			", time " + std::to_string(rec.m_endTime - rec.m_startTime) + " us"
+		);
+	}
+
+	// Workers running on the shared runtime at once
+	TestConcurrentBatches(enclave, 4, eventId);
+
+	// Runs out of budget, suspended at once, each on its own gate
+	TestConcurrentSuspend(enclave, 4, eventId, msg);
+
+	// Sampled runs with different limits at once
+	TestConcurrentSampling(enclave, 4, eventId, msg);
+
+	// Checkpoint reports, sent apart from the requests
+	enclave.TestCheckpoint(eventId, msg);
+	enclave.TestReceipts(eventId, msg);
+
+	// Warm instances, kept apart per owner
+	enclave.TestModuleRegistry();
+
+	// Transaction queue, with confirmations learned from the chain
+	enclave.TestTxnQueue();
+
+	// Session pool, with health checks and reply deadlines
+	enclave.TestSessionPool();
+
+	// Request scheduler admission and weighted sharing
+	enclave.TestRequestScheduler();
+
+	// Result cache hits, threshold misses, and non-deterministic modules
+	enclave.TestResultCache();
+
+	// SLA proposals are accepted once, and failures give their IDs back
+	enclave.TestProposals();
+
+	Common::Platform::Print::StrInfo("All self-tests passed");
+}
+
+
+/**
+ * @brief Measure the costs and the throughput of the runtime on the loaded
+ *        module
+ *
+ */
+void RunBenchmarks(
+	End2End::End2EndEnclave& enclave,
+	const std::vector<uint8_t>& eventId,
+	const std::vector<uint8_t>& msg
+)
+{
+	// Cost of the timestamps taken by the stopwatch
+	enclave.BenchClock(100000);
+
+	// Cost of encrypting 1KB responses to the client
+	enclave.BenchEncrypt(1024, 10000, 64);
+
+	// Throughput with different batch sizes
+	for (size_t batchSize : { 1, 16, 256 })
+	{
+		BenchmarkBatch(enclave, batchSize, 4096, eventId, msg);
+	}
+	// Switchless submission through shared memory rings
+	for (size_t batchSize : { 1, 16 })
+	{
+		BenchmarkRings(enclave, 2, batchSize, 4096, eventId, msg);
+	}
+	// Scaling of the in-enclave worker pool; the main thread and the
+	// workers each take a TCS (see `sk_maxPoolWorkers`)
+	for (size_t numWorkers : std::vector<size_t>{ 1, 2, 4, sk_maxPoolWorkers })
+	{
+		BenchmarkPool(enclave, numWorkers, 16384, eventId, msg);
+	}
+	enclave.LogHeapStats();
+}
+
+
+void PrintUsage()
+{
+	Common::Platform::Print::StrErr(
+		"Usage: End2End [--self-test] [--bench] [--sla-records] "
+		"[--cost-model] [--mem-accounting] [--log-sla] "
+		"[<components config path>]"
+	);
+	Common::Platform::Print::StrErr(
+		"  --self-test       Check the runtime on the loaded module, and exit; "
+		"it implies --sla-records"
+	);
+	Common::Platform::Print::StrErr(
+		"  --bench           Run the benchmarks on the loaded module, and exit"
+	);
+	Common::Platform::Print::StrErr(
+		"  --sla-records     Keep an SLA record of every request in a ring"
+	);
+	Common::Platform::Print::StrErr(
+		"  --cost-model      Learn the cost of the module, for the thresholds"
+	);
+	Common::Platform::Print::StrErr(
+		"  --mem-accounting  Track the memory pages used by every request"
+	);
+	Common::Platform::Print::StrErr(
+		"  --log-sla         Log the SLA report of every request"
+	);
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::string configPath = END2END_SRC_DIR "/components_config.json";
+	bool hasConfigPath = false;
+	bool isSelfTest = false;
+	bool isBench = false;
+	End2End::LoadOptions loadOptions;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--self-test")
+		{
+			isSelfTest = true;
+			// the self-tests export the SLA records
+			loadOptions.m_hasSlaRecordRing = true;
+		}
+		else if (arg == "--bench")
+		{
+			isBench = true;
+		}
+		else if (arg == "--sla-records")
+		{
+			loadOptions.m_hasSlaRecordRing = true;
+		}
+		else if (arg == "--cost-model")
+		{
+			loadOptions.m_hasCostModel = true;
+		}
+		else if (arg == "--mem-accounting")
+		{
+			loadOptions.m_hasMemAccounting = true;
+		}
+		else if (arg == "--log-sla")
+		{
+			loadOptions.m_isSlaLogged = true;
+		}
+		else if (!hasConfigPath && (arg.compare(0, 2, "--") != 0))
+		{
+			configPath = arg;
+			hasConfigPath = true;
+		}
+		else
+		{
+			Common::Platform::Print::StrErr("Unexpected argument: " + arg);
+			PrintUsage();
+			return -1;
+		}
 	}
 
 	// Init MbedTLS
@@ -124,24 +802,60 @@ int main(int argc, char* argv[])
 	// WASM module
 	const auto& wasmConfig = config.AsDict()[String("WasmModule")].AsDict();
 	std::string wasmPath = wasmConfig[String("ModulePath")].AsString().c_str();
-	enclave->LoadWasm(wasmPath);
+	enclave->LoadWasm(wasmPath, loadOptions);
+
+	// Executions running for longer than 100ms are terminated by the
+	// watchdog, which takes a TCS
+	enclave->SetDeadline(100 * 1000);
+	std::thread watchdog(
+		[&enclave]()
+		{
+			enclave->RunWatchdog();
+		}
+	);
 
 	std::vector<uint8_t> eventId = { 0x01, 0x02, 0x03, 0x04 };
 	std::vector<uint8_t> msg = { 0x05, 0x06, 0x07, 0x08, 0x09 };
-	enclave->RunFunc(eventId, msg);
-
+	std::vector<uint8_t> result = enclave->RunFunc(eventId, msg);
+	Common::Platform::Print::StrInfo(
+		"Result size: " + std::to_string(result.size()) + " bytes"
+	);
 
-	End2End::RunUntilSignal(
-		[&]()
+	int ret = 0;
+	try
+	{
+		if (isSelfTest)
 		{
-			threadPool->Update();
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			RunSelfTests(*enclave, eventId, msg);
 		}
-	);
+		if (isBench)
+		{
+			RunBenchmarks(*enclave, eventId, msg);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		Common::Platform::Print::StrErr(e.what());
+		ret = 1;
+	}
+
+	if (!isSelfTest && !isBench)
+	{
+		End2End::RunUntilSignal(
+			[&]()
+			{
+				threadPool->Update();
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		);
+	}
 
 
 	threadPool->Terminate();
 
+	enclave->StopWatchdog();
+	watchdog.join();
+
 
-	return 0;
+	return ret;
 }
@@ -10,6 +10,73 @@
 
 #include <common.h>
 
+// the result is read once `enclave_wasm_main` returns, so it can't be on the
+// stack or freed before then
+static uint8_t s_result[2048];
+
+// larger than the largest window the runtime keeps for a stream (256 KB), so
+// the runtime has to split each of these reads into several fetches
+#define STREAM_CHUNK_SIZE (512 * 1024)
+
+/**
+ * @brief Read the streamed event, if any, in chunks, and check that it holds
+ *        the test pattern of the End2End host (byte i is i % 251), so a
+ *        chunk read from the wrong offset is caught; it traps on a mismatch
+ *
+ */
+static void check_event_stream(void)
+{
+	char buf[128];
+	uint64_t streamLen = enclave_wasm_get_event_stream_len();
+	if (streamLen == 0)
+	{
+		return;
+	}
+
+	uint8_t* chunk = (uint8_t*)malloc(STREAM_CHUNK_SIZE);
+	if (chunk == NULL)
+	{
+		__builtin_trap();
+	}
+
+	uint64_t offset = 0;
+	while (offset < streamLen)
+	{
+		uint32_t readSize = enclave_wasm_read_event_chunk(
+			offset,
+			chunk,
+			STREAM_CHUNK_SIZE
+		);
+		if (readSize == 0)
+		{
+			break;
+		}
+		for (uint32_t i = 0; i < readSize; ++i)
+		{
+			if (chunk[i] != (uint8_t)((offset + i) % 251))
+			{
+				sprintf(buf, "Event stream mismatch at   : %llu\n",
+					(unsigned long long)(offset + i));
+				enclave_wasm_print_string(buf);
+				__builtin_trap();
+			}
+		}
+		offset += readSize;
+	}
+	free(chunk);
+
+	if (offset != streamLen)
+	{
+		sprintf(buf, "Event stream ended early    : %llu != %llu\n",
+			(unsigned long long)offset, (unsigned long long)streamLen);
+		enclave_wasm_print_string(buf);
+		__builtin_trap();
+	}
+	sprintf(buf, "Event stream checked        : %llu bytes\n",
+		(unsigned long long)streamLen);
+	enclave_wasm_print_string(buf);
+}
+
 int32_t enclave_wasm_main(uint32_t eIdSize, uint32_t eDataSize)
 {
 	int32_t retVal = 0;
@@ -92,6 +159,14 @@ int32_t enclave_wasm_main(uint32_t eIdSize, uint32_t eDataSize)
 		enclave_wasm_print_string(buf);
 	}
 
+	check_event_stream();
+
+	// echoing the event data back as the result
+	uint32_t resSize = (eDataSize < sizeof(s_result)) ?
+		eDataSize : sizeof(s_result);
+	memcpy(s_result, eData, resSize);
+	enclave_wasm_set_result(s_result, resSize);
+
 	// freeing buffers
 	free(eId);
 	free(eData);
@@ -22,6 +22,21 @@ extern uint32_t enclave_wasm_get_event_id(uint8_t* buf, uint32_t buf_len);
 
 extern uint32_t enclave_wasm_get_event_data(uint8_t* buf, uint32_t buf_len);
 
+extern uint64_t enclave_wasm_get_event_stream_len();
+
+extern uint32_t enclave_wasm_read_event_chunk(
+	uint64_t offset,
+	uint8_t* buf,
+	uint32_t buf_len
+);
+
+/**
+ * @brief Set the result of the request, which is read from `buf` once
+ *        `enclave_wasm_main` returns, so `buf` must stay valid until then
+ *
+ */
+extern void enclave_wasm_set_result(const uint8_t* buf, uint32_t buf_len);
+
 extern void enclave_wasm_counter_exceed(void);
 
 #ifdef __cplusplus
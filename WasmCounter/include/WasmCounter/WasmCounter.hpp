@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <string>
+#include <utility>
 #include <vector>
 #include <memory>
 
@@ -53,9 +55,56 @@ struct InCmpPtr : public std::unique_ptr<_T>
 struct Graph;
 using GraphPtr = Internal::InCmpPtr<Graph>;
 
+struct InstrumentConfig
+{
+	/**
+	 * @brief Also inject the oracle, which counts every executed instruction
+	 *        exactly (per expression type, and weighted), as the reference to
+	 *        measure the error of the counter; it's slow, and only meant for
+	 *        measurements
+	 *
+	 */
+	bool m_enableOracle = false;
+
+	/**
+	 * @brief Also count the cost of each function (with the same block
+	 *        weights), exported as `enclave_wasm_func_cost_<function index>`;
+	 *        it adds one more add to each counted block
+	 *
+	 */
+	bool m_enableFuncCost = false;
+
+	/**
+	 * @brief Also track the memory pages of each run (the peak, and the
+	 *        pages held weighted by the counter), exported as
+	 *        `enclave_wasm_mem_*`; it adds code after each `memory.grow`,
+	 *        and resets the globals in the injected main
+	 *
+	 */
+	bool m_enableMemAccounting = false;
+}; // struct InstrumentConfig
+
 void Instrument(
 	wabt::Module& mod,
-	std::vector<GraphPtr >* outGraphs = nullptr
+	std::vector<GraphPtr >* outGraphs = nullptr,
+	const InstrumentConfig& config = InstrumentConfig()
+);
+
+/**
+ * @brief Get the names of all functions (including imported ones), indexed
+ *        by function index; they are the names used in the `Graph`s, and are
+ *        empty for functions without a name
+ *
+ */
+std::vector<std::string> GetFuncNames(const wabt::Module& mod);
+
+/**
+ * @brief Get the imported functions, as (module name, field name), in the
+ *        order of their function indices
+ *
+ */
+std::vector<std::pair<std::string, std::string> > GetImportFuncs(
+	const wabt::Module& mod
 );
 
 } // namespace WasmCounter
@@ -5,7 +5,11 @@
 
 #pragma once
 
+#include <cstdint>
+
+#include <iterator>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <src/ir.h>
@@ -33,7 +37,19 @@ struct InjectedSymbolInfo
 		m_wrapFuncVar(wabt::Index(m_wrapFuncId)),
 		m_exceedFuncId(),
 		m_exceedFuncVar(wabt::Index(m_exceedFuncId)),
-		m_funcIncrId()
+		m_funcIncrId(),
+		m_hasMemory(false),
+		m_memPagesId(),
+		m_memPagesVar(wabt::Index(m_memPagesId)),
+		m_memPeakId(),
+		m_memPeakVar(wabt::Index(m_memPeakId)),
+		m_memPageCtrId(),
+		m_memPageCtrVar(wabt::Index(m_memPageCtrId)),
+		m_memLastCtrId(),
+		m_memLastCtrVar(wabt::Index(m_memLastCtrId)),
+		m_hasFuncCost(false),
+		m_funcCostId(),
+		m_funcCostVar(wabt::Index(m_funcCostId))
 	{}
 
 	void SetThresholdId(size_t id)
@@ -60,6 +76,37 @@ struct InjectedSymbolInfo
 		m_exceedFuncVar = wabt::Var(wabt::Index(m_exceedFuncId));
 	}
 
+	void SetMemPagesId(size_t id)
+	{
+		m_memPagesId = id;
+		m_memPagesVar = wabt::Var(wabt::Index(m_memPagesId));
+	}
+
+	void SetMemPeakId(size_t id)
+	{
+		m_memPeakId = id;
+		m_memPeakVar = wabt::Var(wabt::Index(m_memPeakId));
+	}
+
+	void SetMemPageCtrId(size_t id)
+	{
+		m_memPageCtrId = id;
+		m_memPageCtrVar = wabt::Var(wabt::Index(m_memPageCtrId));
+	}
+
+	void SetMemLastCtrId(size_t id)
+	{
+		m_memLastCtrId = id;
+		m_memLastCtrVar = wabt::Var(wabt::Index(m_memLastCtrId));
+	}
+
+	void SetFuncCostId(size_t id)
+	{
+		m_hasFuncCost = true;
+		m_funcCostId = id;
+		m_funcCostVar = wabt::Var(wabt::Index(m_funcCostId));
+	}
+
 	size_t m_thrId;
 	wabt::Var m_thrVar;
 
@@ -73,6 +120,30 @@ struct InjectedSymbolInfo
 	wabt::Var m_exceedFuncVar;
 
 	size_t m_funcIncrId;
+
+	// Memory accounting
+	bool m_hasMemory;
+
+	// current number of pages
+	size_t m_memPagesId;
+	wabt::Var m_memPagesVar;
+
+	// peak number of pages
+	size_t m_memPeakId;
+	wabt::Var m_memPeakVar;
+
+	// pages times counter, up to the counter at the last change of pages
+	size_t m_memPageCtrId;
+	wabt::Var m_memPageCtrVar;
+
+	// counter at the last change of pages
+	size_t m_memLastCtrId;
+	wabt::Var m_memLastCtrVar;
+
+	// Per-function cost, of the function being instrumented
+	bool m_hasFuncCost;
+	size_t m_funcCostId;
+	wabt::Var m_funcCostVar;
 }; // struct InjectedSymbolInfo
 
 inline bool IsFuncTypeFieldExist(
@@ -321,6 +392,217 @@ inline size_t InjectFunc(
 }
 
 
+/**
+ * @brief Build the code that sets the memory accounting globals to the
+ *        current memory size, at the start of a run
+ *
+ */
+inline void BuildMemAccountingReset(
+	wabt::ExprList& exprs,
+	const InjectedSymbolInfo& info
+)
+{
+	//  memory.size
+	//  i64.extend_i32_u
+	//  global.set $mem_pages
+	//  global.get $mem_pages
+	//  global.set $mem_peak
+	//  i64.const 0
+	//  global.set $mem_page_ctr
+	//  global.get $counter
+	//  global.set $mem_last_ctr
+	exprs.push_back(
+		Internal::make_unique<wabt::MemorySizeExpr>(wabt::Var(wabt::Index(0)))
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::ConvertExpr>(wabt::Opcode::I64ExtendI32U)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memPagesVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_memPagesVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memPeakVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::ConstExpr>(wabt::Const::I64(0))
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memPageCtrVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_ctrVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memLastCtrVar)
+	);
+}
+
+
+/**
+ * @brief Build the code, placed right after a `memory.grow`, that updates
+ *        the memory accounting globals; it leaves the stack as it is
+ *
+ */
+inline wabt::ExprList BuildMemAccountingUpdate(const InjectedSymbolInfo& info)
+{
+	wabt::ExprList exprs;
+
+	// ;; pages held since the last change, weighted by the counter
+	// global.get $counter
+	// global.get $mem_last_ctr
+	// i64.sub
+	// global.get $mem_pages
+	// i64.mul
+	// global.get $mem_page_ctr
+	// i64.add
+	// global.set $mem_page_ctr
+	// global.get $counter
+	// global.set $mem_last_ctr
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_ctrVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_memLastCtrVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64Sub)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_memPagesVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64Mul)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_memPageCtrVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64Add)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memPageCtrVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_ctrVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memLastCtrVar)
+	);
+
+	// ;; the new number of pages
+	// memory.size
+	// i64.extend_i32_u
+	// global.set $mem_pages
+	exprs.push_back(
+		Internal::make_unique<wabt::MemorySizeExpr>(wabt::Var(wabt::Index(0)))
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::ConvertExpr>(wabt::Opcode::I64ExtendI32U)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memPagesVar)
+	);
+
+	// ;; the peak number of pages
+	// global.get $mem_pages
+	// global.get $mem_peak
+	// i64.gt_u
+	// if
+	//   global.get $mem_pages
+	//   global.set $mem_peak
+	// end
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_memPagesVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_memPeakVar)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::CompareExpr>(wabt::Opcode::I64GtU)
+	);
+	std::unique_ptr<wabt::IfExpr> ifExpr =
+		Internal::make_unique<wabt::IfExpr>();
+	ifExpr->true_.exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(info.m_memPagesVar)
+	);
+	ifExpr->true_.exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(info.m_memPeakVar)
+	);
+	exprs.push_back(std::move(ifExpr));
+
+	return exprs;
+}
+
+
+inline void InjectMemAccounting(
+	wabt::ExprList& exprs,
+	const InjectedSymbolInfo& info
+)
+{
+	for (auto it = exprs.begin(); it != exprs.end(); ++it)
+	{
+		switch (it->type())
+		{
+		case wabt::ExprType::Block:
+			InjectMemAccounting(wabt::cast<wabt::BlockExpr>(&(*it))->block.exprs, info);
+			break;
+		case wabt::ExprType::Loop:
+			InjectMemAccounting(wabt::cast<wabt::LoopExpr>(&(*it))->block.exprs, info);
+			break;
+		case wabt::ExprType::If:
+		{
+			wabt::IfExpr* ifExpr = wabt::cast<wabt::IfExpr>(&(*it));
+			InjectMemAccounting(ifExpr->true_.exprs, info);
+			InjectMemAccounting(ifExpr->false_, info);
+			break;
+		}
+		case wabt::ExprType::MemoryGrow:
+		{
+			wabt::ExprList update = BuildMemAccountingUpdate(info);
+			auto next = std::next(it);
+			exprs.splice(next, update);
+			// skip the injected code
+			it = std::prev(next);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+
+/**
+ * @brief Track the peak number of memory pages, and the number of pages
+ *        held over the run (weighted by the counter), so that memory can be
+ *        billed along with instructions. This is only updated at
+ *        `memory.grow`, which is the only way the memory size changes.
+ *
+ */
+inline void InjectMemAccounting(
+	wabt::Module& mod,
+	const InjectedSymbolInfo& info
+)
+{
+	if (!info.m_hasMemory)
+	{
+		return;
+	}
+
+	for (wabt::ModuleField& field : mod.fields)
+	{
+		if (field.type() == wabt::ModuleFieldType::Func)
+		{
+			wabt::Func& func = wabt::cast<wabt::FuncModuleField>(&field)->func;
+			InjectMemAccounting(func.exprs, info);
+		}
+	}
+}
+
+
 inline std::unique_ptr<wabt::FuncModuleField> BuildWrappingEntryFunc(
 	const std::string& funcName,
 	const wabt::Var& oriFuncVar,
@@ -383,6 +665,12 @@ inline std::unique_ptr<wabt::FuncModuleField> BuildWrappingEntryFunc(
 		Internal::make_unique<wabt::GlobalSetExpr>(info.m_thrVar)
 	);
 
+	// 5.1. start the memory accounting of this run
+	if (info.m_hasMemory)
+	{
+		BuildMemAccountingReset(func->func.exprs, info);
+	}
+
 	// 6. call the original function
 	//  local.get 0 ;; the 1st parameter - eIdSecSize
 	//  local.get 1 ;; the 2nd parameter - msgSecSize
@@ -443,6 +731,36 @@ inline void InjectWrappingEntryFunc(
 }
 
 
+inline size_t InjectReservedGlobal(
+	wabt::Module& mod,
+	const std::string& varName,
+	const std::string& expName
+)
+{
+	// 1. ensure this name is not used
+	if (HasNameAtModLevel<true>(mod, varName))
+	{
+		throw Exception("Global variable name " + varName + " is used");
+	}
+	// 2. ensure the reserved export name is not used
+	if (HasNameExported(mod, expName))
+	{
+		throw Exception("Export name " + expName + " is used");
+	}
+	// 3. inject global variable
+	size_t id = InjectExportedGlobalVar<WabtType::I64>(mod, 0, expName, varName);
+	// 4. ensure this global var is not referenced in the code
+	if (
+		HasRefGlobal(mod, wabt::Var(static_cast<wabt::Index>(id))) ||
+		HasRefGlobal(mod, wabt::Var(varName))
+	)
+	{
+		throw Exception("Global variable " + varName + " is referenced in the code");
+	}
+	return id;
+}
+
+
 inline InjectedSymbolInfo PreliminaryCheckAndInject(wabt::Module& mod)
 {
 	static const std::string sk_thrName = "$enclave_wasm_threshold";
@@ -507,6 +825,70 @@ inline InjectedSymbolInfo PreliminaryCheckAndInject(wabt::Module& mod)
 }
 
 
+/**
+ * @brief Inject the global variables for memory accounting (see
+ *        `InjectMemAccounting`); modules without a memory get the globals
+ *        too, so they read as zero, but no code updating them
+ *
+ */
+inline void InjectMemAccountingGlobals(
+	wabt::Module& mod,
+	InjectedSymbolInfo& info
+)
+{
+	info.m_hasMemory = !mod.memories.empty();
+	info.SetMemPagesId(InjectReservedGlobal(
+		mod, "$enclave_wasm_mem_pages", "enclave_wasm_mem_pages"
+	));
+	info.SetMemPeakId(InjectReservedGlobal(
+		mod, "$enclave_wasm_mem_peak_pages", "enclave_wasm_mem_peak_pages"
+	));
+	info.SetMemPageCtrId(InjectReservedGlobal(
+		mod, "$enclave_wasm_mem_page_counter", "enclave_wasm_mem_page_counter"
+	));
+	info.SetMemLastCtrId(InjectReservedGlobal(
+		mod, "$enclave_wasm_mem_last_counter", "enclave_wasm_mem_last_counter"
+	));
+}
+
+
+/**
+ * @brief Inject a cost counter for each function defined in the module,
+ *        exported as `enclave_wasm_func_cost_<function index>`, and the
+ *        number of functions, exported as `enclave_wasm_func_cost_num`.
+ *        The counters are unnamed, so they can't clash with names in the code.
+ *
+ * @return The global index of the cost counter of each function, indexed by
+ *         function index; imported functions have none (`SIZE_MAX`)
+ */
+inline std::vector<size_t> InjectFuncCostGlobals(wabt::Module& mod)
+{
+	static const std::string sk_expPrefix = "enclave_wasm_func_cost_";
+
+	const size_t numFuncs = mod.funcs.size();
+	std::vector<size_t> ids(numFuncs, SIZE_MAX);
+
+	for (size_t i = mod.num_func_imports; i < numFuncs; ++i)
+	{
+		const std::string expName = sk_expPrefix + std::to_string(i);
+		if (HasNameExported(mod, expName))
+		{
+			throw Exception("Export name " + expName + " is used");
+		}
+		ids[i] = InjectExportedGlobalVar<WabtType::I64>(mod, 0, expName);
+	}
+
+	const std::string numExpName = sk_expPrefix + "num";
+	if (HasNameExported(mod, numExpName))
+	{
+		throw Exception("Export name " + numExpName + " is used");
+	}
+	InjectExportedGlobalVar<WabtType::I64>(mod, numFuncs, numExpName);
+
+	return ids;
+}
+
+
 inline void PostInject(
 	wabt::Module& mod,
 	InjectedSymbolInfo& info
@@ -545,6 +927,27 @@ inline std::unique_ptr<wabt::BlockExpr> BuildCountingBlock(
 		Internal::make_unique<wabt::GlobalSetExpr>(enclaveSymInfo.m_ctrVar)
 	);
 
+	if (enclaveSymInfo.m_hasFuncCost)
+	{
+		// - ->     ;; increment the cost of this function
+		// - ->     i64.const count
+		// - ->     global.get $func_cost
+		// - ->     i64.add
+		// - ->     global.set $func_cost
+		blk.exprs.push_back(
+			Internal::make_unique<wabt::ConstExpr>(wabt::Const::I64(count))
+		);
+		blk.exprs.push_back(
+			Internal::make_unique<wabt::GlobalGetExpr>(enclaveSymInfo.m_funcCostVar)
+		);
+		blk.exprs.push_back(
+			Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64Add)
+		);
+		blk.exprs.push_back(
+			Internal::make_unique<wabt::GlobalSetExpr>(enclaveSymInfo.m_funcCostVar)
+		);
+	}
+
 	// - ->     ;; check if the counter exceeds the threshold
 	// - ->     global.get $counter
 	// - ->     global.get $threshold
@@ -0,0 +1,252 @@
+// Copyright (c) 2024 WasmCounter
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <src/ir.h>
+#include <src/cast.h>
+
+#include "CodeInjector.hpp"
+#include "WeightCalculator.hpp"
+
+namespace WasmCounter
+{
+
+
+/**
+ * @brief The weight of each expression in the original code, which is the
+ *        weight the counter charges for it, so the oracle counts exactly what
+ *        the counter is meant to count
+ *
+ */
+using OracleExprWeightMap = std::unordered_map<const wabt::Expr*, size_t>;
+
+
+inline void CollectOracleExprs(
+	wabt::ExprList& exprs,
+	const WeightMapType& weightMap,
+	const ImportFuncInfo& funcInfo,
+	OracleExprWeightMap& outWeights
+)
+{
+	for (auto it = exprs.begin(); it != exprs.end(); ++it)
+	{
+		size_t weight = 0;
+		auto itWeight = weightMap.find(it->type());
+		if (itWeight != weightMap.cend())
+		{
+			weight = itWeight->second(it, nullptr, funcInfo);
+		}
+		outWeights.emplace(&(*it), weight);
+
+		switch (it->type())
+		{
+		case wabt::ExprType::Block:
+			CollectOracleExprs(
+				wabt::cast<wabt::BlockExpr>(&(*it))->block.exprs,
+				weightMap, funcInfo, outWeights
+			);
+			break;
+		case wabt::ExprType::Loop:
+			CollectOracleExprs(
+				wabt::cast<wabt::LoopExpr>(&(*it))->block.exprs,
+				weightMap, funcInfo, outWeights
+			);
+			break;
+		case wabt::ExprType::If:
+		{
+			wabt::IfExpr* ifExpr = wabt::cast<wabt::IfExpr>(&(*it));
+			CollectOracleExprs(
+				ifExpr->true_.exprs, weightMap, funcInfo, outWeights
+			);
+			CollectOracleExprs(
+				ifExpr->false_, weightMap, funcInfo, outWeights
+			);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+
+/**
+ * @brief Record the expressions of the original code, before anything is
+ *        injected, so that the oracle doesn't count the injected code
+ *
+ */
+inline OracleExprWeightMap CollectOracleExprs(
+	wabt::Module& mod,
+	const ImportFuncInfo& funcInfo
+)
+{
+	OracleExprWeightMap weights;
+	const WeightMapType& weightMap = GetDefaultExprWeightCalcMap();
+
+	for (wabt::ModuleField& field : mod.fields)
+	{
+		if (field.type() == wabt::ModuleFieldType::Func)
+		{
+			wabt::Func& func = wabt::cast<wabt::FuncModuleField>(&field)->func;
+			CollectOracleExprs(func.exprs, weightMap, funcInfo, weights);
+		}
+	}
+
+	return weights;
+}
+
+
+struct OracleSymbolInfo
+{
+	// number of executed instructions, per expression type
+	std::unordered_map<wabt::ExprType, wabt::Var> m_opVars;
+
+	// sum of weights of executed instructions
+	wabt::Var m_weightedVar;
+}; // struct OracleSymbolInfo
+
+
+inline wabt::ExprList BuildOracleIncrement(const wabt::Var& var, size_t count)
+{
+	// global.get $var
+	// i64.const count
+	// i64.add
+	// global.set $var
+	wabt::ExprList exprs;
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalGetExpr>(var)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::ConstExpr>(wabt::Const::I64(count))
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64Add)
+	);
+	exprs.push_back(
+		Internal::make_unique<wabt::GlobalSetExpr>(var)
+	);
+	return exprs;
+}
+
+
+inline void InjectOracleCounting(
+	wabt::ExprList& exprs,
+	const OracleExprWeightMap& weights,
+	const OracleSymbolInfo& info
+)
+{
+	for (auto it = exprs.begin(); it != exprs.end(); ++it)
+	{
+		auto itWeight = weights.find(&(*it));
+		if (itWeight != weights.cend())
+		{
+			// count it before it runs, so that branches, returns, and traps
+			// are counted as well
+			wabt::ExprList incr =
+				BuildOracleIncrement(info.m_opVars.at(it->type()), 1);
+			exprs.splice(it, incr);
+			if (itWeight->second > 0)
+			{
+				wabt::ExprList wIncr =
+					BuildOracleIncrement(info.m_weightedVar, itWeight->second);
+				exprs.splice(it, wIncr);
+			}
+		}
+
+		// the counting blocks injected by the counter are not in the map,
+		// and only contain injected code
+		switch (it->type())
+		{
+		case wabt::ExprType::Block:
+			InjectOracleCounting(
+				wabt::cast<wabt::BlockExpr>(&(*it))->block.exprs, weights, info
+			);
+			break;
+		case wabt::ExprType::Loop:
+			InjectOracleCounting(
+				wabt::cast<wabt::LoopExpr>(&(*it))->block.exprs, weights, info
+			);
+			break;
+		case wabt::ExprType::If:
+		{
+			wabt::IfExpr* ifExpr = wabt::cast<wabt::IfExpr>(&(*it));
+			InjectOracleCounting(ifExpr->true_.exprs, weights, info);
+			InjectOracleCounting(ifExpr->false_, weights, info);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+
+/**
+ * @brief Inject the oracle, which counts every executed instruction of the
+ *        original code, as the exact reference for the counter, which only
+ *        counts at the block level.
+ *        For each expression type found in the code, a global named
+ *        `enclave_wasm_oracle_<type>` (e.g., `enclave_wasm_oracle_LocalGet`)
+ *        is exported; the sum of weights is `enclave_wasm_oracle_weighted`.
+ *        This must be called after all other injections.
+ *
+ */
+inline void InjectOracle(
+	wabt::Module& mod,
+	const OracleExprWeightMap& weights
+)
+{
+	static const std::string sk_prefix = "enclave_wasm_oracle_";
+
+	OracleSymbolInfo info;
+
+	// 1. inject a global variable for each expression type in the code
+	std::vector<wabt::ExprType> exprTypes;
+	for (const auto& item : weights)
+	{
+		wabt::ExprType exprType = item.first->type();
+		if (info.m_opVars.find(exprType) == info.m_opVars.end())
+		{
+			info.m_opVars.emplace(exprType, wabt::Var());
+			exprTypes.push_back(exprType);
+		}
+	}
+	// keep the order of injected globals stable
+	std::sort(exprTypes.begin(), exprTypes.end());
+	for (wabt::ExprType exprType : exprTypes)
+	{
+		const std::string expName =
+			sk_prefix + std::string(wabt::GetExprTypeName(exprType));
+		size_t id = InjectReservedGlobal(mod, "$" + expName, expName);
+		info.m_opVars[exprType] = wabt::Var(static_cast<wabt::Index>(id));
+	}
+
+	// 2. inject the global variable for the sum of weights
+	info.m_weightedVar = wabt::Var(static_cast<wabt::Index>(
+		InjectReservedGlobal(
+			mod, "$" + sk_prefix + "weighted", sk_prefix + "weighted"
+		)
+	));
+
+	// 3. count the instructions
+	for (wabt::ModuleField& field : mod.fields)
+	{
+		if (field.type() == wabt::ModuleFieldType::Func)
+		{
+			wabt::Func& func = wabt::cast<wabt::FuncModuleField>(&field)->func;
+			InjectOracleCounting(func.exprs, weights, info);
+		}
+	}
+}
+
+
+} // namespace WasmCounter
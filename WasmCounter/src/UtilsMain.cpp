@@ -18,11 +18,14 @@ static std::string GetHelpStr(const std::string& progName)
 	return
 		"Usage: " + progName + " <command>\n"
 		"  Available commands:\n"
-		"    Instrument - Instrument WASM/WAT code\n"
-		"    AdjJson    - Generate adjacency list in JSON for given WASM/WAT code\n"
+		"    Instrument       - Instrument WASM/WAT code\n"
+		"    InstrumentOracle - Instrument WASM/WAT code, with the exact\n"
+		"                       instruction-count oracle (for measurements)\n"
+		"    AdjJson          - Generate adjacency list in JSON for given WASM/WAT code\n"
 		"  Usage for each command:\n"
-		"    Instrument <input file> <output file>\n"
-		"    AdjJson    <input file> <output file>\n";
+		"    Instrument       <input file> <output file>\n"
+		"    InstrumentOracle <input file> <output file>\n"
+		"    AdjJson          <input file> <output file>\n";
 		;
 }
 
@@ -180,7 +183,11 @@ static int CommandAdjJson(int argc, char* argv[])
 }
 
 
-static int CommandInstrument(int argc, char* argv[])
+static int CommandInstrument(
+	int argc,
+	char* argv[],
+	const WasmCounter::InstrumentConfig& config
+)
 {
 	const std::string progName = argv[0];
 	if (argc != 4)
@@ -193,7 +200,7 @@ static int CommandInstrument(int argc, char* argv[])
 
 	auto mod = ReadModule(progName, inputPath);
 
-	WasmCounter::Instrument(*(mod.m_ptr));
+	WasmCounter::Instrument(*(mod.m_ptr), nullptr, config);
 
 	WriteModule(progName, outputPath, mod);
 
@@ -212,7 +219,13 @@ int main(int argc, char* argv[])
 
 	if (cmd == "Instrument")
 	{
-		return CommandInstrument(argc, argv);
+		return CommandInstrument(argc, argv, WasmCounter::InstrumentConfig());
+	}
+	else if (cmd == "InstrumentOracle")
+	{
+		WasmCounter::InstrumentConfig config;
+		config.m_enableOracle = true;
+		return CommandInstrument(argc, argv, config);
 	}
 	else if (cmd == "AdjJson")
 	{
@@ -13,7 +13,7 @@
 
 #include "BlockGenerator.hpp"
 #include "CodeInjector.hpp"
-#include "WeightCalculator.hpp"
+#include "OracleInjector.hpp"
 
 namespace WasmCounter
 {
@@ -78,16 +78,35 @@ static ImportFuncListType GetImportFuncList(
 
 void WasmCounter::Instrument(
 	wabt::Module& mod,
-	std::vector<Internal::InCmpPtr<Graph> >* outGraphs
+	std::vector<Internal::InCmpPtr<Graph> >* outGraphs,
+	const InstrumentConfig& config
 )
 {
 	// Inject counter and functions
 	auto symInfo = PreliminaryCheckAndInject(mod);
+	if (config.m_enableMemAccounting)
+	{
+		InjectMemAccountingGlobals(mod, symInfo);
+	}
 
 	// Generate import function info
 	auto impFuncList = GetImportFuncList(mod.imports);
 	ImportFuncInfo funcInfo{ mod.func_bindings, impFuncList };
 
+	// Record the original code for the oracle, before it's changed
+	OracleExprWeightMap oracleWeights;
+	if (config.m_enableOracle)
+	{
+		oracleWeights = CollectOracleExprs(mod, funcInfo);
+	}
+
+	// Cost counters of functions
+	std::vector<size_t> funcCostIds;
+	if (config.m_enableFuncCost)
+	{
+		funcCostIds = InjectFuncCostGlobals(mod);
+	}
+
 	// Instrument code
 	size_t funcIdx = 0;
 	for (wabt::ModuleField& field : mod.fields)
@@ -99,7 +118,15 @@ void WasmCounter::Instrument(
 			{
 				wabt::Func& func =
 					wabt::cast<wabt::FuncModuleField>(&field)->func;
-				auto gr = InstrumentFunc(func, funcInfo, symInfo);
+				InjectedSymbolInfo funcSymInfo = symInfo;
+				if (
+					(funcIdx < funcCostIds.size()) &&
+					(funcCostIds[funcIdx] != SIZE_MAX)
+				)
+				{
+					funcSymInfo.SetFuncCostId(funcCostIds[funcIdx]);
+				}
+				auto gr = InstrumentFunc(func, funcInfo, funcSymInfo);
 				if (outGraphs != nullptr)
 				{
 					outGraphs->emplace_back(std::move(gr));
@@ -121,14 +148,46 @@ void WasmCounter::Instrument(
 		}
 	}
 
+	// Memory accounting, after counting, so that it's not counted itself
+	if (config.m_enableMemAccounting)
+	{
+		InjectMemAccounting(mod, symInfo);
+	}
+
 	// Post injection
 	PostInject(mod, symInfo);
 
+	// Oracle, after everything else, so that only the original code is counted
+	if (config.m_enableOracle)
+	{
+		InjectOracle(mod, oracleWeights);
+	}
+
 	// validate generated module
 	PostValidateModule(mod);
 }
 
 
+std::vector<std::string> WasmCounter::GetFuncNames(const wabt::Module& mod)
+{
+	std::vector<std::string> names;
+	names.reserve(mod.funcs.size());
+	for (const wabt::Func* func : mod.funcs)
+	{
+		names.push_back(func->name);
+	}
+	return names;
+}
+
+
+std::vector<std::pair<std::string, std::string> > WasmCounter::GetImportFuncs(
+	const wabt::Module& mod
+)
+{
+	return GetImportFuncList(mod.imports);
+}
+
+
 template<>
 WasmCounter::Internal::InCmpPtr<WasmCounter::Graph>::~InCmpPtr()
 {}
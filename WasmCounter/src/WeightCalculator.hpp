@@ -3,6 +3,8 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#pragma once
+
 #include <functional>
 #include <unordered_map>
 #include <vector>
@@ -0,0 +1,598 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Internal/make_unique.hpp"
+#include "Exception.hpp"
+#include "HeapStats.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief A heap allocator over a single buffer, which is partitioned into
+ *        per-thread arenas, for small allocations, plus a shared slab region,
+ *        for large allocations (e.g., instance memories and stacks) and for
+ *        small ones that don't fit in their arena anymore.
+ *
+ *        Requests are rounded up to size classes (four classes per power of
+ *        two, so at most 25% is lost to rounding). Each block records its
+ *        own size and the size of the block before it, so a freed block is
+ *        merged with free neighbours, and a free block at the end of the
+ *        used part of a region is given back to it; thus, a region that
+ *        has been emptied is as good as new. Free blocks are kept in lists
+ *        binned by size class, and a larger block is split when it's
+ *        handed out for a smaller request. A thread is bound to an arena at
+ *        its first allocation, so threads only contend on the slab region,
+ *        or when freeing blocks of another thread's arena.
+ *
+ */
+class ArenaHeap
+{
+public: // static members:
+
+	static constexpr size_t sk_alignment = 16;
+	static constexpr size_t sk_minBlockSize = 64;
+	static constexpr size_t sk_classesPerDoubling = 4;
+
+	/**
+	 * @brief Allocations with a block larger than this go to the slab
+	 *        region directly
+	 *
+	 */
+	static constexpr size_t sk_maxArenaBlockSize = 16 * 1024;
+
+public:
+
+	ArenaHeap(
+		uint8_t* buf,
+		size_t bufSize,
+		size_t numArenas,
+		size_t arenaSize
+	) :
+		m_bufSize(bufSize),
+		m_classSizes(BuildClassSizes(bufSize)),
+		m_regions(),
+		m_nextArena(0)
+	{
+		if (numArenas >= UINT16_MAX)
+		{
+			throw Exception("Too many arenas for the heap");
+		}
+		arenaSize = arenaSize - (arenaSize % sk_alignment);
+		if ((arenaSize / sk_alignment) > UINT32_MAX)
+		{
+			// block sizes are recorded in units of the alignment
+			throw Exception("The arenas are too large");
+		}
+		if (
+			(numArenas != 0 && arenaSize == 0) ||
+			(numArenas * arenaSize >= bufSize)
+		)
+		{
+			throw Exception("The heap is too small for the given arenas");
+		}
+
+		// align the beginning of the buffer
+		size_t misalign = reinterpret_cast<uintptr_t>(buf) % sk_alignment;
+		size_t skip = misalign == 0 ? 0 : sk_alignment - misalign;
+		if (skip >= bufSize - (numArenas * arenaSize))
+		{
+			throw Exception("The heap is too small for the given arenas");
+		}
+
+		uint8_t* ptr = buf + skip;
+		for (size_t i = 0; i < numArenas; ++i)
+		{
+			m_regions.push_back(
+				Internal::make_unique<Region>(ptr, arenaSize, m_classSizes.size())
+			);
+			ptr += arenaSize;
+		}
+		// the last region is the shared slab region
+		size_t slabSize = (buf + bufSize) - ptr;
+		slabSize = slabSize - (slabSize % sk_alignment);
+		if ((slabSize / sk_alignment) > UINT32_MAX)
+		{
+			// block sizes are recorded in units of the alignment
+			throw Exception("The heap is too large");
+		}
+		m_regions.push_back(
+			Internal::make_unique<Region>(ptr, slabSize, m_classSizes.size())
+		);
+	}
+
+	ArenaHeap(const ArenaHeap&) = delete;
+
+	ArenaHeap(ArenaHeap&&) = delete;
+
+	~ArenaHeap() = default;
+
+	ArenaHeap& operator=(const ArenaHeap&) = delete;
+
+	ArenaHeap& operator=(ArenaHeap&&) = delete;
+
+	void* Malloc(size_t size)
+	{
+		size_t blockSize = size + sizeof(BlockHeader);
+		if (blockSize < size || size > UINT32_MAX)
+		{
+			return nullptr;
+		}
+		size_t classIdx = GetClassIdx(blockSize);
+		if (classIdx >= m_classSizes.size())
+		{
+			GetSlabRegion().RecordFailure();
+			return nullptr;
+		}
+
+		void* res = nullptr;
+		if (m_classSizes[classIdx] <= sk_maxArenaBlockSize && GetNumArenas() > 0)
+		{
+			res = Alloc(GetThreadArenaIdx(), classIdx, size, false);
+		}
+		if (res == nullptr)
+		{
+			res = Alloc(GetNumArenas(), classIdx, size, true);
+		}
+		return res;
+	}
+
+	void* Realloc(void* ptr, size_t size)
+	{
+		if (ptr == nullptr)
+		{
+			return Malloc(size);
+		}
+
+		BlockHeader* header = GetHeader(ptr);
+		if (!IsValidBlock(header))
+		{
+			return nullptr;
+		}
+		Region& region = *m_regions[header->m_regionIdx];
+		size_t blockSize = GetBlockSize(header);
+		if (size + sizeof(BlockHeader) <= blockSize && size <= UINT32_MAX)
+		{
+			// it still fits in the same block
+			std::lock_guard<std::mutex> lock(region.m_mutex);
+			region.m_usedSize = region.m_usedSize - header->m_size + size;
+			region.m_internalFragSize =
+				region.m_internalFragSize + header->m_size - size;
+			region.UpdatePeak();
+			header->m_size = static_cast<uint32_t>(size);
+			return ptr;
+		}
+
+		void* newPtr = Malloc(size);
+		if (newPtr != nullptr)
+		{
+			std::memcpy(newPtr, ptr, std::min<size_t>(header->m_size, size));
+			Free(ptr);
+		}
+		return newPtr;
+	}
+
+	void Free(void* ptr)
+	{
+		if (ptr == nullptr)
+		{
+			return;
+		}
+
+		BlockHeader* header = GetHeader(ptr);
+		if (!IsValidBlock(header))
+		{
+			// Not a block of this heap, or it has been corrupted;
+			// leaking it is safer than trusting it
+			return;
+		}
+
+		Region& region = *m_regions[header->m_regionIdx];
+
+		std::lock_guard<std::mutex> lock(region.m_mutex);
+		region.m_usedSize -= header->m_size;
+		region.m_internalFragSize -= GetBlockSize(header) - header->m_size;
+
+		// merge with the free neighbours
+		BlockHeader* next = GetNextBlock(header);
+		if (
+			reinterpret_cast<uint8_t*>(next) < region.m_bump &&
+			next->m_magic == sk_freeMagic
+		)
+		{
+			region.RemoveFree(next, GetBinIdx(GetBlockSize(next)));
+			header->m_units += next->m_units;
+			next->m_magic = 0;
+		}
+		if (header->m_prevUnits != 0)
+		{
+			BlockHeader* prev = GetPrevBlock(header);
+			if (prev->m_magic == sk_freeMagic)
+			{
+				region.RemoveFree(prev, GetBinIdx(GetBlockSize(prev)));
+				prev->m_units += header->m_units;
+				header->m_magic = 0;
+				header = prev;
+			}
+		}
+
+		next = GetNextBlock(header);
+		if (reinterpret_cast<uint8_t*>(next) == region.m_bump)
+		{
+			// the last block of the region; give it back
+			header->m_magic = 0;
+			region.m_bump = reinterpret_cast<uint8_t*>(header);
+			region.m_lastUnits = header->m_prevUnits;
+			return;
+		}
+
+		next->m_prevUnits = header->m_units;
+		header->m_magic = sk_freeMagic;
+		region.InsertFree(header, GetBinIdx(GetBlockSize(header)));
+	}
+
+	size_t GetNumArenas() const
+	{
+		return m_regions.size() - 1;
+	}
+
+	HeapStats GetStats() const
+	{
+		HeapStats stats;
+		stats.m_heapSize = m_bufSize;
+		for (const auto& region : m_regions)
+		{
+			std::lock_guard<std::mutex> lock(region->m_mutex);
+			stats.m_usedSize += region->m_usedSize;
+			// peaks of different regions may not be at the same time, so the
+			// sum is an upper bound of the overall peak
+			stats.m_peakUsedSize += region->m_peakUsedSize;
+			stats.m_internalFragSize += region->m_internalFragSize;
+			stats.m_externalFragSize += region->m_cachedSize;
+			stats.m_numFailedAllocs += region->m_numFailedAllocs;
+		}
+		return stats;
+	}
+
+	/**
+	 * @brief Get the stats of a single region; the regions are the arenas,
+	 *        in order, followed by the slab region
+	 *
+	 */
+	HeapStats GetRegionStats(size_t regionIdx) const
+	{
+		const Region& region = *m_regions.at(regionIdx);
+
+		std::lock_guard<std::mutex> lock(region.m_mutex);
+		HeapStats stats;
+		stats.m_heapSize = region.m_end - region.m_begin;
+		stats.m_usedSize = region.m_usedSize;
+		stats.m_peakUsedSize = region.m_peakUsedSize;
+		stats.m_internalFragSize = region.m_internalFragSize;
+		stats.m_externalFragSize = region.m_cachedSize;
+		stats.m_numFailedAllocs = region.m_numFailedAllocs;
+		return stats;
+	}
+
+	/**
+	 * @brief Get the number of bytes of a region that have ever been handed
+	 *        out and not given back yet, i.e., the part of the region that
+	 *        is covered by used or free blocks
+	 *
+	 */
+	size_t GetRegionFootprint(size_t regionIdx) const
+	{
+		const Region& region = *m_regions.at(regionIdx);
+
+		std::lock_guard<std::mutex> lock(region.m_mutex);
+		return region.m_bump - region.m_begin;
+	}
+
+private:
+
+	static constexpr uint16_t sk_magic = 0x4150; // "AP"
+	static constexpr uint16_t sk_freeMagic = 0x4146; // "AF"
+
+	struct BlockHeader
+	{
+		uint16_t m_magic;
+		uint16_t m_regionIdx;
+		// the size of this block, in units of sk_alignment
+		uint32_t m_units;
+		// the size of the block right before this one, in units of
+		// sk_alignment; 0 if this is the first block of the region
+		uint32_t m_prevUnits;
+		uint32_t m_size;
+	}; // struct BlockHeader
+
+	static_assert(
+		sizeof(BlockHeader) % sk_alignment == 0,
+		"The block header must keep the payload aligned"
+	);
+
+	struct FreeNode
+	{
+		BlockHeader m_header;
+		FreeNode* m_prev;
+		FreeNode* m_next;
+	}; // struct FreeNode
+
+	static_assert(
+		sizeof(FreeNode) <= sk_minBlockSize,
+		"A free block must fit in the smallest block"
+	);
+
+	struct Region
+	{
+		Region(uint8_t* begin, size_t size, size_t numClasses) :
+			m_mutex(),
+			m_begin(begin),
+			m_end(begin + size),
+			m_bump(begin),
+			m_lastUnits(0),
+			m_freeLists(numClasses, nullptr),
+			m_usedSize(0),
+			m_peakUsedSize(0),
+			m_internalFragSize(0),
+			m_cachedSize(0),
+			m_numFailedAllocs(0)
+		{}
+
+		void UpdatePeak()
+		{
+			m_peakUsedSize = std::max(m_peakUsedSize, m_usedSize);
+		}
+
+		void RecordFailure()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_numFailedAllocs;
+		}
+
+		void InsertFree(BlockHeader* header, size_t binIdx)
+		{
+			FreeNode* node = reinterpret_cast<FreeNode*>(header);
+			node->m_prev = nullptr;
+			node->m_next = m_freeLists[binIdx];
+			if (node->m_next != nullptr)
+			{
+				node->m_next->m_prev = node;
+			}
+			m_freeLists[binIdx] = node;
+			m_cachedSize += GetBlockSize(header);
+		}
+
+		void RemoveFree(BlockHeader* header, size_t binIdx)
+		{
+			FreeNode* node = reinterpret_cast<FreeNode*>(header);
+			if (node->m_prev != nullptr)
+			{
+				node->m_prev->m_next = node->m_next;
+			}
+			else
+			{
+				m_freeLists[binIdx] = node->m_next;
+			}
+			if (node->m_next != nullptr)
+			{
+				node->m_next->m_prev = node->m_prev;
+			}
+			m_cachedSize -= GetBlockSize(header);
+		}
+
+		mutable std::mutex m_mutex;
+		uint8_t* m_begin;
+		uint8_t* m_end;
+		uint8_t* m_bump;
+		// the size of the block that ends at m_bump, in units
+		uint32_t m_lastUnits;
+		std::vector<FreeNode*> m_freeLists;
+
+		uint64_t m_usedSize;
+		uint64_t m_peakUsedSize;
+		uint64_t m_internalFragSize;
+		uint64_t m_cachedSize;
+		uint64_t m_numFailedAllocs;
+	}; // struct Region
+
+	static std::vector<size_t> BuildClassSizes(size_t maxSize)
+	{
+		std::vector<size_t> sizes;
+		for (size_t base = sk_minBlockSize; base <= maxSize; base *= 2)
+		{
+			for (size_t i = 0; i < sk_classesPerDoubling; ++i)
+			{
+				size_t step = base / sk_classesPerDoubling;
+				size_t size = base + (step * i);
+				if (size > maxSize)
+				{
+					return sizes;
+				}
+				sizes.push_back(size);
+			}
+			if (base > (SIZE_MAX / 2))
+			{
+				break;
+			}
+		}
+		return sizes;
+	}
+
+	static BlockHeader* GetHeader(void* ptr)
+	{
+		return reinterpret_cast<BlockHeader*>(
+			static_cast<uint8_t*>(ptr) - sizeof(BlockHeader)
+		);
+	}
+
+	static size_t GetBlockSize(const BlockHeader* header)
+	{
+		return static_cast<size_t>(header->m_units) * sk_alignment;
+	}
+
+	static BlockHeader* GetNextBlock(BlockHeader* header)
+	{
+		return reinterpret_cast<BlockHeader*>(
+			reinterpret_cast<uint8_t*>(header) + GetBlockSize(header)
+		);
+	}
+
+	static BlockHeader* GetPrevBlock(BlockHeader* header)
+	{
+		return reinterpret_cast<BlockHeader*>(
+			reinterpret_cast<uint8_t*>(header) -
+				(static_cast<size_t>(header->m_prevUnits) * sk_alignment)
+		);
+	}
+
+	bool IsValidBlock(const BlockHeader* header) const
+	{
+		if (
+			(header->m_magic != sk_magic) ||
+			(header->m_regionIdx >= m_regions.size()) ||
+			(header->m_units == 0)
+		)
+		{
+			return false;
+		}
+		const Region& region = *m_regions[header->m_regionIdx];
+		const uint8_t* begin = reinterpret_cast<const uint8_t*>(header);
+		return (region.m_begin <= begin) &&
+			(GetBlockSize(header) <= static_cast<size_t>(region.m_end - begin));
+	}
+
+	size_t GetClassIdx(size_t blockSize) const
+	{
+		return std::lower_bound(
+			m_classSizes.begin(),
+			m_classSizes.end(),
+			blockSize
+		) - m_classSizes.begin();
+	}
+
+	/**
+	 * @brief Get the free list a free block belongs to, which is the largest
+	 *        class that isn't larger than the block, so every block in the
+	 *        list of a class fits a request of that class
+	 *
+	 */
+	size_t GetBinIdx(size_t blockSize) const
+	{
+		return (std::upper_bound(
+			m_classSizes.begin(),
+			m_classSizes.end(),
+			blockSize
+		) - m_classSizes.begin()) - 1;
+	}
+
+	size_t GetThreadArenaIdx()
+	{
+		// 0 means that the thread hasn't been bound to an arena yet;
+		// there is only one WASM runtime heap, so this can be static
+		static thread_local size_t s_arenaIdxPlusOne = 0;
+		if (s_arenaIdxPlusOne == 0)
+		{
+			s_arenaIdxPlusOne = m_nextArena++ + 1;
+		}
+		return (s_arenaIdxPlusOne - 1) % GetNumArenas();
+	}
+
+	Region& GetSlabRegion()
+	{
+		return *m_regions.back();
+	}
+
+	void* Alloc(size_t regionIdx, size_t classIdx, size_t size, bool isLast)
+	{
+		Region& region = *m_regions[regionIdx];
+		size_t blockSize = m_classSizes[classIdx];
+		uint32_t units = static_cast<uint32_t>(blockSize / sk_alignment);
+
+		std::lock_guard<std::mutex> lock(region.m_mutex);
+
+		// the smallest free block that is known to fit, before fresh space
+		BlockHeader* header = nullptr;
+		for (size_t i = classIdx; i < region.m_freeLists.size(); ++i)
+		{
+			FreeNode* node = region.m_freeLists[i];
+			if (node != nullptr)
+			{
+				header = &(node->m_header);
+				region.RemoveFree(header, i);
+				break;
+			}
+		}
+
+		if (header != nullptr)
+		{
+			size_t restSize = GetBlockSize(header) - blockSize;
+			if (restSize >= sk_minBlockSize)
+			{
+				// split the rest off as a new free block
+				header->m_units = units;
+				BlockHeader* rest = GetNextBlock(header);
+				rest->m_magic = sk_freeMagic;
+				rest->m_regionIdx = static_cast<uint16_t>(regionIdx);
+				rest->m_units = static_cast<uint32_t>(restSize / sk_alignment);
+				rest->m_prevUnits = units;
+				rest->m_size = 0;
+				// free blocks are never the last one, so there is a next one
+				GetNextBlock(rest)->m_prevUnits = rest->m_units;
+				region.InsertFree(rest, GetBinIdx(restSize));
+			}
+		}
+		else if (static_cast<size_t>(region.m_end - region.m_bump) >= blockSize)
+		{
+			header = reinterpret_cast<BlockHeader*>(region.m_bump);
+			header->m_units = units;
+			header->m_prevUnits = region.m_lastUnits;
+			region.m_bump += blockSize;
+			region.m_lastUnits = units;
+		}
+		else
+		{
+			if (isLast)
+			{
+				++region.m_numFailedAllocs;
+			}
+			return nullptr;
+		}
+
+		header->m_magic = sk_magic;
+		header->m_regionIdx = static_cast<uint16_t>(regionIdx);
+		header->m_size = static_cast<uint32_t>(size);
+
+		region.m_usedSize += size;
+		region.m_internalFragSize += GetBlockSize(header) - size;
+		region.UpdatePeak();
+
+		return reinterpret_cast<uint8_t*>(header) + sizeof(BlockHeader);
+	}
+
+	size_t m_bufSize;
+	std::vector<size_t> m_classSizes;
+	std::vector<std::unique_ptr<Region> > m_regions;
+	std::atomic<size_t> m_nextArena;
+
+}; // class ArenaHeap
+
+
+} // namespace WasmRuntime
+
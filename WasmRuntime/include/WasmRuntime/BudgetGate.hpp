@@ -0,0 +1,245 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+#include "Exception.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief Lets an instrumented execution pause when it runs out of budget,
+ *        instead of being aborted, and continue from the same point (with the
+ *        counter intact) once it's given more budget.
+ *
+ *        The execution yields at the injected counter check: the native
+ *        `enclave_wasm_counter_exceed` calls `WaitForBudget`, which either
+ *        asks the budget policy (if one is set), or blocks the execution
+ *        thread until another thread calls `Resume` or `Abort`.
+ *
+ *        One gate serves one execution at a time.
+ *
+ */
+class BudgetGate
+{
+public: // static members:
+
+	/**
+	 * @brief Decide how much more budget to give to an execution that ran out
+	 *        of it; returning 0 aborts the execution
+	 *
+	 * @param counter   The counter at the exceed point
+	 * @param threshold The current threshold
+	 */
+	using Policy = std::function<uint64_t(uint64_t, uint64_t)>;
+
+	enum class State
+	{
+		Idle,
+		Running,
+		Suspended,
+		Done,
+	}; // enum class State
+
+public:
+
+	BudgetGate() :
+		m_mutex(),
+		m_cond(),
+		m_policy(),
+		m_state(State::Idle),
+		m_grant(0),
+		m_isAborted(false),
+		m_suspendedCounter(0),
+		m_numSuspensions(0)
+	{}
+
+	BudgetGate(const BudgetGate&) = delete;
+
+	BudgetGate(BudgetGate&&) = delete;
+
+	~BudgetGate() = default;
+
+	BudgetGate& operator=(const BudgetGate&) = delete;
+
+	BudgetGate& operator=(BudgetGate&&) = delete;
+
+	/**
+	 * @brief Decide on more budget synchronously with the given policy,
+	 *        instead of waiting for `Resume`
+	 *
+	 */
+	void SetPolicy(Policy policy)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_policy = std::move(policy);
+	}
+
+	/**
+	 * @brief Called by the runner before the execution starts
+	 *
+	 */
+	void Start()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_state == State::Running || m_state == State::Suspended)
+		{
+			throw Exception("The budget gate is used by another execution");
+		}
+		m_state = State::Running;
+		m_grant = 0;
+		m_isAborted = false;
+		m_suspendedCounter = 0;
+		m_numSuspensions = 0;
+	}
+
+	/**
+	 * @brief Called by the runner after the execution finished (or failed)
+	 *
+	 */
+	void Finish()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_state = State::Done;
+		}
+		m_cond.notify_all();
+	}
+
+	/**
+	 * @brief Called on the execution thread when the budget runs out
+	 *
+	 * @return The additional budget; 0 if the execution should be aborted
+	 */
+	uint64_t WaitForBudget(uint64_t counter, uint64_t threshold)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		++m_numSuspensions;
+		m_suspendedCounter = counter;
+
+		if (m_policy)
+		{
+			Policy policy = m_policy;
+			lock.unlock();
+			return policy(counter, threshold);
+		}
+
+		m_state = State::Suspended;
+		m_grant = 0;
+		m_cond.notify_all();
+		m_cond.wait(
+			lock,
+			[this]() { return (m_grant != 0) || m_isAborted; }
+		);
+		m_state = State::Running;
+
+		uint64_t grant = m_isAborted ? 0 : m_grant;
+		m_grant = 0;
+		return grant;
+	}
+
+	/**
+	 * @brief Give more budget to the suspended execution, which continues
+	 *        from where it paused
+	 *
+	 */
+	void Resume(uint64_t additionalBudget)
+	{
+		if (additionalBudget == 0)
+		{
+			throw Exception("The additional budget must be greater than 0");
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_state != State::Suspended)
+			{
+				throw Exception("The execution is not suspended");
+			}
+			m_grant = additionalBudget;
+		}
+		m_cond.notify_all();
+	}
+
+	/**
+	 * @brief Abort the suspended execution, as if it had no budget gate
+	 *
+	 */
+	void Abort()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isAborted = true;
+		}
+		m_cond.notify_all();
+	}
+
+	/**
+	 * @brief Wait until the execution is suspended or done
+	 *
+	 */
+	State WaitForSuspendOrDone()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(
+			lock,
+			[this]()
+			{
+				return (m_state == State::Suspended && m_grant == 0) ||
+					(m_state == State::Done);
+			}
+		);
+		return m_state;
+	}
+
+	State GetState() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_state;
+	}
+
+	/**
+	 * @brief The counter at the last point where the budget ran out
+	 *
+	 */
+	uint64_t GetSuspendedCounter() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_suspendedCounter;
+	}
+
+	uint64_t GetNumSuspensions() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numSuspensions;
+	}
+
+private:
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	Policy m_policy;
+
+	State m_state;
+	uint64_t m_grant;
+	bool m_isAborted;
+	uint64_t m_suspendedCounter;
+	uint64_t m_numSuspensions;
+
+}; // class BudgetGate
+
+
+} // namespace WasmRuntime
+
@@ -0,0 +1,246 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Internal/make_unique.hpp"
+#include "Exception.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief A source of event data that is read piece by piece, so that the
+ *        event doesn't have to fit in a single buffer (or in the WASM heap).
+ *
+ */
+class EventDataStream
+{
+public:
+	EventDataStream() = default;
+
+	virtual ~EventDataStream() = default;
+
+	/**
+	 * @brief Get the total size of the event data, in bytes
+	 *
+	 */
+	virtual uint64_t GetSize() const = 0;
+
+	/**
+	 * @brief Read up to `len` bytes starting at `offset` into `dest`
+	 *
+	 * @return The number of bytes read; it is only less than `len` when the
+	 *         end of the stream is reached
+	 */
+	virtual size_t Read(uint64_t offset, uint8_t* dest, size_t len) = 0;
+
+}; // class EventDataStream
+
+
+/**
+ * @brief An event data stream that serves reads from an in-memory window,
+ *        which is filled by a (potentially expensive) fetch function.
+ *
+ *        Each fetch reads a whole window, so many small reads from the
+ *        WASM program are batched into a single fetch (e.g., one ocall).
+ *        When reads are sequential, the window doubles in size (up to
+ *        `maxWindow`), so that the following data is prefetched before the
+ *        program asks for it; a random access resets the window size. A
+ *        single fetch is never larger than `maxWindow`.
+ *
+ */
+class BufferedEventDataStream :
+	public EventDataStream
+{
+public: // static members:
+
+	/**
+	 * @brief Fetch up to `len` bytes starting at `offset` into `dest`,
+	 *        and return the number of bytes fetched
+	 *
+	 */
+	using FetchFunc = std::function<size_t(uint64_t, uint8_t*, size_t)>;
+
+	static constexpr size_t sk_defMinWindow =  64 * 1024; //  64 KB
+	static constexpr size_t sk_defMaxWindow = 256 * 1024; // 256 KB
+
+	static std::unique_ptr<BufferedEventDataStream> MakeUnique(
+		uint64_t size,
+		FetchFunc fetchFunc,
+		size_t minWindow = sk_defMinWindow,
+		size_t maxWindow = sk_defMaxWindow
+	)
+	{
+		return Internal::make_unique<BufferedEventDataStream>(
+			size,
+			std::move(fetchFunc),
+			minWindow,
+			maxWindow
+		);
+	}
+
+public:
+
+	BufferedEventDataStream(
+		uint64_t size,
+		FetchFunc fetchFunc,
+		size_t minWindow = sk_defMinWindow,
+		size_t maxWindow = sk_defMaxWindow
+	) :
+		m_size(size),
+		m_fetchFunc(std::move(fetchFunc)),
+		m_minWindow(minWindow),
+		m_maxWindow(maxWindow),
+		m_window(),
+		m_winBegin(0),
+		m_winSize(minWindow),
+		m_numFetches(0)
+	{
+		if (m_minWindow == 0 || m_minWindow > m_maxWindow)
+		{
+			throw Exception("Invalid window size for event data stream");
+		}
+		m_window.reserve(m_maxWindow);
+	}
+
+	BufferedEventDataStream(const BufferedEventDataStream&) = delete;
+
+	BufferedEventDataStream(BufferedEventDataStream&&) = delete;
+
+	virtual ~BufferedEventDataStream() = default;
+
+	BufferedEventDataStream& operator=(const BufferedEventDataStream&) = delete;
+
+	BufferedEventDataStream& operator=(BufferedEventDataStream&&) = delete;
+
+	virtual uint64_t GetSize() const override
+	{
+		return m_size;
+	}
+
+	virtual size_t Read(uint64_t offset, uint8_t* dest, size_t len) override
+	{
+		if (offset >= m_size)
+		{
+			return 0;
+		}
+		len = static_cast<size_t>(
+			std::min<uint64_t>(static_cast<uint64_t>(len), m_size - offset)
+		);
+
+		size_t totalRead = 0;
+		while (totalRead < len)
+		{
+			uint64_t currOffset = offset + totalRead;
+
+			if (!IsInWindow(currOffset))
+			{
+				size_t remain = len - totalRead;
+				if (remain >= m_maxWindow)
+				{
+					// The request is larger than any window we would keep,
+					// so fetch it directly into the destination, but no more
+					// than a window at a time, which is what a fetch (e.g.,
+					// the buffer of an ocall) is sized for
+					size_t fetched = Fetch(currOffset, dest + totalRead, m_maxWindow);
+					totalRead += fetched;
+					if (fetched < m_maxWindow)
+					{
+						break;
+					}
+					continue;
+				}
+
+				FillWindow(currOffset);
+				if (!IsInWindow(currOffset))
+				{
+					// nothing more can be fetched
+					break;
+				}
+			}
+
+			size_t winOffset = static_cast<size_t>(currOffset - m_winBegin);
+			size_t cpSize = std::min(len - totalRead, m_window.size() - winOffset);
+			std::memcpy(dest + totalRead, m_window.data() + winOffset, cpSize);
+			totalRead += cpSize;
+		}
+
+		return totalRead;
+	}
+
+	/**
+	 * @brief Get the number of times the fetch function has been called
+	 *
+	 */
+	uint64_t GetNumFetches() const
+	{
+		return m_numFetches;
+	}
+
+private:
+
+	bool IsInWindow(uint64_t offset) const
+	{
+		return (offset >= m_winBegin) &&
+			(offset < m_winBegin + m_window.size());
+	}
+
+	size_t Fetch(uint64_t offset, uint8_t* dest, size_t len)
+	{
+		++m_numFetches;
+		size_t fetched = m_fetchFunc(offset, dest, len);
+		if (fetched > len)
+		{
+			throw Exception("Event data stream fetched more than requested");
+		}
+		return fetched;
+	}
+
+	void FillWindow(uint64_t offset)
+	{
+		bool isSequential =
+			(m_window.size() > 0) &&
+			(offset == m_winBegin + m_window.size());
+		m_winSize = isSequential ?
+			std::min(m_winSize * 2, m_maxWindow) :
+			m_minWindow;
+
+		size_t fetchSize = static_cast<size_t>(
+			std::min<uint64_t>(static_cast<uint64_t>(m_winSize), m_size - offset)
+		);
+
+		m_window.resize(fetchSize);
+		m_winBegin = offset;
+		m_window.resize(Fetch(offset, m_window.data(), fetchSize));
+	}
+
+	uint64_t m_size;
+	FetchFunc m_fetchFunc;
+	size_t m_minWindow;
+	size_t m_maxWindow;
+
+	std::vector<uint8_t> m_window;
+	uint64_t m_winBegin;
+	size_t m_winSize;
+
+	uint64_t m_numFetches;
+
+}; // class BufferedEventDataStream
+
+
+} // namespace WasmRuntime
+
@@ -7,11 +7,17 @@
 
 
 #include <cstdint>
+#include <cstring>
 
+#include <algorithm>
 #include <limits>
+#include <memory>
 #include <vector>
 
+#include "BudgetGate.hpp"
+#include "EventDataStream.hpp"
 #include "Exception.hpp"
+#include "SamplingProfiler.hpp"
 #include "WasmExecEnv.hpp"
 
 
@@ -33,7 +39,14 @@ public:
 		m_iCount(0),
 		m_hasCountExceed(false),
 		m_eventId(),
-		m_eventData()
+		m_eventData(),
+		m_eventStream(),
+		m_budgetGate(),
+		m_profiler(),
+		m_samplingState(),
+		m_hasResult(false),
+		m_resultPtr(0),
+		m_resultSize(0)
 	{}
 
 	ExecEnvUserData(const ExecEnvUserData&) = delete;
@@ -44,7 +57,14 @@ public:
 		m_iCount(other.m_iCount),
 		m_hasCountExceed(other.m_hasCountExceed),
 		m_eventId(std::move(other.m_eventId)),
-		m_eventData(std::move(other.m_eventData))
+		m_eventData(std::move(other.m_eventData)),
+		m_eventStream(std::move(other.m_eventStream)),
+		m_budgetGate(std::move(other.m_budgetGate)),
+		m_profiler(std::move(other.m_profiler)),
+		m_samplingState(other.m_samplingState),
+		m_hasResult(other.m_hasResult),
+		m_resultPtr(other.m_resultPtr),
+		m_resultSize(other.m_resultSize)
 	{}
 
 	virtual ~ExecEnvUserData() {}
@@ -62,12 +82,23 @@ public:
 			m_hasCountExceed = other.m_hasCountExceed;
 			m_eventId = std::move(other.m_eventId);
 			m_eventData = std::move(other.m_eventData);
+			m_eventStream = std::move(other.m_eventStream);
+			m_budgetGate = std::move(other.m_budgetGate);
+			m_profiler = std::move(other.m_profiler);
+			m_samplingState = other.m_samplingState;
+			m_hasResult = other.m_hasResult;
+			m_resultPtr = other.m_resultPtr;
+			m_resultSize = other.m_resultSize;
 
 			// basic data - clear the other object
 			other.m_startTime = 0;
 			other.m_endTime = 0;
 			other.m_iCount = 0;
 			other.m_hasCountExceed = false;
+			other.m_samplingState = SamplingState();
+			other.m_hasResult = false;
+			other.m_resultPtr = 0;
+			other.m_resultSize = 0;
 		}
 		return *this;
 	}
@@ -79,7 +110,7 @@ public:
 			throw Exception("Stopwatch already started");
 		}
 
-		execEnv.NativePrintCStr("Starting stopwatch...");
+		execEnv.RuntimePrintStr("Starting stopwatch...");
 
 		m_startTime = execEnv.GetSystemIO().GetTimestampUs();
 	}
@@ -97,7 +128,7 @@ public:
 			"Stopwatch stopped. "
 			"(Started @ " + std::to_string(m_startTime) + " us,"
 			" ended @ " + std::to_string(m_endTime) + " us)";
-		execEnv.NativePrintStr(msg);
+		execEnv.RuntimePrintStr(msg);
 	}
 
 	void ResetStopwatch()
@@ -135,6 +166,93 @@ public:
 	}
 	const std::vector<uint8_t>& GetEventData() const { return m_eventData; }
 
+	/**
+	 * @brief Set a stream as the source of the event data, so the WASM
+	 *        program can read events that don't fit in its memory.
+	 *        Once it's set, the chunk reading API reads from the stream,
+	 *        instead of the event data buffer.
+	 *
+	 * @param eventStream The event data stream
+	 */
+	void SetEventDataStream(std::unique_ptr<EventDataStream> eventStream)
+	{
+		m_eventStream = std::move(eventStream);
+	}
+	bool HasEventDataStream() const { return m_eventStream != nullptr; }
+
+	uint64_t GetEventStreamSize() const
+	{
+		return m_eventStream != nullptr ?
+			m_eventStream->GetSize() :
+			static_cast<uint64_t>(m_eventData.size());
+	}
+
+	size_t ReadEventChunk(uint64_t offset, uint8_t* dest, size_t len)
+	{
+		if (m_eventStream != nullptr)
+		{
+			return m_eventStream->Read(offset, dest, len);
+		}
+
+		if (offset >= m_eventData.size())
+		{
+			return 0;
+		}
+		size_t cpSize = static_cast<size_t>(std::min<uint64_t>(
+			static_cast<uint64_t>(len),
+			m_eventData.size() - offset
+		));
+		std::memcpy(dest, m_eventData.data() + offset, cpSize);
+		return cpSize;
+	}
+
+	/**
+	 * @brief Set the gate where the execution waits for more budget when it
+	 *        runs out of it; without a gate, the execution is aborted
+	 *
+	 */
+	void SetBudgetGate(std::shared_ptr<BudgetGate> budgetGate)
+	{
+		m_budgetGate = std::move(budgetGate);
+	}
+	BudgetGate* GetBudgetGate() const { return m_budgetGate.get(); }
+
+	/**
+	 * @brief Set the profiler that samples the execution at the counter
+	 *        checks; without a profiler, there is no sampling
+	 *
+	 */
+	void SetProfiler(std::shared_ptr<SamplingProfiler> profiler)
+	{
+		m_profiler = std::move(profiler);
+	}
+	SamplingProfiler* GetProfiler() const { return m_profiler.get(); }
+
+	/**
+	 * @brief Where this execution is in its sampling; the profiler may be
+	 *        shared with other executions, but this isn't
+	 *
+	 */
+	SamplingState& GetSamplingState() { return m_samplingState; }
+	const SamplingState& GetSamplingState() const { return m_samplingState; }
+
+	/**
+	 * @brief Record where the result of the execution is in the linear
+	 *        memory (as a WASM address, which stays valid if the memory
+	 *        grows); it's read from there once the execution is done, without
+	 *        being copied in between. A later call replaces the result.
+	 *
+	 */
+	void SetResult(uint32_t wasmPtr, uint32_t size)
+	{
+		m_hasResult = true;
+		m_resultPtr = wasmPtr;
+		m_resultSize = size;
+	}
+	bool HasResult() const { return m_hasResult; }
+	uint32_t GetResultPtr() const { return m_resultPtr; }
+	uint32_t GetResultSize() const { return m_resultSize; }
+
 private:
 
 	uint64_t m_startTime;
@@ -145,6 +263,14 @@ private:
 
 	std::vector<uint8_t> m_eventId;
 	std::vector<uint8_t> m_eventData;
+	std::unique_ptr<EventDataStream> m_eventStream;
+	std::shared_ptr<BudgetGate> m_budgetGate;
+	std::shared_ptr<SamplingProfiler> m_profiler;
+	SamplingState m_samplingState;
+
+	bool m_hasResult;
+	uint32_t m_resultPtr;
+	uint32_t m_resultSize;
 
 }; // class ExecEnvUserData
 
@@ -0,0 +1,130 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "WasmModuleInstance.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief Reads the per-function cost counters injected by the
+ *        instrumentation (with `InstrumentConfig::m_enableFuncCost`), to tell
+ *        which functions consumed the units of a run.
+ *
+ */
+struct FuncCost
+{
+	static const std::string& sk_globalPrefix()
+	{
+		static const std::string sk_globalPrefix = "enclave_wasm_func_cost_";
+		return sk_globalPrefix;
+	}
+
+	static bool HasFuncCost(const WasmModuleInstance& modInst)
+	{
+		return modInst.HasGlobal(sk_globalPrefix() + "num");
+	}
+
+	/**
+	 * @brief Reset the counters, so that an instance can be reused for
+	 *        another run
+	 *
+	 */
+	static void Reset(WasmModuleInstance& modInst)
+	{
+		uint64_t numFuncs = modInst.GetGlobal<uint64_t>(sk_globalPrefix() + "num");
+		for (uint64_t i = 0; i < numFuncs; ++i)
+		{
+			const std::string name = sk_globalPrefix() + std::to_string(i);
+			if (modInst.HasGlobal(name))
+			{
+				modInst.SetGlobal<uint64_t>(name, 0);
+			}
+		}
+	}
+
+	/**
+	 * @brief Get the `topN` functions by cost, from the most costly one;
+	 *        functions that cost nothing are left out
+	 *
+	 * @param funcNames Names of functions, indexed by function index; functions
+	 *                  without a name are named "$f<index>", as WAMR does
+	 */
+	static std::vector<FuncCost> GetTop(
+		const WasmModuleInstance& modInst,
+		const std::vector<std::string>& funcNames,
+		size_t topN
+	)
+	{
+		std::vector<FuncCost> costs;
+
+		uint64_t numFuncs = modInst.GetGlobal<uint64_t>(sk_globalPrefix() + "num");
+		for (uint64_t i = 0; i < numFuncs; ++i)
+		{
+			const std::string name = sk_globalPrefix() + std::to_string(i);
+			if (!modInst.HasGlobal(name))
+			{
+				continue;
+			}
+			uint64_t cost = modInst.GetGlobal<uint64_t>(name);
+			if (cost == 0)
+			{
+				continue;
+			}
+
+			FuncCost funcCost;
+			funcCost.m_funcIdx = i;
+			funcCost.m_cost = cost;
+			if ((i < funcNames.size()) && !funcNames[i].empty())
+			{
+				funcCost.m_name = funcNames[i];
+			}
+			else
+			{
+				funcCost.m_name = "$f" + std::to_string(i);
+			}
+			costs.push_back(std::move(funcCost));
+		}
+
+		auto byCost = [](const FuncCost& a, const FuncCost& b)
+		{
+			return a.m_cost > b.m_cost;
+		};
+		if (costs.size() > topN)
+		{
+			std::partial_sort(
+				costs.begin(),
+				costs.begin() + topN,
+				costs.end(),
+				byCost
+			);
+			costs.resize(topN);
+		}
+		else
+		{
+			std::sort(costs.begin(), costs.end(), byCost);
+		}
+
+		return costs;
+	}
+
+	std::string m_name;
+	uint64_t m_funcIdx = 0;
+	uint64_t m_cost = 0;
+}; // struct FuncCost
+
+
+} // namespace WasmRuntime
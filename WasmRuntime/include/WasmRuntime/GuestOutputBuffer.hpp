@@ -0,0 +1,367 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief What to do with guest output beyond the byte budget of a request
+ *
+ */
+enum class OutputOverBudgetPolicy
+{
+	/**
+	 * @brief Drop the excess output
+	 *
+	 */
+	Truncate,
+
+	/**
+	 * @brief Keep the output, but add the excess bytes (times
+	 *        `m_chargePerByte`) to the instruction counter of the module, on
+	 *        top of `m_printChargePerByte`; modules without a counter are
+	 *        truncated instead
+	 *
+	 */
+	Charge,
+}; // enum class OutputOverBudgetPolicy
+
+
+struct GuestOutputConfig
+{
+	/**
+	 * @brief Size of the buffer; it is flushed when it is full
+	 *
+	 */
+	size_t m_bufferSize = 4 * 1024;
+
+	/**
+	 * @brief Number of bytes a request can print within its budget;
+	 *        0 means unlimited
+	 *
+	 */
+	uint64_t m_byteBudget = 0;
+
+	OutputOverBudgetPolicy m_overBudgetPolicy = OutputOverBudgetPolicy::Truncate;
+
+	uint64_t m_chargePerByte = 1;
+
+	/**
+	 * @brief Units added to the instruction counter for every byte the guest
+	 *        prints, within the budget or not, since the print native does
+	 *        work per byte that the counter doesn't see; 0 disables it
+	 *
+	 */
+	uint64_t m_printChargePerByte = 1;
+
+	/**
+	 * @brief Flush buffered output that is older than this, checked when
+	 *        output is added; 0 disables it, which is preferred when reading
+	 *        the time is an ocall
+	 *
+	 */
+	uint64_t m_flushIntervalUs = 0;
+}; // struct GuestOutputConfig
+
+
+/**
+ * @brief Collects the output printed by the guest, so that it can be sent out
+ *        in bulk (i.e., with one ocall), instead of one ocall per line.
+ *
+ *        Output is flushed when the buffer is full, when the flush interval
+ *        has passed, or when `Flush` is called (e.g., at the end of the
+ *        request).
+ *
+ */
+class GuestOutputBuffer
+{
+public: // static members:
+
+	/**
+	 * @brief Write out the buffered lines, separated by new lines
+	 *
+	 */
+	using FlushFunc = std::function<void(const std::string&)>;
+
+	/**
+	 * @brief Charge the given number of units to the guest; returns false if
+	 *        the guest can't be charged. The charge may only be enforced once
+	 *        the guest runs again (see `WasmExecEnv::ChargeCounter`)
+	 *
+	 */
+	using ChargeFunc = std::function<bool(uint64_t)>;
+
+	using TimeFunc = std::function<uint64_t()>;
+
+	static const std::string& sk_truncateNote()
+	{
+		static const std::string sk_truncateNote =
+			"[output truncated: byte budget exceeded]";
+		return sk_truncateNote;
+	}
+
+public:
+
+	GuestOutputBuffer() :
+		m_config(),
+		m_flushFunc(),
+		m_chargeFunc(),
+		m_timeFunc(),
+		m_buffer(),
+		m_firstBufferedUs(0),
+		m_isCapturing(false),
+		m_captured(),
+		m_numBytes(0),
+		m_numTruncatedBytes(0),
+		m_numChargedBytes(0),
+		m_numFlushes(0)
+	{}
+
+	GuestOutputBuffer(const GuestOutputBuffer&) = delete;
+
+	GuestOutputBuffer(GuestOutputBuffer&&) = default;
+
+	~GuestOutputBuffer() = default;
+
+	GuestOutputBuffer& operator=(const GuestOutputBuffer&) = delete;
+
+	GuestOutputBuffer& operator=(GuestOutputBuffer&&) = default;
+
+	void Bind(FlushFunc flushFunc, ChargeFunc chargeFunc, TimeFunc timeFunc)
+	{
+		m_flushFunc = std::move(flushFunc);
+		m_chargeFunc = std::move(chargeFunc);
+		m_timeFunc = std::move(timeFunc);
+	}
+
+	void SetConfig(const GuestOutputConfig& config)
+	{
+		Flush();
+		m_config = config;
+		m_buffer.reserve(m_config.m_bufferSize);
+	}
+
+	const GuestOutputConfig& GetConfig() const
+	{
+		return m_config;
+	}
+
+	/**
+	 * @brief Add a line printed by the guest, which is charged per byte,
+	 *        and accounted against the byte budget
+	 *
+	 */
+	void Append(const std::string& line)
+	{
+		// one more byte for the new line
+		uint64_t lineSize = line.size() + 1;
+		ChargePrint(lineSize);
+		uint64_t keepSize = Admit(lineSize);
+		if (keepSize == 0)
+		{
+			return;
+		}
+
+		Buffer(line, lineSize, keepSize);
+	}
+
+	/**
+	 * @brief Add a line printed by the runtime on behalf of the guest
+	 *        (e.g., stopwatch readings), which is kept in order with the
+	 *        guest output, but isn't charged to the guest
+	 *
+	 */
+	void AppendRuntime(const std::string& line)
+	{
+		uint64_t lineSize = line.size() + 1;
+		Buffer(line, lineSize, lineSize);
+	}
+
+	void Flush()
+	{
+		if (m_buffer.empty())
+		{
+			return;
+		}
+		std::string out;
+		out.swap(m_buffer);
+		m_buffer.reserve(m_config.m_bufferSize);
+		++m_numFlushes;
+		if (m_isCapturing)
+		{
+			if (!m_captured.empty())
+			{
+				m_captured.push_back('\n');
+			}
+			m_captured.append(out);
+		}
+		if (m_flushFunc)
+		{
+			m_flushFunc(out);
+		}
+	}
+
+	/**
+	 * @brief Keep a copy of the output flushed from now on (or stop keeping
+	 *        it), e.g., so that it can be replayed later
+	 *
+	 */
+	void SetCapture(bool isCapturing)
+	{
+		m_isCapturing = isCapturing;
+	}
+
+	/**
+	 * @brief Take the output kept so far, lines separated by new lines
+	 *
+	 */
+	std::string TakeCaptured()
+	{
+		std::string captured;
+		captured.swap(m_captured);
+		return captured;
+	}
+
+	/**
+	 * @brief Start the budget of a new request
+	 *
+	 */
+	void ResetBudget()
+	{
+		m_numBytes = 0;
+		m_numTruncatedBytes = 0;
+		m_numChargedBytes = 0;
+	}
+
+	uint64_t GetNumBytes() const { return m_numBytes; }
+	uint64_t GetNumTruncatedBytes() const { return m_numTruncatedBytes; }
+	uint64_t GetNumChargedBytes() const { return m_numChargedBytes; }
+	uint64_t GetNumFlushes() const { return m_numFlushes; }
+
+private:
+
+	/**
+	 * @brief Buffer the first `keepSize` bytes of the line, counting its new
+	 *        line, followed by a note if the line is cut short
+	 *
+	 */
+	void Buffer(const std::string& line, uint64_t lineSize, uint64_t keepSize)
+	{
+		if (
+			!m_buffer.empty() &&
+			(m_buffer.size() + 1 + keepSize > m_config.m_bufferSize)
+		)
+		{
+			Flush();
+		}
+
+		if (m_buffer.empty() && (m_config.m_flushIntervalUs != 0) && m_timeFunc)
+		{
+			m_firstBufferedUs = m_timeFunc();
+		}
+		if (!m_buffer.empty())
+		{
+			m_buffer.push_back('\n');
+		}
+		if (keepSize < lineSize)
+		{
+			m_buffer.append(line, 0, static_cast<size_t>(keepSize - 1));
+			m_buffer.push_back('\n');
+			m_buffer.append(sk_truncateNote());
+		}
+		else
+		{
+			m_buffer.append(line);
+		}
+
+		if (m_buffer.size() >= m_config.m_bufferSize || IsFlushIntervalPassed())
+		{
+			Flush();
+		}
+	}
+
+	void ChargePrint(uint64_t lineSize)
+	{
+		uint64_t perByte = m_config.m_printChargePerByte;
+		if ((perByte == 0) || !m_chargeFunc)
+		{
+			return;
+		}
+		uint64_t units = (lineSize > UINT64_MAX / perByte) ?
+			UINT64_MAX :
+			lineSize * perByte;
+		m_chargeFunc(units);
+	}
+
+	/**
+	 * @brief Account the line against the byte budget
+	 *
+	 * @return The number of bytes of the line to keep
+	 */
+	uint64_t Admit(uint64_t lineSize)
+	{
+		uint64_t budget = m_config.m_byteBudget;
+		uint64_t prevBytes = m_numBytes;
+		m_numBytes += lineSize;
+		if (budget == 0 || m_numBytes <= budget)
+		{
+			return lineSize;
+		}
+
+		uint64_t overSize = m_numBytes - std::max(prevBytes, budget);
+		if (
+			(m_config.m_overBudgetPolicy == OutputOverBudgetPolicy::Charge) &&
+			m_chargeFunc &&
+			m_chargeFunc(overSize * m_config.m_chargePerByte)
+		)
+		{
+			m_numChargedBytes += overSize;
+			return lineSize;
+		}
+
+		m_numTruncatedBytes += overSize;
+		// only the first line crossing the budget is partially kept
+		return prevBytes < budget ? (budget - prevBytes) : 0;
+	}
+
+	bool IsFlushIntervalPassed() const
+	{
+		return (m_config.m_flushIntervalUs != 0) &&
+			m_timeFunc &&
+			(m_timeFunc() - m_firstBufferedUs >= m_config.m_flushIntervalUs);
+	}
+
+	GuestOutputConfig m_config;
+	FlushFunc m_flushFunc;
+	ChargeFunc m_chargeFunc;
+	TimeFunc m_timeFunc;
+
+	std::string m_buffer;
+	uint64_t m_firstBufferedUs;
+
+	bool m_isCapturing;
+	std::string m_captured;
+
+	uint64_t m_numBytes;
+	uint64_t m_numTruncatedBytes;
+	uint64_t m_numChargedBytes;
+	uint64_t m_numFlushes;
+
+}; // class GuestOutputBuffer
+
+
+} // namespace WasmRuntime
+
@@ -0,0 +1,79 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief Usage statistics of the heap given to the WASM runtime, which is
+ *        where modules, instances (including their linear memories) and
+ *        execution stacks are allocated.
+ *
+ */
+struct HeapStats
+{
+	/**
+	 * @brief The total size of the heap
+	 *
+	 */
+	uint64_t m_heapSize = 0;
+
+	/**
+	 * @brief Bytes currently requested by the runtime
+	 *
+	 */
+	uint64_t m_usedSize = 0;
+
+	/**
+	 * @brief The high-water mark of the heap usage; this is the number to
+	 *        look at when sizing the heap
+	 *
+	 */
+	uint64_t m_peakUsedSize = 0;
+
+	/**
+	 * @brief Bytes wasted by rounding requests up to block sizes
+	 *
+	 */
+	uint64_t m_internalFragSize = 0;
+
+	/**
+	 * @brief Bytes in free blocks between blocks in use, which can only be
+	 *        reused by requests that fit in one of them
+	 *
+	 */
+	uint64_t m_externalFragSize = 0;
+
+	/**
+	 * @brief Number of allocations that failed because the heap is exhausted
+	 *
+	 */
+	uint64_t m_numFailedAllocs = 0;
+
+	/**
+	 * @brief The share of the heap taken out of use by fragmentation,
+	 *        relative to what is in use
+	 *
+	 */
+	double GetFragmentation() const
+	{
+		uint64_t fragSize = m_internalFragSize + m_externalFragSize;
+		uint64_t total = m_usedSize + fragSize;
+		return total == 0 ?
+			0.0 :
+			static_cast<double>(fragSize) / static_cast<double>(total);
+	}
+}; // struct HeapStats
+
+
+} // namespace WasmRuntime
+
@@ -0,0 +1,142 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "WasmModuleInstance.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief The counts of the exact instruction-count oracle (injected by
+ *        `WasmCounterUtils InstrumentOracle`), compared with the counter
+ *        injected into the same module, in the same run.
+ *
+ */
+struct InstrOracleReport
+{
+	/**
+	 * @brief Names of the expression types the oracle may count, as named by
+	 *        wabt
+	 *
+	 */
+	static const std::vector<std::string>& sk_opNames()
+	{
+		static const std::vector<std::string> sk_opNames = {
+			"AtomicLoad", "AtomicRmw", "AtomicRmwCmpxchg", "AtomicStore",
+			"AtomicNotify", "AtomicFence", "AtomicWait",
+			"Binary", "Block", "Br", "BrIf", "BrTable",
+			"Call", "CallIndirect", "CallRef", "CodeMetadata",
+			"Compare", "Const", "Convert", "Drop",
+			"GlobalGet", "GlobalSet", "If", "Load",
+			"LocalGet", "LocalSet", "LocalTee", "Loop",
+			"MemoryCopy", "DataDrop", "MemoryFill", "MemoryGrow",
+			"MemoryInit", "MemorySize", "Nop",
+			"RefIsNull", "RefFunc", "RefNull",
+			"Rethrow", "Return", "ReturnCall", "ReturnCallIndirect",
+			"Select", "SimdLaneOp", "SimdLoadLane", "SimdStoreLane",
+			"SimdShuffleOp", "LoadSplat", "LoadZero", "Store",
+			"TableCopy", "ElemDrop", "TableInit", "TableGet",
+			"TableGrow", "TableSize", "TableSet", "TableFill",
+			"Ternary", "Throw", "Try", "Unary", "Unreachable",
+		};
+		return sk_opNames;
+	}
+
+	static const std::string& sk_globalPrefix()
+	{
+		static const std::string sk_globalPrefix = "enclave_wasm_oracle_";
+		return sk_globalPrefix;
+	}
+
+	static InstrOracleReport Collect(
+		const WasmModuleInstance& modInst,
+		uint64_t counter
+	)
+	{
+		InstrOracleReport report;
+		report.m_counter = counter;
+
+		const std::string weightedName = sk_globalPrefix() + "weighted";
+		if (!modInst.HasGlobal(weightedName))
+		{
+			throw Exception("The module is not instrumented with the oracle");
+		}
+		report.m_weighted = modInst.GetGlobal<uint64_t>(weightedName);
+
+		for (const auto& opName : sk_opNames())
+		{
+			const std::string name = sk_globalPrefix() + opName;
+			if (modInst.HasGlobal(name))
+			{
+				uint64_t count = modInst.GetGlobal<uint64_t>(name);
+				report.m_numInstrs += count;
+				report.m_opCounts.emplace_back(opName, count);
+			}
+		}
+
+		return report;
+	}
+
+	/**
+	 * @brief Counter minus the exact weighted count; positive means
+	 *        overcharge, and negative means undercharge
+	 *
+	 */
+	int64_t GetError() const
+	{
+		return static_cast<int64_t>(m_counter - m_weighted);
+	}
+
+	/**
+	 * @brief The error relative to the exact weighted count
+	 *
+	 */
+	double GetRelError() const
+	{
+		return m_weighted == 0 ?
+			0.0 :
+			(static_cast<double>(GetError()) / static_cast<double>(m_weighted));
+	}
+
+	std::string ToJson() const
+	{
+		std::string ops;
+		for (const auto& opCount : m_opCounts)
+		{
+			ops += (ops.empty() ? "" : ", ");
+			ops += "\"" + opCount.first + "\":" + std::to_string(opCount.second);
+		}
+
+		return "{"
+			"\"counter\":"    + std::to_string(m_counter)      + ", "
+			"\"weighted\":"   + std::to_string(m_weighted)     + ", "
+			"\"num_instrs\":" + std::to_string(m_numInstrs)    + ", "
+			"\"error\":"      + std::to_string(GetError())     + ", "
+			"\"ops\":{"       + ops                            + "}"
+		"}";
+	}
+
+	// value of the injected (block-level) counter
+	uint64_t m_counter = 0;
+	// exact sum of weights of the executed instructions
+	uint64_t m_weighted = 0;
+	// exact number of executed instructions
+	uint64_t m_numInstrs = 0;
+	std::vector<std::pair<std::string, uint64_t> > m_opCounts;
+}; // struct InstrOracleReport
+
+
+} // namespace WasmRuntime
@@ -8,11 +8,14 @@
 
 #include <cstdint>
 
+#include <memory>
 #include <tuple>
 #include <vector>
 
+#include "BudgetGate.hpp"
 #include "ExecEnvUserData.hpp"
 #include "Logging.hpp"
+#include "SamplingProfiler.hpp"
 #include "SharedWasmExecEnv.hpp"
 #include "SharedWasmModule.hpp"
 #include "SharedWasmModuleInstance.hpp"
@@ -80,18 +83,113 @@ public:
 
 		m_threshold = threshold;
 
-		auto mainRetVals = m_execEnv->ExecFunc<MainRetType>(
-			"enclave_wasm_injected_main",
-			static_cast<uint32_t>(m_execEnv->GetUserData().GetEventId().size()),
-			static_cast<uint32_t>(m_execEnv->GetUserData().GetEventData().size()),
-			static_cast<uint64_t>(threshold)
-		);
-
+		m_execEnv->GetUserData().SetBudgetGate(m_budgetGate);
+		m_execEnv->GetUserData().SetProfiler(m_profiler);
+		if (m_budgetGate != nullptr)
+		{
+			m_budgetGate->Start();
+		}
+		// with the profiler, the module stops at every sample point instead
+		uint64_t modThreshold = (m_profiler != nullptr) ?
+			m_profiler->Start(
+				m_execEnv->GetUserData().GetSamplingState(),
+				threshold
+			) :
+			threshold;
+
+		std::tuple<int32_t> mainRetVals;
+		try
+		{
+			mainRetVals = m_execEnv->ExecFunc<MainRetType>(
+				"enclave_wasm_injected_main",
+				static_cast<uint32_t>(m_execEnv->GetUserData().GetEventId().size()),
+				static_cast<uint32_t>(m_execEnv->GetUserData().GetEventData().size()),
+				static_cast<uint64_t>(modThreshold)
+			);
+		}
+		catch (...)
+		{
+			if (m_budgetGate != nullptr)
+			{
+				m_budgetGate->Finish();
+			}
+			throw;
+		}
+		if (m_budgetGate != nullptr)
+		{
+			m_budgetGate->Finish();
+		}
+
+		// the threshold grows every time the run is resumed
+		m_threshold = (m_profiler != nullptr) ?
+			m_execEnv->GetUserData().GetSamplingState().m_limit :
+			m_modInst->GetGlobal<uint64_t>(sk_globalThresholdName());
 		m_counter = m_modInst->GetGlobal<uint64_t>(sk_globalCounterName());
 
 		return std::get<0>(mainRetVals);
 	}
 
+	/**
+	 * @brief Make instrumented runs pause when they run out of budget,
+	 *        instead of aborting; a paused run continues after `Resume` is
+	 *        called from another thread, or when the given policy (if any)
+	 *        gives it more budget.
+	 *
+	 */
+	void EnableSuspend(BudgetGate::Policy policy = BudgetGate::Policy())
+	{
+		m_budgetGate = std::make_shared<BudgetGate>();
+		m_budgetGate->SetPolicy(std::move(policy));
+	}
+
+	/**
+	 * @brief Continue the paused run from where it ran out of budget, with
+	 *        the counter intact and the threshold raised by `additionalBudget`
+	 *
+	 */
+	void Resume(uint64_t additionalBudget)
+	{
+		GetBudgetGate().Resume(additionalBudget);
+	}
+
+	/**
+	 * @brief Wait until the run is paused (to decide whether to `Resume`
+	 *        it), or until it's done
+	 *
+	 */
+	BudgetGate::State WaitForSuspendOrDone()
+	{
+		return GetBudgetGate().WaitForSuspendOrDone();
+	}
+
+	/**
+	 * @brief Sample the call stack of instrumented runs every `samplePeriod`
+	 *        units; the samples of all runs are collected by the profiler
+	 *
+	 */
+	void EnableProfiling(uint64_t samplePeriod)
+	{
+		m_profiler = std::make_shared<SamplingProfiler>(samplePeriod);
+	}
+
+	SamplingProfiler& GetProfiler()
+	{
+		if (m_profiler == nullptr)
+		{
+			throw Exception("Profiling is not enabled");
+		}
+		return *m_profiler;
+	}
+
+	BudgetGate& GetBudgetGate()
+	{
+		if (m_budgetGate == nullptr)
+		{
+			throw Exception("Suspending on budget exhaustion is not enabled");
+		}
+		return *m_budgetGate;
+	}
+
 	uint64_t GetThreshold() const noexcept
 	{
 		return m_threshold;
@@ -108,6 +206,11 @@ public:
 		m_modInst->SetGlobal<uint64_t>(sk_globalThresholdName(), 0);
 	}
 
+	const WasmModuleInstance& GetModuleInstance() const
+	{
+		return *(m_modInst.get());
+	}
+
 	ExecEnvUserData& GetUserData()
 	{
 		return m_execEnv->GetUserData();
@@ -125,6 +228,8 @@ private:
 	SharedWasmModule m_module;
 	SharedWasmModuleInstance m_modInst;
 	SharedWasmExecEnv m_execEnv;
+	std::shared_ptr<BudgetGate> m_budgetGate;
+	std::shared_ptr<SamplingProfiler> m_profiler;
 
 	uint64_t m_threshold = 0;
 	uint64_t m_counter = 0;
@@ -0,0 +1,350 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <wasm_export.h>
+
+#include "Exception.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief Where one execution is in its sampling; it's kept with the
+ *        execution (see `ExecEnvUserData`), so executions sharing a profiler
+ *        don't overwrite each other's limit
+ *
+ */
+struct SamplingState
+{
+	/**
+	 * @brief The real threshold of the execution
+	 *
+	 */
+	uint64_t m_limit = 0;
+
+	uint64_t m_lastSampleCounter = 0;
+}; // struct SamplingState
+
+
+/**
+ * @brief Samples the WASM call stack every `samplePeriod` units of the
+ *        injected counter, to show what a request spends its units on.
+ *
+ *        It reuses the counter check that is already injected: the threshold
+ *        given to the module is lowered to the next sample point, and
+ *        `enclave_wasm_counter_exceed` takes a sample and moves the threshold
+ *        to the next point, until the real threshold (the limit) is reached.
+ *        So the overhead is one call of the native per sample, plus the stack
+ *        walk, and it's controlled by the sample period.
+ *
+ *        Samples are aggregated into collapsed stacks (the input format of
+ *        flame graph tools), each weighted by the units counted since the
+ *        previous sample. One profiler can be shared by executions running
+ *        at once, and accumulates samples over all of them; each execution
+ *        has its own `SamplingState`, and only the collected stacks are
+ *        shared, behind a lock.
+ *
+ */
+class SamplingProfiler
+{
+public: // static members:
+
+	/**
+	 * @brief Parse the call stack dumped by WAMR, one frame per line, from
+	 *        the innermost frame, e.g., "#00: 0x0a5e - $f12"
+	 *
+	 * @return Function names of the frames, from the outermost frame
+	 */
+	static std::vector<std::string> ParseCallStack(const std::string& dump)
+	{
+		static const std::string sk_nameSep = " - ";
+
+		std::vector<std::string> frames;
+
+		size_t lineBegin = 0;
+		while (lineBegin < dump.size())
+		{
+			size_t lineEnd = dump.find('\n', lineBegin);
+			if (lineEnd == std::string::npos)
+			{
+				lineEnd = dump.size();
+			}
+
+			if (dump[lineBegin] == '#')
+			{
+				size_t nameBegin = dump.find(sk_nameSep, lineBegin);
+				if (nameBegin == std::string::npos || nameBegin > lineEnd)
+				{
+					nameBegin = dump.find(' ', lineBegin);
+				}
+				else
+				{
+					nameBegin += sk_nameSep.size() - 1;
+				}
+
+				if (nameBegin != std::string::npos && nameBegin < lineEnd)
+				{
+					std::string name =
+						dump.substr(nameBegin + 1, lineEnd - nameBegin - 1);
+					while (!name.empty() && (name.back() == ' ' || name.back() == '\r'))
+					{
+						name.pop_back();
+					}
+					frames.push_back(std::move(name));
+				}
+			}
+
+			lineBegin = lineEnd + 1;
+		}
+
+		std::reverse(frames.begin(), frames.end());
+		return frames;
+	}
+
+public:
+
+	SamplingProfiler(uint64_t samplePeriod) :
+		m_samplePeriod(samplePeriod),
+		m_mutex(),
+		m_funcNames(),
+		m_stacks(),
+		m_numSamples(0)
+	{
+		if (m_samplePeriod == 0)
+		{
+			throw Exception("The sample period must be greater than 0");
+		}
+	}
+
+	SamplingProfiler(const SamplingProfiler&) = delete;
+
+	SamplingProfiler(SamplingProfiler&&) = delete;
+
+	~SamplingProfiler() = default;
+
+	SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+
+	SamplingProfiler& operator=(SamplingProfiler&&) = delete;
+
+	/**
+	 * @brief Set the names of functions (e.g., as in the `Graph`s generated
+	 *        by the instrumentation), indexed by function index, which
+	 *        replace the names WAMR gives to functions it has no name for
+	 *        (i.e., "$f<index>")
+	 *
+	 */
+	void SetFuncNames(std::vector<std::string> funcNames)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_funcNames = std::move(funcNames);
+	}
+
+	/**
+	 * @brief Called by the runner before the execution starts
+	 *
+	 * @param state     The sampling state of the execution
+	 * @param threshold The real threshold of the execution
+	 * @return The threshold to give to the module, i.e., the first sample
+	 *         point
+	 */
+	uint64_t Start(SamplingState& state, uint64_t threshold) const
+	{
+		state.m_limit = threshold;
+		state.m_lastSampleCounter = 0;
+		return NextThreshold(state, 0);
+	}
+
+	/**
+	 * @brief Whether the counter passing the module's threshold is a sample
+	 *        point, rather than the real threshold being reached
+	 *
+	 */
+	static bool IsSamplePoint(const SamplingState& state, uint64_t counter)
+	{
+		return counter <= state.m_limit;
+	}
+
+	/**
+	 * @brief The threshold to give to the module after a sample is taken
+	 *
+	 */
+	uint64_t NextThreshold(const SamplingState& state, uint64_t counter) const
+	{
+		uint64_t next = counter + m_samplePeriod;
+		if (next < counter)
+		{
+			next = std::numeric_limits<uint64_t>::max();
+		}
+		return std::min(next, state.m_limit);
+	}
+
+	/**
+	 * @brief Raise the real threshold, e.g., when a suspended execution is
+	 *        given more budget
+	 *
+	 */
+	static void RaiseLimit(SamplingState& state, uint64_t additionalBudget)
+	{
+		uint64_t newLimit = state.m_limit + additionalBudget;
+		state.m_limit = newLimit < state.m_limit ?
+			std::numeric_limits<uint64_t>::max() :
+			newLimit;
+	}
+
+	/**
+	 * @brief Take a sample of the call stack of the given execution; called
+	 *        on the execution thread
+	 *
+	 */
+	void Sample(SamplingState& state, wasm_exec_env_t execEnv, uint64_t counter)
+	{
+		uint32_t bufSize = wasm_runtime_get_call_stack_buf_size(execEnv);
+		std::string dump(bufSize, '\0');
+		if (bufSize != 0)
+		{
+			uint32_t len = wasm_runtime_dump_call_stack_to_buf(
+				execEnv,
+				&dump[0],
+				bufSize
+			);
+			dump.resize(std::min(len, bufSize));
+			size_t nullPos = dump.find('\0');
+			if (nullPos != std::string::npos)
+			{
+				dump.resize(nullPos);
+			}
+		}
+
+		std::vector<std::string> frames = ParseCallStack(dump);
+		// the native taking the sample is not a part of the profile
+		if (!frames.empty() && frames.back() == "enclave_wasm_counter_exceed")
+		{
+			frames.pop_back();
+		}
+
+		uint64_t units = counter - std::min(counter, state.m_lastSampleCounter);
+		state.m_lastSampleCounter = counter;
+
+		AddSample(frames, units);
+	}
+
+	/**
+	 * @brief Add a sample of the given frames (from the outermost frame),
+	 *        weighted by the given units
+	 *
+	 */
+	void AddSample(const std::vector<std::string>& frames, uint64_t units)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		std::string stack;
+		for (const auto& frame : frames)
+		{
+			stack += (stack.empty() ? "" : ";");
+			stack += ResolveName(frame);
+		}
+		if (stack.empty())
+		{
+			stack = "[unknown]";
+		}
+
+		m_stacks[stack] += units;
+		++m_numSamples;
+	}
+
+	/**
+	 * @brief The collapsed stacks, one "<frame>;<frame>;... <units>" per line
+	 *
+	 */
+	std::string ToCollapsed() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		std::string out;
+		for (const auto& stack : m_stacks)
+		{
+			out += stack.first + " " + std::to_string(stack.second) + "\n";
+		}
+		return out;
+	}
+
+	uint64_t GetNumSamples() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_numSamples;
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stacks.clear();
+		m_numSamples = 0;
+	}
+
+private:
+
+	/**
+	 * @brief Resolve "$f<index>" with the function names given, and drop the
+	 *        leading "$" of names, so that names are the same either way;
+	 *        spaces and semicolons are reserved by the collapsed format
+	 *
+	 */
+	std::string ResolveName(const std::string& frame) const
+	{
+		std::string name = frame;
+
+		if (
+			(name.size() > 2) &&
+			(name[0] == '$') &&
+			(name[1] == 'f') &&
+			std::all_of(
+				name.begin() + 2,
+				name.end(),
+				[](char c) { return c >= '0' && c <= '9'; }
+			)
+		)
+		{
+			size_t idx = static_cast<size_t>(std::stoull(name.substr(2)));
+			if (idx < m_funcNames.size() && !m_funcNames[idx].empty())
+			{
+				name = m_funcNames[idx];
+			}
+		}
+
+		if (!name.empty() && name[0] == '$')
+		{
+			name.erase(0, 1);
+		}
+		std::replace(name.begin(), name.end(), ' ', '_');
+		std::replace(name.begin(), name.end(), ';', '_');
+
+		return name;
+	}
+
+	uint64_t m_samplePeriod;
+
+	mutable std::mutex m_mutex;
+	std::vector<std::string> m_funcNames;
+	std::map<std::string, uint64_t> m_stacks;
+	uint64_t m_numSamples;
+
+}; // class SamplingProfiler
+
+
+} // namespace WasmRuntime
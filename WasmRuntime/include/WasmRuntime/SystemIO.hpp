@@ -6,6 +6,8 @@
 #pragma once
 
 
+#include <cstdint>
+
 #include <string>
 
 #include "Internal/make_unique.hpp"
@@ -24,6 +26,21 @@ public:
 
 	virtual uint64_t GetTimestampUs() const = 0;
 
+	/**
+	 * @brief Wait for about the given time; it spins on the clock, unless
+	 *        it's overridden by a clock that can sleep (e.g., through an
+	 *        ocall)
+	 *
+	 */
+	virtual void SleepUs(uint64_t us) const
+	{
+		uint64_t end = GetTimestampUs() + us;
+		while (GetTimestampUs() < end)
+		{
+			__builtin_ia32_pause();
+		}
+	}
+
 }; // class SystemIO
 
 
@@ -47,6 +64,9 @@ public:
 		return 0;
 	}
 
+	virtual void SleepUs(uint64_t) const override
+	{}
+
 }; // class SystemIONull
 
 
@@ -0,0 +1,548 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <cstdint>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "Internal/make_unique.hpp"
+#include "Exception.hpp"
+#include "SystemIO.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+struct TscClockConfig
+{
+	/**
+	 * @brief How long the initial calibration takes; longer gives a more
+	 *        accurate TSC frequency
+	 *
+	 */
+	uint64_t m_calibrationUs = 20000;
+
+	/**
+	 * @brief How often the clock is checked against the reference clock
+	 *
+	 */
+	uint64_t m_recalibrationIntervalUs = 1000000;
+
+	/**
+	 * @brief Difference to the reference clock that counts as drift
+	 *
+	 */
+	uint64_t m_driftToleranceUs = 100;
+
+	/**
+	 * @brief Reference samples taking longer than this (e.g., the ocall was
+	 *        preempted) are too noisy and are retried later
+	 *
+	 */
+	uint64_t m_maxSampleUs = 50;
+
+	/**
+	 * @brief Change of the TSC frequency, in parts per million, that is
+	 *        considered inconsistent rather than drift
+	 *
+	 */
+	uint64_t m_maxRateChangePpm = 10000;
+
+	/**
+	 * @brief Whether to use the reference clock for every timestamp once the
+	 *        TSC is found inconsistent
+	 *
+	 */
+	bool m_fallbackOnInconsistency = true;
+
+	/**
+	 * @brief Checked once, at calibration, before the TSC is read for the
+	 *        first time; if it's given and returns false, the reference
+	 *        clock is used for every timestamp, and the TSC is never read.
+	 *        Enclaves should give it, since RDTSC faults on SGX1
+	 *        (see `SystemIOTsc::IsSupported`)
+	 *
+	 */
+	std::function<bool()> m_isTscUsable;
+}; // struct TscClockConfig
+
+
+/**
+ * @brief A `SystemIO` whose timestamps are derived from the TSC, so that
+ *        taking a timestamp doesn't leave the enclave.
+ *
+ *        The TSC frequency is calibrated against a reference (untrusted)
+ *        clock by calling `Calibrate`, or else on first use, since the
+ *        reference clock may not be usable yet when this is constructed
+ *        (e.g., during the initialization of an enclave, where ocalls aren't
+ *        allowed). The calibration busy-waits for `m_calibrationUs`, so it
+ *        should be done at initialization, rather than in the first
+ *        request that takes a timestamp. Then, the clock is checked against
+ *        the reference clock every `m_recalibrationIntervalUs`. When the two
+ *        differ by more than `m_driftToleranceUs`, the drift is counted and
+ *        the TSC clock is re-anchored to the reference clock. When the TSC or
+ *        the reference clock goes backwards, or the TSC frequency changes by
+ *        more than `m_maxRateChangePpm`, the TSC is considered inconsistent,
+ *        and the reference clock is used from then on (if configured).
+ *
+ *        Timestamps returned by this clock never go backwards.
+ *
+ *        NOTE: RDTSC is only allowed in SGX2 enclaves; on SGX1 it faults.
+ *        Thus, this clock is opt-in, and `m_isTscUsable` should be given
+ *        when it's used in an enclave.
+ *
+ */
+class SystemIOTsc :
+	public SystemIO
+{
+public: // static members:
+
+	static std::unique_ptr<SystemIOTsc> MakeUnique(
+		std::unique_ptr<SystemIO> refSysIO,
+		const TscClockConfig& config = TscClockConfig()
+	)
+	{
+		return Internal::make_unique<SystemIOTsc>(
+			std::move(refSysIO),
+			config
+		);
+	}
+
+	static uint64_t ReadTsc()
+	{
+		return __builtin_ia32_rdtsc();
+	}
+
+	/**
+	 * @brief Read the CPUID leaf with the given subleaf, as EAX, EBX, ECX
+	 *        and EDX; CPUID faults in enclaves, so it has to be read outside
+	 *        (e.g., with `sgx_cpuidex`)
+	 *
+	 */
+	using CpuIdFunc =
+		std::function<std::array<uint32_t, 4>(uint32_t, uint32_t)>;
+
+	/**
+	 * @brief Check, with the given CPUID, that RDTSC is allowed in enclaves
+	 *        (SGX2) and that the TSC runs at a constant rate (invariant TSC)
+	 *
+	 */
+	static bool IsSupported(const CpuIdFunc& cpuId)
+	{
+		static constexpr uint32_t sk_sgxLeaf = 0x12;
+		static constexpr uint32_t sk_sgx2Bit = 1U << 1;
+		static constexpr uint32_t sk_extLeafBase = 0x80000000;
+		static constexpr uint32_t sk_powerLeaf = 0x80000007;
+		static constexpr uint32_t sk_invariantTscBit = 1U << 8;
+
+		if (cpuId(0, 0)[0] < sk_sgxLeaf)
+		{
+			return false;
+		}
+		if ((cpuId(sk_sgxLeaf, 0)[0] & sk_sgx2Bit) == 0)
+		{
+			return false;
+		}
+		if (cpuId(sk_extLeafBase, 0)[0] < sk_powerLeaf)
+		{
+			return false;
+		}
+		return (cpuId(sk_powerLeaf, 0)[3] & sk_invariantTscBit) != 0;
+	}
+
+public:
+
+	SystemIOTsc(
+		std::unique_ptr<SystemIO> refSysIO,
+		const TscClockConfig& config = TscClockConfig()
+	) :
+		SystemIO(),
+		m_refSysIO(std::move(refSysIO)),
+		m_config(config),
+		m_recalibMutex(),
+		m_seq(0),
+		m_baseTsc(0),
+		m_baseUs(0),
+		m_usPerTick(0.0),
+		m_nextRecalibTsc(0),
+		m_lastUs(0),
+		m_anchorTsc(0),
+		m_anchorUs(0),
+		m_initUsPerTick(0.0),
+		m_isCalibrated(false),
+		m_useRef(false),
+		m_numRecalibs(0),
+		m_numDrifts(0),
+		m_numInconsistencies(0),
+		m_maxDriftUs(0)
+	{
+		if (m_refSysIO == nullptr)
+		{
+			throw Exception("The reference clock is not given");
+		}
+	}
+
+	virtual ~SystemIOTsc() = default;
+
+	virtual uint64_t GetTimestampUs() const override
+	{
+		if (!m_isCalibrated.load(std::memory_order_acquire))
+		{
+			Calibrate();
+		}
+		if (m_useRef.load(std::memory_order_relaxed))
+		{
+			return Monotonic(m_refSysIO->GetTimestampUs());
+		}
+
+		uint64_t tsc = ReadTsc();
+		if (tsc >= m_nextRecalibTsc.load(std::memory_order_relaxed))
+		{
+			Recalibrate();
+			if (m_useRef.load(std::memory_order_relaxed))
+			{
+				return Monotonic(m_refSysIO->GetTimestampUs());
+			}
+		}
+
+		return Monotonic(TscToUs(tsc));
+	}
+
+	/**
+	 * @brief Sleep with the reference clock, since the TSC can only spin
+	 *
+	 */
+	virtual void SleepUs(uint64_t us) const override
+	{
+		m_refSysIO->SleepUs(us);
+	}
+
+	/**
+	 * @brief Calibrate the TSC frequency, if it's not calibrated yet; this
+	 *        busy-waits for `m_calibrationUs`, taking reference timestamps
+	 *        all along, since the reference clock is the only time source
+	 *        that can be trusted to advance
+	 *
+	 */
+	void Calibrate() const
+	{
+		std::lock_guard<std::mutex> lock(m_recalibMutex);
+		if (m_isCalibrated.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+		if (m_config.m_isTscUsable && !m_config.m_isTscUsable())
+		{
+			m_useRef.store(true, std::memory_order_relaxed);
+			m_isCalibrated.store(true, std::memory_order_release);
+			return;
+		}
+
+		RefSample start = SampleRef();
+		RefSample end = start;
+		while (end.m_us - start.m_us < m_config.m_calibrationUs)
+		{
+			end = SampleRef();
+			if (end.m_us < start.m_us)
+			{
+				throw Exception("The reference clock went backwards");
+			}
+		}
+		if (end.m_tsc <= start.m_tsc)
+		{
+			throw Exception("The TSC is not increasing");
+		}
+
+		double usPerTick =
+			static_cast<double>(end.m_us - start.m_us) /
+			static_cast<double>(end.m_tsc - start.m_tsc);
+
+		m_anchorTsc = start.m_tsc;
+		m_anchorUs = start.m_us;
+		m_initUsPerTick = usPerTick;
+		Publish(end.m_tsc, end.m_us, usPerTick);
+		ScheduleRecalib(end.m_tsc, m_config.m_recalibrationIntervalUs);
+		m_lastUs.store(end.m_us, std::memory_order_relaxed);
+
+		m_isCalibrated.store(true, std::memory_order_release);
+	}
+
+	const SystemIO& GetRefSystemIO() const
+	{
+		return *m_refSysIO;
+	}
+
+	/**
+	 * @brief Calibrated TSC frequency, in ticks per microsecond
+	 *
+	 */
+	double GetTicksPerUs() const
+	{
+		double usPerTick = m_usPerTick.load(std::memory_order_relaxed);
+		return usPerTick == 0.0 ? 0.0 : (1.0 / usPerTick);
+	}
+
+	bool IsUsingRefClock() const
+	{
+		return m_useRef.load(std::memory_order_relaxed);
+	}
+
+	uint64_t GetNumRecalibrations() const
+	{
+		return m_numRecalibs.load(std::memory_order_relaxed);
+	}
+
+	uint64_t GetNumDrifts() const
+	{
+		return m_numDrifts.load(std::memory_order_relaxed);
+	}
+
+	uint64_t GetNumInconsistencies() const
+	{
+		return m_numInconsistencies.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief The largest difference to the reference clock seen so far
+	 *
+	 */
+	uint64_t GetMaxDriftUs() const
+	{
+		return m_maxDriftUs.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	struct RefSample
+	{
+		uint64_t m_tsc;
+		uint64_t m_us;
+		uint64_t m_costTicks;
+	}; // struct RefSample
+
+	/**
+	 * @brief Take a reference timestamp, bracketed by two TSC reads, so the
+	 *        cost of the ocall is known and split evenly
+	 *
+	 */
+	RefSample SampleRef() const
+	{
+		uint64_t tscBefore = ReadTsc();
+		uint64_t us = m_refSysIO->GetTimestampUs();
+		uint64_t tscAfter = ReadTsc();
+
+		RefSample sample;
+		sample.m_tsc = tscBefore + ((tscAfter - tscBefore) / 2);
+		sample.m_us = us;
+		sample.m_costTicks = tscAfter - tscBefore;
+		return sample;
+	}
+
+	/**
+	 * @brief Check the clock against the reference clock; only one thread
+	 *        does it at a time, the others keep using the current calibration
+	 *
+	 */
+	void Recalibrate() const
+	{
+		std::unique_lock<std::mutex> lock(m_recalibMutex, std::try_to_lock);
+		if (!lock.owns_lock())
+		{
+			return;
+		}
+		// another thread may have just done it
+		if (ReadTsc() < m_nextRecalibTsc.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		RefSample sample = SampleRef();
+		double usPerTick = m_usPerTick.load(std::memory_order_relaxed);
+		if (
+			static_cast<double>(sample.m_costTicks) * usPerTick >
+			static_cast<double>(m_config.m_maxSampleUs)
+		)
+		{
+			// too noisy; try again soon
+			ScheduleRecalib(
+				sample.m_tsc,
+				m_config.m_recalibrationIntervalUs / 16
+			);
+			return;
+		}
+		m_numRecalibs.fetch_add(1, std::memory_order_relaxed);
+
+		if ((sample.m_tsc <= m_anchorTsc) || (sample.m_us <= m_anchorUs))
+		{
+			MarkInconsistent(sample);
+			return;
+		}
+
+		// Over the whole run since the anchor, the frequency estimate gets
+		// more accurate over time
+		double newUsPerTick =
+			static_cast<double>(sample.m_us - m_anchorUs) /
+			static_cast<double>(sample.m_tsc - m_anchorTsc);
+		double rateChange = (newUsPerTick > m_initUsPerTick) ?
+			(newUsPerTick - m_initUsPerTick) / m_initUsPerTick :
+			(m_initUsPerTick - newUsPerTick) / m_initUsPerTick;
+		if (rateChange * 1000000.0 > static_cast<double>(m_config.m_maxRateChangePpm))
+		{
+			MarkInconsistent(sample);
+			return;
+		}
+
+		uint64_t predictedUs = TscToUs(sample.m_tsc);
+		uint64_t driftUs = (predictedUs > sample.m_us) ?
+			(predictedUs - sample.m_us) :
+			(sample.m_us - predictedUs);
+		uint64_t maxDriftUs = m_maxDriftUs.load(std::memory_order_relaxed);
+		if (driftUs > maxDriftUs)
+		{
+			m_maxDriftUs.store(driftUs, std::memory_order_relaxed);
+		}
+
+		// within the tolerance the base is kept, so timestamps stay smooth
+		if (driftUs > m_config.m_driftToleranceUs)
+		{
+			m_numDrifts.fetch_add(1, std::memory_order_relaxed);
+			Publish(sample.m_tsc, sample.m_us, newUsPerTick);
+		}
+		ScheduleRecalib(sample.m_tsc, m_config.m_recalibrationIntervalUs);
+	}
+
+	void MarkInconsistent(const RefSample& sample) const
+	{
+		m_numInconsistencies.fetch_add(1, std::memory_order_relaxed);
+		if (m_config.m_fallbackOnInconsistency)
+		{
+			m_useRef.store(true, std::memory_order_relaxed);
+			return;
+		}
+
+		// start over from this sample
+		m_anchorTsc = sample.m_tsc;
+		m_anchorUs = sample.m_us;
+		Publish(
+			sample.m_tsc,
+			sample.m_us,
+			m_usPerTick.load(std::memory_order_relaxed)
+		);
+		ScheduleRecalib(sample.m_tsc, m_config.m_recalibrationIntervalUs);
+	}
+
+	/**
+	 * @brief Update the calibration; readers are kept consistent with a
+	 *        sequence lock, so they never block
+	 *
+	 */
+	void Publish(uint64_t baseTsc, uint64_t baseUs, double usPerTick) const
+	{
+		uint64_t seq = m_seq.load(std::memory_order_relaxed);
+		m_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		m_baseTsc.store(baseTsc, std::memory_order_relaxed);
+		m_baseUs.store(baseUs, std::memory_order_relaxed);
+		m_usPerTick.store(usPerTick, std::memory_order_relaxed);
+
+		m_seq.store(seq + 2, std::memory_order_release);
+	}
+
+	void ScheduleRecalib(uint64_t tsc, uint64_t intervalUs) const
+	{
+		m_nextRecalibTsc.store(
+			tsc + UsToTicks(intervalUs),
+			std::memory_order_relaxed
+		);
+	}
+
+	uint64_t TscToUs(uint64_t tsc) const
+	{
+		uint64_t seq = 0;
+		uint64_t baseTsc = 0;
+		uint64_t baseUs = 0;
+		double usPerTick = 0.0;
+		do
+		{
+			seq = m_seq.load(std::memory_order_acquire);
+			baseTsc = m_baseTsc.load(std::memory_order_relaxed);
+			baseUs = m_baseUs.load(std::memory_order_relaxed);
+			usPerTick = m_usPerTick.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((seq & 1) || (seq != m_seq.load(std::memory_order_relaxed)));
+
+		if (tsc <= baseTsc)
+		{
+			// read on another core just before the base was moved
+			return baseUs;
+		}
+		return baseUs + static_cast<uint64_t>(
+			static_cast<double>(tsc - baseTsc) * usPerTick
+		);
+	}
+
+	uint64_t UsToTicks(uint64_t us) const
+	{
+		return static_cast<uint64_t>(
+			static_cast<double>(us) /
+			m_usPerTick.load(std::memory_order_relaxed)
+		);
+	}
+
+	uint64_t Monotonic(uint64_t us) const
+	{
+		uint64_t last = m_lastUs.load(std::memory_order_relaxed);
+		while (us > last)
+		{
+			if (m_lastUs.compare_exchange_weak(
+				last, us, std::memory_order_relaxed
+			))
+			{
+				return us;
+			}
+		}
+		return last;
+	}
+
+	std::unique_ptr<SystemIO> m_refSysIO;
+	TscClockConfig m_config;
+
+	mutable std::mutex m_recalibMutex;
+
+	// Calibration, published under the sequence lock
+	mutable std::atomic<uint64_t> m_seq;
+	mutable std::atomic<uint64_t> m_baseTsc;
+	mutable std::atomic<uint64_t> m_baseUs;
+	mutable std::atomic<double> m_usPerTick;
+
+	mutable std::atomic<uint64_t> m_nextRecalibTsc;
+	mutable std::atomic<uint64_t> m_lastUs;
+
+	// Only accessed while holding m_recalibMutex
+	mutable uint64_t m_anchorTsc;
+	mutable uint64_t m_anchorUs;
+	mutable double m_initUsPerTick;
+
+	mutable std::atomic<bool> m_isCalibrated;
+	mutable std::atomic<bool> m_useRef;
+	mutable std::atomic<uint64_t> m_numRecalibs;
+	mutable std::atomic<uint64_t> m_numDrifts;
+	mutable std::atomic<uint64_t> m_numInconsistencies;
+	mutable std::atomic<uint64_t> m_maxDriftUs;
+
+}; // class SystemIOTsc
+
+
+} // namespace WasmRuntime
+
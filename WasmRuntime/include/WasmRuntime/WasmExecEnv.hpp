@@ -15,6 +15,7 @@
 
 #include "Exception.hpp"
 #include "FuncUtils.hpp"
+#include "GuestOutputBuffer.hpp"
 #include "Logging.hpp"
 #include "SystemIO.hpp"
 #include "WasmModuleInstance.hpp"
@@ -95,9 +96,11 @@ public:
 		Base(ptr), // base constructor is noexcept,
 		m_logger(LoggerFactory::GetLogger("WasmRuntime::WasmExecEnv")),
 		m_moduleInst(moduleInst), // shared_ptr copy is noexcept
-		m_userData()
+		m_userData(),
+		m_output()
 	{
 		wasm_runtime_set_user_data(get(), this);
+		BindOutput();
 	}
 
 	/**
@@ -115,14 +118,22 @@ public:
 		Base(std::move(other)), // base move is noexcept
 		m_logger(std::move(other.m_logger)),
 		m_moduleInst(std::move(other.m_moduleInst)), // shared_ptr move is noexcept
-		m_userData(std::move(other.m_userData))
+		m_userData(std::move(other.m_userData)),
+		m_output(std::move(other.m_output))
 	{
 		wasm_runtime_set_user_data(get(), this);
+		BindOutput();
 	}
 
 	virtual ~WasmExecEnv()
 	{
 		// wasm_runtime_destroy_exec_env(get());
+		try
+		{
+			m_output.Flush();
+		}
+		catch (...)
+		{}
 	}
 
 	/**
@@ -146,8 +157,11 @@ public:
 			m_logger = std::move(other.m_logger);
 			m_moduleInst = std::move(other.m_moduleInst); // shared_ptr move is noexcept
 			m_userData = std::move(other.m_userData);
+			m_output.Flush();
+			m_output = std::move(other.m_output);
 
 			wasm_runtime_set_user_data(get(), this);
+			BindOutput();
 		}
 		return *this;
 	}
@@ -183,6 +197,9 @@ public:
 			static_cast<uint32_t>(wasmArg.size()), wasmArg.data()
 		);
 
+		// the request is over, so its output is sent out in one go
+		m_output.Flush();
+
 		if (!execRes)
 		{
 			throw WasmRuntimeException(wasm_runtime_get_exception(moduleInst));
@@ -193,8 +210,15 @@ public:
 		return retVals;
 	}
 
+	/**
+	 * @brief Set the user data for a new request; this also starts a new
+	 *        output budget
+	 *
+	 */
 	void SetUserData(std::unique_ptr<ExecEnvUserData> userData)
 	{
+		m_output.Flush();
+		m_output.ResetBudget();
 		m_userData = std::move(userData);
 	}
 
@@ -224,6 +248,58 @@ public:
 	}
 
 	virtual void NativePrintStr(const std::string& str) const
+	{
+		m_output.Append(TrimLine(str));
+	}
+
+	/**
+	 * @brief Print a message of the runtime itself (e.g., a stopwatch reading)
+	 *        along with the guest output, without charging it to the guest
+	 *
+	 */
+	virtual void RuntimePrintStr(const std::string& str) const
+	{
+		m_output.AppendRuntime(TrimLine(str));
+	}
+
+	void SetOutputConfig(const GuestOutputConfig& config)
+	{
+		m_output.SetConfig(config);
+	}
+
+	const GuestOutputBuffer& GetOutput() const
+	{
+		return m_output;
+	}
+
+	void FlushOutput() const
+	{
+		m_output.Flush();
+	}
+
+	/**
+	 * @brief Keep a copy of the output flushed from now on (or stop keeping
+	 *        it); see `GuestOutputBuffer::SetCapture`
+	 *
+	 */
+	void SetOutputCapture(bool isCapturing)
+	{
+		m_output.SetCapture(isCapturing);
+	}
+
+	std::string TakeCapturedOutput()
+	{
+		return m_output.TakeCaptured();
+	}
+
+	const SystemIO& GetSystemIO() const
+	{
+		return m_moduleInst->GetSystemIO();
+	}
+
+private:
+
+	static std::string TrimLine(const std::string& str)
 	{
 		// The logger should add new lines to the end of each call
 		// so we want to remove spaces or new lines at the end of the string
@@ -231,25 +307,62 @@ public:
 
 		size_t endPos = str.find_last_not_of(" \t\n\r");
 
-		m_logger.Info(
-			(endPos != std::string::npos) ?
-				str.substr(0, endPos + 1) :
-				str
-		);
+		return (endPos != std::string::npos) ?
+			str.substr(0, endPos + 1) :
+			str;
 	}
 
-	const SystemIO& GetSystemIO() const
+	void BindOutput()
 	{
-		return m_moduleInst->GetSystemIO();
+		m_output.Bind(
+			[this](const std::string& out)
+			{
+				m_logger.Info(out);
+			},
+			[this](uint64_t units)
+			{
+				return ChargeCounter(units);
+			},
+			[this]()
+			{
+				return GetSystemIO().GetTimestampUs();
+			}
+		);
 	}
 
-private:
+	/**
+	 * @brief Add units to the instruction counter injected into the module,
+	 *        if there is one. The counter is only checked by the injected
+	 *        code, so a charge that passes the threshold isn't enforced here,
+	 *        but at the next check after the native returns, where the
+	 *        exceed native is called
+	 *
+	 */
+	bool ChargeCounter(uint64_t units)
+	{
+		static const std::string sk_counterName = "enclave_wasm_counter";
+
+		WasmModuleInstance::pointer ptr =
+			const_cast<WasmModuleInstance::pointer>(m_moduleInst->get());
+		auto global = wasm_runtime_lookup_global(ptr, sk_counterName.c_str());
+		if (global == nullptr)
+		{
+			return false;
+		}
+		uint64_t& counter =
+			WasmModuleInstanceGlobalGetter<uint64_t>::GetRef(ptr, global);
+		counter = (counter > UINT64_MAX - units) ? UINT64_MAX : counter + units;
+		return true;
+	}
 
 	Logger m_logger;
 
 	std::shared_ptr<WasmModuleInstance> m_moduleInst;
 	std::unique_ptr<ExecEnvUserData> m_userData;
 
+	// printing is const, but it changes what's buffered
+	mutable GuestOutputBuffer m_output;
+
 }; // class WasmExecEnv
 
 
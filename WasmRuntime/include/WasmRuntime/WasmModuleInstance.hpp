@@ -210,6 +210,12 @@ public:
 		return *this;
 	}
 
+	bool HasGlobal(const std::string& name) const
+	{
+		pointer ptr = const_cast<pointer>(get());
+		return wasm_runtime_lookup_global(ptr, name.c_str()) != nullptr;
+	}
+
 	template<typename _RetType>
 	_RetType GetGlobal(const std::string& name) const
 	{
@@ -246,6 +252,57 @@ public:
 		return wasm_runtime_get_exception(ptr);
 	}
 
+	void ClearException() noexcept
+	{
+		wasm_runtime_clear_exception(get());
+	}
+
+	/**
+	 * @brief A view of `size` bytes of the linear memory, at the given WASM
+	 *        address, without copying; it's only valid until the memory
+	 *        grows, or the instance is gone
+	 *
+	 */
+	const uint8_t* GetMemView(uint32_t wasmPtr, uint32_t size) const
+	{
+		pointer ptr = const_cast<pointer>(get());
+		if (!wasm_runtime_validate_app_addr(ptr, wasmPtr, size))
+		{
+			throw Exception("The memory range is out of the linear memory");
+		}
+		return static_cast<const uint8_t*>(
+			wasm_runtime_addr_app_to_native(ptr, wasmPtr)
+		);
+	}
+
+	/**
+	 * @brief The WASM address of a native pointer into the linear memory,
+	 *        which, unlike the native pointer, stays valid when the memory
+	 *        grows
+	 *
+	 */
+	uint32_t GetWasmPtr(const void* nativePtr, uint32_t size) const
+	{
+		pointer ptr = const_cast<pointer>(get());
+		void* p = const_cast<void*>(nativePtr);
+		if (!wasm_runtime_validate_native_addr(ptr, p, size))
+		{
+			throw Exception("The memory range is out of the linear memory");
+		}
+		return static_cast<uint32_t>(wasm_runtime_addr_native_to_app(ptr, p));
+	}
+
+	/**
+	 * @brief Make the execution running on this instance stop as soon as
+	 *        possible; it can be called from another thread.
+	 *        The execution fails with a "terminated by user" exception.
+	 *
+	 */
+	void Terminate() noexcept
+	{
+		wasm_runtime_terminate(get());
+	}
+
 	const SystemIO& GetSystemIO() const
 	{
 		return m_module->GetSystemIO();
@@ -7,6 +7,7 @@
 
 
 #include "EnclaveWasmNatives.hpp"
+#include "HeapStats.hpp"
 #include "Logging.hpp"
 #include "SystemIO.hpp"
 
@@ -55,6 +56,12 @@ public:
 		return *m_sysIO;
 	}
 
+	/**
+	 * @brief Get the usage statistics of the heap given to the runtime
+	 *
+	 */
+	virtual HeapStats GetHeapStats() const = 0;
+
 protected:
 
 	Logger m_logger;
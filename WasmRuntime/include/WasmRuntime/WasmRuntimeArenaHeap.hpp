@@ -0,0 +1,173 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include "WasmRuntime.hpp"
+
+#include <cstring>
+
+#include <memory>
+
+#include <wasm_export.h>
+
+#include "Internal/make_unique.hpp"
+#include "ArenaHeap.hpp"
+#include "EnclaveWasmNatives.hpp"
+#include "Exception.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief A WASM runtime whose heap is managed by an `ArenaHeap`, instead of
+ *        WAMR's pool allocator, so that threads running WASM concurrently
+ *        don't serialize on a single allocator.
+ *
+ *        WAMR is a global runtime, so there can only be one instance of
+ *        this class at a time.
+ *
+ */
+class WasmRuntimeArenaHeap :
+	public WasmRuntime
+{
+public:
+
+	static std::unique_ptr<WasmRuntimeArenaHeap> MakeUnique(
+		std::unique_ptr<SystemIO> sysIO,
+		size_t heapSize,
+		size_t numArenas,
+		size_t arenaSize
+	)
+	{
+		return Internal::make_unique<WasmRuntimeArenaHeap>(
+			std::move(sysIO),
+			heapSize,
+			numArenas,
+			arenaSize
+		);
+	}
+
+	using Base = WasmRuntime;
+
+public:
+
+	/**
+	 * @param heapSize  Total size of the heap
+	 * @param numArenas Number of per-thread arenas, which should be the
+	 *                  number of threads that run WASM concurrently
+	 * @param arenaSize Size of each arena; the rest of the heap is the
+	 *                  shared slab region
+	 */
+	WasmRuntimeArenaHeap(
+		std::unique_ptr<SystemIO> sysIO,
+		size_t heapSize,
+		size_t numArenas,
+		size_t arenaSize
+	) :
+		Base(std::move(sysIO)),
+		m_heap(Internal::make_unique<uint8_t[]>(heapSize)),
+		m_arenaHeap(
+			Internal::make_unique<ArenaHeap>(
+				m_heap.get(),
+				heapSize,
+				numArenas,
+				arenaSize
+			)
+		)
+	{
+		if (GetInstancePtr() != nullptr)
+		{
+			throw Exception("Only one WASM runtime can exist at a time");
+		}
+		GetInstancePtr() = m_arenaHeap.get();
+
+		RuntimeInitArgs init_args;
+		std::memset(&init_args, 0, sizeof(RuntimeInitArgs));
+
+		init_args.mem_alloc_type = Alloc_With_Allocator;
+		init_args.mem_alloc_option.allocator.malloc_func =
+			reinterpret_cast<void*>(&CMalloc);
+		init_args.mem_alloc_option.allocator.realloc_func =
+			reinterpret_cast<void*>(&CRealloc);
+		init_args.mem_alloc_option.allocator.free_func =
+			reinterpret_cast<void*>(&CFree);
+
+		/* initialize runtime environment */
+		if (!wasm_runtime_full_init(&init_args))
+		{
+			GetInstancePtr() = nullptr;
+			throw Exception("Init runtime environment failed");
+		}
+
+		if (!enclave_wasm_reg_natives())
+		{
+			wasm_runtime_destroy();
+			GetInstancePtr() = nullptr;
+			throw Exception("Failed to register Enclave WASM native symbols");
+		}
+	}
+
+	WasmRuntimeArenaHeap(const WasmRuntimeArenaHeap&) = delete;
+
+	WasmRuntimeArenaHeap(WasmRuntimeArenaHeap&& other) = delete;
+
+	virtual ~WasmRuntimeArenaHeap() noexcept
+	{
+		enclave_wasm_unreg_natives();
+		wasm_runtime_destroy();
+		GetInstancePtr() = nullptr;
+		m_arenaHeap.reset();
+		m_heap.reset();
+	}
+
+	WasmRuntimeArenaHeap& operator=(const WasmRuntimeArenaHeap&) = delete;
+
+	WasmRuntimeArenaHeap& operator=(WasmRuntimeArenaHeap&&) = delete;
+
+	virtual HeapStats GetHeapStats() const override
+	{
+		return m_arenaHeap->GetStats();
+	}
+
+	const ArenaHeap& GetArenaHeap() const
+	{
+		return *m_arenaHeap;
+	}
+
+private:
+
+	static ArenaHeap*& GetInstancePtr()
+	{
+		static ArenaHeap* s_inst = nullptr;
+		return s_inst;
+	}
+
+	static void* CMalloc(unsigned int size)
+	{
+		return GetInstancePtr()->Malloc(size);
+	}
+
+	static void* CRealloc(void* ptr, unsigned int size)
+	{
+		return GetInstancePtr()->Realloc(ptr, size);
+	}
+
+	static void CFree(void* ptr)
+	{
+		GetInstancePtr()->Free(ptr);
+	}
+
+	std::unique_ptr<uint8_t[]> m_heap;
+	std::unique_ptr<ArenaHeap> m_arenaHeap;
+
+}; // class WasmRuntimeArenaHeap
+
+
+} // namespace WasmRuntime
+
@@ -8,6 +8,8 @@
 
 #include "WasmRuntime.hpp"
 
+#include <cstring>
+
 #include <memory>
 
 #include <wasm_export.h>
@@ -84,6 +86,27 @@ public:
 
 	WasmRuntimeStaticHeap& operator=(WasmRuntimeStaticHeap&&) = delete;
 
+	/**
+	 * @brief Get the heap statistics reported by WAMR's pool allocator,
+	 *        which doesn't track fragmentation
+	 *
+	 */
+	virtual HeapStats GetHeapStats() const override
+	{
+		mem_alloc_info_t info;
+		std::memset(&info, 0, sizeof(mem_alloc_info_t));
+		if (!wasm_runtime_get_mem_alloc_info(&info))
+		{
+			throw Exception("Failed to get memory allocation info");
+		}
+
+		HeapStats stats;
+		stats.m_heapSize = m_heapSize;
+		stats.m_usedSize = info.total_size - info.total_free_size;
+		stats.m_peakUsedSize = info.highmark_size;
+		return stats;
+	}
+
 private:
 
 	uint32_t m_heapSize;
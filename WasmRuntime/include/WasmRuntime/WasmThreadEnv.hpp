@@ -0,0 +1,53 @@
+// Copyright (c) 2024 WasmRuntime
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+
+#include <wasm_export.h>
+
+#include "Exception.hpp"
+
+
+namespace WasmRuntime
+{
+
+
+/**
+ * @brief Sets up the WAMR thread environment for the lifetime of this object.
+ *        It must be held by any thread, other than the one that initialized
+ *        the runtime, before it executes WASM code.
+ *
+ */
+class WasmThreadEnv
+{
+public:
+
+	WasmThreadEnv()
+	{
+		if (!wasm_runtime_init_thread_env())
+		{
+			throw Exception("Failed to initialize WASM thread environment");
+		}
+	}
+
+	WasmThreadEnv(const WasmThreadEnv&) = delete;
+
+	WasmThreadEnv(WasmThreadEnv&&) = delete;
+
+	~WasmThreadEnv()
+	{
+		wasm_runtime_destroy_thread_env();
+	}
+
+	WasmThreadEnv& operator=(const WasmThreadEnv&) = delete;
+
+	WasmThreadEnv& operator=(WasmThreadEnv&&) = delete;
+
+}; // class WasmThreadEnv
+
+
+} // namespace WasmRuntime
+
@@ -7,6 +7,8 @@
 #include <cstdint>
 #include <cstring>
 
+#include <limits>
+
 #include <wasm_export.h>
 
 #include <WasmRuntime/ExecEnvUserData.hpp>
@@ -129,6 +131,65 @@ extern "C" uint32_t enclave_wasm_get_event_data(
 }
 
 
+extern "C" uint64_t enclave_wasm_get_event_stream_len(wasm_exec_env_t exec_env)
+{
+	using namespace WasmRuntime;
+	const auto& execEnv = WasmExecEnv::FromConstUserData(exec_env);
+	return execEnv.GetUserData().GetEventStreamSize();
+}
+
+
+extern "C" uint32_t enclave_wasm_read_event_chunk(
+	wasm_exec_env_t exec_env,
+	uint64_t offset,
+	void* nativePtr,
+	uint32_t len
+)
+{
+	using namespace WasmRuntime;
+
+	try
+	{
+		auto& execEnv = WasmExecEnv::FromUserData(exec_env);
+
+		uint8_t* ptr = static_cast<uint8_t*>(nativePtr);
+
+		return static_cast<uint32_t>(
+			execEnv.GetUserData().ReadEventChunk(offset, ptr, len)
+		);
+	}
+	catch (const std::exception& e)
+	{
+		wasm_module_inst_t module_inst = wasm_runtime_get_module_inst(exec_env);
+		wasm_runtime_set_exception(module_inst, e.what());
+		return 0;
+	}
+}
+
+
+extern "C" void enclave_wasm_set_result(
+	wasm_exec_env_t exec_env,
+	void* nativePtr,
+	uint32_t len
+)
+{
+	using namespace WasmRuntime;
+
+	try
+	{
+		auto& execEnv = WasmExecEnv::FromUserData(exec_env);
+
+		uint32_t wasmPtr = execEnv.GetModuleInstance().GetWasmPtr(nativePtr, len);
+		execEnv.GetUserData().SetResult(wasmPtr, len);
+	}
+	catch (const std::exception& e)
+	{
+		wasm_module_inst_t module_inst = wasm_runtime_get_module_inst(exec_env);
+		wasm_runtime_set_exception(module_inst, e.what());
+	}
+}
+
+
 extern "C" void enclave_wasm_exit(wasm_exec_env_t exec_env, int exit_code)
 {
 	(void)exit_code;
@@ -157,10 +218,61 @@ extern "C" void enclave_wasm_counter_exceed(wasm_exec_env_t exec_env)
 			GetGlobal<uint64_t>(sk_globalCounterName);
 		wasm_module_inst_t module_inst = wasm_runtime_get_module_inst(exec_env);
 
+		SamplingProfiler* profiler = execEnv.GetUserData().GetProfiler();
+		SamplingState& samplingState = WasmExecEnv::FromUserData(exec_env).
+			GetUserData().GetSamplingState();
+		if (
+			(profiler != nullptr) &&
+			SamplingProfiler::IsSamplePoint(samplingState, counter)
+		)
+		{
+			// Not out of budget, but at a sample point; take the sample and
+			// continue until the next one
+			profiler->Sample(samplingState, exec_env, counter);
+			auto& modInst = WasmExecEnv::FromUserData(exec_env).
+				GetModuleInstance();
+			modInst.SetGlobal<uint64_t>(
+				sk_globalThresholdName,
+				profiler->NextThreshold(samplingState, counter)
+			);
+			return;
+		}
+		if (profiler != nullptr)
+		{
+			// the threshold of the module is only the last sample point
+			threshold = samplingState.m_limit;
+		}
+
 		std::string msg = "counter exceed. ( "
 			"Threshold: " + std::to_string(threshold) + ", "
 			"Counter: " + std::to_string(counter) + ")" ;
-		execEnv.NativePrintStr(msg);
+		execEnv.RuntimePrintStr(msg);
+
+		BudgetGate* budgetGate = execEnv.GetUserData().GetBudgetGate();
+		if (budgetGate != nullptr)
+		{
+			// Suspend here until more budget is given; then the execution
+			// continues right after the counter check, with the counter intact
+			uint64_t additionalBudget =
+				budgetGate->WaitForBudget(counter, threshold);
+			if (additionalBudget != 0)
+			{
+				uint64_t newThreshold = threshold + additionalBudget;
+				if (newThreshold < threshold)
+				{
+					newThreshold = std::numeric_limits<uint64_t>::max();
+				}
+				if (profiler != nullptr)
+				{
+					SamplingProfiler::RaiseLimit(samplingState, additionalBudget);
+					newThreshold = profiler->NextThreshold(samplingState, counter);
+				}
+				auto& modInst = WasmExecEnv::FromUserData(exec_env).
+					GetModuleInstance();
+				modInst.SetGlobal<uint64_t>(sk_globalThresholdName, newThreshold);
+				return;
+			}
+		}
 
 		/* Here throwing exception is just to let wasm app exit,
 		the upper layer should clear the exception and return
@@ -25,6 +25,9 @@ extern uint32_t enclave_wasm_get_event_id_len(wasm_exec_env_t exec_env);
 extern uint32_t enclave_wasm_get_event_data_len(wasm_exec_env_t exec_env);
 extern uint32_t enclave_wasm_get_event_id(wasm_exec_env_t exec_env, void* wasmPtr, uint32_t len);
 extern uint32_t enclave_wasm_get_event_data(wasm_exec_env_t exec_env, uint32_t wasmPtr, uint32_t len);
+extern uint64_t enclave_wasm_get_event_stream_len(wasm_exec_env_t exec_env);
+extern uint32_t enclave_wasm_read_event_chunk(wasm_exec_env_t exec_env, uint64_t offset, void* wasmPtr, uint32_t len);
+extern void enclave_wasm_set_result(wasm_exec_env_t exec_env, void* wasmPtr, uint32_t len);
 
 
 static NativeSymbol gs_EnclaveWasmNatives[] =
@@ -89,6 +92,24 @@ static NativeSymbol gs_EnclaveWasmNatives[] =
 		"(*~)i",               // the function prototype signature
 		NULL,
 	},
+	{
+		"enclave_wasm_get_event_stream_len", // WASM function name
+		enclave_wasm_get_event_stream_len,   // the native function pointer
+		"()I",               // the function prototype signature
+		NULL,
+	},
+	{
+		"enclave_wasm_read_event_chunk", // WASM function name
+		enclave_wasm_read_event_chunk,   // the native function pointer
+		"(I*~)i",               // the function prototype signature
+		NULL,
+	},
+	{
+		"enclave_wasm_set_result", // WASM function name
+		enclave_wasm_set_result,   // the native function pointer
+		"(*~)",               // the function prototype signature
+		NULL,
+	},
 	{
 		"enclave_wasm_exit", // WASM function name
 		enclave_wasm_exit,   // the native function pointer
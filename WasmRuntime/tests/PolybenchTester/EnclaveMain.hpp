@@ -11,6 +11,7 @@
 
 #include <vector>
 
+#include <WasmRuntime/InstrOracle.hpp>
 #include <WasmRuntime/MainRunner.hpp>
 #include <WasmRuntime/Logging.hpp>
 #include <WasmRuntime/WasmRuntimeStaticHeap.hpp>
@@ -128,6 +129,82 @@ inline bool EnclaveWasmMain(
 			}
 		}
 
+		{
+			// High-water mark of the runtime heap, to size it from data
+			auto heapStats = wasmRt->GetHeapStats();
+			std::string msg =
+				"Heap report: {"
+					"\"heap_size\":"      + std::to_string(heapStats.m_heapSize)     + ", "
+					"\"used_size\":"      + std::to_string(heapStats.m_usedSize)     + ", "
+					"\"peak_used_size\":" + std::to_string(heapStats.m_peakUsedSize) + ""
+				"}";
+			logger.Info(msg);
+		}
+
+		return true;
+	}
+	catch(const std::exception& e)
+	{
+		logger.Error(e.what());
+		return false;
+	}
+}
+
+
+/**
+ * @brief Run the module instrumented with the exact instruction-count oracle
+ *        once, and report the error of the counter against it
+ *
+ */
+inline bool OracleWasmMain(
+	const uint8_t *wasm_oracle_file, size_t wasm_oracle_file_size
+)
+{
+	using namespace WasmRuntime;
+
+	auto logger = LoggerFactory::GetLogger("PolybenchTester::OracleWasmMain");
+
+	try
+	{
+		std::vector<uint8_t> oracleWasmBytecode(
+			wasm_oracle_file,
+			wasm_oracle_file + wasm_oracle_file_size
+		);
+
+		auto wasmRt = SharedWasmRuntime(
+			WasmRuntimeStaticHeap::MakeUnique(
+				PolybenchTester::SystemIO::MakeUnique(),
+				70 * 1024 * 1024 // 70 MB
+			)
+		);
+
+		std::vector<uint8_t> eventId = {
+			'D', 'e', 'c', 'e', 'n', 't', '\0'
+		};
+		std::vector<uint8_t> msgContent = {
+			'E', 'v', 'e', 'n', 't', 'M', 'e', 's', 's', 'a', 'g', 'e', '\0'
+		};
+		uint64_t threshold = std::numeric_limits<uint64_t>::max() / 2;
+
+		auto runner = MainRunner(
+			wasmRt,
+			oracleWasmBytecode,
+			eventId,
+			msgContent,
+			1 * 1024 * 1024,  // mod stack:  1 MB
+			64 * 1024 * 1024, // mod heap:  64 MB
+			1 * 1024 * 1024   // exec stack: 1 MB
+		);
+
+		logger.Info("=====> Starting to run Enclave WASM program (type=oracle)...");
+		runner.RunInstrumented(threshold);
+
+		auto report = InstrOracleReport::Collect(
+			runner.GetModuleInstance(),
+			runner.GetCounter()
+		);
+		logger.Info("<===== Oracle report: " + report.ToJson());
+
 		return true;
 	}
 	catch(const std::exception& e)
@@ -131,6 +131,15 @@ static bool BenchmarkOnUntrusted(
 	);
 }
 
+static bool OracleOnUntrusted(
+	const std::vector<uint8_t>& oracleWasmBytecode
+)
+{
+	return PolybenchTester::OracleWasmMain(
+		oracleWasmBytecode.data(), oracleWasmBytecode.size()
+	);
+}
+
 static void BenchmarkOnEnclave(
 	const std::vector<uint8_t>& wasmBytecode,
 	const std::vector<uint8_t>& noptWasmBytecode
@@ -162,9 +171,19 @@ int main(int argc, char**argv)
 	{
 		std::cerr << "Usage: "
 			<< argv[0] << " <wasm file> <inst. wasm file>" << std::endl;
+		std::cerr << "       "
+			<< argv[0] << " oracle <oracle inst. wasm file>" << std::endl;
 		return -1;
 	}
 
+	if (std::string(argv[1]) == "oracle")
+	{
+		// the oracle is a reference for measurements only, so it's only run
+		// in the untrusted runtime
+		auto oracleWasmBytecode = ReadFile2Buffer(argv[2]);
+		return OracleOnUntrusted(oracleWasmBytecode) ? 0 : -1;
+	}
+
 	const std::string wasmFilenamePath = argv[1];
 	const std::string instWasmFilenamePath = argv[2];
 
@@ -57,6 +57,7 @@ FILENAME_FORMATS = [
 	(os.path.join('native', '{testname}.app'),     '{testname}.app'),
 	(os.path.join('wasm', '{testname}.wasm'),      '{testname}.wasm'),
 	(os.path.join('wasm', '{testname}.nopt.wasm'), '{testname}.nopt.wasm'),
+	(os.path.join('wasm', '{testname}.oracle.wasm'), '{testname}.oracle.wasm'),
 ]
 
 
@@ -248,11 +248,77 @@ def ReProcRawData(jsonFilePath: str) -> None:
 		json.dump(jsonFile, f, indent='\t')
 
 
+def TryParseOracleLogLine(line: str) -> dict:
+	LOG_ORACLE_R = r'^\[(\w+)\]\s*PolybenchTester::OracleWasmMain\(INFO\):\s+<=====\s*Oracle report:\s*(\{.+)$'
+	LOG_ORACLE_REGEX = re.compile(LOG_ORACLE_R)
+
+	m = LOG_ORACLE_REGEX.search(line)
+	if m is None:
+		return None
+	else:
+		return json.loads(m.group(2))
+
+
+def RunOracleAndReportError() -> None:
+	output = {
+		'summary': {},
+		'kernels': {},
+	}
+
+	timeStr = time.strftime('%Y%m%d%H%M%S', time.localtime())
+
+	for testCase in TEST_CASES:
+		testCasePath = os.path.join(TEST_CASES_DIR, testCase)
+		benchmarkPath = os.path.join(BENCHMARK_BUILD_DIR, BENCHMARKER_BIN)
+
+		oracleCmd = [
+			benchmarkPath,
+			'oracle',
+			testCasePath + '.oracle.wasm',
+		]
+		stdout, _, _ = RunProgram(oracleCmd)
+
+		report = None
+		for line in stdout.splitlines():
+			report = TryParseOracleLogLine(line)
+			if report is not None:
+				break
+		if report is None:
+			raise RuntimeError(f'Oracle report of {testCase} is not found')
+
+		weighted = report['weighted']
+		report['rel_error'] = \
+			(report['error'] / weighted) if weighted != 0 else 0.0
+		output['kernels'][testCase] = report
+
+		print(
+			f'{testCase}: counter={report["counter"]}, exact={weighted}, '
+			f'error={report["error"]} ({report["rel_error"]:+.6%})'
+		)
+
+	relErrors = [ x['rel_error'] for x in output['kernels'].values() ]
+	output['summary'] = {
+		'num_kernels': len(relErrors),
+		'num_overcharged': len([ x for x in relErrors if x > 0 ]),
+		'num_undercharged': len([ x for x in relErrors if x < 0 ]),
+		'num_exact': len([ x for x in relErrors if x == 0 ]),
+		'max_abs_rel_error': max([ abs(x) for x in relErrors ]),
+		'mean_abs_rel_error': sum([ abs(x) for x in relErrors ]) / len(relErrors),
+	}
+	print(json.dumps(output['summary'], indent='\t'))
+
+	with open(os.path.join(PROJ_BUILD_DIR, f'oracle-{timeStr}.json'), 'w') as f:
+		json.dump(output, f, indent='\t')
+
+
 def main() -> None:
 	if len(sys.argv) > 1:
 		if sys.argv[1] == 'reproc':
 			ReProcRawData(sys.argv[2])
 			return
+		elif sys.argv[1] == 'oracle':
+			RunOracleAndReportError()
+			return
 		else:
 			print('Unknown command')
 			return
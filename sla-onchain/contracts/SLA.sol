@@ -24,6 +24,14 @@ contract SLA {
         address walletAddr;
     }
 
+    // the receipt of a request, as committed in a checkpoint
+    struct Receipt {
+        uint256 reqId;
+        uint64 unitsUsed;
+        uint32 timeElapsed;
+        bytes32 resultHash;
+    }
+
     struct Dispute {
         bool submitted;
         uint256 payment;
@@ -63,6 +71,8 @@ contract SLA {
 
     mapping (uint64 => uint64) m_chkptAvgUnitUsed;
     mapping (uint64 => uint256) m_chkptReqIdEnd;
+    // Merkle root of the per-request receipts; only for committed checkpoints
+    mapping (uint64 => bytes32) m_chkptReceiptRoot;
 
     //===== Events =====
 
@@ -74,6 +84,11 @@ contract SLA {
         uint256 providerBalance,
         uint256 clientBalance
     );
+    event CheckpointCommitted(
+        address indexed slaAddr,
+        uint256 checkpointSeqNum,
+        bytes32 receiptRoot
+    );
     event SlaContractCreated(address indexed slaAddr, address, address clientWalletAddr);
 
     // disputes
@@ -186,61 +201,19 @@ contract SLA {
         );
     }
 
-    //===== external Functions =====
-
     /**
-     * Submit a checkpoint report
+     * Settle the payment of a checkpoint
      * @param chkptSeqNum    The checkpoint sequence number
      * @param numRequests    The number of requests in the checkpoint
-     * @param checkpointData The checkpoint data
+     * @param numAccepted    The number of requests accepted
+     * @param totalUnitsUsed The units used by all requests
      */
-    function hostCheckpointReport(
+    function settleCheckpoint(
         uint64 chkptSeqNum,
         uint64 numRequests,
-        bytes memory checkpointData
-    )
-        external
-    {
-        // 1. make sure the checkpoint seq num is correct
-        require(
-            chkptSeqNum == m_currChkptSeqNum,
-            "Checkpoint seq num is incorrect"
-        );
-        m_currChkptSeqNum++;
-
-        // 2. verify that the message is signed by the provider
-        require(
-            m_provider.appKeyAddr == msg.sender,
-            "Message signature invalid"
-        );
-
-        // 3. each entry in report needs `CHKPT_REPORT_ENTRY_SIZE` bytes
-        //    thus, the length of the report should be numRequests * CHKPT_REPORT_ENTRY_SIZE
-        require(
-            checkpointData.length == numRequests * CHKPT_REPORT_ENTRY_SIZE,
-            "Invalid checkpoint data"
-        );
-
-        // 4. parse the checkpoint data
-        uint256 numAccepted = 0;
-        uint256 totalUnitsUsed = 0;
-        uint256 totalTimeElapsed = 0;
-        for (uint64 i = 0; i < numRequests; i++) {
-            uint64 unitsUsed = 0;
-
-            unitsUsed = checkpointData.readUint64(
-                i * CHKPT_REPORT_ENTRY_SIZE
-            );
-            totalUnitsUsed += unitsUsed;
-            if (unitsUsed > 0)
-            {
-                numAccepted++;
-                totalTimeElapsed = checkpointData.readUint32(
-                    (i * CHKPT_REPORT_ENTRY_SIZE) + CHKPT_REPORT_FIELD_UNIT_SIZE
-                );
-            }
-        }
-
+        uint256 numAccepted,
+        uint256 totalUnitsUsed
+    ) internal {
         // we assume the enclave correctly orders the requests by reqId
         m_currReqId += numRequests;
 
@@ -257,18 +230,17 @@ contract SLA {
             "Client does not have enough balance"
         );
         m_client.balanceWei -= totalPayment;
-        // 5. update provider and client balances
+        // update provider and client balances
         m_provider.balanceWei += totalPayment;
 
 
-        // 6. notify reputation contract
+        // notify reputation contract
         Interface_Reputation(m_reputationAddr).onCheckpointReport(
             m_provider.hardwareId,
             m_client.walletAddr,
             totalPayment
         );
 
-        // 7. update provider checkpoint seq num
         emit CheckpointReportSubmitted(
             address(this),
             chkptSeqNum,
@@ -280,15 +252,64 @@ contract SLA {
     }
 
     /**
-     * Client sends a dispute
+     * Open a dispute for a request, refunding half of the given units
      * @param reqId The request id
      * @param isEncryptedResReceived Whether the client has received the encrypted response
+     * @param unitsUsed The units the request is charged for
      */
-    function dispute(
+    function openDispute(
         uint256 reqId,
-        uint64 chkptSeqNum,
-        bool isEncryptedResReceived
-    ) external
+        bool isEncryptedResReceived,
+        uint64 unitsUsed
+    ) internal
+    {
+        Dispute storage disputeEntry = m_disputes[reqId];
+
+        // check that the dispute does not already exist
+        require(
+            disputeEntry.submitted == false,
+            "Dispute already submitted"
+        );
+
+        // check that the dispute has not already been resolved
+        require(
+            disputeEntry.settled == false,
+            "Dispute has already been resolved"
+        );
+
+        disputeEntry.submitted = true;
+
+        // revert back half of the payment for the disputed request
+        disputeEntry.payment = unitsUsed * m_pricePerUnit;
+        // check that provider has enough balance to reimburse
+        require(
+            m_provider.balanceWei >= disputeEntry.payment / 2,
+            "Provider does not have enough balance"
+        );
+        m_provider.balanceWei -= disputeEntry.payment / 2;
+        m_client.balanceWei += disputeEntry.payment / 2;
+
+        // assign variable for encrypted response received
+        disputeEntry.isEncryptedResReceived = isEncryptedResReceived;
+
+        // set the dispute starting block num
+        disputeEntry.startBlock = block.number;
+
+        // increment the number of disputes
+        m_numDisputes++;
+
+        // emit event
+        emit ClientDispute(address(this), reqId, isEncryptedResReceived);
+    }
+
+    /**
+     * Check that the dispute is raised by the client, for a request in the
+     * given checkpoint
+     */
+    function checkDisputeRequest(
+        uint256 reqId,
+        uint64 chkptSeqNum
+    ) internal view
     {
         // require that the contract is active
         require(
@@ -323,46 +344,205 @@ contract SLA {
             ),
             "Invalid checkpoint seq num"
         );
+    }
 
-        Dispute storage disputeEntry = m_disputes[reqId];
+    //===== external Functions =====
 
-        // check that the dispute does not already exist
+    /**
+     * Submit a checkpoint report
+     * @param chkptSeqNum    The checkpoint sequence number
+     * @param numRequests    The number of requests in the checkpoint
+     * @param checkpointData The checkpoint data
+     */
+    function hostCheckpointReport(
+        uint64 chkptSeqNum,
+        uint64 numRequests,
+        bytes memory checkpointData
+    )
+        external
+    {
+        // 1. make sure the checkpoint seq num is correct
         require(
-            disputeEntry.submitted == false,
-            "Dispute already submitted"
+            chkptSeqNum == m_currChkptSeqNum,
+            "Checkpoint seq num is incorrect"
         );
+        m_currChkptSeqNum++;
 
-        // check that the dispute has not already been resolved
+        // 2. verify that the message is signed by the provider
         require(
-            disputeEntry.settled == false,
-            "Dispute has already been resolved"
+            m_provider.appKeyAddr == msg.sender,
+            "Message signature invalid"
         );
 
-        disputeEntry.submitted = true;
+        // 3. each entry in report needs `CHKPT_REPORT_ENTRY_SIZE` bytes
+        //    thus, the length of the report should be numRequests * CHKPT_REPORT_ENTRY_SIZE
+        require(
+            checkpointData.length == numRequests * CHKPT_REPORT_ENTRY_SIZE,
+            "Invalid checkpoint data"
+        );
 
-        uint64 unitsUsed = m_chkptAvgUnitUsed[chkptSeqNum];
+        // 4. parse the checkpoint data
+        uint256 numAccepted = 0;
+        uint256 totalUnitsUsed = 0;
+        uint256 totalTimeElapsed = 0;
+        for (uint64 i = 0; i < numRequests; i++) {
+            uint64 unitsUsed = 0;
 
-        // revert back half of the payment for the disputed request
-        disputeEntry.payment = unitsUsed * m_pricePerUnit;
-        // check that provider has enough balance to reimburse
+            unitsUsed = checkpointData.readUint64(
+                i * CHKPT_REPORT_ENTRY_SIZE
+            );
+            totalUnitsUsed += unitsUsed;
+            if (unitsUsed > 0)
+            {
+                numAccepted++;
+                totalTimeElapsed = checkpointData.readUint32(
+                    (i * CHKPT_REPORT_ENTRY_SIZE) + CHKPT_REPORT_FIELD_UNIT_SIZE
+                );
+            }
+        }
+
+        // 5. settle the payment
+        settleCheckpoint(chkptSeqNum, numRequests, numAccepted, totalUnitsUsed);
+    }
+
+    /**
+     * Commit a checkpoint with the Merkle root of the per-request receipts and
+     * the totals only, instead of an entry per request; the receipts are
+     * kept by the enclave, which gives the proof of a receipt for disputes
+     * @param chkptSeqNum The checkpoint sequence number
+     * @param numRequests The number of requests in the checkpoint
+     * @param numAccepted The number of requests that used any units
+     * @param totalUnits  The units used by all requests
+     * @param receiptRoot The Merkle root of the receipts
+     */
+    function hostCheckpointCommit(
+        uint64 chkptSeqNum,
+        uint64 numRequests,
+        uint64 numAccepted,
+        uint64 totalUnits,
+        bytes32 receiptRoot
+    )
+        external
+    {
+        // 1. make sure the checkpoint seq num is correct
         require(
-            m_provider.balanceWei >= disputeEntry.payment / 2,
-            "Provider does not have enough balance"
+            chkptSeqNum == m_currChkptSeqNum,
+            "Checkpoint seq num is incorrect"
         );
-        m_provider.balanceWei -= disputeEntry.payment / 2;
-        m_client.balanceWei += disputeEntry.payment / 2;
+        m_currChkptSeqNum++;
 
-        // assign variable for encrypted response received
-        disputeEntry.isEncryptedResReceived = isEncryptedResReceived;
+        // 2. verify that the message is signed by the provider
+        require(
+            m_provider.appKeyAddr == msg.sender,
+            "Message signature invalid"
+        );
 
-        // set the dispute starting block num
-        disputeEntry.startBlock = block.number;
+        // 3. check the totals
+        require(
+            (numRequests > 0) && (numAccepted <= numRequests),
+            "Invalid checkpoint totals"
+        );
 
-        // increment the number of disputes
-        m_numDisputes++;
+        // 4. keep the root for disputes
+        m_chkptReceiptRoot[chkptSeqNum] = receiptRoot;
+        emit CheckpointCommitted(address(this), chkptSeqNum, receiptRoot);
 
-        // emit event
-        emit ClientDispute(address(this), reqId, isEncryptedResReceived);
+        // 5. settle the payment
+        settleCheckpoint(chkptSeqNum, numRequests, numAccepted, totalUnits);
+    }
+
+    /**
+     * Verify that a receipt is in the Merkle tree of a committed checkpoint
+     * leaf = keccak256(0x00 || reqId || unitsUsed || timeElapsed || resultHash)
+     * node = keccak256(0x01 || left || right)
+     * @param proof The siblings from the leaf level up
+     */
+    function verifyReceipt(
+        uint64 chkptSeqNum,
+        Receipt memory receipt,
+        bytes32[] memory proof
+    )
+        public
+        view
+        returns (bool)
+    {
+        bytes32 root = m_chkptReceiptRoot[chkptSeqNum];
+        if (root == bytes32(0)) {
+            return false;
+        }
+
+        uint256 reqIdBegin =
+            (chkptSeqNum == 0) ? 0 : m_chkptReqIdEnd[chkptSeqNum - 1];
+        if (
+            (receipt.reqId < reqIdBegin) ||
+            (receipt.reqId >= m_chkptReqIdEnd[chkptSeqNum])
+        ) {
+            return false;
+        }
+        uint256 idx = receipt.reqId - reqIdBegin;
+
+        bytes32 node = keccak256(abi.encodePacked(
+            bytes1(0x00),
+            receipt.reqId,
+            receipt.unitsUsed,
+            receipt.timeElapsed,
+            receipt.resultHash
+        ));
+        for (uint256 i = 0; i < proof.length; i++) {
+            if ((idx & 1) == 1) {
+                node = keccak256(abi.encodePacked(bytes1(0x01), proof[i], node));
+            } else {
+                node = keccak256(abi.encodePacked(bytes1(0x01), node, proof[i]));
+            }
+            idx >>= 1;
+        }
+
+        return (idx == 0) && (node == root);
+    }
+
+    /**
+     * Client sends a dispute
+     * @param reqId The request id
+     * @param isEncryptedResReceived Whether the client has received the encrypted response
+     */
+    function dispute(
+        uint256 reqId,
+        uint64 chkptSeqNum,
+        bool isEncryptedResReceived
+    ) external
+    {
+        checkDisputeRequest(reqId, chkptSeqNum);
+
+        openDispute(
+            reqId,
+            isEncryptedResReceived,
+            m_chkptAvgUnitUsed[chkptSeqNum]
+        );
+    }
+
+    /**
+     * Client sends a dispute, with the receipt of the request (given by the
+     * enclave) to be refunded on the units it actually used, instead of the
+     * average of its checkpoint
+     * @param isEncryptedResReceived Whether the client has received the encrypted response
+     * @param receipt The receipt of the disputed request
+     * @param proof The proof of the receipt, see `verifyReceipt`
+     */
+    function disputeWithReceipt(
+        uint64 chkptSeqNum,
+        bool isEncryptedResReceived,
+        Receipt calldata receipt,
+        bytes32[] calldata proof
+    ) external
+    {
+        checkDisputeRequest(receipt.reqId, chkptSeqNum);
+
+        require(
+            verifyReceipt(chkptSeqNum, receipt, proof),
+            "Invalid receipt"
+        );
+
+        openDispute(receipt.reqId, isEncryptedResReceived, receipt.unitsUsed);
     }
 
 